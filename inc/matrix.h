@@ -56,6 +56,12 @@ typedef enum {
     MAT_OT_MAX,
 } mat_obj_type_e;
 
+// 函数代码的生成方式
+typedef enum {
+    MAT_BACKEND_STACK = 0, // 栈指令
+    MAT_BACKEND_REGISTER,  // 局部对象和整数运算使用寄存器指令
+} mat_backend_e;
+
 typedef struct matrix_s* matrix_t;
 typedef struct obj_s* mat_obj_t;
 typedef struct mod_s* mat_mod_t;
@@ -78,6 +84,30 @@ MATRIX_API int MAT_init(matrix_t* mat);
 // 销毁
 MATRIX_API int MAT_free(matrix_t mat);
 
+// 设置之后解析的函数使用的代码生成方式，默认为 MAT_BACKEND_STACK
+MATRIX_API int MAT_set_backend(matrix_t mat, mat_backend_e backend);
+
+// 是否把频繁调用的函数编译成本地代码，默认打开，平台不支持时没有效果
+MATRIX_API int MAT_set_jit(matrix_t mat, int enable);
+
+// 加载模块时是否使用和生成 .matc 字节码缓存，默认打开
+MATRIX_API int MAT_set_cache(matrix_t mat, int enable);
+
+// 解析模块文件时是否只记录函数体的位置，到函数第一次被调用时再编译，默认关闭
+MATRIX_API int MAT_set_lazy(matrix_t mat, int enable);
+
+// 用 threads 个后台线程并行编译导入的模块，0 表示关闭，默认关闭。要在加载第一个模块之前调用
+MATRIX_API int MAT_set_parallel(matrix_t mat, uint32_t threads);
+
+// 把初始化完成的虚拟机写到快照文件，没有函数在执行时才能调用
+MATRIX_API int MAT_snapshot(matrix_t mat, const char* path);
+
+// 从快照文件创建虚拟机，不再解析和执行模块的初始化代码
+MATRIX_API int MAT_restore(const char* path, matrix_t* mat);
+
+// 运行栈最多容纳的对象个数和最大的调用深度，超过时报告栈溢出
+MATRIX_API int MAT_set_stack_limit(matrix_t mat, uint32_t stack_size, uint32_t frame_num);
+
 // 直接运行一个代码文件
 MATRIX_API int MAT_exec_file(matrix_t mat, const char* file_name, uint32_t* mod_idx);
 MATRIX_API int MAT_add_mod(matrix_t mat, const char* mod_name, uint32_t* mod_idx);
@@ -105,7 +135,7 @@ MATRIX_API int MAT_call(matrix_t mat, uint32_t mod_idx, uint32_t param_num);
 // 从运行栈里弹出对象
 MATRIX_API int MAT_pop(matrix_t mat, uint32_t n);
 
-// 从运行栈里获取一个对象
+// 从运行栈里获取一个对象，之后压入对象时运行栈可能扩大，返回的对象不能保存
 MATRIX_API mat_obj_t MAT_get_stack_obj(matrix_t mat, int pos);
 
 // 获取参数个数
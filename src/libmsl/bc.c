@@ -0,0 +1,1178 @@
+﻿/*
+    Matrix Script Language
+    author: Zeb
+    e-mail: zebbey@gmail.com
+    Copyright (c) 2004 Zeb.  All rights reserved.
+*/
+
+#include "obj.h"
+#include "bc.h"
+#include "ins.h"
+#include "vec.h"
+#include "str.h"
+#include "err.h"
+#include "hash_list.h"
+#include "func.h"
+#include "link.h"
+#include "vm.h"
+#include "builtins.h"
+
+#if defined(PLATFORM_LINUX) || defined(PLATFORM_MACOS)
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#endif
+
+#define BC_HEADER_SIZE 7
+
+#define PUT(w, word) V_PUSH_BACK((w)->body, (uint32_t)(word), uint32_t)
+
+// walk_code 只检查时，操作数不合法说明缓存不可用
+#define CHECK_OPERAND(cond)\
+	do {\
+		if (mode == BC_WALK_CHECK && !(cond))\
+			return 1;\
+	} while (0)
+
+// walk_code 重新定位操作数，探测时操作数需要修改就返回1
+#define SET_OPERAND(p, val)\
+	do {\
+		uint32_t v_ = (uint32_t)(val);\
+		if (mode == BC_WALK_PROBE && *(p) != v_)\
+			return 1;\
+		if (mode == BC_WALK_PATCH)\
+			*(p) = v_;\
+	} while (0)
+
+typedef enum {
+	BC_WALK_CHECK, // 检查操作数是否合法
+	BC_WALK_PROBE, // 检查是否需要重新定位
+	BC_WALK_PATCH, // 重新定位
+} bc_walk_e;
+
+// 缓存里模块对象的类型
+typedef enum {
+	BC_OBJ_NAME, // 只保存名字，值是内置函数或者在运行时赋予
+	BC_OBJ_FUNC, // 值为函数表的下标
+	BC_OBJ_MOD,  // import 的模块，值为模块名字的下标
+} bc_obj_e;
+
+typedef struct {
+	uint32_t size;
+	uint32_t mtime_lo;
+	uint32_t mtime_hi;
+	uint32_t hash;
+} bc_src_s;
+
+typedef struct {
+	matrix_t mat;
+	mod_s* mod;
+	vec_s strs; // string_s*
+	vec_s body; // uint32_t，字符串表之后的部分
+} bc_writer_s;
+
+typedef struct {
+	uint32_t name;
+	uint32_t kind;
+	uint32_t val;
+} bc_obj_s;
+
+typedef struct {
+	matrix_t mat;
+	mod_s* mod;
+	const uint32_t* p;
+	uint32_t size;
+	uint32_t pos;
+	int bad; // 读取越界
+	uint32_t str_num;
+	string_s** strs;
+	uint32_t obj_num;
+	bc_obj_s* objs;
+	int32_t* obj_map; // 缓存对象下标对应的模块对象下标
+	uint32_t func_ref; // 代码中引用的最大函数表下标加1，读完函数表后检查
+	vec_s code; // uint32_t
+	vec_s op_line; // op_line_s
+	vec_s funcs; // func_s*
+} bc_loader_s;
+
+static int is_ref_ins(uint32_t ins) {
+	switch (ins) {
+		case IT_REF_OBJ:
+		case IT_PUSH_OBJ:
+		case IT_ASSIGN:
+		case IT_ASSIGN_ADD:
+		case IT_ASSIGN_SUB:
+		case IT_ASSIGN_MUL:
+		case IT_ASSIGN_DIV:
+		case IT_ASSIGN_MOD:
+		case IT_ASSIGN_EXP:
+		case IT_ASSIGN_AND:
+		case IT_ASSIGN_OR:
+		case IT_ASSIGN_XOR:
+		case IT_ASSIGN_SHIFT_LEFT:
+		case IT_ASSIGN_SHIFT_RIGHT:
+		case IT_ASSIGN_INT:
+		case IT_ASSIGN_ADD_INT:
+		case IT_ASSIGN_SUB_INT:
+		case IT_PUSH_ADD_INT:
+		case IT_PUSH_SUB_INT:
+			return 1;
+
+		default:
+			return 0;
+	}
+}
+
+// 寄存器指令的寄存器操作数个数，它们从第一个操作数开始
+static uint32_t reg_num(uint32_t ins) {
+	switch (ins) {
+		case IT_R_LOADI:
+		case IT_R_FALSE_JMP:
+		case IT_R_TRUE_JMP:
+			return 1;
+
+		case IT_R_MOVE:
+			return 2;
+
+		case IT_R_ADD:
+		case IT_R_SUB:
+		case IT_R_MUL:
+		case IT_R_DIV:
+		case IT_R_EQ:
+		case IT_R_NEQ:
+		case IT_R_LT:
+		case IT_R_LE:
+		case IT_R_GT:
+		case IT_R_GE:
+			return 3;
+
+		default:
+			return 0;
+	}
+}
+
+static uint32_t hash_bytes(const uint8_t* p, uint32_t size) {
+	uint32_t h = 2166136261u;
+	uint32_t i;
+
+	for (i = 0; i < size; ++i)
+		h = (h ^ p[i]) * 16777619u;
+
+	return h;
+}
+
+// 读入整个文件，buf 按 uint32_t 对齐
+static int read_file(const char* path, uint8_t** buf, uint32_t* size) {
+	FILE* fp = fopen(path, "rb");
+	long n;
+
+	*buf = NULL;
+
+	if (!fp)
+		return -1;
+
+	if (fseek(fp, 0, SEEK_END) != 0 || (n = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0) {
+		fclose(fp);
+		return -1;
+	}
+
+	*buf = malloc((size_t)n + sizeof(uint32_t));
+	CHECK_MALLOC(*buf);
+
+	if (fread(*buf, 1, (size_t)n, fp) != (size_t)n) {
+		fclose(fp);
+		free(*buf);
+		*buf = NULL;
+		return -1;
+	}
+
+	fclose(fp);
+	*size = (uint32_t)n;
+	return 0;
+}
+
+// 只读映射整个文件，起始地址按页对齐
+int BC_map_file(const char* path, void** p, uint32_t* size) {
+#if defined(PLATFORM_WINDOWS)
+	HANDLE file;
+	HANDLE mapping;
+	DWORD n;
+
+	*p = NULL;
+	file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (file == INVALID_HANDLE_VALUE)
+		return -1;
+
+	n = GetFileSize(file, NULL);
+
+	if (n == INVALID_FILE_SIZE || n == 0) {
+		CloseHandle(file);
+		return -1;
+	}
+
+	mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);
+
+	if (!mapping)
+		return -1;
+
+	*p = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+
+	if (!*p)
+		return -1;
+
+	*size = (uint32_t)n;
+	return 0;
+#elif defined(PLATFORM_LINUX) || defined(PLATFORM_MACOS)
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+
+	*p = NULL;
+
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) != 0 || st.st_size <= 0 || (uint64_t)st.st_size > 0xffffffffu) {
+		close(fd);
+		return -1;
+	}
+
+	*p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (*p == MAP_FAILED) {
+		*p = NULL;
+		return -1;
+	}
+
+	*size = (uint32_t)st.st_size;
+	return 0;
+#endif
+}
+
+void BC_unmap_file(void* p, uint32_t size) {
+	if (!p)
+		return;
+
+#if defined(PLATFORM_WINDOWS)
+	(void)size;
+	UnmapViewOfFile(p);
+#elif defined(PLATFORM_LINUX) || defined(PLATFORM_MACOS)
+	munmap(p, size);
+#endif
+}
+
+static int get_src_info(const char* path, bc_src_s* src) {
+	struct stat st;
+	uint64_t mtime;
+
+	if (stat(path, &st) != 0)
+		return -1;
+
+	mtime = (uint64_t)st.st_mtime;
+	src->size = (uint32_t)st.st_size;
+	src->mtime_lo = (uint32_t)mtime;
+	src->mtime_hi = (uint32_t)(mtime >> 32);
+	src->hash = 0;
+	return 0;
+}
+
+static int get_src_hash(const char* path, bc_src_s* src) {
+	uint8_t* buf;
+	uint32_t size;
+
+	if (read_file(path, &buf, &size) != 0)
+		return -1;
+
+	src->size = size;
+	src->hash = hash_bytes(buf, size);
+	free(buf);
+	return 0;
+}
+
+// 按下标排列对象名字
+static int get_names(hash_list_s* hl, string_s** names) {
+	hash_node_s* node = HL_first(hl);
+
+	while (node) {
+		if (node->key.type != MAT_OT_STR || node->val.type != MAT_OT_INT32 || (uint32_t)node->val.int32 >= V_SIZE(hl->obj))
+			return -1;
+
+		names[node->val.int32] = node->key.str;
+		node = HL_next(hl, node);
+	}
+
+	return 0;
+}
+
+static string_s* get_name(hash_list_s* hl, uint32_t idx) {
+	hash_node_s* node = HL_first(hl);
+
+	while (node) {
+		if (node->val.type == MAT_OT_INT32 && (uint32_t)node->val.int32 == idx)
+			return node->key.str;
+
+		node = HL_next(hl, node);
+	}
+
+	return NULL;
+}
+
+static int put_str(bc_writer_s* w, string_s* s) {
+	uint32_t i;
+
+	if (!s)
+		return -1;
+
+	for (i = 0; i < V_SIZE(w->strs); ++i) {
+		if (V_AT(w->strs, i, string_s*) == s)
+			break;
+	}
+
+	if (i == V_SIZE(w->strs))
+		V_PUSH_BACK(w->strs, s, string_s*);
+
+	PUT(w, i);
+	return 0;
+}
+
+// 写入一段代码和它的 op_line，不能缓存时返回1
+static int put_code(bc_writer_s* w, vec_s* code, vec_s* op_line) {
+	uint32_t* ip_begin = &V_AT(*code, 0, uint32_t);
+	uint32_t* ip_end = ip_begin + V_SIZE(*code);
+	uint32_t* ip;
+	uint32_t i;
+
+	PUT(w, V_SIZE(*code));
+
+	for (ip = ip_begin; ip < ip_end; ip += INS_size(*ip)) {
+		uint32_t size = INS_size(*ip);
+		string_s* s;
+		obj_s obj;
+
+		if (size == 0 || ip + size > ip_end)
+			return -1;
+
+		for (i = 0; i < size; ++i) {
+			if (i == 1 && (*ip == IT_PUSH_STRING || *ip == IT_IMPORT)) {
+				if (S_get_str_by_idx(&w->mat->strs_nogc, ip[1], &s) != 0 || put_str(w, s) != 0)
+					return -1;
+			}
+			else if (i == 2 && is_ref_ins(*ip) && (int32_t)ip[1] != -1) {
+				if (HL_get_obj(&w->mod->objs, (int32_t)ip[1], &obj) != 0 || obj.type != MAT_OT_MOD)
+					return 1;
+
+				if (put_str(w, get_name(&obj.mod->objs, ip[2])) != 0)
+					return 1;
+			}
+			else {
+				PUT(w, ip[i]);
+			}
+		}
+	}
+
+	PUT(w, V_SIZE(*op_line));
+
+	for (i = 0; i < V_SIZE(*op_line); ++i) {
+		PUT(w, V_AT(*op_line, i, op_line_s).op_pos);
+		PUT(w, V_AT(*op_line, i, op_line_s).line);
+	}
+
+	return 0;
+}
+
+static int put_objs(bc_writer_s* w) {
+	int ret;
+	mod_s* mod = w->mod;
+	uint32_t n = HL_SIZE(mod->objs);
+	string_s** names = calloc(n + 1, sizeof(string_s*));
+	uint32_t i, k;
+	CHECK_MALLOC(names);
+
+	ret = get_names(&mod->objs, names);
+	CHECK_RESULT(ret);
+
+	PUT(w, n);
+
+	for (i = 0; i < n; ++i) {
+		obj_s obj;
+		ret = HL_get_obj(&mod->objs, i, &obj);
+		CHECK_RESULT(ret);
+
+		ret = put_str(w, names[i]);
+		CHECK_RESULT(ret);
+
+		switch (obj.type) {
+			case MAT_OT_DUMMY:
+			case MAT_OT_C_FUNC:
+				PUT(w, BC_OBJ_NAME);
+				PUT(w, 0);
+				break;
+
+			case MAT_OT_FUNC:
+				for (k = 0; k < V_SIZE(mod->funcs) && V_AT(mod->funcs, k, func_s*) != obj.func; ++k);
+
+				if (k == V_SIZE(mod->funcs)) {
+					ret = 1;
+					goto exit0;
+				}
+
+				PUT(w, BC_OBJ_FUNC);
+				PUT(w, k);
+				break;
+
+			case MAT_OT_MOD:
+				PUT(w, BC_OBJ_MOD);
+				ret = put_str(w, obj.mod->name);
+				CHECK_RESULT(ret);
+				break;
+
+			// 解析完成时模块对象只会是上面几种，宿主程序预先放入的值不能缓存
+			default:
+				ret = 1;
+				goto exit0;
+		}
+	}
+
+	ret = 0;
+exit0:
+	free(names);
+	return ret;
+}
+
+static int put_func(bc_writer_s* w, func_s* func) {
+	int ret;
+	uint32_t n = HL_SIZE(func->objs);
+	string_s** names = calloc(n + 1, sizeof(string_s*));
+	uint32_t i;
+	CHECK_MALLOC(names);
+
+	ret = get_names(&func->objs, names);
+	CHECK_RESULT(ret);
+
+	ret = put_str(w, func->name);
+	CHECK_RESULT(ret);
+
+	PUT(w, func->param_num);
+	PUT(w, n);
+
+	for (i = 0; i < n; ++i) {
+		ret = put_str(w, names[i]);
+		CHECK_RESULT(ret);
+	}
+
+	ret = put_code(w, &func->code, &func->op_line);
+
+exit0:
+	free(names);
+	return ret;
+}
+
+// 把头部、字符串表和正文拼成完整的缓存映像，image 由调用者释放
+static void build_image(bc_writer_s* w, uint32_t* header, void** image, uint32_t* size) {
+	uint32_t n = BC_HEADER_SIZE + 1 + V_SIZE(w->body);
+	uint32_t* p;
+	uint32_t i;
+
+	for (i = 0; i < V_SIZE(w->strs); ++i)
+		n += 1 + V_AT(w->strs, i, string_s*)->size / 4 + 1;
+
+	p = malloc(n * sizeof(uint32_t));
+	CHECK_MALLOC(p);
+
+	*image = p;
+	*size = n * sizeof(uint32_t);
+
+	memcpy(p, header, BC_HEADER_SIZE * sizeof(uint32_t));
+	p += BC_HEADER_SIZE;
+	*p++ = V_SIZE(w->strs);
+
+	for (i = 0; i < V_SIZE(w->strs); ++i) {
+		string_s* s = V_AT(w->strs, i, string_s*);
+		uint32_t words = s->size / 4 + 1;
+
+		*p++ = s->size;
+		p[words - 1] = 0;
+		memcpy(p, s->str, s->size);
+		p += words;
+	}
+
+	memcpy(p, w->body.p, V_SIZE(w->body) * sizeof(uint32_t));
+}
+
+static int write_file(const char* path, void* image, uint32_t size) {
+	char tmp[MAX_PATH + 8];
+	FILE* fp;
+	int ok;
+
+	// 先写到临时文件再改名，其它进程不会读到写了一半的缓存
+	sprintf(tmp, "%s.tmp", path);
+	fp = fopen(tmp, "wb");
+
+	if (!fp)
+		return 1;
+
+	ok = fwrite(image, 1, size, fp) == size;
+	ok = fclose(fp) == 0 && ok;
+
+	if (ok) {
+		remove(path);
+		ok = rename(tmp, path) == 0;
+	}
+
+	if (!ok) {
+		remove(tmp);
+		return 1;
+	}
+
+	return 0;
+}
+
+static uint32_t get(bc_loader_s* l) {
+	if (l->pos >= l->size) {
+		l->bad = 1;
+		return 0;
+	}
+
+	return l->p[l->pos++];
+}
+
+static const uint32_t* get_words(bc_loader_s* l, uint32_t n) {
+	const uint32_t* p = l->p + l->pos;
+
+	if (n > l->size - l->pos) {
+		l->bad = 1;
+		return NULL;
+	}
+
+	l->pos += n;
+	return p;
+}
+
+static string_s* get_str(bc_loader_s* l) {
+	uint32_t idx = get(l);
+
+	if (l->bad || idx >= l->str_num) {
+		l->bad = 1;
+		return NULL;
+	}
+
+	return l->strs[idx];
+}
+
+static int read_strs(bc_loader_s* l) {
+	uint32_t i;
+
+	l->str_num = get(l);
+
+	if (l->bad || l->str_num > l->size)
+		return 1;
+
+	l->strs = calloc(l->str_num + 1, sizeof(string_s*));
+	CHECK_MALLOC(l->strs);
+
+	for (i = 0; i < l->str_num; ++i) {
+		uint32_t size = get(l);
+		const char* s = (const char*)get_words(l, size / 4 + 1);
+
+		if (l->bad || s[size] != 0 || strlen(s) != size)
+			return 1;
+
+		if (S_get_str(&l->mat->strs_nogc, s, &l->strs[i]) != 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int read_objs(bc_loader_s* l) {
+	uint32_t i;
+
+	l->obj_num = get(l);
+
+	if (l->bad || l->obj_num > l->size)
+		return 1;
+
+	l->objs = calloc(l->obj_num + 1, sizeof(bc_obj_s));
+	CHECK_MALLOC(l->objs);
+	l->obj_map = calloc(l->obj_num + 1, sizeof(int32_t));
+	CHECK_MALLOC(l->obj_map);
+
+	for (i = 0; i < l->obj_num; ++i) {
+		bc_obj_s* o = l->objs + i;
+		o->name = get(l);
+		o->kind = get(l);
+		o->val = get(l);
+
+		if (l->bad || o->name >= l->str_num || o->kind > BC_OBJ_MOD || (o->kind == BC_OBJ_MOD && o->val >= l->str_num))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+	检查或者重新定位一段代码的操作数，local_num 为函数对象个数，模块代码为 -1。
+	BC_WALK_CHECK 有不合法的操作数返回1；
+	BC_WALK_PATCH 把模块对象下标换成当前模块里的下标，模块限定引用按名字找到对象的下标，
+	BC_WALK_PROBE 在有操作数需要这样修改时返回1。
+*/
+static int walk_code(bc_loader_s* l, vec_s* code, int32_t local_num, bc_walk_e mode) {
+	uint32_t* ip_begin = &V_AT(*code, 0, uint32_t);
+	uint32_t* ip_end = ip_begin + V_SIZE(*code);
+	uint32_t* ip;
+	uint32_t* var = NULL;
+	uint32_t i;
+
+	for (ip = ip_begin; ip < ip_end; ip += INS_size(*ip)) {
+		uint32_t ins = *ip;
+		CHECK_OPERAND(INS_size(ins) > 0 && ip + INS_size(ins) <= ip_end);
+
+		switch (ins) {
+			case IT_IMPORT:
+			case IT_PUSH_STRING:
+				CHECK_OPERAND(ip[1] < l->str_num);
+				break;
+
+			case IT_PUSH_LOCAL:
+			case IT_STORE_LOCAL:
+				CHECK_OPERAND((int32_t)ip[1] >= 0 && (int32_t)ip[1] < local_num);
+				break;
+
+			case IT_PUSH_GLOBAL:
+			case IT_STORE_GLOBAL:
+				CHECK_OPERAND(ip[1] < l->obj_num);
+
+				if (mode != BC_WALK_CHECK)
+					SET_OPERAND(ip + 1, l->obj_map[ip[1]]);
+
+				break;
+
+			case IT_INLINE_GUARD:
+				if (mode == BC_WALK_CHECK && ip[2] >= l->func_ref)
+					l->func_ref = ip[2] + 1;
+
+				break;
+
+			case IT_FOR_PREP:
+			case IT_FOR_LOOP:
+				var = ins == IT_FOR_PREP ? ip + 2 : ip + 3;
+
+				if ((int32_t)*var < 0) {
+					CHECK_OPERAND(-((int32_t)*var + 1) < local_num);
+				}
+				else {
+					CHECK_OPERAND(*var < l->obj_num);
+
+					if (mode != BC_WALK_CHECK)
+						SET_OPERAND(var, l->obj_map[*var]);
+				}
+
+				break;
+
+			default:
+				for (i = 1; i <= reg_num(ins); ++i)
+					CHECK_OPERAND((int32_t)ip[i] >= 0 && (int32_t)ip[i] < local_num);
+
+				if (is_ref_ins(ins)) {
+					int32_t mod_pos = (int32_t)ip[1];
+					int32_t pos = (int32_t)ip[2];
+
+					if (mod_pos == -1 && pos < 0) {
+						CHECK_OPERAND(-(pos + 1) < local_num);
+					}
+					else if (mod_pos == -1) {
+						CHECK_OPERAND((uint32_t)pos < l->obj_num);
+
+						if (mode != BC_WALK_CHECK)
+							SET_OPERAND(ip + 2, l->obj_map[pos]);
+					}
+					else {
+						CHECK_OPERAND((uint32_t)mod_pos < l->obj_num && l->objs[mod_pos].kind == BC_OBJ_MOD && (uint32_t)pos < l->str_num);
+
+						// 名字的下标一定要换成对象下标
+						if (mode == BC_WALK_PROBE)
+							return 1;
+
+						if (mode == BC_WALK_PATCH) {
+							obj_s obj;
+							int32_t idx;
+							ip[1] = (uint32_t)l->obj_map[mod_pos];
+
+							if (HL_get_obj(&l->mod->objs, (int32_t)ip[1], &obj) != 0 || obj.type != MAT_OT_MOD)
+								return -1;
+
+							idx = HL_get_obj_idx(&obj.mod->objs, l->strs[pos]);
+
+							if (idx < 0) {
+								obj.type = MAT_OT_DUMMY;
+								idx = HL_set_obj(&obj.mod->objs, l->strs[pos], &obj);
+
+								if (idx < 0)
+									return -1;
+							}
+
+							ip[2] = (uint32_t)idx;
+						}
+					}
+				}
+
+				break;
+		}
+	}
+
+	return 0;
+}
+
+static int read_code(bc_loader_s* l, vec_s* code, vec_s* op_line, int32_t local_num) {
+	uint32_t size = get(l);
+	const uint32_t* words = get_words(l, size);
+
+	if (l->bad)
+		return 1;
+
+	// 直接引用映射的数据，需要修改时再复制
+	V_free(code);
+	V_init_ref(code, (void*)words, sizeof(uint32_t), size);
+
+	size = get(l);
+	words = get_words(l, size * 2);
+
+	if (l->bad)
+		return 1;
+
+	// op_line_s 就是两个字 (op_pos, line)
+	V_free(op_line);
+	V_init_ref(op_line, (void*)words, sizeof(op_line_s), size);
+
+	return walk_code(l, code, local_num, BC_WALK_CHECK);
+}
+
+static int read_func(bc_loader_s* l) {
+	int ret;
+	func_s* func = malloc(sizeof(func_s));
+	uint32_t n;
+	uint32_t i;
+	CHECK_MALLOC(func);
+
+	ret = F_init(func);
+	CHECK_RESULT(ret);
+
+	// 先放进函数表，出错时统一释放
+	V_PUSH_BACK(l->funcs, func, func_s*);
+
+	func->name = get_str(l);
+	func->param_num = get(l);
+	n = get(l);
+
+	if (l->bad || func->param_num > n || n > l->size)
+		return 1;
+
+	for (i = 0; i < n; ++i) {
+		obj_s obj;
+		string_s* name = get_str(l);
+
+		if (l->bad)
+			return 1;
+
+		obj.type = MAT_OT_DUMMY;
+
+		if (HL_set_obj(&func->objs, name, &obj) != (int32_t)i)
+			return 1;
+	}
+
+	ret = read_code(l, &func->code, &func->op_line, (int32_t)n);
+
+exit0:
+	return ret;
+}
+
+// 读取并检查整个缓存，只修改字符串表，返回1表示缓存不可用
+static int read_image(bc_loader_s* l) {
+	int ret;
+	uint32_t n;
+	uint32_t i;
+
+	ret = read_strs(l);
+
+	if (ret == 0)
+		ret = read_objs(l);
+
+	if (ret == 0)
+		ret = read_code(l, &l->code, &l->op_line, -1);
+
+	if (ret != 0)
+		return ret;
+
+	n = get(l);
+
+	if (l->bad || n > l->size)
+		return 1;
+
+	for (i = 0; i < n; ++i) {
+		ret = read_func(l);
+
+		if (ret != 0)
+			return ret;
+	}
+
+	if (l->pos != l->size)
+		return 1;
+
+	for (i = 0; i < l->obj_num; ++i) {
+		if (l->objs[i].kind == BC_OBJ_FUNC && l->objs[i].val >= n)
+			return 1;
+	}
+
+	if (l->func_ref > n)
+		return 1;
+
+	return 0;
+}
+
+// 按名字加入模块对象，建立缓存对象下标到模块对象下标的映射
+static int install_objs(bc_loader_s* l) {
+	uint32_t i;
+
+	for (i = 0; i < l->obj_num; ++i) {
+		bc_obj_s* o = l->objs + i;
+		string_s* name = l->strs[o->name];
+		obj_s obj;
+		int32_t idx = HL_get_obj_idx(&l->mod->objs, name);
+		uint32_t mod_idx;
+
+		switch (o->kind) {
+			case BC_OBJ_NAME:
+				if (idx < 0) {
+					obj.type = MAT_OT_DUMMY;
+					idx = HL_set_obj(&l->mod->objs, name, &obj);
+				}
+
+				break;
+
+			case BC_OBJ_FUNC:
+				obj.type = MAT_OT_FUNC;
+				obj.func = V_AT(l->funcs, o->val, func_s*);
+				idx = HL_set_obj(&l->mod->objs, name, &obj);
+				break;
+
+			case BC_OBJ_MOD:
+				// 与解析 import 时相同，先加入被导入的模块，执行到 IMPORT 时才加载它
+				obj.type = MAT_OT_MOD;
+
+				if (VM_add_mod(l->mat, l->strs[o->val], &obj.mod, &mod_idx) < 0)
+					return -1;
+
+				if (BU_import(l->mat, obj.mod) != 0)
+					return -1;
+
+				idx = HL_set_obj(&l->mod->objs, name, &obj);
+				break;
+
+			default:
+				return -1;
+		}
+
+		if (idx < 0)
+			return -1;
+
+		l->obj_map[i] = idx;
+	}
+
+	return 0;
+}
+
+// 需要重新定位的代码先复制一份，其它的继续引用映射的数据
+static int relocate(bc_loader_s* l, vec_s* code, int32_t local_num) {
+	int ret = walk_code(l, code, local_num, BC_WALK_PROBE);
+
+	if (ret != 1)
+		return ret;
+
+	if (V_detach(code) != 0)
+		return -1;
+
+	return walk_code(l, code, local_num, BC_WALK_PATCH);
+}
+
+static int install(bc_loader_s* l) {
+	int ret;
+	mod_s* mod = l->mod;
+	uint32_t i;
+
+	ret = install_objs(l);
+	CHECK_RESULT(ret);
+
+	ret = relocate(l, &l->code, -1);
+	CHECK_RESULT(ret);
+
+	for (i = 0; i < V_SIZE(l->funcs); ++i) {
+		func_s* func = V_AT(l->funcs, i, func_s*);
+
+		ret = relocate(l, &func->code, (int32_t)HL_SIZE(func->objs));
+		CHECK_RESULT(ret);
+	}
+
+	for (i = 0; i < V_SIZE(l->funcs); ++i)
+		V_PUSH_BACK(mod->funcs, V_AT(l->funcs, i, func_s*), func_s*);
+
+	V_SIZE(l->funcs) = 0;
+
+	V_free(&mod->code);
+	mod->code = l->code;
+	l->code.p = NULL;
+
+	V_free(&mod->op_line);
+	mod->op_line = l->op_line;
+	l->op_line.p = NULL;
+
+	ret = LK_link_mod(l->mat, mod, l->strs);
+	CHECK_RESULT(ret);
+
+	ret = 0;
+exit0:
+	return ret;
+}
+
+/* method */
+// 映射 name.matc，与源文件和当前的代码生成方式一致时返回0
+static int open_cache(matrix_t mat, mod_s* mod, void** image, uint32_t* size) {
+	bc_src_s src;
+	char path[MAX_PATH];
+	char src_path[MAX_PATH];
+	const uint32_t* header;
+
+	sprintf(src_path, "%s.mat", mod->name->str);
+	sprintf(path, "%s.matc", mod->name->str);
+
+	if (get_src_info(src_path, &src) != 0 || BC_map_file(path, image, size) != 0)
+		return 1;
+
+	header = (const uint32_t*)*image;
+
+	if (*size % sizeof(uint32_t) != 0 || *size < BC_HEADER_SIZE * sizeof(uint32_t))
+		goto exit0;
+
+	if (header[0] != BC_MAGIC || header[1] != BC_VERSION || header[2] != (uint32_t)mat->backend || header[3] != src.size)
+		goto exit0;
+
+	// 修改时间不同时内容可能没有变化，比如重新检出的文件
+	if (header[4] != src.mtime_lo || header[5] != src.mtime_hi) {
+		if (get_src_hash(src_path, &src) != 0 || header[3] != src.size || header[6] != src.hash)
+			goto exit0;
+	}
+
+	return 0;
+exit0:
+	BC_unmap_file(*image, *size);
+	*image = NULL;
+	return 1;
+}
+
+// 读取映像并安装到模块，成功时映像归模块所有，heap 表示映像由 malloc 分配
+static int load_image(matrix_t mat, mod_s* mod, void* image, uint32_t size, int heap) {
+	int ret;
+	bc_loader_s l;
+	uint32_t i;
+
+	memset(&l, 0, sizeof(l));
+	l.mat = mat;
+	l.mod = mod;
+	l.p = (const uint32_t*)image + BC_HEADER_SIZE;
+	l.size = size / sizeof(uint32_t) - BC_HEADER_SIZE;
+
+	ret = V_init(&l.code, sizeof(uint32_t), 0);
+	CHECK_RESULT(ret);
+	ret = V_init(&l.op_line, sizeof(op_line_s), 0);
+	CHECK_RESULT(ret);
+	ret = V_init(&l.funcs, sizeof(func_s*), 0);
+	CHECK_RESULT(ret);
+
+	ret = read_image(&l);
+
+	// 模块的代码可能引用映像的数据，映像随模块释放
+	if (ret == 0) {
+		mod->image = image;
+		mod->image_size = size;
+		mod->image_heap = heap;
+
+		ret = install(&l);
+	}
+
+exit0:
+	if (l.funcs.p) {
+		for (i = 0; i < V_SIZE(l.funcs); ++i) {
+			func_s* func = V_AT(l.funcs, i, func_s*);
+			F_free(func);
+			free(func);
+		}
+
+		V_free(&l.funcs);
+	}
+
+	if (l.code.p)
+		V_free(&l.code);
+
+	if (l.op_line.p)
+		V_free(&l.op_line);
+
+	free(l.strs);
+	free(l.objs);
+	free(l.obj_map);
+	return ret;
+}
+
+int BC_load(matrix_t mat, mod_s* mod) {
+	int ret;
+	void* image = NULL;
+	uint32_t size = 0;
+	assert(mat);
+	assert(mod);
+	assert(!mod->image);
+
+	if (open_cache(mat, mod, &image, &size) != 0)
+		return 1;
+
+	ret = load_image(mat, mod, image, size, 0);
+
+	if (!mod->image)
+		BC_unmap_file(image, size);
+
+	return ret;
+}
+
+int BC_check(matrix_t mat, mod_s* mod) {
+	void* image = NULL;
+	uint32_t size = 0;
+	assert(mat);
+	assert(mod);
+
+	if (open_cache(mat, mod, &image, &size) != 0)
+		return 1;
+
+	BC_unmap_file(image, size);
+	return 0;
+}
+
+int BC_load_image(matrix_t mat, mod_s* mod, void* image, uint32_t size) {
+	int ret = 1;
+	const uint32_t* header = (const uint32_t*)image;
+	assert(mat);
+	assert(mod);
+	assert(!mod->image);
+
+	if (size % sizeof(uint32_t) == 0 && size >= BC_HEADER_SIZE * sizeof(uint32_t) &&
+	        header[0] == BC_MAGIC && header[1] == BC_VERSION && header[2] == (uint32_t)mat->backend)
+		ret = load_image(mat, mod, image, size, 1);
+
+	if (!mod->image)
+		free(image);
+
+	return ret;
+}
+
+int BC_save_image(matrix_t mat, mod_s* mod, void** image, uint32_t* size) {
+	int ret;
+	bc_writer_s w;
+	bc_src_s src;
+	char src_path[MAX_PATH];
+	uint32_t header[BC_HEADER_SIZE];
+	uint32_t i;
+	assert(mat);
+	assert(mod);
+
+	memset(&w, 0, sizeof(w));
+	w.mat = mat;
+	w.mod = mod;
+
+	sprintf(src_path, "%s.mat", mod->name->str);
+
+	// 还有没编译的函数体时不写缓存，下次加载时重新解析
+	if (mod->lazy_num > 0)
+		return 1;
+
+	if (get_src_info(src_path, &src) != 0 || get_src_hash(src_path, &src) != 0)
+		return 1;
+
+	ret = V_init(&w.strs, sizeof(string_s*), DEFAULT_STR_TABLE_SIZE);
+	CHECK_RESULT(ret);
+	ret = V_init(&w.body, sizeof(uint32_t), V_SIZE(mod->code) * 2);
+	CHECK_RESULT(ret);
+
+	ret = put_objs(&w);
+
+	if (ret == 0)
+		ret = put_code(&w, &mod->code, &mod->op_line);
+
+	if (ret != 0)
+		goto exit0;
+
+	PUT(&w, V_SIZE(mod->funcs));
+
+	for (i = 0; i < V_SIZE(mod->funcs); ++i) {
+		ret = put_func(&w, V_AT(mod->funcs, i, func_s*));
+
+		if (ret != 0)
+			goto exit0;
+	}
+
+	header[0] = BC_MAGIC;
+	header[1] = BC_VERSION;
+	header[2] = (uint32_t)mat->backend;
+	header[3] = src.size;
+	header[4] = src.mtime_lo;
+	header[5] = src.mtime_hi;
+	header[6] = src.hash;
+
+	build_image(&w, header, image, size);
+	ret = 0;
+
+exit0:
+	if (w.strs.p)
+		V_free(&w.strs);
+
+	if (w.body.p)
+		V_free(&w.body);
+
+	return ret;
+}
+
+int BC_save(matrix_t mat, mod_s* mod) {
+	int ret;
+	void* image;
+	uint32_t size;
+	assert(mat);
+	assert(mod);
+
+	ret = BC_save_image(mat, mod, &image, &size);
+
+	if (ret != 0)
+		return ret;
+
+	ret = BC_write_image(mod, image, size);
+	free(image);
+	return ret;
+}
+
+int BC_write_image(mod_s* mod, void* image, uint32_t size) {
+	char path[MAX_PATH];
+	assert(mod);
+	assert(image);
+
+	sprintf(path, "%s.matc", mod->name->str);
+	return write_file(path, image, size);
+}
+
+void BC_free_image(mod_s* mod) {
+	assert(mod);
+
+	if (mod->image_heap)
+		free(mod->image);
+	else
+		BC_unmap_file(mod->image, mod->image_size);
+
+	mod->image = NULL;
+	mod->image_size = 0;
+	mod->image_heap = 0;
+}
@@ -0,0 +1,66 @@
+﻿/*
+    Matrix Script Language
+    author: Zeb
+    e-mail: zebbey@gmail.com
+    Copyright (c) 2004 Zeb.  All rights reserved.
+*/
+
+#ifndef __H_BC__
+#define __H_BC__
+
+#include "matrix.h"
+#include "mod.h"
+
+/**
+    字节码缓存
+    源文件 name.mat 解析、优化完成后，把模块代码、函数表、对象名字、字符串常量和 op_line 写到 name.matc，
+    之后再加载这个模块时，如果源文件没有变化就直接读取缓存，不再做词法分析和解析，读取后照常链接。
+    文件由 uint32_t 字组成，按本机字节序保存：
+        头部:   BC_MAGIC, BC_VERSION, 代码生成方式, 源文件大小, 修改时间低32位, 修改时间高32位, 源文件哈希
+        字符串: 个数，每个字符串为字节数和以 0 结尾、补齐到4字节的内容
+        对象:   个数，每个模块对象为 (名字, 类型, 值)，按对象下标排列
+        代码:   字数和指令字，op_line 个数和 (op_pos, line)
+        函数:   个数，每个函数为名字、参数个数、对象个数和对象名字，然后是代码和 op_line
+    指令里的字符串索引换成缓存字符串表的下标，模块限定引用 m:x 的下标换成名字 x 的下标，
+    加载时再换回当前虚拟机里的索引。其它模块可能先引用过这个模块的对象，它们的下标会不同，
+    所以模块对象按名字重新加入，指令里的模块对象下标也重新映射。
+    源文件的大小和修改时间与缓存相同时直接使用，修改时间不同时再比较内容的哈希值。
+
+    缓存文件只读映射到内存，字数组和 op_line 的布局与 vec_s 中的相同，
+    不需要重新定位的代码和 op_line 直接引用映射的数据（见 V_init_ref），多个进程加载同一个缓存时共享这些页。
+    只有模块对象下标变化或者含有模块限定引用的代码才复制一份再修改。
+    字符串索引不修改，链接时通过缓存的字符串表换成 string_s*。
+    lcode 保存处理代码和对象的地址，每个进程仍然要各自链接。
+*/
+
+#define BC_MAGIC 0x4354414d // "MATC"
+
+// 指令集或者文件格式改变时必须增加
+#define BC_VERSION 2
+
+// 从 name.matc 加载模块，mod 已经导入了内置函数。加载并链接完成返回0，没有可用的缓存返回1，出错返回 -1
+int BC_load(matrix_t mat, mod_s* mod);
+
+// 把刚解析完成的模块写到 name.matc，模块不能缓存或者写入失败时返回1
+int BC_save(matrix_t mat, mod_s* mod);
+
+// 只检查 name.matc 是否可用，不加载，可用时返回0
+int BC_check(matrix_t mat, mod_s* mod);
+
+// 与 BC_save 相同，但是映像写到 malloc 分配的内存里，由调用者释放
+int BC_save_image(matrix_t mat, mod_s* mod, void** image, uint32_t* size);
+
+// 把 BC_save_image 生成的映像写到 name.matc
+int BC_write_image(mod_s* mod, void* image, uint32_t size);
+
+// 从内存里的映像加载模块，返回值与 BC_load 相同，映像总是由这个函数接管
+int BC_load_image(matrix_t mat, mod_s* mod, void* image, uint32_t size);
+
+// 只读映射整个文件，起始地址按页对齐，空文件不能映射。词法分析也用它读取源文件
+int BC_map_file(const char* path, void** p, uint32_t* size);
+void BC_unmap_file(void* p, uint32_t size);
+
+// 释放模块引用的缓存映射，模块的代码和函数已经释放
+void BC_free_image(mod_s* mod);
+
+#endif // __H_BC__
@@ -19,6 +19,11 @@
 
 #define DEFAULT_STACK_SIZE 2048
 
+// 运行栈按需扩大，最多容纳的对象个数，可以用 MAT_set_stack_limit 修改
+#ifndef MAX_STACK_SIZE
+#define MAX_STACK_SIZE (1024 * 1024 * 4)
+#endif
+
 #define DEFAULT_VM_MOD_NUM 16
 
 #define MAX_IF_BLOCK_NUM 128
@@ -31,10 +36,74 @@
 
 #define DEFALT_FUNC_FRAME_SIZE 128
 
+// 一个条件表达式里由 && 和 || 生成的条件跳转个数
+#define MAX_COND_JMP_NUM 64
+
+// 常量折叠时记录的最近常量入栈指令个数
+#define MAX_FOLD_CONST_NUM 32
+
+// 常量传播时记录的值已知的变量个数
+#define MAX_KNOWN_CONST_NUM 64
+
+// 调用帧按需扩大，最大的调用深度
+#ifndef MAX_FUNC_FRAME_SIZE
+#define MAX_FUNC_FRAME_SIZE (1024 * 256)
+#endif
+
+// 代码不超过这么多个字的函数在调用处内联，为0时不内联
+#ifndef MAX_INLINE_SIZE
+#define MAX_INLINE_SIZE 64
+#endif
+
+// 寄存器后端虚拟栈的最大深度，也是每个函数最多增加的临时对象个数
+#define MAX_REG_TEMP_NUM 16
+
 #define LIST_INIT_SIZE 16
 #define POOL_ALLOC_LIST 32
 #define POOL_ALLOC_DICT 32
 
 #define MATRIX_DEBUG 0
 
+// 虚拟机是否使用 computed goto 分派指令，只有 GCC/Clang 支持
+#ifndef MATRIX_THREADED_DISPATCH
+#	if defined(__GNUC__) || defined(__clang__)
+#		define MATRIX_THREADED_DISPATCH 1
+#	else
+#		define MATRIX_THREADED_DISPATCH 0
+#	endif
+#endif
+
+// 是否把频繁调用的函数编译成本地代码，目前只支持 x86-64 的 System V 调用约定
+#ifndef MATRIX_JIT
+#	if defined(__x86_64__) && !defined(_WIN32)
+#		define MATRIX_JIT 1
+#	else
+#		define MATRIX_JIT 0
+#	endif
+#endif
+
+// 词法分析是否用 SSE2/AVX2 成组扫描空白、注释和字符串，运行时检测 AVX2，目前只支持 x86-64 的 GCC/Clang
+#ifndef MATRIX_SIMD_LEX
+#	if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#		define MATRIX_SIMD_LEX 1
+#	else
+#		define MATRIX_SIMD_LEX 0
+#	endif
+#endif
+
+// 函数被调用多少次以后编译成本地代码
+#ifndef JIT_CALL_THRESHOLD
+#define JIT_CALL_THRESHOLD 64
+#endif
+
+// 循环回边执行多少次以后把循环编译成本地代码
+#ifndef JIT_LOOP_THRESHOLD
+#define JIT_LOOP_THRESHOLD 64
+#endif
+
+// 本地代码里的调用占用 C 栈，嵌套超过这个层数后新的调用解释执行，解释器的调用不占用 C 栈
+#ifndef JIT_MAX_DEPTH
+#define JIT_MAX_DEPTH 1024
+#endif
+
 #endif
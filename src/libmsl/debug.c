@@ -11,7 +11,8 @@
 #include "vec.h"
 #include "str.h"
 
-static uint32_t get_pos(matrix_t mat, uint32_t* op, mod_s** mod, func_s** func) {
+// 找不到指令所在的代码时返回 -1
+static int32_t get_pos(matrix_t mat, lword_u* op, mod_s** mod, func_s** func) {
 	uint32_t i;
 
 	for (i = 0; i < V_SIZE(mat->dbg_info); ++i) {
@@ -24,7 +25,7 @@ static uint32_t get_pos(matrix_t mat, uint32_t* op, mod_s** mod, func_s** func)
 		}
 	}
 
-	return 0;
+	return -1;
 }
 
 int DBG_init(matrix_t mat) {
@@ -48,18 +49,40 @@ int DBG_add_mod(matrix_t mat, mod_s* mod) {
 	V_PUSH_BACK_GET(mat->dbg_info, dbg, dbg_info_s);
 	dbg->mod = mod;
 	dbg->func = NULL;
-	dbg->ip_begin = &V_AT(mod->code, 0, uint32_t);
-	dbg->ip_end = dbg->ip_begin + V_SIZE(mod->code);
+	dbg->ip_begin = &V_AT(mod->lcode, 0, lword_u);
+	dbg->ip_end = dbg->ip_begin + V_SIZE(mod->lcode);
 
 	for (i = 0; i < V_SIZE(mod->funcs); ++i) {
 		func_s* func = V_AT(mod->funcs, i, func_s*);
 		V_PUSH_BACK_GET(mat->dbg_info, dbg, dbg_info_s);
 		dbg->mod = mod;
 		dbg->func = func;
-		dbg->ip_begin = &V_AT(func->code, 0, uint32_t);
-		dbg->ip_end = dbg->ip_begin + V_SIZE(func->code);
+		dbg->ip_begin = &V_AT(func->lcode, 0, lword_u);
+		dbg->ip_end = dbg->ip_begin + V_SIZE(func->lcode);
+	}
+
+	return 0;
+}
+
+int DBG_add_func(matrix_t mat, mod_s* mod, func_s* func) {
+	uint32_t i;
+	dbg_info_s* dbg = NULL;
+
+	for (i = 0; i < V_SIZE(mat->dbg_info); ++i) {
+		if (V_AT(mat->dbg_info, i, dbg_info_s).func == func) {
+			dbg = &V_AT(mat->dbg_info, i, dbg_info_s);
+			break;
+		}
 	}
 
+	if (dbg == NULL) {
+		V_PUSH_BACK_GET(mat->dbg_info, dbg, dbg_info_s);
+	}
+
+	dbg->mod = mod;
+	dbg->func = func;
+	dbg->ip_begin = &V_AT(func->lcode, 0, lword_u);
+	dbg->ip_end = dbg->ip_begin + V_SIZE(func->lcode);
 	return 0;
 }
 
@@ -80,14 +103,37 @@ int DBG_add_op_line(matrix_t mat, mod_s* mod, func_s* func, uint32_t op_pos, uin
 	return 0;
 }
 
-uint32_t DBG_get_line(matrix_t mat, uint32_t* op) {
+void DBG_truncate_op_line(mod_s* mod, func_s* func, uint32_t op_pos) {
+	vec_s* op_line = func ? &func->op_line : &mod->op_line;
+
+	while (V_SIZE(*op_line) > 0 && V_AT(*op_line, V_SIZE(*op_line) - 1, op_line_s).op_pos >= op_pos)
+		V_SIZE(*op_line)--;
+}
+
+int DBG_relocate_op_line(vec_s* op_line, const uint32_t* pos_map, uint32_t code_size) {
+	uint32_t i;
+
+	for (i = 0; i < V_SIZE(*op_line); ++i) {
+		op_line_s* opl = &V_AT(*op_line, i, op_line_s);
+
+		if (opl->op_pos > code_size)
+			return -1;
+
+		opl->op_pos = pos_map[opl->op_pos];
+	}
+
+	return 0;
+}
+
+uint32_t DBG_get_line(matrix_t mat, lword_u* op) {
 	uint32_t i;
 	mod_s* mod;
 	func_s* func;
 	op_line_s* opl;
-	uint32_t op_pos = get_pos(mat, op, &mod, &func);
+	int32_t pos = get_pos(mat, op, &mod, &func);
+	uint32_t op_pos = (uint32_t)pos;
 
-	if (op_pos == 0)
+	if (pos < 0)
 		return 0;
 
 	if (func) {
@@ -108,7 +154,7 @@ uint32_t DBG_get_line(matrix_t mat, uint32_t* op) {
 			op_line_s* opl = &V_AT(mod->op_line, i, op_line_s);
 			op_line_s* opl_next = &V_AT(mod->op_line, i + 1, op_line_s);
 
-			if (op_pos >= opl->op_pos && op_pos < opl->op_pos)
+			if (op_pos >= opl->op_pos && op_pos < opl_next->op_pos)
 				return opl->line;
 		}
 
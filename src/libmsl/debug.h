@@ -11,7 +11,16 @@
 int DBG_init(matrix_t mat);
 void DBG_free(matrix_t mat);
 int DBG_add_mod(matrix_t mat, mod_s* mod);
+
+// 函数在模块加入之后才链接时（延迟编译的函数体）更新它的指令范围
+int DBG_add_func(matrix_t mat, mod_s* mod, func_s* func);
 int DBG_add_op_line(matrix_t mat, mod_s* mod, func_s* func, uint32_t op_pos, uint32_t line);
-uint32_t DBG_get_line(matrix_t mat, uint32_t* op);
+uint32_t DBG_get_line(matrix_t mat, lword_u* op);
+
+// 代码回退到 op_pos 时删掉 op_pos 及之后指令的行号信息
+void DBG_truncate_op_line(mod_s* mod, func_s* func, uint32_t op_pos);
+
+// 代码重写以后修正 op_line，pos_map 把旧的指令位置（0 ~ code_size）映射到新位置
+int DBG_relocate_op_line(vec_s* op_line, const uint32_t* pos_map, uint32_t code_size);
 
 #endif // __H_DEBUG__
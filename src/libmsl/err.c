@@ -7,7 +7,7 @@
 #include "matrix.h"
 #include "header.h"
 #include "err.h"
-#include "matrix.h"
+#include "obj.h"
 
 #define LOG_BUFFER_SIZE 1024
 
@@ -28,6 +28,10 @@ void E_rt_err(matrix_t mat, const char* file_name, uint32_t line, const char* fm
 	va_list list;
 	assert(mat);
 	assert(fmt);
+
+	if (mat->quiet)
+		return;
+
 	va_start(list, fmt);
 	vsprintf(buffer, fmt, list);
 	printf("Error: %s\nFile \"%s\", line: %d\n", buffer, file_name, line);
@@ -10,6 +10,7 @@
 #include "hash_list.h"
 #include "config.h"
 #include "vec.h"
+#include "jit.h"
 
 int F_init(func_s* func) {
 	int ret;
@@ -17,19 +18,40 @@ int F_init(func_s* func) {
 	ret = V_init(&func->code, sizeof(uint32_t), DEFAULT_FUNC_CODE_SIZE);
 	CHECK_RESULT(ret);
 
+	ret = V_init(&func->lcode, sizeof(lword_u), 0);
+	CHECK_RESULT(ret);
+
+	ret = V_init(&func->caches, sizeof(ref_cache_s), 0);
+	CHECK_RESULT(ret);
+
 	ret = V_init(&func->op_line, sizeof(op_line_s), DEFAULT_FUNC_CODE_SIZE);
 	CHECK_RESULT(ret);
 
 	ret = HL_init(&func->objs, DEFAULT_FUNC_OBJ_SIZE);
 	CHECK_RESULT(ret);
 
+	func->entry = NULL;
+	func->local_num = 0;
+	func->frame_size = 0;
+	func->calls = 0;
+	func->jit = NULL;
+	func->jit_size = 0;
+	func->jit_failed = 0;
+	func->lazy = NULL;
+
 	ret = 0;
 exit0:
 	return ret;
 }
 
 void F_free(func_s* func) {
+#if MATRIX_JIT
+	JIT_free_func(func);
+#endif
+	free(func->lazy);
 	HL_free(&func->objs);
 	V_free(&func->op_line);
+	V_free(&func->caches);
+	V_free(&func->lcode);
 	V_free(&func->code);
 }
@@ -74,7 +74,11 @@ static hash_node_s* find_hash_node(vec_s* nodes, uint32_t mask, obj_s* key, uint
 		i = (i << 2) + i + perturb + 1;
 		node = &V_AT(*nodes, (i & mask), hash_node_s);
 
-		if (node->key.type != MAT_OT_DUMMY && O_compare_eq(&node->key, key))
+		// 结点不会被删除，探测到空位说明键不存在
+		if (node->key.type == MAT_OT_DUMMY)
+			return NULL;
+
+		if (O_compare_eq(&node->key, key))
 			return node;
 	}
 
@@ -40,6 +40,7 @@
 #include <math.h>
 #include <ctype.h>
 #include <limits.h>
+#include <sys/stat.h>
 
 #if defined(PLATFORM_WINDOWS)
 #   include <conio.h>
@@ -0,0 +1,496 @@
+﻿/*
+    Matrix Script Language
+    author: Zeb
+    e-mail: zebbey@gmail.com
+    Copyright (c) 2004 Zeb.  All rights reserved.
+*/
+
+#include "obj.h"
+#include "inl.h"
+#include "ins.h"
+#include "vec.h"
+#include "str.h"
+#include "err.h"
+#include "hash_list.h"
+#include "debug.h"
+
+#define EMIT(s, w) V_PUSH_BACK((s)->code, (uint32_t)(w), uint32_t)
+
+typedef struct {
+	matrix_t mat;
+	mod_s* mod;
+	func_s* caller;
+	func_s* callee;
+	int32_t slot; // 被调用函数在模块对象中的下标
+	uint32_t obj_num;
+	string_s** names; // 被调用函数的对象名字，按下标排列
+	int32_t* map; // 被调用函数的对象对应的调用者对象，与解析器的 id_pos 相同，小于0为局部对象
+	uint32_t* pos_map; // 被调用函数的指令位置对应的内联代码位置
+	vec_s code; // uint32_t，跳转目标先保留被调用函数中的位置，最后统一换算
+} inl_s;
+
+static int is_ref_ins(uint32_t ins) {
+	switch (ins) {
+		case IT_REF_OBJ:
+		case IT_PUSH_OBJ:
+		case IT_ASSIGN:
+		case IT_ASSIGN_ADD:
+		case IT_ASSIGN_SUB:
+		case IT_ASSIGN_MUL:
+		case IT_ASSIGN_DIV:
+		case IT_ASSIGN_MOD:
+		case IT_ASSIGN_EXP:
+		case IT_ASSIGN_AND:
+		case IT_ASSIGN_OR:
+		case IT_ASSIGN_XOR:
+		case IT_ASSIGN_SHIFT_LEFT:
+		case IT_ASSIGN_SHIFT_RIGHT:
+			return 1;
+
+		default:
+			return 0;
+	}
+}
+
+// 寄存器指令的寄存器操作数个数，它们从第一个操作数开始，不是寄存器指令返回0
+static uint32_t reg_num(uint32_t ins) {
+	switch (ins) {
+		case IT_R_LOADI:
+		case IT_R_FALSE_JMP:
+		case IT_R_TRUE_JMP:
+			return 1;
+
+		case IT_R_MOVE:
+			return 2;
+
+		case IT_R_ADD:
+		case IT_R_SUB:
+		case IT_R_MUL:
+		case IT_R_DIV:
+		case IT_R_EQ:
+		case IT_R_NEQ:
+		case IT_R_LT:
+		case IT_R_LE:
+		case IT_R_GT:
+		case IT_R_GE:
+			return 3;
+
+		default:
+			return 0;
+	}
+}
+
+// 函数在模块函数表中的下标，不是这个模块的函数返回 -1
+static int32_t find_mod_func(mod_s* mod, func_s* func) {
+	uint32_t i;
+
+	for (i = 0; i < V_SIZE(mod->funcs); ++i) {
+		if (V_AT(mod->funcs, i, func_s*) == func)
+			return (int32_t)i;
+	}
+
+	return -1;
+}
+
+// 取得被调用函数的对象名字，隐藏对象的名字太长时返回1
+static int get_names(inl_s* s) {
+	hash_node_s* node = HL_first(&s->callee->objs);
+	uint32_t i;
+
+	while (node) {
+		obj_s* k = &node->key;
+		obj_s* v = &node->val;
+
+		if (k->type != MAT_OT_STR || v->type != MAT_OT_INT32 || (uint32_t)v->int32 >= s->obj_num)
+			return 1;
+
+		s->names[v->int32] = k->str;
+		node = HL_next(&s->callee->objs, node);
+	}
+
+	for (i = 0; i < s->obj_num; ++i) {
+		if (!s->names[i] || strlen(S_CSTR(s->callee->name)) + strlen(S_CSTR(s->names[i])) + 2 > MAX_IDENTIFIER_LEN)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+	局部对象 idx 被访问，entry 表示还没有经过跳转或者跳转目标。
+	参数和隐藏对象不需要检查，隐藏对象是寄存器后端的临时对象或者内联进来的对象，总是先赋值再使用。
+	返回1表示它可能在赋值之前被读取。
+*/
+static int use_local(inl_s* s, uint8_t* assigned, int entry, uint32_t idx, int write) {
+	if (idx >= s->obj_num)
+		return 1;
+
+	if (idx < s->callee->param_num || assigned[idx] || S_CSTR(s->names[idx])[0] == '$')
+		return 0;
+
+	if (!entry || !write)
+		return 1;
+
+	assigned[idx] = 1;
+	return 0;
+}
+
+// 被调用函数可以内联时返回0，不能时返回1
+static int check_callee(inl_s* s, uint8_t* leaders, uint8_t* assigned) {
+	uint32_t size = V_SIZE(s->callee->code);
+	uint32_t* ip_begin = &V_AT(s->callee->code, 0, uint32_t);
+	uint32_t* ip_end = ip_begin + size;
+	uint32_t* ip;
+	int entry = 1;
+	uint32_t i;
+
+	for (ip = ip_begin; ip < ip_end; ip += INS_size(*ip)) {
+		uint32_t* target = INS_jmp_target(ip);
+
+		if (INS_size(*ip) == 0 || ip + INS_size(*ip) > ip_end)
+			return 1;
+
+		if (target) {
+			if (*target > size)
+				return 1;
+
+			leaders[*target] = 1;
+		}
+	}
+
+	for (ip = ip_begin; ip < ip_end; ip += INS_size(*ip)) {
+		uint32_t ins = *ip;
+
+		if (leaders[ip - ip_begin])
+			entry = 0;
+
+		switch (ins) {
+			case IT_PUSH_LOCAL:
+			case IT_STORE_LOCAL:
+				if (use_local(s, assigned, entry, ip[1], ins == IT_STORE_LOCAL))
+					return 1;
+
+				break;
+
+			case IT_PUSH_GLOBAL:
+			case IT_STORE_GLOBAL:
+				if ((int32_t)ip[1] == s->slot)
+					return 1;
+
+				break;
+
+			// for 循环的计数留在运行栈上，循环里的 return 不能直接跳到末尾
+			case IT_FOR_PREP:
+			case IT_FOR_LOOP:
+			case IT_IMPORT:
+			case IT_IMPORT_DLL:
+			case IT_EXIT:
+				return 1;
+
+			default:
+				// 超级指令和 _II 指令只在优化以后出现，已经优化过的函数不会内联
+				if (ins >= IT_ASSIGN_INT)
+					return 1;
+
+				if (reg_num(ins) > 0) {
+					int is_jmp = ins == IT_R_FALSE_JMP || ins == IT_R_TRUE_JMP;
+
+					// 模块代码没有调用帧，寄存器只能是局部对象
+					if (!s->caller)
+						return 1;
+
+					// 第一个寄存器是目标，条件跳转的寄存器只被读取
+					for (i = is_jmp ? 1 : 2; i <= reg_num(ins); ++i) {
+						if (use_local(s, assigned, entry, ip[i], 0))
+							return 1;
+					}
+
+					if (!is_jmp && use_local(s, assigned, entry, ip[1], 1))
+						return 1;
+				}
+				else if (is_ref_ins(ins)) {
+					int32_t mod_pos = (int32_t)ip[1];
+					int32_t pos = (int32_t)ip[2];
+
+					if (mod_pos == s->slot || (mod_pos == -1 && pos == s->slot))
+						return 1;
+
+					if (mod_pos == -1 && pos < 0 && use_local(s, assigned, entry, (uint32_t)(-(pos + 1)), ins == IT_ASSIGN && ip[3] == 0))
+						return 1;
+				}
+
+				break;
+		}
+
+		if (INS_jmp_target(ip) || ins == IT_RET || ins == IT_RET_RESULT)
+			entry = 0;
+	}
+
+	return 0;
+}
+
+// 被调用函数的对象 idx 换成调用者的隐藏对象 $f.x，同一个函数的多次内联共用这些对象
+static int get_hidden(inl_s* s, uint32_t idx) {
+	char name[MAX_IDENTIFIER_LEN + 1];
+	hash_list_s* hl = s->caller ? &s->caller->objs : &s->mod->objs;
+	string_s* str;
+	obj_s obj;
+	int32_t pos;
+
+	sprintf(name, "$%s.%s", S_CSTR(s->callee->name), S_CSTR(s->names[idx]));
+
+	if (S_get_str(&s->mat->strs_nogc, name, &str) != 0)
+		return -1;
+
+	pos = HL_get_obj_idx(hl, str);
+
+	if (pos < 0) {
+		obj.type = MAT_OT_DUMMY;
+		pos = HL_set_obj(hl, str, &obj);
+
+		if (pos < 0)
+			return -1;
+	}
+
+	s->map[idx] = s->caller ? -pos - 1 : pos;
+	return 0;
+}
+
+static int emit_move(inl_s* s, int store, int32_t id_pos) {
+	if (id_pos < 0) {
+		EMIT(s, store ? IT_STORE_LOCAL : IT_PUSH_LOCAL);
+		EMIT(s, -id_pos - 1);
+	}
+	else {
+		EMIT(s, store ? IT_STORE_GLOBAL : IT_PUSH_GLOBAL);
+		EMIT(s, id_pos);
+		EMIT(s, 0);
+	}
+
+	return 0;
+}
+
+// ip_end 之后只剩下执行不到的指令，最后一条返回直接落到内联代码的末尾
+static int emit_ins(inl_s* s, uint32_t* ip, uint32_t* ip_end) {
+	uint32_t size = INS_size(*ip);
+	uint32_t i;
+
+	switch (*ip) {
+		case IT_NOP:
+			return 0;
+
+		case IT_PUSH_LOCAL:
+		case IT_STORE_LOCAL:
+			return emit_move(s, *ip == IT_STORE_LOCAL, s->map[ip[1]]);
+
+		case IT_TAIL_CALL:
+			EMIT(s, IT_CALL);
+			EMIT(s, ip[1]);
+			return 0;
+
+		// 返回值留在栈顶，跳到内联代码的末尾，最后一条指令直接落到末尾
+		case IT_RET:
+		case IT_RET_RESULT:
+			if (*ip == IT_RET)
+				EMIT(s, IT_PUSH_NONE);
+
+			if (ip + size < ip_end) {
+				EMIT(s, IT_JMP);
+				EMIT(s, V_SIZE(s->callee->code));
+			}
+
+			return 0;
+
+		default:
+			break;
+	}
+
+	if (reg_num(*ip) > 0) {
+		EMIT(s, *ip);
+
+		for (i = 1; i < size; ++i)
+			EMIT(s, i <= reg_num(*ip) ? (uint32_t)(-s->map[ip[i]] - 1) : ip[i]);
+
+		return 0;
+	}
+
+	for (i = 0; i < size; ++i) {
+		uint32_t w = ip[i];
+
+		if (i == 2 && is_ref_ins(*ip) && (int32_t)ip[1] == -1 && (int32_t)ip[2] < 0)
+			w = (uint32_t)s->map[-((int32_t)ip[2] + 1)];
+
+		EMIT(s, w);
+	}
+
+	return 0;
+}
+
+int INL_inline_call(matrix_t mat, mod_s* mod, func_s* caller, int32_t slot, uint32_t n, uint32_t line) {
+	int ret;
+	inl_s s;
+	obj_s obj;
+	vec_s* code = caller ? &caller->code : &mod->code;
+	uint32_t base = V_SIZE(*code);
+	uint32_t size;
+	uint32_t* ip_begin;
+	uint32_t* ip_end;
+	uint32_t* ip;
+	uint32_t* prev = NULL;
+	uint32_t* last;
+	uint32_t body;
+	uint32_t call_pos;
+	int32_t func_idx;
+	uint8_t* leaders = NULL;
+	uint8_t* assigned = NULL;
+	uint32_t i;
+	assert(mat);
+	assert(mod);
+
+	memset(&s, 0, sizeof(s));
+
+	if (MAX_INLINE_SIZE == 0 || slot < 0 || HL_get_obj(&mod->objs, slot, &obj) != 0 || obj.type != MAT_OT_FUNC)
+		return 1;
+
+	// 只内联这个模块里用 def 定义、还没有链接的函数，正在解析的函数代码还不完整
+	s.callee = obj.func;
+	size = V_SIZE(s.callee->code);
+
+	if (s.callee == caller || size == 0 || size > MAX_INLINE_SIZE || V_SIZE(s.callee->lcode) > 0)
+		return 1;
+
+	func_idx = find_mod_func(mod, s.callee);
+
+	if (HL_get_obj_idx(&mod->objs, s.callee->name) != slot || func_idx < 0)
+		return 1;
+
+	s.mat = mat;
+	s.mod = mod;
+	s.caller = caller;
+	s.slot = slot;
+	s.obj_num = HL_SIZE(s.callee->objs);
+
+	s.names = calloc(s.obj_num + 1, sizeof(string_s*));
+	CHECK_MALLOC(s.names);
+	s.map = calloc(s.obj_num + 1, sizeof(int32_t));
+	CHECK_MALLOC(s.map);
+	s.pos_map = calloc(size + 1, sizeof(uint32_t));
+	CHECK_MALLOC(s.pos_map);
+	leaders = calloc(size + 1, sizeof(uint8_t));
+	CHECK_MALLOC(leaders);
+	assigned = calloc(s.obj_num + 1, sizeof(uint8_t));
+	CHECK_MALLOC(assigned);
+
+	ret = get_names(&s);
+
+	if (ret == 0)
+		ret = check_callee(&s, leaders, assigned);
+
+	if (ret != 0)
+		goto exit0;
+
+	ret = V_init(&s.code, sizeof(uint32_t), size * 2);
+	CHECK_RESULT(ret);
+
+	for (i = 0; i < s.obj_num; ++i) {
+		ret = get_hidden(&s, i);
+		CHECK_RESULT(ret);
+	}
+
+	// 被调用对象已经不是这个函数时跳到末尾的 CALL，跳转位置最后再填
+	EMIT(&s, IT_INLINE_GUARD);
+	EMIT(&s, 0);
+	EMIT(&s, func_idx);
+	EMIT(&s, n);
+
+	// 多余的实参丢弃，不足的参数补 none，与建立调用帧时相同，然后从栈顶开始依次写入参数，最后弹出被调用对象
+	for (i = n; i > s.callee->param_num; --i)
+		EMIT(&s, IT_POP);
+
+	for (i = n; i < s.callee->param_num; ++i)
+		EMIT(&s, IT_PUSH_NONE);
+
+	for (i = s.callee->param_num; i > 0; --i) {
+		ret = emit_move(&s, 1, s.map[i - 1]);
+		CHECK_RESULT(ret);
+	}
+
+	EMIT(&s, IT_POP);
+	body = V_SIZE(s.code);
+
+	// 函数末尾补上的 RET 前面已经是返回时执行不到，不再复制
+	ip_begin = &V_AT(s.callee->code, 0, uint32_t);
+	ip_end = ip_begin + size;
+	last = ip_end;
+
+	for (ip = ip_begin; ip < ip_end; ip += INS_size(*ip)) {
+		if (ip + INS_size(*ip) == ip_end && *ip == IT_RET && !leaders[ip - ip_begin] && prev && (*prev == IT_RET || *prev == IT_RET_RESULT || *prev == IT_JMP))
+			last = ip;
+
+		prev = ip;
+	}
+
+	for (ip = ip_begin; ip < ip_end; ip += INS_size(*ip)) {
+		s.pos_map[ip - ip_begin] = V_SIZE(s.code);
+
+		if (ip < last) {
+			ret = emit_ins(&s, ip, last);
+			CHECK_RESULT(ret);
+		}
+	}
+
+	// 返回跳过后面的 JMP 和 CALL，直接到内联代码的末尾
+	s.pos_map[size] = V_SIZE(s.code) + 4;
+
+	// 跳转目标换成调用者代码中的位置
+	ip_begin = &V_AT(s.code, 0, uint32_t);
+	ip_end = ip_begin + V_SIZE(s.code);
+
+	for (ip = ip_begin + body; ip < ip_end; ip += INS_size(*ip)) {
+		uint32_t* target = INS_jmp_target(ip);
+
+		if (target)
+			*target = base + s.pos_map[*target];
+	}
+
+	// 复制的代码执行完跳过普通调用，普通调用的结果同样留在被调用对象的位置
+	EMIT(&s, IT_JMP);
+	EMIT(&s, base + s.pos_map[size]);
+	call_pos = V_SIZE(s.code);
+	EMIT(&s, IT_CALL);
+	EMIT(&s, n);
+	V_AT(s.code, 1, uint32_t) = base + call_pos;
+
+	ret = DBG_add_op_line(mat, mod, caller, base, line);
+	CHECK_RESULT(ret);
+
+	for (i = 0; i < V_SIZE(s.callee->op_line); ++i) {
+		op_line_s* opl = &V_AT(s.callee->op_line, i, op_line_s);
+		CHECK_CONDITION(opl->op_pos <= size);
+
+		ret = DBG_add_op_line(mat, mod, caller, base + s.pos_map[opl->op_pos], opl->line);
+		CHECK_RESULT(ret);
+	}
+
+	ret = DBG_add_op_line(mat, mod, caller, base + call_pos, line);
+	CHECK_RESULT(ret);
+
+	for (i = 0; i < V_SIZE(s.code); ++i)
+		V_PUSH_BACK(*code, V_AT(s.code, i, uint32_t), uint32_t);
+
+	// 之后的指令回到调用处的行号
+	ret = DBG_add_op_line(mat, mod, caller, V_SIZE(*code), line);
+	CHECK_RESULT(ret);
+
+	ret = 0;
+exit0:
+	if (s.code.p)
+		V_free(&s.code);
+
+	free(s.names);
+	free(s.map);
+	free(s.pos_map);
+	free(leaders);
+	free(assigned);
+	return ret;
+}
@@ -0,0 +1,37 @@
+﻿/*
+    Matrix Script Language
+    author: Zeb
+    e-mail: zebbey@gmail.com
+    Copyright (c) 2004 Zeb.  All rights reserved.
+*/
+
+#ifndef __H_INL__
+#define __H_INL__
+
+#include "matrix.h"
+#include "mod.h"
+
+/**
+    函数内联
+    解析到对同一模块中已经定义好的小函数的调用时，不生成 CALL，而是把被调用函数的代码复制到调用处：
+    实参从运行栈写入参数后弹出被调用对象，被调用函数的对象换成调用者的隐藏对象 $f.x，
+    调用者是函数时为局部对象，是模块代码时为模块对象；RET 换成压入 none 后跳到末尾，
+    RET_RESULT 直接跳到末尾，返回值正好留在原来被调用对象的位置。
+    复制的指令保留被调用函数的行号，出错时报告的仍然是函数里的那一行。
+
+    函数名可以被重新赋值，其它模块也可以通过 m:f = g 修改它，所以复制的代码前面是 INLINE_GUARD：
+    压入的被调用对象仍然是这个函数时才执行复制的代码，否则跳到末尾的 CALL 按普通调用执行：
+        INLINE_GUARD call f n; 写入参数; POP; 复制的代码; JMP end; call: CALL n; end:
+
+    只内联代码不超过 MAX_INLINE_SIZE 个字、不直接递归、没有 for 循环的函数。
+    函数每次被调用时局部对象都是未赋值的，内联代码不会重新初始化它们，
+    所以要求每个局部对象在第一个跳转之前就先被赋值。
+*/
+
+/*
+	调用者 caller 为 NULL 时是模块代码，slot 为被调用对象在模块对象中的下标，n 为实参个数，
+	被调用对象和实参已经压入运行栈。可以内联时把代码追加到调用者，返回0；不能内联时不生成任何代码，返回1；出错返回 -1。
+*/
+int INL_inline_call(matrix_t mat, mod_s* mod, func_s* caller, int32_t slot, uint32_t n, uint32_t line);
+
+#endif // __H_INL__
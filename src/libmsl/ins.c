@@ -11,6 +11,157 @@
 #include "mod.h"
 #include "hash_list.h"
 
+uint32_t INS_size(uint32_t ins) {
+	switch (ins) {
+		case IT_NOP:
+		case IT_EXIT:
+		case IT_PUSH_NONE:
+		case IT_POP:
+		case IT_MINUS:
+		case IT_INC:
+		case IT_DEC:
+		case IT_LNOT:
+		case IT_BNOT:
+		case IT_ADD:
+		case IT_SUB:
+		case IT_MUL:
+		case IT_DIV:
+		case IT_MOD:
+		case IT_EXP:
+		case IT_BXOR:
+		case IT_BOR:
+		case IT_BAND:
+		case IT_SHL:
+		case IT_SHR:
+		case IT_LOR:
+		case IT_LAND:
+		case IT_NEQ:
+		case IT_EQ:
+		case IT_GE:
+		case IT_LE:
+		case IT_GT:
+		case IT_LT:
+		case IT_RET:
+		case IT_RET_RESULT:
+		case IT_ADD_II:
+		case IT_SUB_II:
+		case IT_MUL_II:
+		case IT_EQ_II:
+		case IT_NEQ_II:
+		case IT_LT_II:
+		case IT_LE_II:
+		case IT_GT_II:
+		case IT_GE_II:
+			return 1;
+
+		case IT_IMPORT:
+		case IT_IMPORT_DLL:
+		case IT_PUSH_STRING:
+		case IT_PUSH_INT:
+		case IT_PUSH_REAL:
+		case IT_FALSE_JMP:
+		case IT_TRUE_JMP:
+		case IT_JMP:
+		case IT_TRUE_JMP_KEEP:
+		case IT_FALSE_JMP_KEEP:
+		case IT_CALL:
+		case IT_TAIL_CALL:
+		case IT_MAKE_LIST:
+		case IT_MAKE_DICT:
+		case IT_FALSE_JMP_EQ:
+		case IT_FALSE_JMP_NEQ:
+		case IT_FALSE_JMP_LT:
+		case IT_FALSE_JMP_LE:
+		case IT_FALSE_JMP_GT:
+		case IT_FALSE_JMP_GE:
+		case IT_FALSE_JMP_EQ_II:
+		case IT_FALSE_JMP_NEQ_II:
+		case IT_FALSE_JMP_LT_II:
+		case IT_FALSE_JMP_LE_II:
+		case IT_FALSE_JMP_GT_II:
+		case IT_FALSE_JMP_GE_II:
+		case IT_PUSH_LOCAL:
+		case IT_STORE_LOCAL:
+			return 2;
+
+		case IT_REF_OBJ:
+		case IT_PUSH_OBJ:
+		case IT_ASSIGN:
+		case IT_ASSIGN_ADD:
+		case IT_ASSIGN_SUB:
+		case IT_ASSIGN_MUL:
+		case IT_ASSIGN_DIV:
+		case IT_ASSIGN_MOD:
+		case IT_ASSIGN_EXP:
+		case IT_ASSIGN_AND:
+		case IT_ASSIGN_OR:
+		case IT_ASSIGN_XOR:
+		case IT_ASSIGN_SHIFT_LEFT:
+		case IT_ASSIGN_SHIFT_RIGHT:
+		case IT_FOR_PREP:
+		case IT_INLINE_GUARD:
+		case IT_R_ADD:
+		case IT_R_SUB:
+		case IT_R_MUL:
+		case IT_R_DIV:
+		case IT_R_EQ:
+		case IT_R_NEQ:
+		case IT_R_LT:
+		case IT_R_LE:
+		case IT_R_GT:
+		case IT_R_GE:
+			return 4;
+
+		case IT_LOOP:
+		case IT_PUSH_GLOBAL:
+		case IT_STORE_GLOBAL:
+		case IT_R_MOVE:
+		case IT_R_LOADI:
+		case IT_R_FALSE_JMP:
+		case IT_R_TRUE_JMP:
+			return 3;
+
+		case IT_ASSIGN_INT:
+		case IT_ASSIGN_ADD_INT:
+		case IT_ASSIGN_SUB_INT:
+		case IT_PUSH_ADD_INT:
+		case IT_PUSH_SUB_INT:
+		case IT_FOR_LOOP:
+			return 5;
+
+		default:
+			return 0;
+	}
+}
+
+uint32_t* INS_jmp_target(uint32_t* ip) {
+	switch (*ip) {
+		case IT_FALSE_JMP:
+		case IT_TRUE_JMP:
+		case IT_JMP:
+		case IT_LOOP:
+		case IT_FOR_PREP:
+		case IT_FOR_LOOP:
+		case IT_INLINE_GUARD:
+		case IT_TRUE_JMP_KEEP:
+		case IT_FALSE_JMP_KEEP:
+		case IT_FALSE_JMP_EQ:
+		case IT_FALSE_JMP_NEQ:
+		case IT_FALSE_JMP_LT:
+		case IT_FALSE_JMP_LE:
+		case IT_FALSE_JMP_GT:
+		case IT_FALSE_JMP_GE:
+			return ip + 1;
+
+		case IT_R_FALSE_JMP:
+		case IT_R_TRUE_JMP:
+			return ip + 2;
+
+		default:
+			return NULL;
+	}
+}
+
 static void show_splitter(MAT_disasm_callback cb) {
 	cb("---------------------------------");
 }
@@ -118,6 +269,16 @@ static int disasm(vec_s* code, mat_str_table_s* strs, MAT_disasm_callback cb) {
 				ip += 4;
 				break;
 
+			case IT_STORE_LOCAL:
+				sprintf(buf, "%ld STORE_LOCAL %d", ip - ipbegin, *(ip + 1));
+				ip += 2;
+				break;
+
+			case IT_STORE_GLOBAL:
+				sprintf(buf, "%ld STORE_GLOBAL %d", ip - ipbegin, *(ip + 1));
+				ip += 3;
+				break;
+
 			case IT_ASSIGN_ADD:
 				sprintf(buf, "%ld ASSIGN_ADD %d %d %d", ip - ipbegin, *(int32_t*)(ip + 1), *(ip + 2), *(ip + 3));
 				ip += 4;
@@ -173,6 +334,61 @@ static int disasm(vec_s* code, mat_str_table_s* strs, MAT_disasm_callback cb) {
 				ip += 4;
 				break;
 
+			case IT_ASSIGN_INT:
+				sprintf(buf, "%ld ASSIGN_INT %d %d %d %d", ip - ipbegin, *(int32_t*)(ip + 1), *(int32_t*)(ip + 2), *(ip + 3), *(int32_t*)(ip + 4));
+				ip += 5;
+				break;
+
+			case IT_ASSIGN_ADD_INT:
+				sprintf(buf, "%ld ASSIGN_ADD_INT %d %d %d %d", ip - ipbegin, *(int32_t*)(ip + 1), *(int32_t*)(ip + 2), *(ip + 3), *(int32_t*)(ip + 4));
+				ip += 5;
+				break;
+
+			case IT_ASSIGN_SUB_INT:
+				sprintf(buf, "%ld ASSIGN_SUB_INT %d %d %d %d", ip - ipbegin, *(int32_t*)(ip + 1), *(int32_t*)(ip + 2), *(ip + 3), *(int32_t*)(ip + 4));
+				ip += 5;
+				break;
+
+			case IT_PUSH_ADD_INT:
+				sprintf(buf, "%ld PUSH_ADD_INT %d %d %d %d", ip - ipbegin, *(int32_t*)(ip + 1), *(int32_t*)(ip + 2), *(ip + 3), *(int32_t*)(ip + 4));
+				ip += 5;
+				break;
+
+			case IT_PUSH_SUB_INT:
+				sprintf(buf, "%ld PUSH_SUB_INT %d %d %d %d", ip - ipbegin, *(int32_t*)(ip + 1), *(int32_t*)(ip + 2), *(ip + 3), *(int32_t*)(ip + 4));
+				ip += 5;
+				break;
+
+			case IT_FALSE_JMP_EQ:
+				sprintf(buf, "%ld FALSE_JMP_EQ %d", ip - ipbegin, *(ip + 1));
+				ip += 2;
+				break;
+
+			case IT_FALSE_JMP_NEQ:
+				sprintf(buf, "%ld FALSE_JMP_NEQ %d", ip - ipbegin, *(ip + 1));
+				ip += 2;
+				break;
+
+			case IT_FALSE_JMP_LT:
+				sprintf(buf, "%ld FALSE_JMP_LT %d", ip - ipbegin, *(ip + 1));
+				ip += 2;
+				break;
+
+			case IT_FALSE_JMP_LE:
+				sprintf(buf, "%ld FALSE_JMP_LE %d", ip - ipbegin, *(ip + 1));
+				ip += 2;
+				break;
+
+			case IT_FALSE_JMP_GT:
+				sprintf(buf, "%ld FALSE_JMP_GT %d", ip - ipbegin, *(ip + 1));
+				ip += 2;
+				break;
+
+			case IT_FALSE_JMP_GE:
+				sprintf(buf, "%ld FALSE_JMP_GE %d", ip - ipbegin, *(ip + 1));
+				ip += 2;
+				break;
+
 			case IT_FALSE_JMP:
 				sprintf(buf, "%ld FALSE_JMP %d", ip - ipbegin, *(ip + 1));
 				ip += 2;
@@ -188,6 +404,21 @@ static int disasm(vec_s* code, mat_str_table_s* strs, MAT_disasm_callback cb) {
 				ip += 2;
 				break;
 
+			case IT_LOOP:
+				sprintf(buf, "%ld LOOP %d", ip - ipbegin, *(ip + 1));
+				ip += 3;
+				break;
+
+			case IT_FOR_PREP:
+				sprintf(buf, "%ld FOR_PREP %d %d", ip - ipbegin, *(ip + 1), *(ip + 2));
+				ip += 4;
+				break;
+
+			case IT_FOR_LOOP:
+				sprintf(buf, "%ld FOR_LOOP %d %d", ip - ipbegin, *(ip + 1), *(ip + 3));
+				ip += 5;
+				break;
+
 			case IT_MINUS:
 				sprintf(buf, "%ld MINUS", ip - ipbegin);
 				ip++;
@@ -278,6 +509,16 @@ static int disasm(vec_s* code, mat_str_table_s* strs, MAT_disasm_callback cb) {
 				ip++;
 				break;
 
+			case IT_TRUE_JMP_KEEP:
+				sprintf(buf, "%ld TRUE_JMP_KEEP %d", ip - ipbegin, *(ip + 1));
+				ip += 2;
+				break;
+
+			case IT_FALSE_JMP_KEEP:
+				sprintf(buf, "%ld FALSE_JMP_KEEP %d", ip - ipbegin, *(ip + 1));
+				ip += 2;
+				break;
+
 			case IT_NEQ:
 				sprintf(buf, "%ld NEQ", ip - ipbegin);
 				ip++;
@@ -313,6 +554,11 @@ static int disasm(vec_s* code, mat_str_table_s* strs, MAT_disasm_callback cb) {
 				ip += 2;
 				break;
 
+			case IT_TAIL_CALL:
+				sprintf(buf, "%ld TAIL_CALL %d", ip - ipbegin, *(ip + 1));
+				ip += 2;
+				break;
+
 			case IT_RET:
 				sprintf(buf, "%ld RET", ip++ - ipbegin);
 				break;
@@ -321,6 +567,11 @@ static int disasm(vec_s* code, mat_str_table_s* strs, MAT_disasm_callback cb) {
 				sprintf(buf, "%ld RET_RESULT", ip++ - ipbegin);
 				break;
 
+			case IT_INLINE_GUARD:
+				sprintf(buf, "%ld INLINE_GUARD %d %d %d", ip - ipbegin, *(ip + 1), *(ip + 2), *(ip + 3));
+				ip += 4;
+				break;
+
 			case IT_MAKE_LIST:
 				sprintf(buf, "%ld MAKE_LIST %d", ip - ipbegin, *(ip + 1));
 				ip += 2;
@@ -333,11 +584,91 @@ static int disasm(vec_s* code, mat_str_table_s* strs, MAT_disasm_callback cb) {
 
 			case IT_REF_OBJ:
 				sprintf(buf, "%ld REF_OBJ %d %d %d", ip - ipbegin, *(int32_t*)(ip + 1), *(int32_t*)(ip + 2), *(ip + 3));
-				ip += 3;
+				ip += 4;
 				break;
 
 			case IT_PUSH_OBJ:
 				sprintf(buf, "%ld PUSH_OBJ %d %d %d", ip - ipbegin, *(int32_t*)(ip + 1), *(int32_t*)(ip + 2), *(ip + 3));
+				ip += 4;
+				break;
+
+			case IT_PUSH_LOCAL:
+				sprintf(buf, "%ld PUSH_LOCAL %d", ip - ipbegin, *(ip + 1));
+				ip += 2;
+				break;
+
+			case IT_PUSH_GLOBAL:
+				sprintf(buf, "%ld PUSH_GLOBAL %d", ip - ipbegin, *(ip + 1));
+				ip += 3;
+				break;
+
+			case IT_R_MOVE:
+				sprintf(buf, "%ld R_MOVE r%d r%d", ip - ipbegin, *(ip + 1), *(ip + 2));
+				ip += 3;
+				break;
+
+			case IT_R_LOADI:
+				sprintf(buf, "%ld R_LOADI r%d %d", ip - ipbegin, *(ip + 1), *(int32_t*)(ip + 2));
+				ip += 3;
+				break;
+
+			case IT_R_ADD:
+				sprintf(buf, "%ld R_ADD r%d r%d r%d", ip - ipbegin, *(ip + 1), *(ip + 2), *(ip + 3));
+				ip += 4;
+				break;
+
+			case IT_R_SUB:
+				sprintf(buf, "%ld R_SUB r%d r%d r%d", ip - ipbegin, *(ip + 1), *(ip + 2), *(ip + 3));
+				ip += 4;
+				break;
+
+			case IT_R_MUL:
+				sprintf(buf, "%ld R_MUL r%d r%d r%d", ip - ipbegin, *(ip + 1), *(ip + 2), *(ip + 3));
+				ip += 4;
+				break;
+
+			case IT_R_DIV:
+				sprintf(buf, "%ld R_DIV r%d r%d r%d", ip - ipbegin, *(ip + 1), *(ip + 2), *(ip + 3));
+				ip += 4;
+				break;
+
+			case IT_R_EQ:
+				sprintf(buf, "%ld R_EQ r%d r%d r%d", ip - ipbegin, *(ip + 1), *(ip + 2), *(ip + 3));
+				ip += 4;
+				break;
+
+			case IT_R_NEQ:
+				sprintf(buf, "%ld R_NEQ r%d r%d r%d", ip - ipbegin, *(ip + 1), *(ip + 2), *(ip + 3));
+				ip += 4;
+				break;
+
+			case IT_R_LT:
+				sprintf(buf, "%ld R_LT r%d r%d r%d", ip - ipbegin, *(ip + 1), *(ip + 2), *(ip + 3));
+				ip += 4;
+				break;
+
+			case IT_R_LE:
+				sprintf(buf, "%ld R_LE r%d r%d r%d", ip - ipbegin, *(ip + 1), *(ip + 2), *(ip + 3));
+				ip += 4;
+				break;
+
+			case IT_R_GT:
+				sprintf(buf, "%ld R_GT r%d r%d r%d", ip - ipbegin, *(ip + 1), *(ip + 2), *(ip + 3));
+				ip += 4;
+				break;
+
+			case IT_R_GE:
+				sprintf(buf, "%ld R_GE r%d r%d r%d", ip - ipbegin, *(ip + 1), *(ip + 2), *(ip + 3));
+				ip += 4;
+				break;
+
+			case IT_R_FALSE_JMP:
+				sprintf(buf, "%ld R_FALSE_JMP r%d %d", ip - ipbegin, *(ip + 1), *(ip + 2));
+				ip += 3;
+				break;
+
+			case IT_R_TRUE_JMP:
+				sprintf(buf, "%ld R_TRUE_JMP r%d %d", ip - ipbegin, *(ip + 1), *(ip + 2));
 				ip += 3;
 				break;
 
@@ -26,10 +26,14 @@ typedef enum {
     IT_PUSH_REAL,
     IT_POP,
     IT_REF_OBJ,
-    IT_PUSH_OBJ,
+    IT_PUSH_OBJ,    // mod_pos pos n，带下标或者模块限定的对象
+    IT_PUSH_LOCAL,  // k，k 为函数对象的下标，即帧内的槽位
+    IT_PUSH_GLOBAL, // k -，k 为模块对象的下标，第二个操作数在链接时换成模块对象数组的地址
 
     // assign
     IT_ASSIGN,
+    IT_STORE_LOCAL,  // k
+    IT_STORE_GLOBAL, // k -
     IT_ASSIGN_ADD,
     IT_ASSIGN_SUB,
     IT_ASSIGN_MUL,
@@ -46,6 +50,9 @@ typedef enum {
     IT_FALSE_JMP,
     IT_TRUE_JMP,
     IT_JMP,
+    IT_LOOP, // pos slot，while 循环跳回循环头，slot 记录回边次数和编译后的循环
+    IT_FOR_PREP, // pos var objs，栈顶为计数、上限和步长，检查后把计数写到循环变量，范围为空时跳到 pos
+    IT_FOR_LOOP, // pos slot var objs，计数加上步长，没有越过上限时写到循环变量并跳回 pos，slot 与 IT_LOOP 相同
 
     // unary operator
     IT_MINUS,
@@ -70,6 +77,8 @@ typedef enum {
     // logical operator
     IT_LOR,
     IT_LAND,
+    IT_TRUE_JMP_KEEP,  // pos，栈顶为真时跳转，不弹出栈顶，|| 用它跳过右操作数
+    IT_FALSE_JMP_KEEP, // pos，栈顶为 none 时跳转，不弹出栈顶，&& 用它跳过右操作数
 
     // relational operator
     IT_NEQ,
@@ -81,16 +90,76 @@ typedef enum {
 
     // function call
     IT_CALL,
+    IT_TAIL_CALL, // n，return 语句中的调用，复用当前调用帧
     IT_RET,
     IT_RET_RESULT,
+    IT_INLINE_GUARD, // pos f n，内联的调用处，栈顶 n 个实参之下的被调用对象不是函数表中第 f 个函数时跳到 pos 的 CALL
 
     // list
     IT_MAKE_LIST,
 
     // dict
     IT_MAKE_DICT,
+
+    // register
+    // 寄存器指令只出现在函数中，操作数 r 是函数对象的下标，即帧内的槽位
+    IT_R_MOVE,      // r_dst r_src
+    IT_R_LOADI,     // r_dst int
+    IT_R_ADD,       // r_dst r_a r_b
+    IT_R_SUB,
+    IT_R_MUL,
+    IT_R_DIV,
+    IT_R_EQ,
+    IT_R_NEQ,
+    IT_R_LT,
+    IT_R_LE,
+    IT_R_GT,
+    IT_R_GE,
+    IT_R_FALSE_JMP, // r pos
+    IT_R_TRUE_JMP,  // r pos
+
+    // superinstruction
+    // 由窥孔优化合并常见的指令序列得到，对象引用的操作数与 IT_PUSH_OBJ 相同
+    IT_ASSIGN_INT,     // mod_pos pos n int，PUSH_INT + ASSIGN
+    IT_ASSIGN_ADD_INT, // mod_pos pos n int，PUSH_INT + ASSIGN_ADD
+    IT_ASSIGN_SUB_INT, // mod_pos pos n int，PUSH_INT + ASSIGN_SUB
+    IT_PUSH_ADD_INT,   // mod_pos pos n int，PUSH_OBJ + PUSH_INT + ADD
+    IT_PUSH_SUB_INT,   // mod_pos pos n int，PUSH_OBJ + PUSH_INT + SUB
+    IT_FALSE_JMP_EQ,   // pos，EQ + FALSE_JMP
+    IT_FALSE_JMP_NEQ,
+    IT_FALSE_JMP_LT,
+    IT_FALSE_JMP_LE,
+    IT_FALSE_JMP_GT,
+    IT_FALSE_JMP_GE,
+
+    // 以下指令只在运行时由快速化生成，不会出现在 code 中
+    // 指令执行时发现两个操作数都是 int32，就把 lcode 中的指令改写为对应的 _II 版本，
+    // _II 版本只检查操作数类型，类型不符时改回原指令重新执行
+    IT_ADD_II,
+    IT_SUB_II,
+    IT_MUL_II,
+    IT_EQ_II,
+    IT_NEQ_II,
+    IT_LT_II,
+    IT_LE_II,
+    IT_GT_II,
+    IT_GE_II,
+    IT_FALSE_JMP_EQ_II,
+    IT_FALSE_JMP_NEQ_II,
+    IT_FALSE_JMP_LT_II,
+    IT_FALSE_JMP_LE_II,
+    IT_FALSE_JMP_GT_II,
+    IT_FALSE_JMP_GE_II,
+
+    IT_MAX,
 } ins_e;
 
+// 指令所占的字数（包括操作数），未知指令返回0
+uint32_t INS_size(uint32_t ins);
+
+// 跳转指令中目标位置操作数的地址，不是跳转指令返回NULL
+uint32_t* INS_jmp_target(uint32_t* ip);
+
 int INS_disasm(mod_s* mod, mat_str_table_s* strs, MAT_disasm_callback cb);
 
 #endif
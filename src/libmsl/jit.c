@@ -0,0 +1,1635 @@
+﻿/*
+    Matrix Script Language
+    author: Zeb
+    e-mail: zebbey@gmail.com
+    Copyright (c) 2004 Zeb.  All rights reserved.
+*/
+
+#include "obj.h"
+#include "jit.h"
+
+#if MATRIX_JIT
+
+#include <sys/mman.h>
+#include <stddef.h>
+#include "ins.h"
+#include "vec.h"
+#include "err.h"
+#include "vm.h"
+#include "link.h"
+#include "list.h"
+#include "dict.h"
+#include "hash.h"
+#include "hash_list.h"
+#include "debug.h"
+
+#define JIT_EXIT 0xffffffff
+#define JIT_ERROR 0xfffffffe
+#define JIT_SIDE_EXIT 0xfffffffd
+
+/*
+	本地代码运行时 rbx 指向这个结构，生成的代码通过它访问运行栈，
+	调用函数以后运行栈的位置可能改变，由 h_call 重新计算 stack 和 fp。
+*/
+typedef struct jit_ctx_s {
+	obj_s* stack;
+	obj_s* fp; // 当前函数的帧基址
+	uint32_t* top; // &mat->stack_top
+	uint32_t base;
+	matrix_t mat;
+	mod_s* mod;
+} jit_ctx_s;
+
+typedef int (*jit_helper)(jit_ctx_s* ctx, lword_u* op);
+typedef int (*jit_entry)(jit_ctx_s* ctx);
+
+// 需要跳转目标的本地地址的 rel32，pos 为目标指令位置或者 JIT_EXIT 等标号
+typedef struct jit_fixup_s {
+	uint32_t at;
+	uint32_t pos;
+} jit_fixup_s;
+
+// 生成的代码假定 obj_s 为16字节，类型在偏移0，值在偏移8
+// 编译成本地代码的循环，由 IT_LOOP 或 IT_FOR_LOOP 的计数字记录编号
+typedef struct jit_trace_s {
+	void* code;
+	uint32_t size;
+} jit_trace_s;
+
+typedef char jit_check_obj_size[sizeof(obj_s) == 16 ? 1 : -1];
+typedef char jit_check_obj_value[offsetof(obj_s, int32) == 8 ? 1 : -1];
+
+// 与 vm.c 的 GET_REF_OBJECT 相同，offset 为引用之上还有几个栈上对象
+static int get_ref(jit_ctx_s* ctx, lword_u* op, uint32_t offset, obj_s** out) {
+	int ret;
+	uint32_t n = op[3].pair.lo;
+	uint32_t i;
+	obj_s* ro;
+	obj_s* o;
+
+	switch (op[3].pair.hi) {
+		case LK_REF_GLOBAL:
+			ro = *op[1].objs + op[2].u;
+			break;
+
+		case LK_REF_LOCAL:
+			ro = ctx->fp + op[2].i;
+			break;
+
+		default:
+			ro = *op[1].objs + op[2].cache->mod_pos;
+
+			if (LK_CACHE_HIT(op[2].cache, ro)) {
+				ro = op[2].cache->ref;
+				break;
+			}
+
+			if (ro->type != MAT_OT_MOD) {
+				E_rt_err(ctx->mat, ctx->mod->name->str, DBG_get_line(ctx->mat, op), "Invalid module object.");
+				return -1;
+			}
+
+			ret = LK_ref_mod_obj(op[2].cache, ro->mod, &ro);
+			CHECK_RESULT(ret);
+			break;
+	}
+
+	for (i = 0; i < n; ++i) {
+		o = ctx->stack + *ctx->top - offset - n + i;
+
+		if (ro->type == MAT_OT_LIST)
+			ret = LI_index_ref(ctx->mat, ro->list, o, &ro);
+		else if (ro->type == MAT_OT_DICT)
+			ret = D_index_ref(ctx->mat, ro->dict, o, &ro);
+		else {
+			E_rt_err(ctx->mat, ctx->mod->name->str, DBG_get_line(ctx->mat, op), "The object cannot be indexed.");
+			return -1;
+		}
+
+		if (ret == -1) {
+			E_rt_err(ctx->mat, ctx->mod->name->str, DBG_get_line(ctx->mat, op), "The index is invalid.");
+			return -1;
+		}
+	}
+
+	*out = ro;
+	ret = 0;
+exit0:
+	return ret;
+}
+
+/*
+	指令处理函数
+	返回0继续执行下一条指令，非0表示出错；条件跳转返回1表示跳转。
+*/
+static int h_push_none(jit_ctx_s* ctx, lword_u* op) {
+	ctx->stack[(*ctx->top)++].type = MAT_OT_NONE;
+	return 0;
+}
+
+static int h_push_string(jit_ctx_s* ctx, lword_u* op) {
+	obj_s* o = ctx->stack + (*ctx->top)++;
+	o->type = MAT_OT_STR;
+	o->str = op[1].str;
+	return 0;
+}
+
+static int h_push_real(jit_ctx_s* ctx, lword_u* op) {
+	obj_s* o = ctx->stack + (*ctx->top)++;
+	o->type = MAT_OT_REAL;
+	o->real = op[1].real;
+	return 0;
+}
+
+static int h_pop(jit_ctx_s* ctx, lword_u* op) {
+	(*ctx->top)--;
+	return 0;
+}
+
+static int h_push_obj(jit_ctx_s* ctx, lword_u* op) {
+	obj_s* ro;
+
+	if (get_ref(ctx, op, 0, &ro) != 0)
+		return -1;
+
+	*ctx->top -= op[3].pair.lo;
+	ctx->stack[(*ctx->top)++] = *ro;
+	return 0;
+}
+
+static int h_assign(jit_ctx_s* ctx, lword_u* op) {
+	obj_s* ro;
+
+	if (get_ref(ctx, op, 1, &ro) != 0)
+		return -1;
+
+	*ro = ctx->stack[*ctx->top - 1];
+	*ctx->top -= op[3].pair.lo + 1;
+	return 0;
+}
+
+#define JIT_ASSIGN_OP(fn, expr, verb) \
+static int fn(jit_ctx_s* ctx, lword_u* op) {\
+	obj_s* ro;\
+	obj_s* o;\
+	if (get_ref(ctx, op, 1, &ro) != 0)\
+		return -1;\
+	o = ctx->stack + *ctx->top - 1;\
+	if ((expr) != 0) {\
+		E_rt_err(ctx->mat, ctx->mod->name->str, DBG_get_line(ctx->mat, op), "Cannot " verb " %s and %s.", O_type_to_str(ro->type), O_type_to_str(o->type));\
+		return -1;\
+	}\
+	*ctx->top -= op[3].pair.lo + 1;\
+	return 0;\
+}
+
+JIT_ASSIGN_OP(h_assign_add, O_add(ctx->mat, ro, o, ro), "add")
+JIT_ASSIGN_OP(h_assign_sub, O_sub(ro, o, ro), "sub")
+JIT_ASSIGN_OP(h_assign_mul, O_mul(ctx->mat, ro, o, ro), "mul")
+JIT_ASSIGN_OP(h_assign_div, O_div(ro, o, ro), "div")
+
+static int h_assign_int(jit_ctx_s* ctx, lword_u* op) {
+	obj_s* ro;
+
+	if (get_ref(ctx, op, 0, &ro) != 0)
+		return -1;
+
+	ro->type = MAT_OT_INT32;
+	ro->int32 = op[4].i;
+	*ctx->top -= op[3].pair.lo;
+	return 0;
+}
+
+// 超级指令 ASSIGN_ADD_INT 等，整数操作数在 op[4]
+#define JIT_ASSIGN_INT_OP(fn, int_op, expr, verb) \
+static int fn(jit_ctx_s* ctx, lword_u* op) {\
+	obj_s* ro;\
+	obj_s imm;\
+	if (get_ref(ctx, op, 0, &ro) != 0)\
+		return -1;\
+	imm.type = MAT_OT_INT32;\
+	imm.int32 = op[4].i;\
+	if (ro->type == MAT_OT_INT32)\
+		ro->int32 = ro->int32 int_op imm.int32;\
+	else if ((expr) != 0) {\
+		E_rt_err(ctx->mat, ctx->mod->name->str, DBG_get_line(ctx->mat, op), "Cannot " verb " %s and %s.", O_type_to_str(ro->type), O_type_to_str(imm.type));\
+		return -1;\
+	}\
+	*ctx->top -= op[3].pair.lo;\
+	return 0;\
+}
+
+JIT_ASSIGN_INT_OP(h_assign_add_int, +, O_add(ctx->mat, ro, &imm, ro), "add")
+JIT_ASSIGN_INT_OP(h_assign_sub_int, -, O_sub(ro, &imm, ro), "sub")
+
+#define JIT_PUSH_INT_OP(fn, int_op, expr, verb) \
+static int fn(jit_ctx_s* ctx, lword_u* op) {\
+	obj_s* ro;\
+	obj_s* r;\
+	obj_s imm;\
+	if (get_ref(ctx, op, 0, &ro) != 0)\
+		return -1;\
+	imm.type = MAT_OT_INT32;\
+	imm.int32 = op[4].i;\
+	*ctx->top -= op[3].pair.lo;\
+	r = ctx->stack + (*ctx->top)++;\
+	if (ro->type == MAT_OT_INT32) {\
+		r->type = MAT_OT_INT32;\
+		r->int32 = ro->int32 int_op imm.int32;\
+	}\
+	else if ((expr) != 0) {\
+		E_rt_err(ctx->mat, ctx->mod->name->str, DBG_get_line(ctx->mat, op), "Cannot " verb " %s and %s.", O_type_to_str(ro->type), O_type_to_str(imm.type));\
+		return -1;\
+	}\
+	return 0;\
+}
+
+JIT_PUSH_INT_OP(h_push_add_int, +, O_add(ctx->mat, ro, &imm, r), "add")
+JIT_PUSH_INT_OP(h_push_sub_int, -, O_sub(ro, &imm, r), "sub")
+
+static int h_false_jmp(jit_ctx_s* ctx, lword_u* op) {
+	return ctx->stack[--(*ctx->top)].type == MAT_OT_NONE;
+}
+
+static int h_true_jmp(jit_ctx_s* ctx, lword_u* op) {
+	return ctx->stack[--(*ctx->top)].type != MAT_OT_NONE;
+}
+
+static int h_minus(jit_ctx_s* ctx, lword_u* op) {
+	obj_s* o = ctx->stack + *ctx->top - 1;
+
+	if (o->type == MAT_OT_INT32)
+		o->int32 = -o->int32;
+	else if (o->type == MAT_OT_REAL)
+		o->real = -o->real;
+	else {
+		E_rt_err(ctx->mat, ctx->mod->name->str, DBG_get_line(ctx->mat, op), "Cannot minus %s.", O_type_to_str(o->type));
+		return -1;
+	}
+
+	return 0;
+}
+
+// 栈顶两个对象的算术运算，两个都是整数时直接计算，与快速化后的指令相同
+#define JIT_BINARY_OP(fn, int_op, expr, verb) \
+static int fn(jit_ctx_s* ctx, lword_u* op) {\
+	obj_s* r = ctx->stack + *ctx->top - 2;\
+	obj_s* o = r + 1;\
+	if (r->type == MAT_OT_INT32 && o->type == MAT_OT_INT32)\
+		r->int32 = r->int32 int_op o->int32;\
+	else if ((expr) != 0) {\
+		E_rt_err(ctx->mat, ctx->mod->name->str, DBG_get_line(ctx->mat, op), "Cannot " verb " %s and %s.", O_type_to_str(r->type), O_type_to_str(o->type));\
+		return -1;\
+	}\
+	(*ctx->top)--;\
+	return 0;\
+}
+
+JIT_BINARY_OP(h_add, +, O_add(ctx->mat, r, o, r), "add")
+JIT_BINARY_OP(h_sub, -, O_sub(r, o, r), "sub")
+JIT_BINARY_OP(h_mul, *, O_mul(ctx->mat, r, o, r), "mul")
+
+static int h_div(jit_ctx_s* ctx, lword_u* op) {
+	obj_s* r = ctx->stack + *ctx->top - 2;
+	obj_s* o = r + 1;
+
+	if (O_div(r, o, r) != 0) {
+		E_rt_err(ctx->mat, ctx->mod->name->str, DBG_get_line(ctx->mat, op), "Cannot div %s and %s.", O_type_to_str(r->type), O_type_to_str(o->type));
+		return -1;
+	}
+
+	(*ctx->top)--;
+	return 0;
+}
+
+static int h_exp(jit_ctx_s* ctx, lword_u* op) {
+	obj_s* r = ctx->stack + *ctx->top - 2;
+	obj_s* o = r + 1;
+
+	if (O_exp(r, o, r) != 0) {
+		E_rt_err(ctx->mat, ctx->mod->name->str, DBG_get_line(ctx->mat, op), "Cannot exp %s and %s.", O_type_to_str(r->type), O_type_to_str(o->type));
+		return -1;
+	}
+
+	(*ctx->top)--;
+	return 0;
+}
+
+static int h_lor(jit_ctx_s* ctx, lword_u* op) {
+	obj_s* r = ctx->stack + *ctx->top - 2;
+	obj_s* o = r + 1;
+
+	if (r->type != MAT_OT_NONE || o->type != MAT_OT_NONE)
+		r->type = MAT_OT_INT32;
+	else
+		r->type = MAT_OT_NONE;
+
+	(*ctx->top)--;
+	return 0;
+}
+
+static int h_land(jit_ctx_s* ctx, lword_u* op) {
+	obj_s* r = ctx->stack + *ctx->top - 2;
+	obj_s* o = r + 1;
+
+	if (r->type == MAT_OT_NONE || o->type == MAT_OT_NONE)
+		r->type = MAT_OT_NONE;
+	else
+		r->type = MAT_OT_INT32;
+
+	(*ctx->top)--;
+	return 0;
+}
+
+/*
+	比较运算，expr 的结果为 ret，is_false 为真时比较结果为假。
+	check 为1时 ret 为 -1 表示两个对象不能比较，EQ 和 NEQ 不检查。
+*/
+#define JIT_COMPARE(r, o, int_op, expr, is_false, check) \
+	if (r->type == MAT_OT_INT32 && o->type == MAT_OT_INT32)\
+		ret = !(r->int32 int_op o->int32);\
+	else {\
+		ret = (expr);\
+		if (check && ret == -1) {\
+			E_rt_err(ctx->mat, ctx->mod->name->str, DBG_get_line(ctx->mat, op), "Cannot compare %s and %s.", O_type_to_str(r->type), O_type_to_str(o->type));\
+			return -1;\
+		}\
+		ret = (is_false);\
+	}
+
+#define JIT_COMPARE_OP(fn, int_op, expr, is_false, check) \
+static int fn(jit_ctx_s* ctx, lword_u* op) {\
+	int ret;\
+	obj_s* r = ctx->stack + *ctx->top - 2;\
+	obj_s* o = r + 1;\
+	JIT_COMPARE(r, o, int_op, expr, is_false, check)\
+	r->type = ret ? MAT_OT_NONE : MAT_OT_INT32;\
+	(*ctx->top)--;\
+	return 0;\
+}
+
+JIT_COMPARE_OP(h_eq, ==, O_compare_eq(r, o), ret == 0, 0)
+JIT_COMPARE_OP(h_neq, !=, O_compare_eq(r, o), ret != 0, 0)
+JIT_COMPARE_OP(h_lt, <, O_compare_ge(r, o), ret == 1, 1)
+JIT_COMPARE_OP(h_le, <=, O_compare_gt(r, o), ret == 1, 1)
+JIT_COMPARE_OP(h_gt, >, O_compare_gt(r, o), ret == 0, 1)
+JIT_COMPARE_OP(h_ge, >=, O_compare_ge(r, o), ret == 0, 1)
+
+// 比较后为假时跳转
+#define JIT_FALSE_JMP_OP(fn, int_op, expr, is_false, check) \
+static int fn(jit_ctx_s* ctx, lword_u* op) {\
+	int ret;\
+	obj_s* r = ctx->stack + *ctx->top - 2;\
+	obj_s* o = r + 1;\
+	JIT_COMPARE(r, o, int_op, expr, is_false, check)\
+	*ctx->top -= 2;\
+	return ret;\
+}
+
+JIT_FALSE_JMP_OP(h_false_jmp_eq, ==, O_compare_eq(r, o), ret == 0, 0)
+JIT_FALSE_JMP_OP(h_false_jmp_neq, !=, O_compare_eq(r, o), ret != 0, 0)
+JIT_FALSE_JMP_OP(h_false_jmp_lt, <, O_compare_ge(r, o), ret == 1, 1)
+JIT_FALSE_JMP_OP(h_false_jmp_le, <=, O_compare_gt(r, o), ret == 1, 1)
+JIT_FALSE_JMP_OP(h_false_jmp_gt, >, O_compare_gt(r, o), ret == 0, 1)
+JIT_FALSE_JMP_OP(h_false_jmp_ge, >=, O_compare_ge(r, o), ret == 0, 1)
+
+static int h_call(jit_ctx_s* ctx, lword_u* op) {
+	int ret = VM_call_obj(ctx->mat, ctx->mod, op[1].u, op);
+
+	// 被调用的函数可能让运行栈重新分配，模块代码中的循环没有帧基址
+	ctx->stack = &V_AT(ctx->mat->stack, 0, obj_s);
+
+	if (ctx->fp)
+		ctx->fp = ctx->stack + ctx->base;
+
+	return ret;
+}
+
+static int h_ret(jit_ctx_s* ctx, lword_u* op) {
+	matrix_t mat = ctx->mat;
+	call_frame_s* f = &V_AT(mat->call_frames, --mat->frame_top, call_frame_s);
+
+	mat->stack_top = f->stack_base;
+	ctx->stack[mat->stack_top - 1].type = MAT_OT_NONE;
+	return 0;
+}
+
+static int h_ret_result(jit_ctx_s* ctx, lword_u* op) {
+	matrix_t mat = ctx->mat;
+	obj_s* r = ctx->stack + mat->stack_top - 1;
+	call_frame_s* f = &V_AT(mat->call_frames, --mat->frame_top, call_frame_s);
+
+	mat->stack_top = f->stack_base;
+	ctx->stack[mat->stack_top - 1] = *r;
+	return 0;
+}
+
+static int h_make_list(jit_ctx_s* ctx, lword_u* op) {
+	int ret;
+	uint32_t n = op[1].u;
+	list_s* l;
+	obj_s* o;
+
+	ret = LI_alloc(ctx->mat, n, &l);
+	CHECK_RESULT(ret);
+
+	if (n > 0) {
+		memcpy(&V_AT(l->v, 0, obj_s), ctx->stack + *ctx->top - n, sizeof(obj_s) * n);
+		*ctx->top -= n;
+		o = ctx->stack + (*ctx->top)++;
+		o->type = MAT_OT_LIST;
+		o->list = l;
+		V_SIZE(l->v) = n;
+	}
+
+	ret = 0;
+exit0:
+	return ret;
+}
+
+static int h_make_dict(jit_ctx_s* ctx, lword_u* op) {
+	int ret;
+	uint32_t n = op[1].u;
+	uint32_t i = n;
+	dict_s* d;
+	obj_s* o;
+
+	ret = D_alloc(ctx->mat, n, &d);
+	CHECK_RESULT(ret);
+
+	while (n) {
+		o = ctx->stack + *ctx->top - n * 2;
+		ret = H_set(&d->h, o, o + 1);
+
+		if (ret == -1) {
+			E_rt_err(ctx->mat, ctx->mod->name->str, DBG_get_line(ctx->mat, op), "Make dict failed. %s %s", O_type_to_str(o->type), O_type_to_str(o[1].type));
+			return -1;
+		}
+
+		n--;
+	}
+
+	*ctx->top -= i * 2;
+	o = ctx->stack + (*ctx->top)++;
+	o->type = MAT_OT_DICT;
+	o->dict = d;
+	ret = 0;
+exit0:
+	return ret;
+}
+
+static int h_r_move(jit_ctx_s* ctx, lword_u* op) {
+	ctx->fp[op[1].i] = ctx->fp[op[2].i];
+	return 0;
+}
+
+static int h_r_loadi(jit_ctx_s* ctx, lword_u* op) {
+	obj_s* r = ctx->fp + op[1].i;
+	r->type = MAT_OT_INT32;
+	r->int32 = op[2].i;
+	return 0;
+}
+
+#define JIT_R_BINARY_OP(fn, expr, verb) \
+static int fn(jit_ctx_s* ctx, lword_u* op) {\
+	obj_s* r = ctx->fp + op[1].i;\
+	obj_s* ro = ctx->fp + op[2].i;\
+	obj_s* o = ctx->fp + op[3].i;\
+	if ((expr) != 0) {\
+		E_rt_err(ctx->mat, ctx->mod->name->str, DBG_get_line(ctx->mat, op), "Cannot " verb " %s and %s.", O_type_to_str(ro->type), O_type_to_str(o->type));\
+		return -1;\
+	}\
+	return 0;\
+}
+
+JIT_R_BINARY_OP(h_r_add, O_add(ctx->mat, ro, o, r), "add")
+JIT_R_BINARY_OP(h_r_sub, O_sub(ro, o, r), "sub")
+JIT_R_BINARY_OP(h_r_mul, O_mul(ctx->mat, ro, o, r), "mul")
+JIT_R_BINARY_OP(h_r_div, O_div(ro, o, r), "div")
+
+#define JIT_R_COMPARE_OP(fn, int_op, expr, is_false, check) \
+static int fn(jit_ctx_s* ctx, lword_u* op) {\
+	int ret;\
+	obj_s* r = ctx->fp + op[1].i;\
+	obj_s* ro = ctx->fp + op[2].i;\
+	obj_s* o = ctx->fp + op[3].i;\
+	JIT_COMPARE(ro, o, int_op, expr, is_false, check)\
+	*r = *ro;\
+	r->type = ret ? MAT_OT_NONE : MAT_OT_INT32;\
+	return 0;\
+}
+
+JIT_R_COMPARE_OP(h_r_eq, ==, O_compare_eq(ro, o), ret == 0, 0)
+JIT_R_COMPARE_OP(h_r_neq, !=, O_compare_eq(ro, o), ret != 0, 0)
+JIT_R_COMPARE_OP(h_r_lt, <, O_compare_ge(ro, o), ret == 1, 1)
+JIT_R_COMPARE_OP(h_r_le, <=, O_compare_gt(ro, o), ret == 1, 1)
+JIT_R_COMPARE_OP(h_r_gt, >, O_compare_gt(ro, o), ret == 0, 1)
+JIT_R_COMPARE_OP(h_r_ge, >=, O_compare_ge(ro, o), ret == 0, 1)
+
+static int h_true_jmp_keep(jit_ctx_s* ctx, lword_u* op) {
+	return ctx->stack[*ctx->top - 1].type != MAT_OT_NONE;
+}
+
+static int h_false_jmp_keep(jit_ctx_s* ctx, lword_u* op) {
+	return ctx->stack[*ctx->top - 1].type == MAT_OT_NONE;
+}
+
+// for 循环只有 FOR_PREP 使用处理函数，FOR_LOOP 由 emit_for_loop 直接生成本地代码
+static int h_for_prep(jit_ctx_s* ctx, lword_u* op) {
+	obj_s* o = ctx->stack + *ctx->top - 3;
+	obj_s* r;
+
+	if (o[0].type != MAT_OT_INT32 || o[1].type != MAT_OT_INT32 || o[2].type != MAT_OT_INT32) {
+		E_rt_err(ctx->mat, ctx->mod->name->str, DBG_get_line(ctx->mat, op), "The range of for loop must be int.");
+		return -1;
+	}
+
+	if (o[2].int32 == 0) {
+		E_rt_err(ctx->mat, ctx->mod->name->str, DBG_get_line(ctx->mat, op), "The step of for loop cannot be 0.");
+		return -1;
+	}
+
+	if (o[2].int32 > 0 ? o[0].int32 > o[1].int32 : o[0].int32 < o[1].int32)
+		return 1;
+
+	r = op[3].objs ? *op[3].objs + op[2].u : ctx->fp + op[2].i;
+	*r = o[0];
+	return 0;
+}
+
+static int h_r_false_jmp(jit_ctx_s* ctx, lword_u* op) {
+	return ctx->fp[op[1].i].type == MAT_OT_NONE;
+}
+
+static int h_r_true_jmp(jit_ctx_s* ctx, lword_u* op) {
+	return ctx->fp[op[1].i].type != MAT_OT_NONE;
+}
+
+// 普通指令的处理函数，不支持的指令返回 NULL
+static jit_helper get_helper(uint32_t ins) {
+	switch (ins) {
+		case IT_PUSH_NONE: return h_push_none;
+		case IT_PUSH_STRING: return h_push_string;
+		case IT_PUSH_REAL: return h_push_real;
+		case IT_POP: return h_pop;
+		case IT_PUSH_OBJ: return h_push_obj;
+		case IT_ASSIGN: return h_assign;
+		case IT_ASSIGN_ADD: return h_assign_add;
+		case IT_ASSIGN_SUB: return h_assign_sub;
+		case IT_ASSIGN_MUL: return h_assign_mul;
+		case IT_ASSIGN_DIV: return h_assign_div;
+		case IT_ASSIGN_INT: return h_assign_int;
+		case IT_ASSIGN_ADD_INT: return h_assign_add_int;
+		case IT_ASSIGN_SUB_INT: return h_assign_sub_int;
+		case IT_PUSH_ADD_INT: return h_push_add_int;
+		case IT_PUSH_SUB_INT: return h_push_sub_int;
+		case IT_MINUS: return h_minus;
+		case IT_ADD: return h_add;
+		case IT_SUB: return h_sub;
+		case IT_MUL: return h_mul;
+		case IT_DIV: return h_div;
+		case IT_EXP: return h_exp;
+		case IT_LOR: return h_lor;
+		case IT_LAND: return h_land;
+		case IT_EQ: return h_eq;
+		case IT_NEQ: return h_neq;
+		case IT_LT: return h_lt;
+		case IT_LE: return h_le;
+		case IT_GT: return h_gt;
+		case IT_GE: return h_ge;
+		case IT_CALL: return h_call;
+		case IT_MAKE_LIST: return h_make_list;
+		case IT_MAKE_DICT: return h_make_dict;
+		case IT_R_MOVE: return h_r_move;
+		case IT_R_LOADI: return h_r_loadi;
+		case IT_R_ADD: return h_r_add;
+		case IT_R_SUB: return h_r_sub;
+		case IT_R_MUL: return h_r_mul;
+		case IT_R_DIV: return h_r_div;
+		case IT_R_EQ: return h_r_eq;
+		case IT_R_NEQ: return h_r_neq;
+		case IT_R_LT: return h_r_lt;
+		case IT_R_LE: return h_r_le;
+		case IT_R_GT: return h_r_gt;
+		case IT_R_GE: return h_r_ge;
+		default: return NULL;
+	}
+}
+
+// 条件跳转指令的处理函数
+static jit_helper get_jmp_helper(uint32_t ins) {
+	switch (ins) {
+		case IT_FALSE_JMP: return h_false_jmp;
+		case IT_TRUE_JMP: return h_true_jmp;
+		case IT_TRUE_JMP_KEEP: return h_true_jmp_keep;
+		case IT_FALSE_JMP_KEEP: return h_false_jmp_keep;
+		case IT_FOR_PREP: return h_for_prep;
+		case IT_FALSE_JMP_EQ: return h_false_jmp_eq;
+		case IT_FALSE_JMP_NEQ: return h_false_jmp_neq;
+		case IT_FALSE_JMP_LT: return h_false_jmp_lt;
+		case IT_FALSE_JMP_LE: return h_false_jmp_le;
+		case IT_FALSE_JMP_GT: return h_false_jmp_gt;
+		case IT_FALSE_JMP_GE: return h_false_jmp_ge;
+		case IT_R_FALSE_JMP: return h_r_false_jmp;
+		case IT_R_TRUE_JMP: return h_r_true_jmp;
+		default: return NULL;
+	}
+}
+
+static int emit(vec_s* buf, const void* data, uint32_t n) {
+	int ret;
+
+	if (V_SIZE(*buf) + n > V_CAP(*buf)) {
+		ret = V_reserve(buf, (V_SIZE(*buf) + n) * 2);
+		CHECK_RESULT(ret);
+	}
+
+	memcpy(&V_AT(*buf, V_SIZE(*buf), uint8_t), data, n);
+	V_SIZE(*buf) += n;
+	ret = 0;
+exit0:
+	return ret;
+}
+
+// 指令模板写到临时数组里再一次写入 buf，put 系列返回写入的字节数
+static uint32_t put(uint8_t* p, const uint8_t* data, uint32_t n) {
+	memcpy(p, data, n);
+	return n;
+}
+
+static uint32_t put_u32(uint8_t* p, uint32_t v) {
+	memcpy(p, &v, 4);
+	return 4;
+}
+
+static uint32_t put_u64(uint8_t* p, uint64_t v) {
+	memcpy(p, &v, 8);
+	return 8;
+}
+
+// 写一个待修正的 rel32，跳转到指令 pos
+static int emit_rel32(vec_s* buf, vec_s* fixups, uint32_t pos) {
+	int ret;
+	jit_fixup_s* fixup;
+
+	ret = V_alloc_one(fixups);
+	CHECK_RESULT(ret);
+
+	fixup = &V_AT(*fixups, V_SIZE(*fixups)++, jit_fixup_s);
+	fixup->at = V_SIZE(*buf);
+	fixup->pos = pos;
+
+	ret = emit(buf, "\0\0\0\0", 4);
+	CHECK_RESULT(ret);
+
+	ret = 0;
+exit0:
+	return ret;
+}
+
+// jcc rel32，cc 为第二个操作码字节，0 表示 jmp
+static int emit_jcc(vec_s* buf, vec_s* fixups, uint8_t cc, uint32_t pos) {
+	uint8_t code[2];
+	int ret;
+
+	code[0] = 0x0f;
+	code[1] = cc;
+
+	if (cc == 0)
+		ret = emit(buf, "\xe9", 1);
+	else
+		ret = emit(buf, code, sizeof(code));
+
+	CHECK_RESULT(ret);
+	ret = emit_rel32(buf, fixups, pos);
+	CHECK_RESULT(ret);
+
+	ret = 0;
+exit0:
+	return ret;
+}
+
+// 写一个短跳转，rel8 在目标确定以后由 bind_rel8 填写
+static int emit_short_jcc(vec_s* buf, uint8_t cc, uint32_t* at) {
+	int ret;
+	uint8_t code[2];
+
+	code[0] = cc;
+	code[1] = 0;
+	ret = emit(buf, code, sizeof(code));
+	CHECK_RESULT(ret);
+
+	*at = V_SIZE(*buf) - 1;
+	ret = 0;
+exit0:
+	return ret;
+}
+
+// 把 at 处的短跳转指向当前位置
+static void bind_rel8(vec_s* buf, uint32_t at) {
+	uint32_t rel = V_SIZE(*buf) - (at + 1);
+	assert(rel < 128);
+	V_AT(*buf, at, uint8_t) = (uint8_t)rel;
+}
+
+/*
+	从 ctx 重新载入 r13 = fp，r12 = &stack[top]
+	mov r13, [rbx + fp]; mov r12, [rbx + stack]; mov rdx, [rbx + top]; mov ecx, [rdx]; shl rcx, 4; add r12, rcx
+*/
+static uint32_t put_reload(uint8_t* p) {
+	static const uint8_t code[] = {
+		0x4c, 0x8b, 0x6b, offsetof(jit_ctx_s, fp),
+		0x4c, 0x8b, 0x63, offsetof(jit_ctx_s, stack),
+		0x48, 0x8b, 0x53, offsetof(jit_ctx_s, top),
+		0x8b, 0x0a,
+		0x48, 0xc1, 0xe1, 0x04,
+		0x49, 0x01, 0xcc,
+	};
+
+	return put(p, code, sizeof(code));
+}
+
+/*
+	调用处理函数之前把 r12 写回栈顶位置，然后调用 h(ctx, op)
+	mov rax, r12; sub rax, [rbx + stack]; shr rax, 4; mov rdx, [rbx + top]; mov [rdx], eax
+	mov rdi, rbx; mov rsi, op; mov rax, h; call rax
+*/
+static uint32_t put_call(uint8_t* p, jit_helper h, lword_u* op) {
+	static const uint8_t sync[] = {
+		0x4c, 0x89, 0xe0,
+		0x48, 0x2b, 0x43, offsetof(jit_ctx_s, stack),
+		0x48, 0xc1, 0xe8, 0x04,
+		0x48, 0x8b, 0x53, offsetof(jit_ctx_s, top),
+		0x89, 0x02,
+		0x48, 0x89, 0xdf,
+		0x48, 0xbe,
+	};
+	static const uint8_t mov_rax[] = { 0x48, 0xb8 };
+	static const uint8_t call_rax[] = { 0xff, 0xd0 };
+	uint32_t n = 0;
+
+	n += put(p + n, sync, sizeof(sync));
+	n += put_u64(p + n, (uint64_t)(uintptr_t)op);
+	n += put(p + n, mov_rax, sizeof(mov_rax));
+	n += put_u64(p + n, (uint64_t)(uintptr_t)h);
+	n += put(p + n, call_rax, sizeof(call_rax));
+	return n;
+}
+
+/*
+	调用处理函数，之后重新载入 r12 和 r13。
+	target 为 JIT_EXIT 时是普通指令，返回非0时出错；否则是条件跳转，返回 -1 出错，1 跳转到 target。
+*/
+static int emit_helper(vec_s* buf, vec_s* fixups, jit_helper h, lword_u* op, uint32_t target) {
+	static const uint8_t test_eax[] = { 0x85, 0xc0 };
+	uint8_t code[96];
+	uint32_t n = 0;
+	int ret;
+
+	n += put_call(code + n, h, op);
+	n += put_reload(code + n);
+	n += put(code + n, test_eax, sizeof(test_eax));
+	ret = emit(buf, code, n);
+	CHECK_RESULT(ret);
+
+	if (target == JIT_EXIT)
+		return emit_jcc(buf, fixups, 0x85, JIT_ERROR);
+
+	ret = emit_jcc(buf, fixups, 0x88, JIT_ERROR);
+	CHECK_RESULT(ret);
+	ret = emit_jcc(buf, fixups, 0x85, target);
+	CHECK_RESULT(ret);
+
+	ret = 0;
+exit0:
+	return ret;
+}
+
+/*
+	整数快速路径后面的慢速路径：快速路径跳过它，类型检查失败的 n 个短跳转 slow 跳到这里，
+	由处理函数完成整条指令。
+*/
+static int emit_slow_path(vec_s* buf, vec_s* fixups, const uint32_t* slow, uint32_t n, jit_helper h, lword_u* op, uint32_t target) {
+	int ret;
+	uint32_t done;
+	uint32_t i;
+
+	ret = emit_short_jcc(buf, 0xeb, &done);
+	CHECK_RESULT(ret);
+
+	for (i = 0; i < n; ++i)
+		bind_rel8(buf, slow[i]);
+
+	ret = emit_helper(buf, fixups, h, op, target);
+	CHECK_RESULT(ret);
+
+	bind_rel8(buf, done);
+	ret = 0;
+exit0:
+	return ret;
+}
+
+/*
+	访问没有下标的局部对象或者全局对象 [base + disp32]，局部对象的 base 为 r13，全局对象为 rdx。
+	rex 为 0x40 或者 0x48，opc 为操作码，reg 为 ModRM 的 reg 字段。
+*/
+static uint32_t put_ref_mem(uint8_t* p, uint8_t rex, uint8_t opc, uint8_t reg, int local, int32_t disp) {
+	p[0] = (uint8_t)(rex | (local ? 1 : 0));
+	p[1] = opc;
+	p[2] = (uint8_t)(0x80 | (reg << 3) | (local ? 5 : 2));
+	return 3 + put_u32(p + 3, (uint32_t)disp);
+}
+
+// 全局对象先载入 rdx = *objs
+static uint32_t put_load_objs(uint8_t* p, obj_s** objs) {
+	static const uint8_t load_objs[] = { 0x48, 0xba }; // mov rdx, imm64
+	static const uint8_t deref_objs[] = { 0x48, 0x8b, 0x12 }; // mov rdx, [rdx]
+	uint32_t n = 0;
+
+	n += put(p + n, load_objs, sizeof(load_objs));
+	n += put_u64(p + n, (uint64_t)(uintptr_t)objs);
+	n += put(p + n, deref_objs, sizeof(deref_objs));
+	return n;
+}
+
+// 没有下标的对象引用的基址，disp 为对象相对基址的偏移
+static uint32_t put_ref_base(uint8_t* p, lword_u* op, int32_t* disp) {
+	if (op[3].pair.hi == LK_REF_LOCAL) {
+		*disp = op[2].i * (int32_t)sizeof(obj_s);
+		return 0;
+	}
+
+	*disp = (int32_t)(op[2].u * sizeof(obj_s));
+	return put_load_objs(p, op[1].objs);
+}
+
+/*
+	把对象压入运行栈或者把栈顶对象写入对象，objs 为 NULL 时是局部对象。
+	复制对象时分别复制类型和值两个 qword，写入整数时也写满 qword，
+	这样之后读取对象时都能从之前的写操作直接转发，避免 16 字节读跨越多个写操作。
+*/
+static int emit_move(vec_s* buf, int store, obj_s** objs, int32_t disp) {
+	// sub r12, 16; mov rax, [r12]; mov rcx, [r12 + 8]
+	static const uint8_t pop[] = { 0x49, 0x83, 0xec, 0x10, 0x49, 0x8b, 0x04, 0x24, 0x49, 0x8b, 0x4c, 0x24, 0x08 };
+	// mov [r12], rax; mov [r12 + 8], rcx; add r12, 16
+	static const uint8_t push[] = { 0x49, 0x89, 0x04, 0x24, 0x49, 0x89, 0x4c, 0x24, 0x08, 0x49, 0x83, 0xc4, 0x10 };
+	uint8_t code[64];
+	uint32_t n = 0;
+	int local = objs == NULL;
+	uint8_t opc = store ? 0x89 : 0x8b;
+
+	if (!local)
+		n += put_load_objs(code + n, objs);
+
+	if (store)
+		n += put(code + n, pop, sizeof(pop));
+
+	n += put_ref_mem(code + n, 0x48, opc, 0, local, disp);
+	n += put_ref_mem(code + n, 0x48, opc, 1, local, disp + 8);
+
+	if (!store)
+		n += put(code + n, push, sizeof(push));
+
+	return emit(buf, code, n);
+}
+
+// PUSH_OBJ 和 ASSIGN 引用没有下标的局部对象或者全局对象
+static int emit_move_ref(vec_s* buf, uint32_t ins, lword_u* op) {
+	int32_t disp;
+
+	if (op[3].pair.hi == LK_REF_LOCAL)
+		return emit_move(buf, ins == IT_ASSIGN, NULL, op[2].i * (int32_t)sizeof(obj_s));
+
+	disp = (int32_t)(op[2].u * sizeof(obj_s));
+	return emit_move(buf, ins == IT_ASSIGN, op[1].objs, disp);
+}
+
+// mov qword [r12], MAT_OT_INT32; mov qword [r12 + 8], v; add r12, 16
+static int emit_push_int(vec_s* buf, int32_t v) {
+	static const uint8_t mov_type[] = { 0x49, 0xc7, 0x04, 0x24 };
+	static const uint8_t mov_value[] = { 0x49, 0xc7, 0x44, 0x24, 0x08 };
+	static const uint8_t inc_top[] = { 0x49, 0x83, 0xc4, 0x10 };
+	uint8_t code[32];
+	uint32_t n = 0;
+
+	n += put(code + n, mov_type, sizeof(mov_type));
+	n += put_u32(code + n, MAT_OT_INT32);
+	n += put(code + n, mov_value, sizeof(mov_value));
+	n += put_u32(code + n, (uint32_t)v);
+	n += put(code + n, inc_top, sizeof(inc_top));
+	return emit(buf, code, n);
+}
+
+// 栈顶两个对象有一个不是整数时跳到 slow
+static int emit_check_top_int(vec_s* buf, uint32_t* slow) {
+	static const uint8_t cmp_r[] = { 0x41, 0x81, 0x7c, 0x24, 0xe0 }; // cmp dword [r12 - 32], imm32
+	static const uint8_t cmp_o[] = { 0x41, 0x81, 0x7c, 0x24, 0xf0 }; // cmp dword [r12 - 16], imm32
+	uint8_t code[16];
+	uint32_t n;
+	int ret;
+
+	n = put(code, cmp_r, sizeof(cmp_r));
+	n += put_u32(code + n, MAT_OT_INT32);
+	ret = emit(buf, code, n);
+	CHECK_RESULT(ret);
+	ret = emit_short_jcc(buf, 0x75, &slow[0]);
+	CHECK_RESULT(ret);
+
+	n = put(code, cmp_o, sizeof(cmp_o));
+	n += put_u32(code + n, MAT_OT_INT32);
+	ret = emit(buf, code, n);
+	CHECK_RESULT(ret);
+	ret = emit_short_jcc(buf, 0x75, &slow[1]);
+	CHECK_RESULT(ret);
+
+	ret = 0;
+exit0:
+	return ret;
+}
+
+// ADD、SUB、MUL 的整数快速路径
+static int emit_int_binary(vec_s* buf, vec_s* fixups, uint32_t ins, lword_u* op, jit_helper h) {
+	static const uint8_t load_r[] = { 0x41, 0x8b, 0x44, 0x24, 0xe8 }; // mov eax, [r12 - 24]
+	static const uint8_t add[] = { 0x41, 0x03, 0x44, 0x24, 0xf8 }; // add eax, [r12 - 8]
+	static const uint8_t sub[] = { 0x41, 0x2b, 0x44, 0x24, 0xf8 }; // sub eax, [r12 - 8]
+	static const uint8_t mul[] = { 0x41, 0x0f, 0xaf, 0x44, 0x24, 0xf8 }; // imul eax, [r12 - 8]
+	static const uint8_t store_r[] = { 0x49, 0x89, 0x44, 0x24, 0xe8, 0x49, 0x83, 0xec, 0x10 }; // mov [r12 - 24], rax; sub r12, 16
+	uint8_t code[32];
+	uint32_t n = 0;
+	int ret;
+	uint32_t slow[2];
+
+	ret = emit_check_top_int(buf, slow);
+	CHECK_RESULT(ret);
+
+	n += put(code + n, load_r, sizeof(load_r));
+
+	if (ins == IT_ADD)
+		n += put(code + n, add, sizeof(add));
+	else if (ins == IT_SUB)
+		n += put(code + n, sub, sizeof(sub));
+	else
+		n += put(code + n, mul, sizeof(mul));
+
+	n += put(code + n, store_r, sizeof(store_r));
+	ret = emit(buf, code, n);
+	CHECK_RESULT(ret);
+
+	ret = emit_slow_path(buf, fixups, slow, 2, h, op, JIT_EXIT);
+	CHECK_RESULT(ret);
+
+	ret = 0;
+exit0:
+	return ret;
+}
+
+// 引用没有下标的局部对象或者全局对象的 ASSIGN_ADD、ASSIGN_SUB、ASSIGN_MUL 的整数快速路径
+static int emit_ref_assign_op(vec_s* buf, vec_s* fixups, uint32_t ins, lword_u* op, jit_helper h) {
+	static const uint8_t cmp_o[] = { 0x41, 0x81, 0x7c, 0x24, 0xf0 }; // cmp dword [r12 - 16], imm32
+	static const uint8_t add[] = { 0x41, 0x03, 0x44, 0x24, 0xf8 }; // add eax, [r12 - 8]
+	static const uint8_t sub[] = { 0x41, 0x2b, 0x44, 0x24, 0xf8 }; // sub eax, [r12 - 8]
+	static const uint8_t mul[] = { 0x41, 0x0f, 0xaf, 0x44, 0x24, 0xf8 }; // imul eax, [r12 - 8]
+	static const uint8_t pop[] = { 0x49, 0x83, 0xec, 0x10 }; // sub r12, 16
+	uint8_t code[64];
+	uint32_t n;
+	int local = op[3].pair.hi == LK_REF_LOCAL;
+	int32_t disp;
+	uint32_t slow[2];
+	int ret;
+
+	n = put_ref_base(code, op, &disp);
+	n += put(code + n, cmp_o, sizeof(cmp_o));
+	n += put_u32(code + n, MAT_OT_INT32);
+	ret = emit(buf, code, n);
+	CHECK_RESULT(ret);
+	ret = emit_short_jcc(buf, 0x75, &slow[0]);
+	CHECK_RESULT(ret);
+
+	n = put_ref_mem(code, 0x40, 0x81, 7, local, disp); // cmp dword [ref], imm32
+	n += put_u32(code + n, MAT_OT_INT32);
+	ret = emit(buf, code, n);
+	CHECK_RESULT(ret);
+	ret = emit_short_jcc(buf, 0x75, &slow[1]);
+	CHECK_RESULT(ret);
+
+	n = put_ref_mem(code, 0x40, 0x8b, 0, local, disp + 8); // mov eax, [ref + 8]
+
+	if (ins == IT_ASSIGN_ADD)
+		n += put(code + n, add, sizeof(add));
+	else if (ins == IT_ASSIGN_SUB)
+		n += put(code + n, sub, sizeof(sub));
+	else
+		n += put(code + n, mul, sizeof(mul));
+
+	n += put_ref_mem(code + n, 0x48, 0x89, 0, local, disp + 8); // mov [ref + 8], rax
+	n += put(code + n, pop, sizeof(pop));
+	ret = emit(buf, code, n);
+	CHECK_RESULT(ret);
+
+	ret = emit_slow_path(buf, fixups, slow, 2, h, op, JIT_EXIT);
+	CHECK_RESULT(ret);
+
+	ret = 0;
+exit0:
+	return ret;
+}
+
+// 比较结果为假时跳转的条件码
+static uint8_t false_cc(uint32_t ins) {
+	switch (ins) {
+		case IT_FALSE_JMP_EQ:
+			return 0x85; // jne
+
+		case IT_FALSE_JMP_NEQ:
+			return 0x84; // je
+
+		case IT_FALSE_JMP_LT:
+			return 0x8d; // jge
+
+		case IT_FALSE_JMP_LE:
+			return 0x8f; // jg
+
+		case IT_FALSE_JMP_GT:
+			return 0x8e; // jle
+
+		default:
+			return 0x8c; // jl
+	}
+}
+
+// FALSE_JMP_LT 等的整数快速路径
+static int emit_int_false_jmp(vec_s* buf, vec_s* fixups, uint32_t ins, lword_u* op, jit_helper h, uint32_t target) {
+	// mov eax, [r12 - 24]; cmp eax, [r12 - 8]; lea r12, [r12 - 32]
+	static const uint8_t cmp[] = { 0x41, 0x8b, 0x44, 0x24, 0xe8, 0x41, 0x3b, 0x44, 0x24, 0xf8, 0x4d, 0x8d, 0x64, 0x24, 0xe0 };
+	int ret;
+	uint32_t slow[2];
+
+	ret = emit_check_top_int(buf, slow);
+	CHECK_RESULT(ret);
+	ret = emit(buf, cmp, sizeof(cmp));
+	CHECK_RESULT(ret);
+	ret = emit_jcc(buf, fixups, false_cc(ins), target);
+	CHECK_RESULT(ret);
+
+	ret = emit_slow_path(buf, fixups, slow, 2, h, op, target);
+	CHECK_RESULT(ret);
+
+	ret = 0;
+exit0:
+	return ret;
+}
+
+// 引用没有下标的局部对象或者全局对象的 ASSIGN_INT、ASSIGN_ADD_INT 等超级指令
+static int emit_ref_int(vec_s* buf, vec_s* fixups, uint32_t ins, lword_u* op, jit_helper h) {
+	static const uint8_t mov_type[] = { 0x49, 0xc7, 0x04, 0x24 }; // mov qword [r12], imm32
+	static const uint8_t push_value[] = { 0x49, 0x89, 0x44, 0x24, 0x08, 0x49, 0x83, 0xc4, 0x10 }; // mov [r12 + 8], rax; add r12, 16
+	uint8_t code[64];
+	uint32_t n;
+	int local = op[3].pair.hi == LK_REF_LOCAL;
+	int32_t disp;
+	uint32_t v = (uint32_t)op[4].i;
+	uint32_t slow;
+	int ret;
+
+	n = put_ref_base(code, op, &disp);
+
+	if (ins == IT_ASSIGN_INT) {
+		n += put_ref_mem(code + n, 0x48, 0xc7, 0, local, disp); // mov qword [ref], imm32
+		n += put_u32(code + n, MAT_OT_INT32);
+		n += put_ref_mem(code + n, 0x48, 0xc7, 0, local, disp + 8);
+		n += put_u32(code + n, v);
+		return emit(buf, code, n);
+	}
+
+	n += put_ref_mem(code + n, 0x40, 0x81, 7, local, disp); // cmp dword [ref], imm32
+	n += put_u32(code + n, MAT_OT_INT32);
+	ret = emit(buf, code, n);
+	CHECK_RESULT(ret);
+	ret = emit_short_jcc(buf, 0x75, &slow);
+	CHECK_RESULT(ret);
+
+	n = put_ref_mem(code, 0x40, 0x8b, 0, local, disp + 8); // mov eax, [ref + 8]
+	n += put(code + n, (const uint8_t*)(ins == IT_ASSIGN_ADD_INT || ins == IT_PUSH_ADD_INT ? "\x05" : "\x2d"), 1); // add/sub eax, imm32
+	n += put_u32(code + n, v);
+
+	if (ins == IT_ASSIGN_ADD_INT || ins == IT_ASSIGN_SUB_INT)
+		n += put_ref_mem(code + n, 0x48, 0x89, 0, local, disp + 8); // mov [ref + 8], rax
+	else {
+		n += put(code + n, mov_type, sizeof(mov_type));
+		n += put_u32(code + n, MAT_OT_INT32);
+		n += put(code + n, push_value, sizeof(push_value));
+	}
+
+	ret = emit(buf, code, n);
+	CHECK_RESULT(ret);
+
+	ret = emit_slow_path(buf, fixups, &slow, 1, h, op, JIT_EXIT);
+	CHECK_RESULT(ret);
+
+	ret = 0;
+exit0:
+	return ret;
+}
+
+/*
+	FOR_LOOP 直接生成本地代码，不需要处理函数：
+	栈顶的计数、上限和步长在 FOR_PREP 检查过，一定是整数，循环体也不会改变它们。
+	加步长溢出时一定越过了上限，与解释器用 64 位计算的结果相同。
+*/
+static int emit_for_loop(vec_s* buf, vec_s* fixups, lword_u* op, uint32_t target) {
+	// mov eax, [r12 - 40]; mov ecx, [r12 - 8]; add eax, ecx
+	static const uint8_t add[] = { 0x41, 0x8b, 0x44, 0x24, 0xd8, 0x41, 0x8b, 0x4c, 0x24, 0xf8, 0x01, 0xc8 };
+	static const uint8_t test_step[] = { 0x85, 0xc9 }; // test ecx, ecx
+	static const uint8_t cmp_limit[] = { 0x41, 0x3b, 0x44, 0x24, 0xe8 }; // cmp eax, [r12 - 24]
+	static const uint8_t store[] = { 0x49, 0x89, 0x44, 0x24, 0xd8 }; // mov [r12 - 40], rax
+	uint8_t code[64];
+	uint32_t n;
+	int local = op[4].objs == NULL;
+	int32_t disp = local ? op[3].i * (int32_t)sizeof(obj_s) : (int32_t)(op[3].u * sizeof(obj_s));
+	uint32_t done[3];
+	uint32_t neg;
+	uint32_t in_range;
+	int ret;
+
+	ret = emit(buf, add, sizeof(add));
+	CHECK_RESULT(ret);
+	ret = emit_short_jcc(buf, 0x70, &done[0]); // jo
+	CHECK_RESULT(ret);
+	ret = emit(buf, test_step, sizeof(test_step));
+	CHECK_RESULT(ret);
+	ret = emit_short_jcc(buf, 0x78, &neg); // js
+	CHECK_RESULT(ret);
+	ret = emit(buf, cmp_limit, sizeof(cmp_limit));
+	CHECK_RESULT(ret);
+	ret = emit_short_jcc(buf, 0x7f, &done[1]); // jg
+	CHECK_RESULT(ret);
+	ret = emit_short_jcc(buf, 0xeb, &in_range);
+	CHECK_RESULT(ret);
+
+	bind_rel8(buf, neg);
+	ret = emit(buf, cmp_limit, sizeof(cmp_limit));
+	CHECK_RESULT(ret);
+	ret = emit_short_jcc(buf, 0x7c, &done[2]); // jl
+	CHECK_RESULT(ret);
+
+	bind_rel8(buf, in_range);
+	n = put(code, store, sizeof(store));
+
+	if (!local)
+		n += put_load_objs(code + n, op[4].objs);
+
+	n += put_ref_mem(code + n, 0x48, 0xc7, 0, local, disp); // mov qword [var], imm32
+	n += put_u32(code + n, MAT_OT_INT32);
+	n += put_ref_mem(code + n, 0x48, 0x89, 0, local, disp + 8); // mov [var + 8], rax
+	ret = emit(buf, code, n);
+	CHECK_RESULT(ret);
+	ret = emit_jcc(buf, fixups, 0, target);
+	CHECK_RESULT(ret);
+
+	bind_rel8(buf, done[0]);
+	bind_rel8(buf, done[1]);
+	bind_rel8(buf, done[2]);
+	ret = 0;
+exit0:
+	return ret;
+}
+
+// INLINE_GUARD：被调用对象不是内联的函数时跳到 target 的 CALL
+static int emit_inline_guard(vec_s* buf, vec_s* fixups, lword_u* op, uint32_t target) {
+	static const uint8_t cmp_type[] = { 0x41, 0x81, 0xbc, 0x24 }; // cmp dword [r12 + disp32], imm32
+	static const uint8_t mov_rax[] = { 0x48, 0xb8 }; // mov rax, imm64
+	static const uint8_t cmp_func[] = { 0x49, 0x39, 0x84, 0x24 }; // cmp [r12 + disp32], rax
+	uint8_t code[32];
+	uint32_t n;
+	int32_t disp = -(int32_t)((op[3].u + 1) * sizeof(obj_s));
+	int ret;
+
+	n = put(code, cmp_type, sizeof(cmp_type));
+	n += put_u32(code + n, (uint32_t)disp);
+	n += put_u32(code + n, MAT_OT_FUNC);
+	ret = emit(buf, code, n);
+	CHECK_RESULT(ret);
+	ret = emit_jcc(buf, fixups, 0x85, target);
+	CHECK_RESULT(ret);
+
+	n = put(code, mov_rax, sizeof(mov_rax));
+	n += put_u64(code + n, (uint64_t)(uintptr_t)op[2].func);
+	n += put(code + n, cmp_func, sizeof(cmp_func));
+	n += put_u32(code + n, (uint32_t)(disp + 8));
+	ret = emit(buf, code, n);
+	CHECK_RESULT(ret);
+	ret = emit_jcc(buf, fixups, 0x85, target);
+	CHECK_RESULT(ret);
+
+	ret = 0;
+exit0:
+	return ret;
+}
+
+// 翻译一条指令，不支持时返回1
+static int compile_ins(vec_s* buf, vec_s* fixups, uint32_t* ip, lword_u* op) {
+	int ret;
+	uint32_t* target = INS_jmp_target(ip);
+	uint8_t code[64];
+	jit_helper h;
+
+	switch (*ip) {
+		case IT_NOP:
+			return 0;
+
+		case IT_PUSH_INT:
+			return emit_push_int(buf, op[1].i);
+
+		case IT_PUSH_LOCAL:
+		case IT_STORE_LOCAL:
+			return emit_move(buf, *ip == IT_STORE_LOCAL, NULL, op[1].i * (int32_t)sizeof(obj_s));
+
+		case IT_PUSH_GLOBAL:
+		case IT_STORE_GLOBAL:
+			return emit_move(buf, *ip == IT_STORE_GLOBAL, op[2].objs, (int32_t)(op[1].u * sizeof(obj_s)));
+
+		case IT_PUSH_OBJ:
+		case IT_ASSIGN:
+			if (op[3].pair.lo == 0 && op[3].pair.hi != LK_REF_MOD)
+				return emit_move_ref(buf, *ip, op);
+
+			break;
+
+		case IT_ASSIGN_INT:
+		case IT_ASSIGN_ADD_INT:
+		case IT_ASSIGN_SUB_INT:
+		case IT_PUSH_ADD_INT:
+		case IT_PUSH_SUB_INT:
+			if (op[3].pair.lo == 0 && op[3].pair.hi != LK_REF_MOD)
+				return emit_ref_int(buf, fixups, *ip, op, get_helper(*ip));
+
+			break;
+
+		case IT_ASSIGN_ADD:
+		case IT_ASSIGN_SUB:
+		case IT_ASSIGN_MUL:
+			if (op[3].pair.lo == 0 && op[3].pair.hi != LK_REF_MOD)
+				return emit_ref_assign_op(buf, fixups, *ip, op, get_helper(*ip));
+
+			break;
+
+		case IT_ADD:
+		case IT_SUB:
+		case IT_MUL:
+			return emit_int_binary(buf, fixups, *ip, op, get_helper(*ip));
+
+		case IT_FALSE_JMP_EQ:
+		case IT_FALSE_JMP_NEQ:
+		case IT_FALSE_JMP_LT:
+		case IT_FALSE_JMP_LE:
+		case IT_FALSE_JMP_GT:
+		case IT_FALSE_JMP_GE:
+			return emit_int_false_jmp(buf, fixups, *ip, op, get_jmp_helper(*ip), *target);
+
+		case IT_JMP:
+		case IT_LOOP:
+			return emit_jcc(buf, fixups, 0, *target);
+
+		case IT_FOR_LOOP:
+			return emit_for_loop(buf, fixups, op, *target);
+
+		case IT_INLINE_GUARD:
+			return emit_inline_guard(buf, fixups, op, *target);
+
+		case IT_RET:
+		case IT_RET_RESULT:
+			ret = emit(buf, code, put_call(code, *ip == IT_RET ? h_ret : h_ret_result, op));
+			CHECK_RESULT(ret);
+			ret = emit_jcc(buf, fixups, 0, JIT_EXIT);
+			CHECK_RESULT(ret);
+			return 0;
+
+		default:
+			break;
+	}
+
+	h = get_jmp_helper(*ip);
+
+	if (h)
+		return emit_helper(buf, fixups, h, op, *target);
+
+	h = get_helper(*ip);
+
+	if (!h)
+		return 1;
+
+	return emit_helper(buf, fixups, h, op, JIT_EXIT);
+exit0:
+	return ret;
+}
+
+// 侧出口：mov eax, pos; jmp side_exit，回到解释器的 pos 继续执行
+static int emit_side_exit(vec_s* buf, vec_s* fixups, uint32_t pos) {
+	uint8_t code[8];
+	int ret;
+
+	code[0] = 0xb8;
+	ret = emit(buf, code, 1 + put_u32(code + 1, pos));
+	CHECK_RESULT(ret);
+	ret = emit_jcc(buf, fixups, 0, JIT_SIDE_EXIT);
+	CHECK_RESULT(ret);
+
+	ret = 0;
+exit0:
+	return ret;
+}
+
+/*
+	生成的代码：rbx 指向 jit_ctx_s，r12 指向栈顶（&stack[top]），r13 为帧基址，
+	栈顶位置只在调用处理函数前写回 ctx，调用后重新载入 r12 和 r13。
+	编译 code 中 [begin, end) 的指令，lcode 为链接后的指令，两者一一对应。
+	trace 为0时编译整个函数，有不支持的指令时返回1；
+	trace 为1时编译一个循环，不支持的指令和跳到范围之外的跳转变成侧出口，
+	本地代码返回解释器继续执行的指令位置。出错时本地代码返回 -1。
+*/
+static int compile_code(vec_s* code, vec_s* lcode, uint32_t begin, uint32_t end, int trace, void** out, uint32_t* out_size) {
+	static const uint8_t prologue[] = { 0x53, 0x41, 0x54, 0x41, 0x55, 0x48, 0x89, 0xfb }; // push rbx; push r12; push r13; mov rbx, rdi
+	static const uint8_t epilogue[] = { 0x41, 0x5d, 0x41, 0x5c, 0x5b, 0xc3 }; // pop r13; pop r12; pop rbx; ret
+	static const uint8_t error[] = { 0xb8, 0xff, 0xff, 0xff, 0xff }; // mov eax, -1
+	// 侧出口把 r12 写回栈顶位置：mov rcx, r12; sub rcx, [rbx + stack]; shr rcx, 4; mov rdx, [rbx + top]; mov [rdx], ecx
+	static const uint8_t sync[] = {
+		0x4c, 0x89, 0xe1,
+		0x48, 0x2b, 0x4b, offsetof(jit_ctx_s, stack),
+		0x48, 0xc1, 0xe9, 0x04,
+		0x48, 0x8b, 0x53, offsetof(jit_ctx_s, top),
+		0x89, 0x0a,
+	};
+	uint8_t tmp[64];
+	int ret;
+	uint32_t size = V_SIZE(*code);
+	uint32_t* ip_begin = &V_AT(*code, 0, uint32_t);
+	lword_u* lp_begin = &V_AT(*lcode, 0, lword_u);
+	uint32_t* ip;
+	uint32_t* native_pos = NULL;
+	uint32_t exit_pos;
+	uint32_t error_pos;
+	uint32_t side_exit_pos = 0;
+	uint32_t i;
+	vec_s buf;
+	vec_s fixups;
+	void* mem = MAP_FAILED;
+
+	memset(&buf, 0, sizeof(buf));
+	memset(&fixups, 0, sizeof(fixups));
+
+	ret = V_init(&buf, sizeof(uint8_t), (end - begin) * 16 + 64);
+	CHECK_RESULT(ret);
+
+	ret = V_init(&fixups, sizeof(jit_fixup_s), 16);
+	CHECK_RESULT(ret);
+
+	native_pos = calloc(size + 1, sizeof(uint32_t));
+	CHECK_MALLOC(native_pos);
+
+	ret = emit(&buf, prologue, sizeof(prologue));
+	CHECK_RESULT(ret);
+	ret = emit(&buf, tmp, put_reload(tmp));
+	CHECK_RESULT(ret);
+
+	for (ip = ip_begin + begin; ip < ip_begin + end; ip += INS_size(*ip)) {
+		uint32_t pos = ip - ip_begin;
+		CHECK_CONDITION(INS_size(*ip) > 0);
+		native_pos[pos] = V_SIZE(buf);
+
+		// 返回指令由解释器弹出调用帧
+		if (trace && (*ip == IT_RET || *ip == IT_RET_RESULT))
+			ret = 1;
+		else {
+			ret = compile_ins(&buf, &fixups, ip, lp_begin + pos);
+			CHECK_RESULT(ret);
+		}
+
+		if (ret == 1 && !trace)
+			goto exit0;
+
+		if (ret == 1) {
+			ret = emit_side_exit(&buf, &fixups, pos);
+			CHECK_RESULT(ret);
+		}
+	}
+
+	if (trace) {
+		ret = emit_side_exit(&buf, &fixups, end);
+		CHECK_RESULT(ret);
+
+		side_exit_pos = V_SIZE(buf);
+		ret = emit(&buf, sync, sizeof(sync));
+		CHECK_RESULT(ret);
+	}
+	else
+		native_pos[end] = V_SIZE(buf);
+
+	exit_pos = V_SIZE(buf);
+	ret = emit(&buf, epilogue, sizeof(epilogue));
+	CHECK_RESULT(ret);
+
+	error_pos = V_SIZE(buf);
+	ret = emit(&buf, error, sizeof(error));
+	CHECK_RESULT(ret);
+	ret = emit(&buf, epilogue, sizeof(epilogue));
+	CHECK_RESULT(ret);
+
+	// 跳到循环之外的指令，每个目标生成一个侧出口
+	for (i = 0; i < V_SIZE(fixups); ++i) {
+		uint32_t pos = V_AT(fixups, i, jit_fixup_s).pos;
+
+		if (pos < JIT_SIDE_EXIT && native_pos[pos] == 0) {
+			CHECK_CONDITION(trace && pos <= size);
+			native_pos[pos] = V_SIZE(buf);
+			ret = emit_side_exit(&buf, &fixups, pos);
+			CHECK_RESULT(ret);
+		}
+	}
+
+	for (i = 0; i < V_SIZE(fixups); ++i) {
+		jit_fixup_s* fixup = &V_AT(fixups, i, jit_fixup_s);
+		uint32_t to;
+		int32_t rel;
+
+		if (fixup->pos == JIT_EXIT)
+			to = exit_pos;
+		else if (fixup->pos == JIT_ERROR)
+			to = error_pos;
+		else if (fixup->pos == JIT_SIDE_EXIT)
+			to = side_exit_pos;
+		else
+			to = native_pos[fixup->pos];
+
+		rel = (int32_t)to - (int32_t)(fixup->at + 4);
+		memcpy(&V_AT(buf, fixup->at, uint8_t), &rel, 4);
+	}
+
+	mem = mmap(NULL, V_SIZE(buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	CHECK_CONDITION(mem != MAP_FAILED);
+
+	memcpy(mem, buf.p, V_SIZE(buf));
+	CHECK_CONDITION(mprotect(mem, V_SIZE(buf), PROT_READ | PROT_EXEC) == 0);
+
+	*out = mem;
+	*out_size = V_SIZE(buf);
+	mem = MAP_FAILED;
+	ret = 0;
+exit0:
+	if (mem != MAP_FAILED)
+		munmap(mem, V_SIZE(buf));
+
+	free(native_pos);
+	V_free(&fixups);
+	V_free(&buf);
+	return ret;
+}
+
+/*
+	编译 op 处的 IT_LOOP 或 IT_FOR_LOOP 所在的循环，即回边的跳转目标到回边之间的指令。
+	ip_begin 为当前执行的代码，可能是栈顶帧的函数或者模块代码。
+*/
+static int compile_trace(matrix_t mat, mod_s* mod, lword_u* op, lword_u* ip_begin) {
+	int ret;
+	vec_s* code = NULL;
+	vec_s* lcode = NULL;
+	uint32_t pos = op - ip_begin;
+	uint32_t begin;
+	uint32_t ins;
+	func_s* func;
+	jit_trace_s trace;
+
+	trace.code = NULL;
+
+	if (mat->frame_top > 0) {
+		func = V_AT(mat->call_frames, mat->frame_top - 1, call_frame_s).func;
+
+		if (V_SIZE(func->lcode) > 0 && &V_AT(func->lcode, 0, lword_u) == ip_begin) {
+			code = &func->code;
+			lcode = &func->lcode;
+		}
+	}
+
+	if (!code && V_SIZE(mod->lcode) > 0 && &V_AT(mod->lcode, 0, lword_u) == ip_begin) {
+		code = &mod->code;
+		lcode = &mod->lcode;
+	}
+
+	CHECK_CONDITION(code && V_SIZE(*code) == V_SIZE(*lcode));
+	CHECK_CONDITION(pos < V_SIZE(*code));
+
+	ins = V_AT(*code, pos, uint32_t);
+	CHECK_CONDITION((ins == IT_LOOP || ins == IT_FOR_LOOP) && pos + INS_size(ins) <= V_SIZE(*code));
+
+	begin = V_AT(*code, pos + 1, uint32_t);
+	CHECK_CONDITION(begin < pos);
+
+	ret = V_alloc_one(&mat->traces);
+	CHECK_RESULT(ret);
+
+	ret = compile_code(code, lcode, begin, pos + INS_size(ins), 1, &trace.code, &trace.size);
+	CHECK_RESULT(ret);
+
+	V_AT(mat->traces, V_SIZE(mat->traces)++, jit_trace_s) = trace;
+	op[2].pair.hi = V_SIZE(mat->traces);
+	ret = 0;
+exit0:
+	return ret;
+}
+
+int JIT_ready(matrix_t mat, func_s* func) {
+	if (!mat->jit || mat->jit_depth >= JIT_MAX_DEPTH)
+		return 0;
+
+	if (func->jit)
+		return 1;
+
+	if (func->jit_failed || ++func->calls < JIT_CALL_THRESHOLD)
+		return 0;
+
+	if (compile_code(&func->code, &func->lcode, 0, V_SIZE(func->code), 0, &func->jit, &func->jit_size) != 0 || !func->jit) {
+		func->jit_failed = 1;
+		return 0;
+	}
+
+	return 1;
+}
+
+int JIT_exec(matrix_t mat, mod_s* mod, func_s* func) {
+	int ret;
+	jit_ctx_s ctx;
+	assert(func->jit);
+	assert(mat->frame_top > 0);
+
+	ctx.mat = mat;
+	ctx.mod = mod;
+	ctx.top = &mat->stack_top;
+	ctx.base = V_AT(mat->call_frames, mat->frame_top - 1, call_frame_s).stack_base;
+	ctx.stack = &V_AT(mat->stack, 0, obj_s);
+	ctx.fp = ctx.stack + ctx.base;
+	mat->jit_depth++;
+	ret = ((jit_entry)func->jit)(&ctx);
+	mat->jit_depth--;
+	return ret;
+}
+
+int JIT_loop(matrix_t mat, mod_s* mod, lword_u* op, lword_u* ip_begin, obj_s* fp, uint32_t* pos) {
+	int ret;
+	jit_trace_s* trace;
+	jit_ctx_s ctx;
+
+	if (!mat->jit || op[2].pair.hi == JIT_TRACE_FAILED || mat->jit_depth >= JIT_MAX_DEPTH)
+		return 1;
+
+	if (op[2].pair.hi == 0) {
+		if (++op[2].pair.lo < JIT_LOOP_THRESHOLD)
+			return 1;
+
+		if (compile_trace(mat, mod, op, ip_begin) != 0) {
+			op[2].pair.hi = JIT_TRACE_FAILED;
+			return 1;
+		}
+	}
+
+	trace = &V_AT(mat->traces, op[2].pair.hi - 1, jit_trace_s);
+	ctx.mat = mat;
+	ctx.mod = mod;
+	ctx.top = &mat->stack_top;
+	ctx.stack = &V_AT(mat->stack, 0, obj_s);
+	ctx.fp = fp;
+	ctx.base = fp ? (uint32_t)(fp - ctx.stack) : 0;
+	mat->jit_depth++;
+	ret = ((jit_entry)trace->code)(&ctx);
+	mat->jit_depth--;
+
+	if (ret < 0)
+		return -1;
+
+	*pos = (uint32_t)ret;
+	return 0;
+}
+
+int JIT_init(matrix_t mat) {
+	mat->jit_depth = 0;
+	return V_init(&mat->traces, sizeof(jit_trace_s), 16);
+}
+
+void JIT_free(matrix_t mat) {
+	uint32_t i;
+
+	for (i = 0; i < V_SIZE(mat->traces); ++i) {
+		jit_trace_s* trace = &V_AT(mat->traces, i, jit_trace_s);
+		munmap(trace->code, trace->size);
+	}
+
+	V_free(&mat->traces);
+}
+
+void JIT_free_func(func_s* func) {
+	if (func->jit) {
+		munmap(func->jit, func->jit_size);
+		func->jit = NULL;
+		func->jit_size = 0;
+	}
+}
+
+#endif // MATRIX_JIT
@@ -0,0 +1,51 @@
+﻿/*
+    Matrix Script Language
+    author: Zeb
+    e-mail: zebbey@gmail.com
+    Copyright (c) 2004 Zeb.  All rights reserved.
+*/
+
+#ifndef __H_JIT__
+#define __H_JIT__
+
+#include "obj.h"
+
+#if MATRIX_JIT
+
+/**
+    基线 JIT
+    函数被解释执行的调用次数达到 JIT_CALL_THRESHOLD 后，把它的指令逐条翻译成本地代码：
+    常用的栈操作（局部对象的读写、整数入栈）直接生成机器码，其它指令生成对处理函数的调用，
+    跳转指令翻译成本地跳转，不再需要指令分派。处理函数与解释器的语义、错误信息完全相同。
+    函数里有不支持的指令时整个函数保持解释执行。
+    尾调用 IT_TAIL_CALL 需要复用解释器的调用帧，含有尾调用的函数也保持解释执行。
+
+    while 循环的回边是 IT_LOOP，for 循环的回边是 IT_FOR_LOOP，
+    回边执行次数达到 JIT_LOOP_THRESHOLD 后把整个循环编译成本地代码，
+    之后每次到达回边都直接执行循环的本地代码，循环退出或者遇到不支持的指令时从侧出口回到解释器。
+    这样只调用一次的函数和模块代码里的循环也能得到编译。
+*/
+
+// IT_LOOP 和 IT_FOR_LOOP 的计数字 pair.hi 为 trace 编号加1，编译失败时为 JIT_TRACE_FAILED
+#define JIT_TRACE_FAILED 0xffffffff
+
+// 调用 func 之前检查是否可以执行本地代码，必要时编译，返回1表示可以
+int JIT_ready(matrix_t mat, func_s* func);
+
+// 执行编译好的函数，调用帧已经建立，返回时帧已经弹出，结果留在被调用对象的位置
+int JIT_exec(matrix_t mat, mod_s* mod, func_s* func);
+
+/*
+	执行到 op 处的 IT_LOOP 或者要跳回循环体的 IT_FOR_LOOP 时调用，必要时编译循环。
+	返回0表示循环的本地代码已经执行，pos 为解释器继续执行的指令位置；
+	返回1表示没有本地代码，按普通跳转执行；出错返回 -1。
+*/
+int JIT_loop(matrix_t mat, mod_s* mod, lword_u* op, lword_u* ip_begin, obj_s* fp, uint32_t* pos);
+
+int JIT_init(matrix_t mat);
+void JIT_free(matrix_t mat);
+void JIT_free_func(func_s* func);
+
+#endif // MATRIX_JIT
+
+#endif // __H_JIT__
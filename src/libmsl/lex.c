@@ -9,103 +9,225 @@
 #include "vec.h"
 #include "str.h"
 #include "err.h"
+#include "bc.h"
 
-typedef int (*pfn_getc)();
-typedef int (*pfn_ungetc)(int);
-
-struct lex_state_s {
-	matrix_t mat;
-	const char* file_name;
-	FILE* file;
-	const char* str;
-	uint32_t str_len;
-	uint32_t str_pos;
-	uint32_t line;
-	vec_s unread; // token_s
-	int name_len;
-	char name[MAX_IDENTIFIER_LEN];
-	pfn_getc getchar;
-	pfn_ungetc ungetchar;
-	mat_str_table_s* strs;
-};
+#if MATRIX_SIMD_LEX
+#	include <immintrin.h>
+#endif
+
+// 源代码是一块连续的内存，读完时返回 EOF，退回 EOF 不移动位置
+#define GETC(l) ((l)->p < (l)->end ? (unsigned char)*(l)->p++ : EOF)
+#define UNGETC(l, c) \
+	do {\
+		if ((c) != EOF)\
+			(l)->p--;\
+	} while (0)
+
+#define IS_IDENT_CHAR(c) (isalnum(c) || (c) == '_')
+
+/*
+	成组扫描：找到下一个需要处理的字符，或者跳过一串空白。
+	x86-64 上用 SSE2 一次比较16个字节，CPU 支持 AVX2 时一次比较32个字节，不足一组的部分逐个比较，
+	不会读到 end 之后，映射的源文件末尾不需要补齐。其它平台只用逐个比较的版本。
+*/
+static const char* find_scalar(const char* p, const char* end, int a, int b, int c, int d) {
+	for (; p < end; ++p) {
+		if (*p == a || *p == b || *p == c || *p == d)
+			break;
+	}
+
+	return p;
+}
+
+static const char* skip_blank_scalar(const char* p, const char* end) {
+	while (p < end && (*p == ' ' || *p == '\t'))
+		++p;
 
-static struct lex_state_s L;
+	return p;
+}
+
+#if MATRIX_SIMD_LEX
+static const char* find_sse2(const char* p, const char* end, int a, int b, int c, int d) {
+	const __m128i va = _mm_set1_epi8((char)a);
+	const __m128i vb = _mm_set1_epi8((char)b);
+	const __m128i vc = _mm_set1_epi8((char)c);
+	const __m128i vd = _mm_set1_epi8((char)d);
+
+	while (end - p >= 16) {
+		__m128i x = _mm_loadu_si128((const __m128i*)p);
+		__m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, va), _mm_cmpeq_epi8(x, vb)),
+		                         _mm_or_si128(_mm_cmpeq_epi8(x, vc), _mm_cmpeq_epi8(x, vd)));
+		uint32_t mask = (uint32_t)_mm_movemask_epi8(m);
+
+		if (mask)
+			return p + __builtin_ctz(mask);
+
+		p += 16;
+	}
 
-static int file_getc() {
-	return getc(L.file);
+	return find_scalar(p, end, a, b, c, d);
 }
 
-static int file_ungetc(int c) {
-	return ungetc(c, L.file);
+static const char* skip_blank_sse2(const char* p, const char* end) {
+	const __m128i space = _mm_set1_epi8(' ');
+	const __m128i tab = _mm_set1_epi8('\t');
+
+	while (end - p >= 16) {
+		__m128i x = _mm_loadu_si128((const __m128i*)p);
+		__m128i m = _mm_or_si128(_mm_cmpeq_epi8(x, space), _mm_cmpeq_epi8(x, tab));
+		uint32_t mask = ~(uint32_t)_mm_movemask_epi8(m) & 0xffff;
+
+		if (mask)
+			return p + __builtin_ctz(mask);
+
+		p += 16;
+	}
+
+	return skip_blank_scalar(p, end);
 }
 
-static int str_getc() {
-	if (L.str_pos >= L.str_len)
-		return EOF;
+__attribute__((target("avx2")))
+static const char* find_avx2(const char* p, const char* end, int a, int b, int c, int d) {
+	const __m256i va = _mm256_set1_epi8((char)a);
+	const __m256i vb = _mm256_set1_epi8((char)b);
+	const __m256i vc = _mm256_set1_epi8((char)c);
+	const __m256i vd = _mm256_set1_epi8((char)d);
 
-	return L.str[L.str_pos++];
+	while (end - p >= 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i*)p);
+		__m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(x, va), _mm256_cmpeq_epi8(x, vb)),
+		                            _mm256_or_si256(_mm256_cmpeq_epi8(x, vc), _mm256_cmpeq_epi8(x, vd)));
+		uint32_t mask = (uint32_t)_mm256_movemask_epi8(m);
+
+		if (mask)
+			return p + __builtin_ctz(mask);
+
+		p += 32;
+	}
+
+	return find_sse2(p, end, a, b, c, d);
 }
 
-static int str_ungetc(int c) {
-	if (L.str_pos > 0) {
-		L.str_pos--;
-		return c;
+__attribute__((target("avx2")))
+static const char* skip_blank_avx2(const char* p, const char* end) {
+	const __m256i space = _mm256_set1_epi8(' ');
+	const __m256i tab = _mm256_set1_epi8('\t');
+
+	while (end - p >= 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i*)p);
+		__m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(x, space), _mm256_cmpeq_epi8(x, tab));
+		uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(m);
+
+		if (mask)
+			return p + __builtin_ctz(mask);
+
+		p += 32;
 	}
 
-	return EOF;
+	return skip_blank_sse2(p, end);
+}
+#endif // MATRIX_SIMD_LEX
+
+static void init_scan(lex_state_s* l) {
+#if MATRIX_SIMD_LEX
+	if (__builtin_cpu_supports("avx2")) {
+		l->find = find_avx2;
+		l->skip_blank = skip_blank_avx2;
+	}
+	else {
+		l->find = find_sse2;
+		l->skip_blank = skip_blank_sse2;
+	}
+#else
+	l->find = find_scalar;
+	l->skip_blank = skip_blank_scalar;
+#endif
 }
 
 #define ADD_CHAR(c) \
 	do {\
-		if (L.name_len >= MAX_IDENTIFIER_LEN) {\
-			E_rt_err(L.mat, L.file_name, L.line, "Identifier is too long. The max length is %d.", MAX_IDENTIFIER_LEN);\
+		if (l->name_len >= MAX_IDENTIFIER_LEN) {\
+			E_rt_err(l->mat, l->file_name, l->line, "Identifier is too long. The max length is %d.", MAX_IDENTIFIER_LEN);\
 			return -1;\
 		}\
-		L.name[L.name_len++] = c;\
+		l->name[l->name_len++] = c;\
 	} while (0);
 
-static int take_identifier(int alpha, token_s* t) {
+#define TOO_LONG(l) \
+	do {\
+		E_rt_err((l)->mat, (l)->file_name, (l)->line, "Identifier is too long. The max length is %d.", MAX_IDENTIFIER_LEN);\
+		return -1;\
+	} while (0)
+
+typedef struct keyword_s {
+	const char* word;
+	uint32_t size;
+	token_type_e tt;
+} keyword_s;
+
+/*
+	关键字的完美哈希：(首字符 + 尾字符 + 长度) & 31 对所有关键字互不相同，
+	标识符只需要查一次表、比较一次。增加关键字时要检查是否冲突，冲突时换一个哈希函数。
+*/
+#define KEYWORD_HASH(s, size) (((unsigned char)(s)[0] + (unsigned char)(s)[(size) - 1] + (size)) & 31)
+#define KEYWORD_MIN_SIZE 2
+#define KEYWORD_MAX_SIZE 8
+
+static const keyword_s keywords[32] = {
+	[1] = { "while", 5, TT_REV_WHILE },
+	[17] = { "if", 2, TT_REV_IF },
+	[15] = { "elif", 4, TT_REV_ELIF },
+	[14] = { "else", 4, TT_REV_ELSE },
+	[13] = { "def", 3, TT_REV_DEF },
+	[6] = { "return", 6, TT_REV_RETURN },
+	[18] = { "break", 5, TT_REV_BREAK },
+	[16] = { "continue", 8, TT_REV_CONTINUE },
+	[3] = { "import", 6, TT_REV_IMPORT },
+	[22] = { "as", 2, TT_REV_AS },
+	[23] = { "none", 4, TT_REV_NONE },
+	[27] = { "for", 3, TT_REV_FOR },
+	[25] = { "in", 2, TT_REV_IN },
+	[7] = { "step", 4, TT_REV_STEP },
+};
+
+/*
+	标识符直接在源代码上截取，不再复制到 name。
+	扫描的同时计算与 S_hash 相同的哈希值（最后一个字符不参与），加入字符串表时不用再算一遍。
+*/
+static int take_identifier(lex_state_s* l, token_s* t) {
 	int ret;
-	int c = alpha;
+	const char* s = l->p - 1;
+	uint32_t hash = *s << 7;
+	uint32_t size;
 
-	while (c != EOF) {
-		ADD_CHAR(c);
-		c = L.getchar();
+	while (l->p < l->end && IS_IDENT_CHAR((unsigned char)*l->p)) {
+		hash = (1000003 * hash) ^ l->p[-1];
+		l->p++;
+	}
 
-		if (!isalpha(c) && c != '_' && !isdigit(c)) {
-			L.ungetchar(c);
-			break;
+	size = (uint32_t)(l->p - s);
+
+	if (size >= MAX_IDENTIFIER_LEN)
+		TOO_LONG(l);
+
+	if (size >= KEYWORD_MIN_SIZE && size <= KEYWORD_MAX_SIZE) {
+		const keyword_s* k = &keywords[KEYWORD_HASH(s, size)];
+
+		if (k->size == size && memcmp(k->word, s, size) == 0) {
+			t->tt = k->tt;
+			return 0;
 		}
 	}
 
-	ADD_CHAR('\0');
-
-	if (strcmp("while", L.name) == 0)
-		t->tt = TT_REV_WHILE;
-	else if (strcmp("if", L.name) == 0)
-		t->tt = TT_REV_IF;
-	else if (strcmp("elif", L.name) == 0)
-		t->tt = TT_REV_ELIF;
-	else if (strcmp("else", L.name) == 0)
-		t->tt = TT_REV_ELSE;
-	else if (strcmp("def", L.name) == 0)
-		t->tt = TT_REV_DEF;
-	else if (strcmp("return", L.name) == 0)
-		t->tt = TT_REV_RETURN;
-	else if (strcmp("break", L.name) == 0)
-		t->tt = TT_REV_BREAK;
-	else if (strcmp("continue", L.name) == 0)
-		t->tt = TT_REV_CONTINUE;
-	else if (strcmp("import", L.name) == 0)
-		t->tt = TT_REV_IMPORT;
-	else if (strcmp("as", L.name) == 0)
-		t->tt = TT_REV_AS;
-	else if (strcmp("none", L.name) == 0)
-		t->tt = TT_REV_NONE;
-	else {
+	hash ^= size;
+
+	if (!hash)
+		hash = (uint32_t)(-1);
+
+	{
 		string_s* str;
 
-		ret = S_get_str(L.strs, L.name, &str);
+		ret = S_get_str_hash(l->strs, s, size, hash, &str);
 		CHECK_RESULT(ret);
 
 		assert(str);
@@ -118,12 +240,12 @@ exit0:
 	return ret;
 }
 
-static int hex2int(int32_t* out) {
-	int i;
-	unsigned int n = 0;
+static int take_hex(lex_state_s* l, token_s* t) {
+	const char* s = l->p;
+	uint32_t n = 0;
 
-	for (i = 0; i < L.name_len - 1; ++i) {
-		char c = L.name[i];
+	for (; l->p < l->end; l->p++) {
+		int c = (unsigned char)*l->p;
 
 		if (isdigit(c))
 			n = n * 16 + (c - '0');
@@ -132,101 +254,130 @@ static int hex2int(int32_t* out) {
 		else if (c >= 'A' && c <= 'F')
 			n = n * 16 + (c - 'A' + 10);
 		else
-			return -1;
-	}
-
-	*out = (int32_t)n;
-	return 0;
-}
-
-static int take_hex(token_s* t) {
-	int ret;
-	int c = L.getchar();
-
-	for (;;) {
-		if (c == EOF)
-			break;
-		else if (isdigit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F')) {
-			ADD_CHAR(c);
-			c = L.getchar();
-		}
-		else {
-			L.ungetchar(c);
 			break;
-		}
 	}
 
-	ADD_CHAR('\0');
+	if (l->p - s >= MAX_IDENTIFIER_LEN)
+		TOO_LONG(l);
 
 	t->tt = TT_CONST_INT;
-	ret = hex2int(&t->int32);
-	CHECK_RESULT(ret);
-
-	ret = 0;
-exit0:
-	return ret;
+	t->int32 = (int32_t)n;
+	return 0;
 }
 
-static int take_number(int digit, token_s* t) {
+// 数字也直接在源代码上截取，整数就地转换，实数复制出来交给 atof
+static int take_number(lex_state_s* l, token_s* t) {
+	const char* s = l->p - 1;
+	uint32_t size;
 	int dot = 0;
-	int c = digit;
 
 	assert(t);
 
 	// 处理十六进制
-	if (digit == '0') {
-		c = L.getchar();
-
-		if (c == 'x' || c == 'X')
-			return take_hex(t);
-		else {
-			L.ungetchar(c);
-			c = digit;
-		}
+	if (*s == '0' && l->p < l->end && (*l->p == 'x' || *l->p == 'X')) {
+		l->p++;
+		return take_hex(l, t);
 	}
 
-	for (;;) {
-		ADD_CHAR(c);
-		c = L.getchar();
+	while (l->p < l->end) {
+		int c = (unsigned char)*l->p;
 
-		if (c == EOF)
-			break;
-		else if (!isdigit(c)) {
-			if (!dot && c == '.') {
-				dot = 1;
-				continue;
+		if (isdigit(c)) {
+			l->p++;
+			continue;
+		}
+
+		if (!dot && c == '.') {
+			// 1..n 中的整数在 .. 之前结束，.. 作为下一个记号
+			if (l->p + 1 < l->end && l->p[1] == '.') {
+				token_s r;
+				size = (uint32_t)(l->p - s);
+				l->p += 2;
+				r.tt = TT_RANGE;
+				r.line = l->line;
+				L_unread_token(l, &r);
+				goto number;
 			}
 
-			L.ungetchar(c);
-			break;
+			dot = 1;
+			l->p++;
+			continue;
 		}
-	};
 
-	ADD_CHAR('\0');
+		break;
+	}
+
+	size = (uint32_t)(l->p - s);
+
+number:
+	if (size >= MAX_IDENTIFIER_LEN)
+		TOO_LONG(l);
 
 	if (dot) {
+		char buf[MAX_IDENTIFIER_LEN];
+		memcpy(buf, s, size);
+		buf[size] = '\0';
 		t->tt = TT_CONST_REAL;
-		t->real = (real_t)atof(L.name);
+		t->real = (real_t)atof(buf);
 	}
 	else {
+		uint32_t n = 0;
+		uint32_t i;
+
+		for (i = 0; i < size; ++i)
+			n = n * 10 + (s[i] - '0');
+
 		t->tt = TT_CONST_INT;
-		t->int32 = (int32_t)atoi(L.name);
+		t->int32 = (int32_t)n;
 	}
 
 	return 0;
 }
 
-static int take_const_string(token_s* t) {
+static int take_const_string(lex_state_s* l, token_s* t) {
 	int ret;
 	int32_t escape = 0;
+	const char* s = l->p;
 	int c;
 	assert(t);
 
+	// 没有转义字符的字符串直接在源代码上截取，成组扫描到引号、反斜杠或者换行
+	l->p = l->find(l->p, l->end, '"', '\\', '\r', '\n');
+
+	if (l->p - s > MAX_IDENTIFIER_LEN)
+		TOO_LONG(l);
+
+	if (l->p >= l->end) {
+		E_rt_err(l->mat, l->file_name, l->line, "Unfinished string.");
+		return -1;
+	}
+
+	if (*l->p == '"') {
+		string_s* str;
+		uint32_t size = (uint32_t)(l->p - s);
+
+		if (size >= MAX_IDENTIFIER_LEN)
+			TOO_LONG(l);
+
+		l->p++;
+
+		ret = S_get_str_n(l->strs, s, size, &str);
+		CHECK_RESULT(ret);
+
+		t->str = str;
+		t->tt = TT_CONST_STRING;
+		return 0;
+	}
+
+	// 有转义字符时复制到 name 再处理
+	l->name_len = (int)(l->p - s);
+	memcpy(l->name, s, l->name_len);
+
 	while (1) {
-		c = L.getchar();
+		c = GETC(l);
 
 		if (c == EOF) {
-			E_rt_err(L.mat, L.file_name, L.line, "Unfinished string.");
+			E_rt_err(l->mat, l->file_name, l->line, "Unfinished string.");
 			return -1;
 		}
 
@@ -243,15 +394,15 @@ static int take_const_string(token_s* t) {
 					break;
 
 				case '\r':
-					c = L.getchar();
+					c = GETC(l);
 
 					if (c != '\n') {
-						E_rt_err(L.mat, L.file_name, L.line, "Error escape.");
+						E_rt_err(l->mat, l->file_name, l->line, "Error escape.");
 						return -1;
 					}
 
 				case '\n':
-					L.line++;
+					l->line++;
 					escape = 0;
 					continue;
 
@@ -261,7 +412,7 @@ static int take_const_string(token_s* t) {
 					break;
 
 				default:
-					E_rt_err(L.mat, L.file_name, L.line, "Error escape.");
+					E_rt_err(l->mat, l->file_name, l->line, "Error escape.");
 					return -1;
 			}
 		}
@@ -269,7 +420,7 @@ static int take_const_string(token_s* t) {
 			switch (c) {
 				case '\r':
 				case '\n':
-					E_rt_err(L.mat, L.file_name, L.line, "Unfinished string.");
+					E_rt_err(l->mat, l->file_name, l->line, "Unfinished string.");
 					return -1;
 
 				case '\\':
@@ -278,9 +429,7 @@ static int take_const_string(token_s* t) {
 
 				case '"': {
 					string_s* str;
-					ADD_CHAR('\0');
-
-					ret = S_get_str(L.strs, L.name, &str);
+					ret = S_get_str_n(l->strs, l->name, l->name_len, &str);
 					CHECK_RESULT(ret);
 
 					t->str = str;
@@ -301,8 +450,8 @@ exit0:
 	return ret;
 }
 
-static int take_left_slash(token_s* t) {
-	int c = L.getchar();
+static int take_left_slash(lex_state_s* l, token_s* t) {
+	int c = GETC(l);
 
 	if (c == '=') {
 		t->tt = TT_OPERATOR;
@@ -311,44 +460,41 @@ static int take_left_slash(token_s* t) {
 	}
 
 	if (c == '/') {
-		while (1) {
-			c = L.getchar();
+		l->p = l->find(l->p, l->end, '\n', '\n', '\n', '\n');
 
-			if (c == EOF)
-				break;
-			else if (c == '\n') {
-				L.line++;
-				t->line++;
-				break;
-			}
+		if (l->p < l->end) {
+			l->p++;
+			l->line++;
+			t->line++;
 		}
 
 		return 1;
 	}
 	else if (c == '*') {
 		while (1) {
-			c = L.getchar();
+			l->p = l->find(l->p, l->end, '*', '\n', '*', '\n');
+			c = GETC(l);
 
 			if (c == '\n') {
 				t->line++;
-				L.line++;
+				l->line++;
 			}
 			else if (c == EOF) {
-				E_rt_err(L.mat, L.file_name, L.line, "Unfinished comment block.");
+				E_rt_err(l->mat, l->file_name, l->line, "Unfinished comment block.");
 				return -1;
 			}
 			else if (c == '*') {
-				c = L.getchar();
+				c = GETC(l);
 
 				if (c == EOF) {
-					E_rt_err(L.mat, L.file_name, L.line, "Unfinished comment block.");
+					E_rt_err(l->mat, l->file_name, l->line, "Unfinished comment block.");
 					return -1;
 				}
 
 				if (c == '/')
 					break;
 				else
-					L.ungetchar(c);
+					UNGETC(l, c);
 			}
 		}
 
@@ -359,118 +505,113 @@ static int take_left_slash(token_s* t) {
 		t->ot = OT_DIV;
 
 		if (c != EOF)
-			L.ungetchar(c);
+			UNGETC(l, c);
 	}
 
 	return 0;
 }
 
 /* method */
-int L_init() {
+int L_init(lex_state_s* l) {
 	int ret;
-	L.file = NULL;
-	L.line = 1;
-
-	ret = V_init(&L.unread, sizeof(token_s), 5);
+	l->image = NULL;
+	l->image_size = 0;
+	l->begin = NULL;
+	l->p = NULL;
+	l->end = NULL;
+	l->line = 1;
+
+	ret = V_init(&l->unread, sizeof(token_s), 5);
 	CHECK_RESULT(ret);
 
-	L.name_len = 0;
-	memset(L.name, 0, sizeof(L.name));
-	L.getchar = NULL;
-	L.ungetchar = NULL;
-	L.strs = NULL;
+	l->name_len = 0;
+	memset(l->name, 0, sizeof(l->name));
+	l->strs = NULL;
 
 	ret = 0;
 exit0:
 	return ret;
 }
 
-void L_clear() {
-	if (L.file) {
-		fclose(L.file);
-		L.file = NULL;
+void L_clear(lex_state_s* l) {
+	if (l->image) {
+		BC_unmap_file(l->image, l->image_size);
+		l->image = NULL;
+		l->image_size = 0;
 	}
 
-	V_free(&L.unread);
-	L.line = 1;
-	L.name[0] = '\0';
-	L.name_len = 0;
-	L.getchar = NULL;
-	L.ungetchar = NULL;
-	L.strs = NULL;
+	V_free(&l->unread);
+	l->begin = NULL;
+	l->p = NULL;
+	l->end = NULL;
+	l->line = 1;
+	l->name[0] = '\0';
+	l->name_len = 0;
+	l->strs = NULL;
 }
 
-int L_set_env(matrix_t mat, const char* filename, mat_str_table_s* mat_str_table) {
+int L_set_env(lex_state_s* l, matrix_t mat, const char* filename, mat_str_table_s* mat_str_table) {
 	int ret;
 	char path[MAX_PATH];
+	struct stat st;
 	assert(filename);
 	assert(mat_str_table);
 
+	// 整个源文件只读映射到内存，空文件不能映射，按空的源代码处理
 	sprintf(path, "%s.mat", filename);
-	L.file = fopen(path, "rb");
-	CHECK_CONDITION(L.file);
 
-	ret = V_init(&L.unread, sizeof(token_s), 5);
-	CHECK_RESULT(ret);
+	if (BC_map_file(path, &l->image, &l->image_size) != 0) {
+		CHECK_CONDITION(stat(path, &st) == 0 && st.st_size == 0);
+		l->image = NULL;
+		l->image_size = 0;
+	}
 
-	L.mat = mat;
-	L.file_name = filename;
-	L.str = NULL;
-	L.str_pos = 0;
-	L.strs = mat_str_table;
-	L.line = 1;
-	L.getchar = file_getc;
-	L.ungetchar = file_ungetc;
+	ret = L_set_env_str(l, mat, filename, (const char*)l->image, l->image_size, mat_str_table);
+	CHECK_RESULT(ret);
 
 	ret = 0;
 exit0:
 	return ret;
 }
 
-int L_set_env_str(matrix_t mat, const char* file_name, const char* str, uint32_t size, mat_str_table_s* mat_str_table) {
+int L_set_env_str(lex_state_s* l, matrix_t mat, const char* file_name, const char* str, uint32_t size, mat_str_table_s* mat_str_table) {
 	int ret;
 	assert(file_name);
 	assert(mat_str_table);
 
-	ret = V_init(&L.unread, sizeof(token_s), 5);
+	ret = V_init(&l->unread, sizeof(token_s), 5);
 	CHECK_RESULT(ret);
 
-	L.mat = mat;
-	L.file = NULL;
-	L.str = str;
-	L.str_len = size;
-	L.str_pos = 0;
-	L.file_name = file_name;
-	L.strs = mat_str_table;
-	L.line = 1;
-	L.getchar = str_getc;
-	L.ungetchar = str_ungetc;
+	l->mat = mat;
+	l->begin = str;
+	l->p = str;
+	l->end = str + size;
+	l->file_name = file_name;
+	l->strs = mat_str_table;
+	l->line = 1;
+	init_scan(l);
 
 	ret = 0;
 exit0:
 	return ret;
 }
 
-int L_read_token(token_s* t) {
+int L_read_token(lex_state_s* l, token_s* t) {
 	int ret;
 	assert(t);
-	assert(L.getchar);
-	assert(L.ungetchar);
 
-	if (V_SIZE(L.unread)) {
-		*t = V_AT(L.unread, --V_SIZE(L.unread), token_s);
+	if (V_SIZE(l->unread)) {
+		*t = V_AT(l->unread, --V_SIZE(l->unread), token_s);
 		return 0;
 	}
 
-	L.name_len = 0;
-	L.name[0] = '\0';
+	l->name_len = 0;
+	l->name[0] = '\0';
 
 	while (1) {
-		int c = L.getchar();
-		int alpha = c;
-		int digit = c;
+		int c = GETC(l);
 
-		t->line = L.line;
+		t->line = l->line;
 
 		if (isalpha(c))
 			c = 'a';
@@ -483,41 +624,45 @@ int L_read_token(token_s* t) {
 				return 0;
 
 			case '\n':
-				++L.line;
+				++l->line;
 				continue;
 
 			case '\r': {
-				int n = L.getchar();
-				++L.line;
+				int n = GETC(l);
+				++l->line;
 
 				if (n != '\n')
-					L.ungetchar(n);
+					UNGETC(l, n);
 
 				continue;
 			}
 
 
+			// 单个空格最常见，不值得调用扫描函数
 			case ' ':
 			case '\t':
+				if (l->p < l->end && (*l->p == ' ' || *l->p == '\t'))
+					l->p = l->skip_blank(l->p, l->end);
+
 				continue;
 
 			case 'a':
 			case '_': {
-				ret = take_identifier(alpha, t);
+				ret = take_identifier(l, t);
 				CHECK_RESULT(ret);
 
 				return 0;
 			}
 
 			case '1': {
-				ret = take_number(digit, t);
+				ret = take_number(l, t);
 				CHECK_RESULT(ret);
 
 				return 0;
 			}
 
 			case '"': {
-				ret = take_const_string(t);
+				ret = take_const_string(l, t);
 				CHECK_RESULT(ret);
 
 				return 0;
@@ -556,7 +701,17 @@ int L_read_token(token_s* t) {
 				return 0;
 
 			case '.':
-				t->tt = TT_POINT;
+				c = GETC(l);
+
+				if (c == '.')
+					t->tt = TT_RANGE;
+				else {
+					t->tt = TT_POINT;
+
+					if (c != EOF)
+						UNGETC(l, c);
+				}
+
 				return 0;
 
 			case ';':
@@ -565,7 +720,7 @@ int L_read_token(token_s* t) {
 
 			case '+':
 				t->tt = TT_OPERATOR;
-				c = L.getchar();
+				c = GETC(l);
 
 				if (c == '=')
 					t->ot = OT_ASSIGN_ADD;
@@ -575,14 +730,14 @@ int L_read_token(token_s* t) {
 					t->ot = OT_ADD;
 
 					if (c != EOF)
-						L.ungetchar(c);
+						UNGETC(l, c);
 				}
 
 				return 0;
 
 			case '-':
 				t->tt = TT_OPERATOR;
-				c = L.getchar();
+				c = GETC(l);
 
 				if (c == '=')
 					t->ot = OT_ASSIGN_SUB;
@@ -592,14 +747,14 @@ int L_read_token(token_s* t) {
 					t->ot = OT_SUB;
 
 					if (c != EOF)
-						L.ungetchar(c);
+						UNGETC(l, c);
 				}
 
 				return 0;
 
 			case '*':
 				t->tt = TT_OPERATOR;
-				c = L.getchar();
+				c = GETC(l);
 
 				if (c == '=')
 					t->ot = OT_ASSIGN_MUL;
@@ -607,13 +762,13 @@ int L_read_token(token_s* t) {
 					t->ot = OT_MUL;
 
 					if (c != EOF)
-						L.ungetchar(c);
+						UNGETC(l, c);
 				}
 
 				return 0;
 
 			case '/': {
-				ret = take_left_slash(t);
+				ret = take_left_slash(l, t);
 
 				if (ret == 0)
 					return 0;
@@ -625,7 +780,7 @@ int L_read_token(token_s* t) {
 
 			case '&':
 				t->tt = TT_OPERATOR;
-				c = L.getchar();
+				c = GETC(l);
 
 				if (c == '=')
 					t->ot = OT_ASSIGN_ADD;
@@ -635,20 +790,20 @@ int L_read_token(token_s* t) {
 					t->ot = OT_BITWISE_AND;
 
 					if (c != EOF)
-						L.ungetchar(c);
+						UNGETC(l, c);
 				}
 
 				return 0;
 
 			case '!':
 				t->tt = TT_OPERATOR;
-				c = L.getchar();
+				c = GETC(l);
 
 				if (c == '=')
 					t->ot = OT_NOT_EQUAL;
 				else {
 					if (c != EOF)
-						L.ungetchar(c);
+						UNGETC(l, c);
 
 					t->ot = OT_LOGICAL_NOT;
 				}
@@ -657,7 +812,7 @@ int L_read_token(token_s* t) {
 
 			case '|':
 				t->tt = TT_OPERATOR;
-				c = L.getchar();
+				c = GETC(l);
 
 				if (c == '=')
 					t->ot = OT_ASSIGN_OR;
@@ -665,7 +820,7 @@ int L_read_token(token_s* t) {
 					t->ot = OT_LOGICAL_OR;
 				else {
 					if (c != EOF)
-						L.ungetchar(c);
+						UNGETC(l, c);
 
 					t->ot = OT_BITWISE_OR;
 				}
@@ -680,13 +835,13 @@ int L_read_token(token_s* t) {
 
 			case '#':
 				t->tt = TT_OPERATOR;
-				c = L.getchar();
+				c = GETC(l);
 
 				if (c == '=')
 					t->ot = OT_ASSIGN_XOR;
 				else {
 					if (c != EOF)
-						L.ungetchar(c);
+						UNGETC(l, c);
 
 					t->ot = OT_BITWISE_XOR;
 				}
@@ -695,13 +850,13 @@ int L_read_token(token_s* t) {
 
 			case '^':
 				t->tt = TT_OPERATOR;
-				c = L.getchar();
+				c = GETC(l);
 
 				if (c == '=')
 					t->ot = OT_ASSIGN_EXP;
 				else {
 					if (c != EOF)
-						L.ungetchar(c);
+						UNGETC(l, c);
 
 					t->ot = OT_EXP;
 				}
@@ -710,13 +865,13 @@ int L_read_token(token_s* t) {
 
 			case '%':
 				t->tt = TT_OPERATOR;
-				c = L.getchar();
+				c = GETC(l);
 
 				if (c == '=')
 					t->ot = OT_ASSIGN_MOD;
 				else {
 					if (c != EOF)
-						L.ungetchar(c);
+						UNGETC(l, c);
 
 					t->ot = OT_MOD;
 				}
@@ -725,16 +880,16 @@ int L_read_token(token_s* t) {
 
 			case '<':
 				t->tt = TT_OPERATOR;
-				c = L.getchar();
+				c = GETC(l);
 
 				if (c == '<') {
-					c = L.getchar();
+					c = GETC(l);
 
 					if (c == '=')
 						t->ot = OT_ASSIGN_SHIFT_LEFT;
 					else {
 						if (c != EOF)
-							L.ungetchar(c);
+							UNGETC(l, c);
 
 						t->ot = OT_BITWISE_SHIFT_LEFT;
 					}
@@ -743,7 +898,7 @@ int L_read_token(token_s* t) {
 					t->ot = OT_LESS_EQUAL;
 				else {
 					if (c != EOF)
-						L.ungetchar(c);
+						UNGETC(l, c);
 
 					t->ot = OT_LESS;
 				}
@@ -752,16 +907,16 @@ int L_read_token(token_s* t) {
 
 			case '>':
 				t->tt = TT_OPERATOR;
-				c = L.getchar();
+				c = GETC(l);
 
 				if (c == '>') {
-					c = L.getchar();
+					c = GETC(l);
 
 					if (c == '=')
 						t->ot = OT_ASSIGN_SHIFT_RIGHT;
 					else {
 						if (c != EOF)
-							L.ungetchar(c);
+							UNGETC(l, c);
 
 						t->ot = OT_BITWISE_SHIFT_RIGHT;
 					}
@@ -770,7 +925,7 @@ int L_read_token(token_s* t) {
 					t->ot = OT_GREATER_EQUAL;
 				else {
 					if (c != EOF)
-						L.ungetchar(c);
+						UNGETC(l, c);
 
 					t->ot = OT_GREATER;
 				}
@@ -779,13 +934,13 @@ int L_read_token(token_s* t) {
 
 			case '=':
 				t->tt = TT_OPERATOR;
-				c = L.getchar();
+				c = GETC(l);
 
 				if (c == '=')
 					t->ot = OT_EQUAL;
 				else {
 					if (c != EOF)
-						L.ungetchar(c);
+						UNGETC(l, c);
 
 					t->ot = OT_ASSIGN;
 				}
@@ -793,7 +948,7 @@ int L_read_token(token_s* t) {
 				return 0;
 
 			default:
-				E_rt_err(L.mat, L.file_name, L.line, "Unrecognize symbol: %c(0x%x).", c, c);
+				E_rt_err(l->mat, l->file_name, l->line, "Unrecognize symbol: %c(0x%x).", c, c);
 				return -1;
 		}
 	}
@@ -803,14 +958,139 @@ exit0:
 	return ret;
 }
 
-int L_unread_token(token_s* t) {
+uint32_t L_tell(lex_state_s* l, uint32_t* line) {
+	assert(V_SIZE(l->unread) == 0);
+
+	*line = l->line;
+	return (uint32_t)(l->p - l->begin);
+}
+
+void L_seek(lex_state_s* l, uint32_t pos, uint32_t line) {
+	assert(pos <= (uint32_t)(l->end - l->begin));
+
+	V_SIZE(l->unread) = 0;
+	l->p = l->begin + pos;
+	l->line = line;
+}
+
+/*
+	跳过函数体，刚读过左花括号，找到与它匹配的右花括号。
+	字符串和注释里的花括号不算，规则与 take_const_string、take_left_slash 相同，行号照常计数，
+	函数体内的其它错误要到编译函数体时才会报告。
+*/
+int L_skip_block(lex_state_s* l) {
+	int depth = 1;
+	int c;
+	assert(V_SIZE(l->unread) == 0);
+
+	while (depth > 0) {
+		c = GETC(l);
+
+		switch (c) {
+			case EOF:
+				E_rt_err(l->mat, l->file_name, l->line, "Unfinished function body.");
+				return -1;
+
+			case '{':
+				depth++;
+				break;
+
+			case '}':
+				depth--;
+				break;
+
+			case '\n':
+				l->line++;
+				break;
+
+			case '\r':
+				l->line++;
+				c = GETC(l);
+
+				if (c != '\n' && c != EOF)
+					UNGETC(l, c);
+
+				break;
+
+			case '"':
+				while (1) {
+					c = GETC(l);
+
+					if (c == '"')
+						break;
+
+					if (c == EOF || c == '\r' || c == '\n') {
+						E_rt_err(l->mat, l->file_name, l->line, "Unfinished string.");
+						return -1;
+					}
+
+					if (c == '\\') {
+						c = GETC(l);
+
+						if (c == '\r')
+							c = GETC(l);
+
+						if (c == '\n')
+							l->line++;
+						else if (c == EOF) {
+							E_rt_err(l->mat, l->file_name, l->line, "Unfinished string.");
+							return -1;
+						}
+					}
+				}
+
+				break;
+
+			case '/':
+				c = GETC(l);
+
+				if (c == '/') {
+					while ((c = GETC(l)) != EOF && c != '\n')
+						;
+
+					if (c == '\n')
+						l->line++;
+				}
+				else if (c == '*') {
+					int last = 0;
+
+					while (1) {
+						c = GETC(l);
+
+						if (c == EOF) {
+							E_rt_err(l->mat, l->file_name, l->line, "Unfinished comment block.");
+							return -1;
+						}
+
+						if (c == '\n')
+							l->line++;
+						else if (last == '*' && c == '/')
+							break;
+
+						last = c;
+					}
+				}
+				else if (c != EOF)
+					UNGETC(l, c);
+
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	return 0;
+}
+
+int L_unread_token(lex_state_s* l, token_s* t) {
 	assert(t);
-	V_PUSH_BACK(L.unread, *t, token_s);
+	V_PUSH_BACK(l->unread, *t, token_s);
 	return 0;
 }
 
-const char* L_token_to_string(token_s* t) {
-	static char buf[128];
+const char* L_token_to_string(lex_state_s* l, token_s* t) {
+	char* buf = l->buf;
 
 	switch (t->tt) {
 		case TT_STREAM_END:
@@ -846,12 +1126,24 @@ const char* L_token_to_string(token_s* t) {
 		case TT_REV_NONE:
 			return "[none]";
 
+		case TT_REV_FOR:
+			return "[for]";
+
+		case TT_REV_IN:
+			return "[in]";
+
+		case TT_REV_STEP:
+			return "[step]";
+
 		case TT_COMMA:               // ,
 			return "[,]";
 
 		case TT_POINT:               // .
 			return "[.]";
 
+		case TT_RANGE:               // ..
+			return "[..]";
+
 		case TT_SEMICOLON:           // ;
 			return "[;]";
 
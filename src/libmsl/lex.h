@@ -9,6 +9,8 @@
 #define __H_LEX__
 
 #include "str.h"
+#include "vec.h"
+#include "vec.h"
 
 typedef enum {
     TT_STREAM_END = 0,
@@ -24,9 +26,13 @@ typedef enum {
     TT_REV_IMPORT,
     TT_REV_AS,
     TT_REV_NONE,
+    TT_REV_FOR,
+    TT_REV_IN,
+    TT_REV_STEP,
 
     TT_COMMA,               // ,
     TT_POINT,               // .
+    TT_RANGE,               // ..
     TT_COLON,               // :
     TT_SEMICOLON,           // ;
 
@@ -104,13 +110,39 @@ typedef struct token_s {
 	};
 } token_s;
 
-int L_init();
-void L_clear();
-int L_set_env(matrix_t mat, const char* filename, mat_str_table_s* mat_str_table);
-int L_set_env_str(matrix_t mat, const char* file_name, const char* str, uint32_t size, mat_str_table_s* mat_str_table);
-int L_read_token(token_s* t);
-int L_unread_token(token_s* t);
-const char* L_token_to_string(token_s* t);
+// 词法分析状态，每次解析使用自己的一份，不同的虚拟机可以在不同的线程里同时解析
+// 源代码总是一块连续的内存：文件只读映射，字符串直接使用调用者的缓冲区，读取字符只需移动指针
+typedef struct lex_state_s {
+	matrix_t mat;
+	const char* file_name;
+	void* image; // L_set_env 映射的源文件
+	uint32_t image_size;
+	const char* begin;
+	const char* p; // 下一个要读的字符
+	const char* end;
+	uint32_t line;
+	vec_s unread; // token_s
+	int name_len;
+	char name[MAX_IDENTIFIER_LEN]; // 含有转义字符的字符串常量
+	char buf[128]; // L_token_to_string 返回的数字
+	mat_str_table_s* strs;
+	// 按 CPU 选择的扫描函数：找到第一个等于 a、b、c、d 之一的字符，跳过空格和制表符，都不越过 end
+	const char* (*find)(const char* p, const char* end, int a, int b, int c, int d);
+	const char* (*skip_blank)(const char* p, const char* end);
+} lex_state_s;
+
+int L_init(lex_state_s* l);
+void L_clear(lex_state_s* l);
+int L_set_env(lex_state_s* l, matrix_t mat, const char* filename, mat_str_table_s* mat_str_table);
+int L_set_env_str(lex_state_s* l, matrix_t mat, const char* file_name, const char* str, uint32_t size, mat_str_table_s* mat_str_table);
+int L_read_token(lex_state_s* l, token_s* t);
+int L_unread_token(lex_state_s* l, token_s* t);
+
+// 以下用于延迟编译函数体，调用时不能有退回的 token
+uint32_t L_tell(lex_state_s* l, uint32_t* line);
+void L_seek(lex_state_s* l, uint32_t pos, uint32_t line);
+int L_skip_block(lex_state_s* l);
+const char* L_token_to_string(lex_state_s* l, token_s* t);
 
 #endif
 
@@ -0,0 +1,315 @@
+﻿/*
+    Matrix Script Language
+    author: Zeb
+    e-mail: zebbey@gmail.com
+    Copyright (c) 2004 Zeb.  All rights reserved.
+*/
+
+#include "obj.h"
+#include "link.h"
+#include "ins.h"
+#include "vec.h"
+#include "str.h"
+#include "err.h"
+#include "vm.h"
+#include "hash_list.h"
+
+// 帧基址指向第一个参数，参数和局部对象连续存放，槽位就是函数对象的下标
+static int32_t local_offset(func_s* func, uint32_t idx) {
+	assert(idx < HL_SIZE(func->objs));
+	return (int32_t)idx;
+}
+
+static int is_ref_ins(uint32_t ins) {
+	switch (ins) {
+		case IT_REF_OBJ:
+		case IT_PUSH_OBJ:
+		case IT_ASSIGN:
+		case IT_ASSIGN_ADD:
+		case IT_ASSIGN_SUB:
+		case IT_ASSIGN_MUL:
+		case IT_ASSIGN_DIV:
+		case IT_ASSIGN_MOD:
+		case IT_ASSIGN_EXP:
+		case IT_ASSIGN_AND:
+		case IT_ASSIGN_OR:
+		case IT_ASSIGN_XOR:
+		case IT_ASSIGN_SHIFT_LEFT:
+		case IT_ASSIGN_SHIFT_RIGHT:
+		case IT_ASSIGN_INT:
+		case IT_ASSIGN_ADD_INT:
+		case IT_ASSIGN_SUB_INT:
+		case IT_PUSH_ADD_INT:
+		case IT_PUSH_SUB_INT:
+			return 1;
+
+		default:
+			return 0;
+	}
+}
+
+static int link_ref(mod_s* mod, func_s* func, vec_s* caches, uint32_t* ip, lword_u* lp) {
+	int32_t mod_pos = (int32_t)ip[1];
+	int32_t pos = (int32_t)ip[2];
+	uint32_t n = ip[3];
+	uint32_t idx;
+
+	lp[1].objs = (obj_s**)&mod->objs.obj.p;
+	lp[3].pair.lo = n;
+
+	if (pos >= 0) {
+		if (mod_pos == -1) {
+			lp[2].u = (uint32_t)pos;
+			lp[3].pair.hi = LK_REF_GLOBAL;
+		}
+		else {
+			ref_cache_s* cache = &V_AT(*caches, V_SIZE(*caches)++, ref_cache_s);
+			memset(cache, 0, sizeof(ref_cache_s));
+			cache->mod_pos = (uint32_t)mod_pos;
+			cache->pos = (uint32_t)pos;
+			lp[2].cache = cache;
+			lp[3].pair.hi = LK_REF_MOD;
+		}
+
+		return 0;
+	}
+
+	// 局部对象只会出现在函数里，并且不能被模块限定
+	if (mod_pos != -1 || !func)
+		return -1;
+
+	idx = (uint32_t)(-(pos + 1));
+	lp[2].i = local_offset(func, idx);
+	lp[3].pair.hi = LK_REF_LOCAL;
+	return 0;
+}
+
+// for 循环变量的 (var, objs) 两个字，var 与 parse 的 id_pos 相同，局部对象的 objs 为 NULL
+static int link_for_var(mod_s* mod, func_s* func, uint32_t* ip, lword_u* lp) {
+	int32_t pos = (int32_t)ip[0];
+
+	if (pos >= 0) {
+		lp[0].u = (uint32_t)pos;
+		lp[1].objs = (obj_s**)&mod->objs.obj.p;
+		return 0;
+	}
+
+	if (!func)
+		return -1;
+
+	lp[0].i = local_offset(func, (uint32_t)(-(pos + 1)));
+	lp[1].objs = NULL;
+	return 0;
+}
+
+static int link_code(matrix_t mat, mod_s* mod, func_s* func, vec_s* code, vec_s* lcode, vec_s* caches, string_s** strs) {
+	int ret;
+	uint32_t* ip = &V_AT(*code, 0, uint32_t);
+	uint32_t* ip_begin = ip;
+	uint32_t* ip_end = ip + V_SIZE(*code);
+	lword_u* lp_begin;
+	uint32_t i;
+	uint32_t n = 0;
+
+	ret = V_reserve(lcode, V_SIZE(*code));
+	CHECK_RESULT(ret);
+
+	// 内联缓存一次分配好，指令字里保存它们的地址
+	for (ip = ip_begin; ip < ip_end; ip += INS_size(*ip)) {
+		CHECK_CONDITION(INS_size(*ip) > 0 && ip + INS_size(*ip) <= ip_end);
+
+		if (is_ref_ins(*ip) && (int32_t)ip[1] != -1 && (int32_t)ip[2] >= 0)
+			n++;
+	}
+
+	ip = ip_begin;
+	V_SIZE(*caches) = 0;
+	ret = V_reserve(caches, n);
+	CHECK_RESULT(ret);
+
+	V_SIZE(*lcode) = V_SIZE(*code);
+	lp_begin = &V_AT(*lcode, 0, lword_u);
+
+	for (i = 0; i < V_SIZE(*code); ++i) {
+		memset(lp_begin + i, 0, sizeof(lword_u));
+		lp_begin[i].u = ip_begin[i];
+	}
+
+	while (ip < ip_end) {
+		lword_u* lp = lp_begin + (ip - ip_begin);
+		uint32_t ins = *ip;
+		uint32_t size = INS_size(ins);
+
+		CHECK_CONDITION(size > 0 && ip + size <= ip_end);
+
+		switch (ins) {
+			case IT_IMPORT:
+			case IT_PUSH_STRING:
+				if (strs) {
+					lp[1].str = strs[ip[1]];
+				}
+				else {
+					ret = S_get_str_by_idx(&mat->strs_nogc, ip[1], &lp[1].str);
+					CHECK_RESULT(ret);
+				}
+				break;
+
+			case IT_FALSE_JMP:
+			case IT_TRUE_JMP:
+			case IT_JMP:
+			case IT_LOOP:
+			case IT_TRUE_JMP_KEEP:
+			case IT_FALSE_JMP_KEEP:
+			case IT_FALSE_JMP_EQ:
+			case IT_FALSE_JMP_NEQ:
+			case IT_FALSE_JMP_LT:
+			case IT_FALSE_JMP_LE:
+			case IT_FALSE_JMP_GT:
+			case IT_FALSE_JMP_GE:
+				CHECK_CONDITION(ip[1] <= V_SIZE(*code));
+				lp[1].ip = lp_begin + ip[1];
+				break;
+
+			case IT_FOR_PREP:
+				CHECK_CONDITION(ip[1] <= V_SIZE(*code));
+				lp[1].ip = lp_begin + ip[1];
+				ret = link_for_var(mod, func, ip + 2, lp + 2);
+				CHECK_RESULT(ret);
+				break;
+
+			case IT_FOR_LOOP:
+				CHECK_CONDITION(ip[1] <= V_SIZE(*code));
+				lp[1].ip = lp_begin + ip[1];
+				ret = link_for_var(mod, func, ip + 3, lp + 3);
+				CHECK_RESULT(ret);
+				break;
+
+			case IT_INLINE_GUARD:
+				CHECK_CONDITION(ip[1] <= V_SIZE(*code) && ip[2] < V_SIZE(mod->funcs));
+				lp[1].ip = lp_begin + ip[1];
+				lp[2].func = V_AT(mod->funcs, ip[2], func_s*);
+				break;
+
+			case IT_PUSH_LOCAL:
+			case IT_STORE_LOCAL:
+				CHECK_CONDITION(func);
+				lp[1].i = local_offset(func, ip[1]);
+				break;
+
+			case IT_PUSH_GLOBAL:
+			case IT_STORE_GLOBAL:
+				lp[2].objs = (obj_s**)&mod->objs.obj.p;
+				break;
+
+			case IT_R_MOVE:
+				CHECK_CONDITION(func);
+				lp[1].i = local_offset(func, ip[1]);
+				lp[2].i = local_offset(func, ip[2]);
+				break;
+
+			case IT_R_LOADI:
+				CHECK_CONDITION(func);
+				lp[1].i = local_offset(func, ip[1]);
+				break;
+
+			case IT_R_ADD:
+			case IT_R_SUB:
+			case IT_R_MUL:
+			case IT_R_DIV:
+			case IT_R_EQ:
+			case IT_R_NEQ:
+			case IT_R_LT:
+			case IT_R_LE:
+			case IT_R_GT:
+			case IT_R_GE:
+				CHECK_CONDITION(func);
+				lp[1].i = local_offset(func, ip[1]);
+				lp[2].i = local_offset(func, ip[2]);
+				lp[3].i = local_offset(func, ip[3]);
+				break;
+
+			case IT_R_FALSE_JMP:
+			case IT_R_TRUE_JMP:
+				CHECK_CONDITION(func && ip[2] <= V_SIZE(*code));
+				lp[1].i = local_offset(func, ip[1]);
+				lp[2].ip = lp_begin + ip[2];
+				break;
+
+			default:
+				if (is_ref_ins(ins)) {
+					ret = link_ref(mod, func, caches, ip, lp);
+					CHECK_RESULT(ret);
+				}
+
+				break;
+		}
+
+		lp[0] = VM_handler(mat, ins);
+		ip += size;
+	}
+
+	ret = 0;
+exit0:
+	return ret;
+}
+
+/* method */
+int LK_link_mod(matrix_t mat, mod_s* mod, string_s** strs) {
+	int ret;
+	uint32_t i;
+	assert(mat);
+	assert(mod);
+
+	ret = link_code(mat, mod, NULL, &mod->code, &mod->lcode, &mod->caches, strs);
+	CHECK_RESULT(ret);
+
+	for (i = 0; i < V_SIZE(mod->funcs); ++i) {
+		func_s* func = V_AT(mod->funcs, i, func_s*);
+
+		// 函数代码解析完成后不再变化，已经链接过的不需要再次链接，延迟编译的函数在编译函数体时链接
+		if (V_SIZE(func->lcode) > 0 || func->lazy)
+			continue;
+
+		ret = LK_link_func(mat, mod, func, strs);
+		CHECK_RESULT(ret);
+	}
+
+	ret = 0;
+exit0:
+	return ret;
+}
+
+int LK_link_func(matrix_t mat, mod_s* mod, func_s* func, string_s** strs) {
+	int ret;
+	assert(mat);
+	assert(mod);
+	assert(func);
+
+	ret = link_code(mat, mod, func, &func->code, &func->lcode, &func->caches, strs);
+	CHECK_RESULT(ret);
+
+	// 每条指令最多压入一个对象，临时对象不会超过指令字数
+	func->entry = &V_AT(func->lcode, 0, lword_u);
+	func->local_num = HL_SIZE(func->objs) - func->param_num;
+	func->frame_size = HL_SIZE(func->objs) + V_SIZE(func->lcode);
+
+	ret = 0;
+exit0:
+	return ret;
+}
+
+int LK_ref_mod_obj(ref_cache_s* cache, mod_s* mod, obj_s** ref) {
+	int ret;
+	assert(cache);
+	assert(mod);
+
+	ret = HL_ref_obj(&mod->objs, cache->pos, ref);
+	CHECK_RESULT(ret);
+
+	cache->mod = mod;
+	cache->objs = &V_AT(mod->objs.obj, 0, obj_s);
+	cache->ref = *ref;
+	ret = 0;
+exit0:
+	return ret;
+}
@@ -0,0 +1,56 @@
+﻿/*
+    Matrix Script Language
+    author: Zeb
+    e-mail: zebbey@gmail.com
+    Copyright (c) 2004 Zeb.  All rights reserved.
+*/
+
+#ifndef __H_LINK__
+#define __H_LINK__
+
+#include "matrix.h"
+#include "mod.h"
+
+/**
+    链接阶段
+    解析完成后，把 code 转换为 lcode，虚拟机只执行 lcode。
+    lcode 与 code 逐字对应，所以跳转地址、返回地址和 op_line 都不需要修改。
+    指令字保存处理代码的地址，操作数在这里一次性解码：
+    字符串索引换成 string_s*，跳转位置换成目标指令字的地址，
+    对象引用 (mod_pos, pos, n) 换成下面的形式：
+        word1: 所在模块对象数组的地址
+        word2: 全局对象为下标；局部对象为相对于帧基址的偏移；
+               模块限定对象为内联缓存 ref_cache_s 的地址
+        word3: (下标个数, 引用类型)
+    槽位指令 PUSH_LOCAL/STORE_LOCAL 的 k 换成相对于帧基址的偏移，
+    PUSH_GLOBAL/STORE_GLOBAL 的 k 不变，第二个操作数换成所在模块对象数组的地址。
+    寄存器指令的寄存器操作数换成相对于帧基址的偏移。
+    INLINE_GUARD 的函数表下标换成 func_s*。
+*/
+
+typedef enum {
+	LK_REF_GLOBAL,
+	LK_REF_LOCAL,
+	LK_REF_MOD,
+} link_ref_e;
+
+/*
+	链接模块代码和模块内所有未链接的函数
+	strs 为 NULL 时字符串索引是 strs_nogc 的下标，否则是 strs 的下标（从字节码缓存加载的代码）
+*/
+int LK_link_mod(matrix_t mat, mod_s* mod, string_s** strs);
+
+// 链接模块 mod 中的一个函数，strs 与 LK_link_mod 相同
+int LK_link_func(matrix_t mat, mod_s* mod, func_s* func, string_s** strs);
+
+/*
+	模块限定引用的内联缓存
+	mo 为所在模块中的模块对象，它仍然是缓存的模块，并且模块的对象数组没有重新分配时，
+	缓存的对象地址仍然有效，否则由 LK_ref_mod_obj 重新解析并更新缓存。
+*/
+#define LK_CACHE_HIT(cache, mo) \
+	((mo)->type == MAT_OT_MOD && (mo)->mod == (cache)->mod && (obj_s*)(cache)->mod->objs.obj.p == (cache)->objs)
+
+int LK_ref_mod_obj(ref_cache_s* cache, mod_s* mod, obj_s** ref);
+
+#endif // __H_LINK__
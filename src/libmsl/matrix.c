@@ -18,6 +18,7 @@
 #include "hash_list.h"
 #include "list.h"
 #include "builtins.h"
+#include "snap.h"
 
 /* method */
 int MAT_init(matrix_t* mat) {
@@ -37,7 +38,79 @@ int MAT_init(matrix_t* mat) {
 int MAT_free(matrix_t mat) {
 	VM_free(mat);
 	free(mat);
-	P_clear();
+	return 0;
+}
+
+int MAT_snapshot(matrix_t mat, const char* path) {
+	assert(mat);
+	assert(path);
+	return SN_save(mat, path);
+}
+
+int MAT_restore(const char* path, matrix_t* mat) {
+	int ret;
+	matrix_t m = NULL;
+	assert(path);
+	assert(mat);
+
+	ret = MAT_init(&m);
+	CHECK_RESULT(ret);
+
+	ret = SN_load(m, path);
+	CHECK_RESULT(ret);
+
+	*mat = m;
+	m = NULL;
+	ret = 0;
+exit0:
+	if (m)
+		MAT_free(m);
+
+	return ret;
+}
+
+int MAT_set_backend(matrix_t mat, mat_backend_e backend) {
+	assert(mat);
+
+	if (backend != MAT_BACKEND_STACK && backend != MAT_BACKEND_REGISTER)
+		return -1;
+
+	mat->backend = backend;
+	return 0;
+}
+
+int MAT_set_jit(matrix_t mat, int enable) {
+	assert(mat);
+	mat->jit = enable ? 1 : 0;
+	return 0;
+}
+
+int MAT_set_cache(matrix_t mat, int enable) {
+	assert(mat);
+	mat->cache = enable ? 1 : 0;
+	return 0;
+}
+
+int MAT_set_lazy(matrix_t mat, int enable) {
+	assert(mat);
+	mat->lazy = enable ? 1 : 0;
+	return 0;
+}
+
+int MAT_set_parallel(matrix_t mat, uint32_t threads) {
+	assert(mat);
+	mat->parallel = threads;
+	return 0;
+}
+
+int MAT_set_stack_limit(matrix_t mat, uint32_t stack_size, uint32_t frame_num) {
+	assert(mat);
+
+	if (stack_size == 0 || frame_num == 0)
+		return -1;
+
+	mat->stack_limit = stack_size;
+	mat->frame_limit = frame_num;
 	return 0;
 }
 
@@ -117,6 +190,9 @@ int MAT_disasm(matrix_t mat, const char* mod_name, MAT_disasm_callback cb) {
 		CHECK_RESULT(ret);
 	}
 
+	ret = P_compile_mod(mat, mod);
+	CHECK_RESULT(ret);
+
 	ret = INS_disasm(mod, &mat->strs_nogc, cb);
 	CHECK_RESULT(ret);
 
@@ -147,6 +223,14 @@ exit0:
 	return ret;
 }
 
+// 在栈顶分配一个对象，运行栈已经达到上限时返回 NULL
+static obj_s* push_obj(matrix_t mat) {
+	if (VM_grow_stack(mat, 1) != 0)
+		return NULL;
+
+	return &V_AT(mat->stack, 0, obj_s) + mat->stack_top++;
+}
+
 int MAT_push_mod_obj(matrix_t mat, uint32_t mod_idx, uint32_t obj_idx) {
 	int ret;
 	obj_s* o;
@@ -155,7 +239,11 @@ int MAT_push_mod_obj(matrix_t mat, uint32_t mod_idx, uint32_t obj_idx) {
 	ret = VM_get_mod_by_idx(mat, mod_idx, &mod);
 	CHECK_RESULT(ret);
 
-	o = &V_AT(mat->stack, 0, obj_s) + mat->stack_top++;
+	o = push_obj(mat);
+
+	if (!o)
+		return -1;
+
 	ret = MOD_get_obj_by_idx(mod, obj_idx, o);
 	CHECK_RESULT(ret);
 
@@ -165,20 +253,32 @@ exit0:
 }
 
 int MAT_push_none(matrix_t mat) {
-	obj_s* o = &V_AT(mat->stack, 0, obj_s) + mat->stack_top++;
+	obj_s* o = push_obj(mat);
+
+	if (!o)
+		return -1;
+
 	o->type = MAT_OT_NONE;
 	return 0;
 }
 
 int MAT_push_int(matrix_t mat, int i) {
-	obj_s* o = &V_AT(mat->stack, 0, obj_s) + mat->stack_top++;
+	obj_s* o = push_obj(mat);
+
+	if (!o)
+		return -1;
+
 	o->type = MAT_OT_INT32;
 	o->int32 = (int32_t)i;
 	return 0;
 }
 
 int MAT_push_float(matrix_t mat, float f) {
-	obj_s* o = &V_AT(mat->stack, 0, obj_s) + mat->stack_top++;
+	obj_s* o = push_obj(mat);
+
+	if (!o)
+		return -1;
+
 	o->type = MAT_OT_REAL;
 	o->real = (real_t)f;
 	return 0;
@@ -186,7 +286,12 @@ int MAT_push_float(matrix_t mat, float f) {
 
 int MAT_push_str(matrix_t mat, const char* s) {
 	int ret;
-	obj_s* o = &V_AT(mat->stack, 0, obj_s) + mat->stack_top;
+	obj_s* o;
+
+	ret = VM_grow_stack(mat, 1);
+	CHECK_RESULT(ret);
+
+	o = &V_AT(mat->stack, 0, obj_s) + mat->stack_top;
 	o->type = MAT_OT_STR;
 	ret = S_create_str(&mat->strs_gc, s, &o->str);
 	CHECK_RESULT(ret);
@@ -197,14 +302,22 @@ exit0:
 }
 
 int MAT_push_str_obj(matrix_t mat, mat_str_t s) {
-	obj_s* o = &V_AT(mat->stack, 0, obj_s) + mat->stack_top++;
+	obj_s* o = push_obj(mat);
+
+	if (!o)
+		return -1;
+
 	o->type = MAT_OT_STR;
 	o->str = s;
 	return 0;
 }
 
 int MAT_push_ext(matrix_t mat, mat_ext_header_s* ext) {
-	obj_s* o = &V_AT(mat->stack, 0, obj_s) + mat->stack_top++;
+	obj_s* o = push_obj(mat);
+
+	if (!o)
+		return -1;
+
 	o->type = MAT_OT_EXT;
 	o->ext = ext;
 	return 0;
@@ -12,14 +12,27 @@
 #include "str.h"
 #include "err.h"
 #include "func.h"
+#include "bc.h"
 
 int MOD_init(mod_s* mod, string_s* name) {
 	int ret;
 	mod->handle = 0;
+	mod->image = NULL;
+	mod->image_size = 0;
+	mod->image_heap = 0;
+	mod->src = NULL;
+	mod->src_size = 0;
+	mod->lazy_num = 0;
 
 	ret = V_init(&mod->code, sizeof(uint32_t), DEFAULT_MOD_CODE_SIZE);
 	CHECK_RESULT(ret);
 
+	ret = V_init(&mod->lcode, sizeof(lword_u), 0);
+	CHECK_RESULT(ret);
+
+	ret = V_init(&mod->caches, sizeof(ref_cache_s), 0);
+	CHECK_RESULT(ret);
+
 	ret = V_init(&mod->op_line, sizeof(op_line_s), DEFAULT_MOD_CODE_SIZE);
 	CHECK_RESULT(ret);
 
@@ -43,9 +56,22 @@ int MOD_init_dll(matrix_t mat, mod_s* mod, string_s* name) {
 	typedef int (*PFN_IMPORT)(matrix_t mat, mat_mod_t mod);
 	PFN_IMPORT pfn;
 
+	mod->image = NULL;
+	mod->image_size = 0;
+	mod->image_heap = 0;
+	mod->src = NULL;
+	mod->src_size = 0;
+	mod->lazy_num = 0;
+
 	ret = V_init(&mod->code, sizeof(uint32_t), 0);
 	CHECK_RESULT(ret);
 
+	ret = V_init(&mod->lcode, sizeof(lword_u), 0);
+	CHECK_RESULT(ret);
+
+	ret = V_init(&mod->caches, sizeof(ref_cache_s), 0);
+	CHECK_RESULT(ret);
+
 	ret = V_init(&mod->op_line, sizeof(op_line_s), 0);
 	CHECK_RESULT(ret);
 
@@ -107,21 +133,24 @@ void MOD_free(mod_s* mod) {
 	PFN_CLOSE pfn = NULL;
 	assert(mod);
 
+	// 脚本模块没有动态库句柄
+	if (mod->handle) {
 #if defined(PLATFORM_WINDOWS)
-	pfn = (PFN_CLOSE)GetProcAddress(mod->handle, "close");
+		pfn = (PFN_CLOSE)GetProcAddress(mod->handle, "close");
 
-	if (pfn)
-		pfn(mod);
+		if (pfn)
+			pfn(mod);
 
-	FreeLibrary(mod->handle);
+		FreeLibrary(mod->handle);
 #elif defined(PLATFORM_LINUX) || defined(PLATFORM_MACOS)
-	pfn = (PFN_CLOSE)dlsym(mod->handle, "close");
+		pfn = (PFN_CLOSE)dlsym(mod->handle, "close");
 
-	if (pfn)
-		pfn(mod);
+		if (pfn)
+			pfn(mod);
 
-	dlclose(mod->handle);
+		dlclose(mod->handle);
 #endif
+	}
 
 	for (i = 0; i < V_SIZE(mod->funcs); ++i) {
 		func_s* func = V_AT(mod->funcs, i, func_s*);
@@ -131,8 +160,12 @@ void MOD_free(mod_s* mod) {
 
 	V_free(&mod->funcs);
 	V_free(&mod->op_line);
+	V_free(&mod->caches);
+	V_free(&mod->lcode);
 	V_free(&mod->code);
 	HL_free(&mod->objs);
+	BC_free_image(mod);
+	free(mod->src);
 }
 
 int MOD_get_obj_by_idx(mod_s* mod, uint32_t idx, obj_s* obj) {
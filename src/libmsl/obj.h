@@ -45,6 +45,9 @@ typedef struct vec_s {
 typedef struct mat_str_table_s {
 	vec_s strs; // string_s
 	vec_s free_idx; // uint32_t
+	uint32_t* buckets; // 按 S_hash 分桶的字符串下标加1，0 表示空，第一次查找时建立
+	uint32_t bucket_num; // 2的幂
+	vec_s next; // uint32_t，与 strs 对应，同一个桶里下一个字符串的下标加1
 } mat_str_table_s;
 
 typedef struct hash_node_s {
@@ -69,12 +72,58 @@ typedef struct op_line_s {
 	uint32_t line;
 } op_line_s;
 
+// 模块限定对象引用的内联缓存，模块对象和它的对象数组都没有变化时 ref 仍然有效
+typedef struct ref_cache_s {
+	uint32_t mod_pos; // 模块对象在所在模块中的下标
+	uint32_t pos; // 对象在被引用模块中的下标
+	struct mod_s* mod;
+	struct obj_s* objs; // 缓存时 mod->objs 的数组地址
+	struct obj_s* ref;
+} ref_cache_s;
+
+// 链接后的指令字，与 code 中的 uint32_t 一一对应，位置不变
+typedef union lword_u {
+	const void* h; // 指令处理代码地址（computed goto 分派）
+	uint32_t u; // 指令编号（switch 分派）或者原样保存的操作数
+	int32_t i;
+	real_t real;
+	struct string_s* str;
+	union lword_u* ip; // 跳转目标
+	struct obj_s** objs; // 模块对象数组的地址
+	ref_cache_s* cache; // 模块限定引用的内联缓存
+	struct func_s* func; // 内联检查的函数
+	struct {
+		uint32_t lo;
+		uint32_t hi;
+	} pair;
+} lword_u;
+
+// 延迟编译的函数体在模块源代码中的位置
+typedef struct func_lazy_s {
+	struct mod_s* mod;
+	uint32_t pos; // 参数表之后的位置
+	uint32_t line;
+	uint32_t ret_line; // 函数名所在的行，函数末尾的 RET 使用
+	uint32_t global_num; // 定义函数时模块对象的个数，之后加入的模块对象对函数体不可见
+	mat_backend_e backend;
+} func_lazy_s;
+
 typedef struct func_s {
 	string_s* name;
 	uint32_t param_num; // 函数定义的参数个数
 	vec_s code; // uint32_t
+	vec_s lcode; // lword_u
+	vec_s caches; // ref_cache_s
 	vec_s op_line; // op_line_s
 	hash_list_s objs;
+	lword_u* entry; // 链接后的第一条指令，以下三项在链接时确定
+	uint32_t local_num; // 参数之外的局部对象个数
+	uint32_t frame_size; // 帧内对象和临时对象最多占用的运行栈大小
+	uint32_t calls; // 解释执行的调用次数
+	void* jit; // 编译后的本地代码
+	uint32_t jit_size;
+	uint8_t jit_failed; // 含有 JIT 不支持的指令，一直解释执行
+	func_lazy_s* lazy; // 函数体还没有编译时不为 NULL，第一次调用时编译
 } func_s;
 
 typedef struct list_s {
@@ -103,8 +152,10 @@ typedef struct pool_dict_s {
 
 typedef struct call_frame_s {
 	func_s* func;
-	uint32_t stack_base;
+	uint32_t stack_base; // 第一个参数的位置，参数和局部对象从这里开始连续存放
 	uint32_t param_num; // 实际传入参数个数
+	lword_u* ret_ip; // 返回后继续执行的指令，NULL 表示返回到 C 代码
+	lword_u* ret_ip_begin; // 调用者代码的第一条指令
 } call_frame_s;
 
 typedef struct mod_s {
@@ -114,8 +165,16 @@ typedef struct mod_s {
 #elif defined(PLATFORM_LINUX) || defined(PLATFORM_MACOS)
 	void* handle;
 #endif
+	void* image; // 从 .matc 加载时映射的文件，code 和 op_line 可能直接指向其中的数据
+	uint32_t image_size;
+	int image_heap; // image 是后台编译生成的，由 malloc 分配
+	char* src; // 延迟编译函数体时保留的源代码，所有函数都编译以后释放
+	uint32_t src_size;
+	uint32_t lazy_num; // 还没有编译的函数个数
 	int init; // 是否初始化过
 	vec_s code; // uint32_t
+	vec_s lcode; // lword_u
+	vec_s caches; // ref_cache_s
 	vec_s op_line; // op_line_s
 	vec_s funcs; // func_s*
 	hash_list_s objs;
@@ -124,8 +183,8 @@ typedef struct mod_s {
 typedef struct dbg_info_s {
 	mod_s* mod;
 	func_s* func;
-	uint32_t* ip_begin;
-	uint32_t* ip_end;
+	lword_u* ip_begin;
+	lword_u* ip_end;
 } dbg_info_s;
 
 typedef struct matrix_s {
@@ -137,9 +196,21 @@ typedef struct matrix_s {
 	uint32_t stack_base;
 	vec_s call_frames; // call_frame_s
 	uint32_t frame_top;
+	uint32_t stack_limit; // 运行栈最多容纳的对象个数
+	uint32_t frame_limit; // 最大的调用深度
 	vec_s dbg_info;
 	pool_list_s pool_list;
 	pool_dict_s pool_dict;
+	mat_backend_e backend;
+	int jit; // 是否允许把函数编译成本地代码
+	int cache; // 是否使用 .matc 字节码缓存
+	int lazy; // 解析模块文件时是否把函数体推迟到第一次调用时编译
+	vec_s traces; // jit_trace_s，编译成本地代码的循环
+	uint32_t jit_depth; // 正在执行的本地代码的嵌套层数
+	const void* const* handlers; // 链接阶段通过 VM_handler 获取的指令处理代码地址
+	uint32_t parallel; // 后台编译模块的线程数，0 表示不使用后台编译
+	struct pc_pool_s* pc; // 后台编译的线程和任务，第一次提交时创建
+	int quiet; // 不输出错误信息，后台编译用的临时虚拟机
 } matrix_s;
 
 int O_compare_eq(obj_s* o1, obj_s* o2);
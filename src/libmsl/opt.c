@@ -10,98 +10,239 @@
 #include "err.h"
 #include "ins.h"
 #include "vec.h"
+#include "debug.h"
 
-static int try_assign(uint32_t** ip, uint32_t* ip_end) {
-	// uint32_t* p = *ip;
-	// uint32_t push_op, sth, assign, id_pos, index_num;
-
-	// if (ip_end - p < 5)
-	//  return 0;
-
-	// push_op = *p;
-	// sth = *(p + 1);
-	// assign = *(p + 2);
-	// id_pos = *(p + 3);
-	// index_num = *(p + 4);
-
-	// if (assign == IT_ASSIGN)
-	// switch (push_op) {
-	//  case IT_PUSH_NONE:
-	//      *p++ = IT_ASSIGN_NONE;
-	//      break;
-
-	//  case IT_PUSH_INT:
-	//      *p++ = IT_ASSIGN_INT;
-	//      break;
-
-	//  case IT_PUSH_STRING:
-	//      *p++ = IT_ASSIGN_STRING;
-	//      break;
-
-	//  case IT_PUSH_REAL:
-	//      *p++ = IT_ASSIGN_REAL;
-	//      break;
-
-	//  default:
-	//      return 0;
-	// }
-
-	// *p++ = sth;
-	// *p++ =
-
-	// {
-	//  *p++ = ref_local_idx;
-	//  *p++ = op_idx;
-	//  *p++ = IT_NOP;
-	//  *p++ = IT_NOP;
-	//  *ip += 5;
-	//  return 1;
-	// }
-
-	return 0;
+#define MAX_FUSED_SIZE 5
+
+static uint32_t cmp_jmp(uint32_t ins) {
+	switch (ins) {
+		case IT_EQ:
+			return IT_FALSE_JMP_EQ;
+
+		case IT_NEQ:
+			return IT_FALSE_JMP_NEQ;
+
+		case IT_LT:
+			return IT_FALSE_JMP_LT;
+
+		case IT_LE:
+			return IT_FALSE_JMP_LE;
+
+		case IT_GT:
+			return IT_FALSE_JMP_GT;
+
+		case IT_GE:
+			return IT_FALSE_JMP_GE;
+
+		default:
+			return IT_NOP;
+	}
+}
+
+// 超级指令的对象引用操作数 (mod_pos, pos, n)，槽位指令换成不带下标的引用
+static void get_ref(uint32_t* ip, uint32_t* out) {
+	switch (*ip) {
+		case IT_PUSH_LOCAL:
+		case IT_STORE_LOCAL:
+			out[0] = (uint32_t)-1;
+			out[1] = (uint32_t)(-(int32_t)ip[1] - 1);
+			out[2] = 0;
+			break;
+
+		case IT_PUSH_GLOBAL:
+		case IT_STORE_GLOBAL:
+			out[0] = (uint32_t)-1;
+			out[1] = ip[1];
+			out[2] = 0;
+			break;
+
+		default:
+			out[0] = ip[1];
+			out[1] = ip[2];
+			out[2] = ip[3];
+			break;
+	}
+}
+
+/*
+	尝试把 ip 开始的几条指令合并成一条超级指令，合并后的指令写到 out，
+	返回合并后指令的字数，不能合并时返回0。
+	leaders 以 ip 为起点，被合并的后续指令不能是跳转目标。
+*/
+static uint32_t try_fuse(uint32_t* ip, uint32_t* ip_end, const uint8_t* leaders, uint32_t* out, uint32_t* used) {
+	uint32_t a = INS_size(*ip);
+	uint32_t* b = ip + a;
+	uint32_t* c;
+
+	if (b >= ip_end || leaders[a])
+		return 0;
+
+	switch (*ip) {
+		// PUSH_INT k; ASSIGN x  =>  ASSIGN_INT x k
+		case IT_PUSH_INT:
+			if (*b == IT_ASSIGN || *b == IT_STORE_LOCAL || *b == IT_STORE_GLOBAL)
+				out[0] = IT_ASSIGN_INT;
+			else if (*b == IT_ASSIGN_ADD)
+				out[0] = IT_ASSIGN_ADD_INT;
+			else if (*b == IT_ASSIGN_SUB)
+				out[0] = IT_ASSIGN_SUB_INT;
+			else
+				return 0;
+
+			get_ref(b, out + 1);
+			out[4] = ip[1];
+			*used = a + INS_size(*b);
+			return 5;
+
+		// PUSH_OBJ x; PUSH_INT k; ADD  =>  PUSH_ADD_INT x k
+		case IT_PUSH_OBJ:
+		case IT_PUSH_LOCAL:
+		case IT_PUSH_GLOBAL:
+			c = b + INS_size(*b);
+
+			if (*b != IT_PUSH_INT || c >= ip_end || leaders[c - ip])
+				return 0;
+
+			if (*c == IT_ADD)
+				out[0] = IT_PUSH_ADD_INT;
+			else if (*c == IT_SUB)
+				out[0] = IT_PUSH_SUB_INT;
+			else
+				return 0;
+
+			get_ref(ip, out + 1);
+			out[4] = b[1];
+			*used = (c - ip) + INS_size(*c);
+			return 5;
+
+		// LT; FALSE_JMP pos  =>  FALSE_JMP_LT pos
+		case IT_EQ:
+		case IT_NEQ:
+		case IT_LT:
+		case IT_LE:
+		case IT_GT:
+		case IT_GE:
+			if (*b != IT_FALSE_JMP)
+				return 0;
+
+			out[0] = cmp_jmp(*ip);
+			out[1] = b[1];
+			*used = a + INS_size(*b);
+			return 2;
+
+		default:
+			return 0;
+	}
 }
 
-static int optimize(vec_s* code) {
-	// uint32_t* ip = &V_AT(*code, 0, uint32_t);
-	// uint32_t* ip_begin = ip;
-	// uint32_t* ip_end = &V_AT(*code, V_SIZE(*code), uint32_t);
+static int optimize(vec_s* code, vec_s* op_line) {
+	int ret;
+	vec_s out;
+	uint32_t size = V_SIZE(*code);
+	uint32_t* ip_begin = &V_AT(*code, 0, uint32_t);
+	uint32_t* ip_end = ip_begin + size;
+	uint32_t* ip;
+	uint8_t* leaders = NULL;
+	uint32_t* pos_map = NULL;
+	uint32_t i;
+
+	memset(&out, 0, sizeof(out));
+
+	if (size == 0)
+		return 0;
+
+	ret = V_init(&out, sizeof(uint32_t), size);
+	CHECK_RESULT(ret);
+
+	leaders = calloc(size + 1, sizeof(uint8_t));
+	CHECK_MALLOC(leaders);
+	pos_map = calloc(size + 1, sizeof(uint32_t));
+	CHECK_MALLOC(pos_map);
 
-	// while (ip < ip_end) {
-	//  switch (*ip) {
-	//      case IT_PUSH_NONE:
-	//      case IT_PUSH_INT:
-	//      case IT_PUSH_REAL:
-	//      case IT_PUSH_STRING:
-	//          if (try_assign(&ip, ip_end))
-	//              continue;
+	for (ip = ip_begin; ip < ip_end; ip += INS_size(*ip)) {
+		uint32_t* target = INS_jmp_target(ip);
+		CHECK_CONDITION(INS_size(*ip) > 0);
 
-	//          break;
+		if (target) {
+			CHECK_CONDITION(*target <= size);
+			leaders[*target] = 1;
+		}
+	}
+
+	ip = ip_begin;
+
+	while (ip < ip_end) {
+		uint32_t fused[MAX_FUSED_SIZE];
+		uint32_t used = INS_size(*ip);
+		uint32_t n = try_fuse(ip, ip_end, leaders + (ip - ip_begin), fused, &used);
+		uint32_t* src = ip;
+		uint32_t* p;
+
+		// 解析时改写条件跳转留下的 NOP 直接去掉
+		if (*ip == IT_NOP) {
+			pos_map[ip - ip_begin] = V_SIZE(out);
+			ip++;
+			continue;
+		}
 
-	//      case IT_PUSH_OBJ:
-	//          if (try_assign_obj(&ip, ip_end))
-	//              continue;
+		if (n == 0)
+			n = used;
+		else
+			src = fused;
 
-	//          break;
+		// 被合并的指令都映射到新指令的位置
+		for (p = ip; p < ip + used; p += INS_size(*p))
+			pos_map[p - ip_begin] = V_SIZE(out);
+
+		for (i = 0; i < n; ++i) {
+			ret = V_alloc_one(&out);
+			CHECK_RESULT(ret);
+			V_AT(out, V_SIZE(out)++, uint32_t) = src[i];
+		}
+
+		ip += used;
+	}
 
-	//      default:
-	//          break;
-	//  }
+	pos_map[size] = V_SIZE(out);
 
-	//  ip++;
-	// }
+	for (ip = &V_AT(out, 0, uint32_t); ip < &V_AT(out, V_SIZE(out), uint32_t); ip += INS_size(*ip)) {
+		uint32_t* target = INS_jmp_target(ip);
 
-	return 0;
+		if (target)
+			*target = pos_map[*target];
+	}
+
+	ret = DBG_relocate_op_line(op_line, pos_map, size);
+	CHECK_RESULT(ret);
+
+	V_free(code);
+	*code = out;
+	out.p = NULL;
+
+	ret = 0;
+exit0:
+	if (out.p)
+		V_free(&out);
+
+	free(leaders);
+	free(pos_map);
+	return ret;
 }
 
 int OPT_optimize(mod_s* mod) {
 	int ret;
 	uint32_t i;
-	ret = optimize(&mod->code);
+	ret = optimize(&mod->code, &mod->op_line);
 	CHECK_RESULT(ret);
 
 	for (i = 0; i < V_SIZE(mod->funcs); i++) {
 		func_s* func = V_AT(mod->funcs, i, func_s*);
-		ret = optimize(&func->code);
+
+		// 已经链接过的函数在之前的解析中优化过了，延迟编译的函数在编译函数体时优化
+		if (V_SIZE(func->lcode) > 0 || func->lazy)
+			continue;
+
+		ret = OPT_optimize_func(func);
 		CHECK_RESULT(ret);
 	}
 
@@ -109,3 +250,7 @@ int OPT_optimize(mod_s* mod) {
 exit0:
 	return ret;
 }
+
+int OPT_optimize_func(func_s* func) {
+	return optimize(&func->code, &func->op_line);
+}
@@ -9,5 +9,6 @@
 #define __H_OPT__
 
 int OPT_optimize(mod_s* mod);
+int OPT_optimize_func(func_s* func);
 
 #endif // __H_OPT__
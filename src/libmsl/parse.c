@@ -18,10 +18,13 @@
 #include "debug.h"
 #include "vm.h"
 #include "builtins.h"
+#include "link.h"
+#include "reg.h"
+#include "inl.h"
 
 #define NEXT_TOKEN(t)\
 	do {\
-		int r = L_read_token(&t);\
+		int r = L_read_token(&p->lex, &t);\
 		if (r != 0)\
 			return r;\
 		if (t.tt == TT_STREAM_END)\
@@ -30,14 +33,14 @@
 
 #define TRY_NEXT_TOKEN(t)\
 	do {\
-		if (L_read_token(&t) != 0)\
+		if (L_read_token(&p->lex, &t) != 0)\
 			return -1;\
 	} while (0)
 
 #define EXPECT_TOKEN(t, n)\
 	do {\
 		if (t.tt != n) {\
-			E_rt_err(P.mat, P.file_name, t.line, "Token \"%s\" is not expected.", L_token_to_string(&t));\
+			E_rt_err(p->mat, p->file_name, t.line, "Token \"%s\" is not expected.", L_token_to_string(&p->lex, &t));\
 			return -1;\
 		}\
 	} while (0)
@@ -48,16 +51,16 @@
 		EXPECT_TOKEN(t, n);\
 	} while (0)
 
-#define CUR_CODE_POS V_SIZE(*get_cur_code())
-#define ADD_INS(i)  V_PUSH_BACK(*get_cur_code(), (uint32_t)i, uint32_t)
+#define CUR_CODE_POS V_SIZE(*get_cur_code(p))
+#define ADD_INS(i)  V_PUSH_BACK(*get_cur_code(p), (uint32_t)i, uint32_t)
 #define SET_INS(pos, i)\
 	do {\
-		V_AT(*get_cur_code(), pos, uint32_t) = i;\
+		V_AT(*get_cur_code(p), pos, uint32_t) = i;\
 	} while (0)
 
 #define ADD_OP_LINE(line)\
 	do {\
-		if (DBG_add_op_line(P.mat, P.mod, P.func, CUR_CODE_POS, line) != 0)\
+		if (DBG_add_op_line(p->mat, p->mod, p->func, CUR_CODE_POS, line) != 0)\
 			return -1;\
 	} while (0)
 
@@ -69,6 +72,25 @@ typedef struct {
 	int exit_size;
 } parse_loop_s;
 
+// 常量入栈指令，end 为指令结束的位置
+typedef struct {
+	uint32_t pos;
+	uint32_t end;
+	obj_s obj;
+} parse_const_s;
+
+// 值已知的变量，id_pos 与 parse_get_obj 的结果相同
+typedef struct {
+	int32_t id_pos;
+	obj_s obj;
+} parse_known_s;
+
+// 条件跳转指令的操作数位置，跳转目标确定后统一设置
+typedef struct {
+	uint32_t pos[MAX_COND_JMP_NUM];
+	int size;
+} parse_jmp_list_s;
+
 // 解析状态信息
 typedef struct parse_state_s {
 	matrix_t mat;
@@ -77,48 +99,69 @@ typedef struct parse_state_s {
 	func_s* func;
 	parse_loop_s loops[MAX_LOOP_NEST];
 	int loop_size;
+	uint32_t last_call; // 最近一条 CALL 指令的位置，用来识别尾调用
+	parse_const_s consts[MAX_FOLD_CONST_NUM]; // 最近生成的常量入栈指令，用来折叠常量表达式
+	int const_size;
+	parse_known_s known[MAX_KNOWN_CONST_NUM]; // 顺序执行的代码里值已知的变量，用来传播常量
+	int known_size;
+	int lazy; // 只记录函数体的位置，到第一次调用时再编译
+	int32_t global_num; // 编译延迟的函数体时，定义函数时模块对象的个数，其它情况为 -1
+	lex_state_s lex;
 } parse_state_s;
 
-static parse_state_s P;
-
-static int parse_program();
-static int parse_statement();
-static int parse_get_obj_global(string_s* name, int32_t* id_pos);
-static int parse_get_obj_local(string_s* name, int32_t* id_pos);
-static int parse_get_obj(string_s* name, int32_t* id_pos);
-static int parse_left_value(int32_t* mod_pos, int32_t* id_pos, uint32_t* index_num);
-static int parse_assign(operator_e ot, uint32_t line, int32_t mod_pos, int32_t id_pos, uint32_t index_num);
-static int parse_left_identifier();
-static int parse_right_value(int32_t* mod_pos, int32_t* id_pos, uint32_t* index_num);
-static int parse_right_identifier();
-static int parse_expression();
-static int parse_sub_expression();
-static int parse_term();
-static int parse_make_list();
-static int parse_make_dict();
-static int parse_factor();
-static int parse_if();
-static int parse_then();
-static int parse_block();
-static int parse_while();
-static int parse_function();
-static int parse_func_param(func_s* func);
-static int parse_func_call();
-static int parse_import();
-
-static int init_parser(matrix_t mat, mod_s* mod) {
+static int parse_program(parse_state_s* p);
+static int parse_statement(parse_state_s* p);
+static int parse_get_obj_global(parse_state_s* p, string_s* name, int32_t* id_pos);
+static int parse_get_obj_local(parse_state_s* p, string_s* name, int32_t* id_pos);
+static int parse_get_obj(parse_state_s* p, string_s* name, int32_t* id_pos);
+static int parse_left_value(parse_state_s* p, int32_t* mod_pos, int32_t* id_pos, uint32_t* index_num);
+static int parse_assign(parse_state_s* p, operator_e ot, uint32_t line, int32_t mod_pos, int32_t id_pos, uint32_t index_num);
+static int parse_left_identifier(parse_state_s* p);
+static int parse_right_value(parse_state_s* p, int32_t* mod_pos, int32_t* id_pos, uint32_t* index_num);
+static int parse_right_identifier(parse_state_s* p);
+static int parse_expression(parse_state_s* p);
+static int parse_and_expression(parse_state_s* p);
+static int parse_compare_expression(parse_state_s* p);
+static int parse_sub_expression(parse_state_s* p);
+static int parse_term(parse_state_s* p);
+static int parse_make_list(parse_state_s* p);
+static int parse_make_dict(parse_state_s* p);
+static int parse_factor(parse_state_s* p);
+static int parse_if(parse_state_s* p);
+static int parse_then(parse_state_s* p);
+static int parse_block(parse_state_s* p);
+static int parse_while(parse_state_s* p);
+static int parse_for(parse_state_s* p);
+static int parse_function(parse_state_s* p);
+static int parse_func_param(parse_state_s* p, func_s* func);
+static int parse_func_body(parse_state_s* p, func_s* func, uint32_t ret_line, mat_backend_e backend);
+static int skip_func_body(parse_state_s* p, func_s* func, uint32_t ret_line);
+static int parse_func_call(parse_state_s* p, uint32_t callee_pos, int32_t func_pos);
+static int parse_import(parse_state_s* p);
+
+static int init_parser(parse_state_s* p, matrix_t mat, mod_s* mod) {
 	int ret;
 	assert(mat);
 	assert(mod);
 
-	P.mat = mat;
-	P.file_name = mod->name->str;
-	P.mod = mod;
-	P.func = NULL;
-	memset(P.loops, 0, sizeof(P.loops));
-	P.loop_size = 0;
+	p->mat = mat;
+	p->file_name = mod->name->str;
+	p->mod = mod;
+	p->func = NULL;
+	memset(p->loops, 0, sizeof(p->loops));
+	p->loop_size = 0;
+	p->last_call = (uint32_t)-1;
+	p->const_size = 0;
+	p->known_size = 0;
+	p->lazy = mod->src != NULL;
+	p->global_num = -1;
+
+	// 延迟编译函数体时源代码已经读到内存里，编译函数体时还要用到
+	if (mod->src)
+		ret = L_set_env_str(&p->lex, mat, mod->name->str, mod->src, mod->src_size, &mat->strs_nogc);
+	else
+		ret = L_set_env(&p->lex, mat, mod->name->str, &mat->strs_nogc);
 
-	ret = L_set_env(mat, mod->name->str, &mat->strs_nogc);
 	CHECK_RESULT(ret);
 
 	ret = 0;
@@ -126,20 +169,25 @@ exit0:
 	return ret;
 }
 
-static int init_parser_str(matrix_t mat, mod_s* mod, const char* str, uint32_t size) {
+static int init_parser_str(parse_state_s* p, matrix_t mat, mod_s* mod, const char* str, uint32_t size) {
 	int ret;
 	assert(mat);
 	assert(mod);
 	assert(str);
 
-	P.mat = mat;
-	P.file_name = NULL;
-	P.mod = mod;
-	P.func = NULL;
-	memset(P.loops, 0, sizeof(P.loops));
-	P.loop_size = 0;
-
-	ret = L_set_env_str(mat, mod->name->str, str, size, &mat->strs_nogc);
+	p->mat = mat;
+	p->file_name = NULL;
+	p->mod = mod;
+	p->func = NULL;
+	memset(p->loops, 0, sizeof(p->loops));
+	p->loop_size = 0;
+	p->last_call = (uint32_t)-1;
+	p->const_size = 0;
+	p->known_size = 0;
+	p->lazy = 0;
+	p->global_num = -1;
+
+	ret = L_set_env_str(&p->lex, mat, mod->name->str, str, size, &mat->strs_nogc);
 	CHECK_RESULT(ret);
 
 	ret = 0;
@@ -147,21 +195,428 @@ exit0:
 	return ret;
 }
 
-static vec_s* get_cur_code() {
-	vec_s* code = &P.mod->code;
+static vec_s* get_cur_code(parse_state_s* p) {
+	vec_s* code = &p->mod->code;
 
-	if (P.func)
-		code = &P.func->code;
+	if (p->func)
+		code = &p->func->code;
 
 	return code;
 }
 
-static int parse_program() {
+/*
+	常量折叠和传播。
+	常量入栈指令记录在 p->consts 里，运算符的两个操作数正好是最后两条相邻的常量入栈指令时，
+	在编译期算出结果，回退代码换成一条常量入栈指令。折叠调用运行时的运算函数，结果与解释执行相同，
+	整数除零、移位越界这样的情况不折叠，留给运行时处理。
+	变量被赋值为常量以后记录在 p->known 里，之后读取它时直接生成常量。只在顺序执行的代码里传播，
+	跳转目标会清除所有记录，函数调用可能修改模块对象，会清除模块对象的记录。
+*/
+
+// 跳转目标处的值可能来自多条路径，之前记录的常量都不能再用
+static void fold_reset(parse_state_s* p) {
+	p->const_size = 0;
+	p->known_size = 0;
+}
+
+// 表达式内部的跳转目标，表达式不会给变量赋值，只需要清除常量指令的记录
+static void fold_join(parse_state_s* p) {
+	p->const_size = 0;
+}
+
+static void forget_globals(parse_state_s* p) {
+	int i, n = 0;
+
+	for (i = 0; i < p->known_size; ++i) {
+		if (p->known[i].id_pos < 0)
+			p->known[n++] = p->known[i];
+	}
+
+	p->known_size = n;
+}
+
+static parse_known_s* find_known(parse_state_s* p, int32_t id_pos) {
+	int i;
+
+	for (i = 0; i < p->known_size; ++i) {
+		if (p->known[i].id_pos == id_pos)
+			return p->known + i;
+	}
+
+	return NULL;
+}
+
+// 变量被赋值，obj 为 NULL 表示新的值未知
+static void set_known(parse_state_s* p, int32_t id_pos, obj_s* obj) {
+	parse_known_s* k = find_known(p, id_pos);
+
+	if (obj == NULL) {
+		if (k)
+			*k = p->known[--p->known_size];
+
+		return;
+	}
+
+	if (k == NULL) {
+		if (p->known_size >= MAX_KNOWN_CONST_NUM)
+			return;
+
+		k = p->known + p->known_size++;
+		k->id_pos = id_pos;
+	}
+
+	k->obj = *obj;
+}
+
+// 代码回退到 pos，丢弃之后的指令以及与它们有关的记录
+static void rollback_code(parse_state_s* p, uint32_t pos) {
+	int i, n;
+	V_SIZE(*get_cur_code(p)) = pos;
+	DBG_truncate_op_line(p->mod, p->func, pos);
+
+	while (p->const_size > 0 && p->consts[p->const_size - 1].pos >= pos)
+		p->const_size--;
+
+	if (p->last_call != (uint32_t)-1 && p->last_call >= pos)
+		p->last_call = (uint32_t)-1;
+
+	if (p->loop_size > 0) {
+		parse_loop_s* loop = p->loops + p->loop_size - 1;
+
+		for (i = 0, n = 0; i < loop->enter_size; ++i) {
+			if (loop->enter[i] < pos)
+				loop->enter[n++] = loop->enter[i];
+		}
+
+		loop->enter_size = n;
+
+		for (i = 0, n = 0; i < loop->exit_size; ++i) {
+			if (loop->exit[i] < pos)
+				loop->exit[n++] = loop->exit[i];
+		}
+
+		loop->exit_size = n;
+	}
+}
+
+// 从 pos 到当前位置的代码正好是一条常量入栈指令时返回它的记录
+static parse_const_s* get_const(parse_state_s* p, uint32_t pos) {
+	parse_const_s* c;
+
+	if (p->const_size == 0)
+		return NULL;
+
+	c = p->consts + p->const_size - 1;
+
+	if (c->pos != pos || c->end != CUR_CODE_POS)
+		return NULL;
+
+	return c;
+}
+
+static int add_const(parse_state_s* p, uint32_t line, obj_s* obj) {
+	int ret;
+	uint32_t idx;
+	parse_const_s* c;
+
+	if (p->const_size >= MAX_FOLD_CONST_NUM) {
+		memmove(p->consts, p->consts + 1, sizeof(parse_const_s) * (MAX_FOLD_CONST_NUM - 1));
+		p->const_size--;
+	}
+
+	c = p->consts + p->const_size;
+	c->pos = CUR_CODE_POS;
+	c->obj = *obj;
+
+	ADD_OP_LINE(line);
+
+	switch (obj->type) {
+		case MAT_OT_NONE:
+			ADD_INS(IT_PUSH_NONE);
+			break;
+
+		case MAT_OT_INT32:
+			ADD_INS(IT_PUSH_INT);
+			ADD_INS((uint32_t)obj->int32);
+			break;
+
+		case MAT_OT_REAL:
+			ADD_INS(IT_PUSH_REAL);
+			ADD_INS(*(uint32_t*)&obj->real);
+			break;
+
+		case MAT_OT_STR:
+			ret = S_get_str_idx(&p->mat->strs_nogc, obj->str, &idx);
+			CHECK_RESULT(ret);
+
+			ADD_INS(IT_PUSH_STRING);
+			ADD_INS(idx);
+			break;
+
+		default:
+			return -1;
+	}
+
+	c->end = CUR_CODE_POS;
+	p->const_size++;
+
+	ret = 0;
+exit0:
+	return ret;
+}
+
+// 字符串常量的连接结果放在不回收的字符串表里
+static int fold_conc(parse_state_s* p, obj_s* o1, obj_s* o2, obj_s* r) {
+	int ret;
+	char* buf = malloc(o1->str->size + o2->str->size + 1);
+	CHECK_MALLOC(buf);
+
+	memcpy(buf, S_CSTR(o1->str), o1->str->size);
+	memcpy(buf + o1->str->size, S_CSTR(o2->str), o2->str->size + 1);
+
+	r->type = MAT_OT_STR;
+	ret = S_get_str(&p->mat->strs_nogc, buf, &r->str);
+	free(buf);
+	CHECK_RESULT(ret);
+
+	ret = 0;
+exit0:
+	return ret;
+}
+
+// 在编译期计算 o1 ins o2，不能折叠时返回 -1
+static int fold_binary(parse_state_s* p, uint32_t ins, obj_s* o1, obj_s* o2, obj_s* r) {
+	int cmp;
+	int is_num = (o1->type == MAT_OT_INT32 || o1->type == MAT_OT_REAL) &&
+	             (o2->type == MAT_OT_INT32 || o2->type == MAT_OT_REAL);
+	int is_int = o1->type == MAT_OT_INT32 && o2->type == MAT_OT_INT32;
+
+	if (ins == IT_ADD && o1->type == MAT_OT_STR && o2->type == MAT_OT_STR)
+		return fold_conc(p, o1, o2, r);
+
+	if (!is_num)
+		return -1;
+
+	*r = *o1;
+
+	switch (ins) {
+		case IT_ADD:
+			return O_add(p->mat, r, o2, r);
+
+		case IT_SUB:
+			return O_sub(r, o2, r);
+
+		case IT_MUL:
+			return O_mul(p->mat, r, o2, r);
+
+		case IT_DIV:
+			// 有整数操作数时按整数除法计算
+			if ((o1->type == MAT_OT_INT32 || o2->type == MAT_OT_INT32) &&
+			        (o2->int32 == 0 || (o2->int32 == -1 && o1->int32 == INT32_MIN)))
+				return -1;
+
+			return O_div(r, o2, r);
+
+		case IT_EXP:
+			return O_exp(r, o2, r);
+
+		case IT_SHL:
+		case IT_SHR:
+			if (!is_int || o2->int32 < 0 || o2->int32 >= 32)
+				return -1;
+
+			return ins == IT_SHL ? O_shift_left(r, o2, r) : O_shift_right(r, o2, r);
+
+		case IT_BOR:
+			return is_int ? O_bitwise_or(r, o2, r) : -1;
+
+		case IT_BAND:
+			return is_int ? O_bitwise_and(r, o2, r) : -1;
+
+		// 与解释器相同，比较为真时保留左操作数的值，类型为整数
+		case IT_EQ:
+		case IT_NEQ:
+			cmp = O_compare_eq(o1, o2);
+			r->type = (cmp != 0) == (ins == IT_EQ) ? MAT_OT_INT32 : MAT_OT_NONE;
+			return 0;
+
+		case IT_LT:
+		case IT_GE:
+			cmp = O_compare_ge(o1, o2);
+
+			if (cmp == -1)
+				return -1;
+
+			r->type = (cmp == 1) == (ins == IT_GE) ? MAT_OT_INT32 : MAT_OT_NONE;
+			return 0;
+
+		case IT_LE:
+		case IT_GT:
+			cmp = O_compare_gt(o1, o2);
+
+			if (cmp == -1)
+				return -1;
+
+			r->type = (cmp == 1) == (ins == IT_GT) ? MAT_OT_INT32 : MAT_OT_NONE;
+			return 0;
+
+		default:
+			return -1;
+	}
+}
+
+static int add_binary(parse_state_s* p, uint32_t line, uint32_t ins) {
+	if (p->const_size >= 2) {
+		parse_const_s* c1 = p->consts + p->const_size - 2;
+		parse_const_s* c2 = p->consts + p->const_size - 1;
+		obj_s r;
+
+		if (c1->end == c2->pos && c2->end == CUR_CODE_POS && fold_binary(p, ins, &c1->obj, &c2->obj, &r) == 0) {
+			rollback_code(p, c1->pos);
+			return add_const(p, line, &r);
+		}
+	}
+
+	ADD_OP_LINE(line);
+	ADD_INS(ins);
+	return 0;
+}
+
+// pos 开始的操作数是数值常量时直接取负
+static int add_minus(parse_state_s* p, uint32_t line, uint32_t pos) {
+	parse_const_s* c = get_const(p, pos);
+
+	if (c && (c->obj.type == MAT_OT_INT32 || c->obj.type == MAT_OT_REAL)) {
+		obj_s r = c->obj;
+
+		// 按 uint32_t 取负，-2147483648 与运行时一样回绕为它本身
+		if (r.type == MAT_OT_INT32)
+			r.int32 = (int32_t)(0u - (uint32_t)r.int32);
+		else
+			r.real = -r.real;
+
+		rollback_code(p, pos);
+		return add_const(p, line, &r);
+	}
+
+	ADD_OP_LINE(line);
+	ADD_INS(IT_MINUS);
+	return 0;
+}
+
+/*
+	pos 开始的条件表达式是常量时去掉它的代码，返回条件的真假（只有 none 为假），
+	否则返回 -1，代码保持不变。
+*/
+static int pop_const_cond(parse_state_s* p, uint32_t pos) {
+	parse_const_s* c = get_const(p, pos);
+	int cond;
+
+	if (c == NULL)
+		return -1;
+
+	cond = c->obj.type != MAT_OT_NONE;
+	rollback_code(p, pos);
+	return cond;
+}
+
+// 沿着 KEEP 跳转链找到 ins 跳转后实际继续执行的位置，跳到条件末尾 end 时返回 end，不能确定时返回0
+static uint32_t resolve_keep(parse_state_s* p, uint32_t ins, uint32_t target, uint32_t end) {
+	vec_s* code = get_cur_code(p);
+
+	while (target < end) {
+		uint32_t next = V_AT(*code, target, uint32_t);
+
+		if (next != IT_TRUE_JMP_KEEP && next != IT_FALSE_JMP_KEEP)
+			return 0;
+
+		// 同类的跳转对同一个值也会跳转，另一类的跳转不会跳转，继续执行它后面的 POP
+		if (next == ins)
+			target = V_AT(*code, target + 1, uint32_t);
+		else
+			return target + 3;
+	}
+
+	return target == end ? end : 0;
+}
+
+/*
+	条件表达式 [start, 当前位置) 之后生成 FALSE_JMP，记录到 falses 里，跳转目标由调用者设置。
+	条件里的 && 和 || 不需要把操作数留在栈上，KEEP 跳转改成普通的条件跳转，后面的 POP 改成 NOP：
+	a; FALSE_JMP_KEEP end; POP; b; end: FALSE_JMP  =>  a; FALSE_JMP; NOP; b; FALSE_JMP
+	a; TRUE_JMP_KEEP end; POP; b; end: FALSE_JMP   =>  a; TRUE_JMP body; NOP; b; FALSE_JMP; body:
+*/
+static int add_cond_jmp(parse_state_s* p, uint32_t start, parse_jmp_list_s* falses) {
+	vec_s* code = get_cur_code(p);
+	uint32_t end = CUR_CODE_POS;
+	uint32_t body = end + 2;
+	uint32_t jmp[MAX_COND_JMP_NUM];
+	uint32_t dest[MAX_COND_JMP_NUM];
+	int n = 0;
+	int i;
+	uint32_t pos;
+
+	// 先在原来的代码上确定每个跳转的去向，再统一改写
+	for (pos = start; pos < end; pos += INS_size(V_AT(*code, pos, uint32_t))) {
+		uint32_t ins = V_AT(*code, pos, uint32_t);
+
+		if (ins != IT_TRUE_JMP_KEEP && ins != IT_FALSE_JMP_KEEP)
+			continue;
+
+		if (n >= MAX_COND_JMP_NUM)
+			break;
+
+		jmp[n] = pos;
+		dest[n] = resolve_keep(p, ins, V_AT(*code, pos + 1, uint32_t), end);
+
+		if (dest[n] != 0)
+			n++;
+	}
+
+	for (i = 0; i < n; ++i) {
+		uint32_t ins = V_AT(*code, jmp[i], uint32_t);
+
+		if (dest[i] != end) {
+			SET_INS(jmp[i], ins == IT_TRUE_JMP_KEEP ? IT_TRUE_JMP : IT_FALSE_JMP);
+			SET_INS(jmp[i] + 1, dest[i]);
+		}
+		else if (ins == IT_TRUE_JMP_KEEP) {
+			SET_INS(jmp[i], IT_TRUE_JMP);
+			SET_INS(jmp[i] + 1, body);
+		}
+		else if (falses->size < MAX_COND_JMP_NUM - 1) {
+			SET_INS(jmp[i], IT_FALSE_JMP);
+			falses->pos[falses->size++] = jmp[i] + 1;
+		}
+		else
+			continue;
+
+		SET_INS(jmp[i] + 2, IT_NOP);
+	}
+
+	ADD_INS(IT_FALSE_JMP);
+	falses->pos[falses->size++] = CUR_CODE_POS;
+	ADD_INS(0);
+
+	fold_join(p);
+	return 0;
+}
+
+static void set_jmps(parse_state_s* p, parse_jmp_list_s* jmps, uint32_t target) {
+	int i;
+
+	for (i = 0; i < jmps->size; ++i)
+		SET_INS(jmps->pos[i], target);
+
+	jmps->size = 0;
+}
+
+static int parse_program(parse_state_s* p) {
 	int ret;
 	token_s t;
 
 	while (1) {
-		ret = L_read_token(&t);
+		ret = L_read_token(&p->lex, &t);
 
 		if (ret != 0)
 			return ret;
@@ -171,12 +626,12 @@ static int parse_program() {
 			return 0;
 		}
 		else if (t.tt == TT_REV_DEF) {
-			ret = parse_function();
+			ret = parse_function(p);
 			CHECK_RESULT(ret);
 		}
 		else {
-			L_unread_token(&t);
-			ret = parse_statement();
+			L_unread_token(&p->lex, &t);
+			ret = parse_statement(p);
 			CHECK_RESULT(ret);
 		}
 	}
@@ -186,7 +641,7 @@ exit0:
 	return ret;
 }
 
-static int parse_statement() {
+static int parse_statement(parse_state_s* p) {
 	int ret;
 	token_s t;
 	NEXT_TOKEN(t);
@@ -198,15 +653,15 @@ static int parse_statement() {
 		case TT_REV_BREAK: {
 			parse_loop_s* loop;
 
-			if (P.loop_size == 0) {
-				E_rt_err(P.mat, P.file_name, t.line, "Cannot find loop statement to break.");
+			if (p->loop_size == 0) {
+				E_rt_err(p->mat, p->file_name, t.line, "Cannot find loop statement to break.");
 				return -1;
 			}
 
-			loop = P.loops + P.loop_size - 1;
+			loop = p->loops + p->loop_size - 1;
 
 			if (loop->exit_size >= MAX_BREAK_NUM) {
-				E_rt_err(P.mat, P.file_name, t.line, "There are too many \"break\" in the loop statement, the max value is %d.", MAX_BREAK_NUM);
+				E_rt_err(p->mat, p->file_name, t.line, "There are too many \"break\" in the loop statement, the max value is %d.", MAX_BREAK_NUM);
 				return -1;
 			}
 
@@ -222,15 +677,15 @@ static int parse_statement() {
 		case TT_REV_CONTINUE: {
 			parse_loop_s* loop;
 
-			if (P.loop_size == 0) {
-				E_rt_err(P.mat, P.file_name, t.line, "Cannot find loop statement to break.");
+			if (p->loop_size == 0) {
+				E_rt_err(p->mat, p->file_name, t.line, "Cannot find loop statement to break.");
 				return -1;
 			}
 
-			loop = P.loops + P.loop_size - 1;
+			loop = p->loops + p->loop_size - 1;
 
 			if (loop->enter_size >= MAX_CONTINUE_NUM) {
-				E_rt_err(P.mat, P.file_name, t.line, "There is too many \"continue\" in the loop statement, the max value is %d.", MAX_CONTINUE_NUM);
+				E_rt_err(p->mat, p->file_name, t.line, "There is too many \"continue\" in the loop statement, the max value is %d.", MAX_CONTINUE_NUM);
 				return -1;
 			}
 
@@ -244,8 +699,8 @@ static int parse_statement() {
 		}
 
 		case TT_REV_RETURN: {
-			if (P.func == NULL) {
-				E_rt_err(P.mat, P.file_name, t.line, "\"return\" can only be uesd in function.");
+			if (p->func == NULL) {
+				E_rt_err(p->mat, p->file_name, t.line, "\"return\" can only be uesd in function.");
 				return -1;
 			}
 
@@ -257,11 +712,16 @@ static int parse_statement() {
 				return 0;
 			}
 			else {
-				L_unread_token(&t);
+				L_unread_token(&p->lex, &t);
 
-				ret = parse_expression();
+				p->last_call = (uint32_t)-1;
+				ret = parse_expression(p);
 				CHECK_RESULT(ret);
 
+				// 表达式的最后一条指令是 CALL 时改成尾调用，其后的 RET_RESULT 留给不能复用帧的调用
+				if (p->last_call != (uint32_t)-1 && p->last_call + 2 == CUR_CODE_POS)
+					SET_INS(p->last_call, IT_TAIL_CALL);
+
 				ADD_OP_LINE(t.line);
 				ADD_INS(IT_RET_RESULT);
 				EXPECT_NEXT_TOKEN(t, TT_SEMICOLON);
@@ -272,33 +732,38 @@ static int parse_statement() {
 		}
 
 		case TT_REV_IF:
-			ret = parse_if();
+			ret = parse_if(p);
 			CHECK_RESULT(ret);
 			break;
 
 		case TT_REV_WHILE:
-			ret = parse_while();
+			ret = parse_while(p);
+			CHECK_RESULT(ret);
+			break;
+
+		case TT_REV_FOR:
+			ret = parse_for(p);
 			CHECK_RESULT(ret);
 			break;
 
 		case TT_IDENTIFIER:
-			L_unread_token(&t);
-			ret = parse_left_identifier();
+			L_unread_token(&p->lex, &t);
+			ret = parse_left_identifier(p);
 			CHECK_RESULT(ret);
 			break;
 
 		case TT_REV_IMPORT:
-			if (P.func != NULL || P.loop_size > 0) {
-				E_rt_err(P.mat, P.file_name, t.line, "\"import\" can only be uesd in global space.");
+			if (p->func != NULL || p->loop_size > 0) {
+				E_rt_err(p->mat, p->file_name, t.line, "\"import\" can only be uesd in global space.");
 				return -1;
 			}
 
-			ret = parse_import();
+			ret = parse_import(p);
 			CHECK_RESULT(ret);
 			break;
 
 		default:
-			E_rt_err(P.mat, P.file_name, t.line, "Unknown statement.");
+			E_rt_err(p->mat, p->file_name, t.line, "Unknown statement.");
 			return -1;
 	}
 
@@ -307,10 +772,10 @@ exit0:
 	return ret;
 }
 
-static int parse_get_obj_global(string_s* name, int32_t* id_pos) {
+static int parse_get_obj_global(parse_state_s* p, string_s* name, int32_t* id_pos) {
 	obj_s obj;
 	int is_func = 0;
-	mod_s* mod = P.mod;
+	mod_s* mod = p->mod;
 	int32_t idx;
 
 	idx = HL_get_obj_idx(&mod->objs, name);
@@ -327,16 +792,17 @@ static int parse_get_obj_global(string_s* name, int32_t* id_pos) {
 	return 0;
 }
 
-static int parse_get_obj_local(string_s* name, int32_t* id_pos) {
+static int parse_get_obj_local(parse_state_s* p, string_s* name, int32_t* id_pos) {
 	obj_s obj;
-	func_s* func = P.func;
+	func_s* func = p->func;
 	int32_t idx = HL_get_obj_idx(&func->objs, name);
 
 	if (idx < 0) {
-		mod_s* mod = P.mod;
+		mod_s* mod = p->mod;
 		idx = HL_get_obj_idx(&mod->objs, name);
 
-		if (idx < 0) {
+		// 延迟编译的函数体只能看到定义函数时已有的模块对象，与立即编译的结果相同
+		if (idx < 0 || (p->global_num >= 0 && idx >= p->global_num)) {
 			obj.type = MAT_OT_DUMMY;
 			idx = HL_set_obj(&func->objs, name, &obj);
 
@@ -353,20 +819,20 @@ static int parse_get_obj_local(string_s* name, int32_t* id_pos) {
 	return 0;
 }
 
-static int parse_get_obj(string_s* name, int32_t* id_pos) {
-	if (P.func)
-		return parse_get_obj_local(name, id_pos);
+static int parse_get_obj(parse_state_s* p, string_s* name, int32_t* id_pos) {
+	if (p->func)
+		return parse_get_obj_local(p, name, id_pos);
 	else
-		return parse_get_obj_global(name, id_pos);
+		return parse_get_obj_global(p, name, id_pos);
 }
 
-static int parse_left_value(int32_t* mod_pos, int32_t* id_pos, uint32_t* index_num) {
+static int parse_left_value(parse_state_s* p, int32_t* mod_pos, int32_t* id_pos, uint32_t* index_num) {
 	int ret;
 	token_s t;
 	EXPECT_NEXT_TOKEN(t, TT_IDENTIFIER);
 
 	*mod_pos = -1;
-	ret = parse_get_obj(t.str, id_pos);
+	ret = parse_get_obj(p, t.str, id_pos);
 	CHECK_RESULT(ret);
 
 	NEXT_TOKEN(t);
@@ -378,7 +844,7 @@ static int parse_left_value(int32_t* mod_pos, int32_t* id_pos, uint32_t* index_n
 
 		EXPECT_NEXT_TOKEN(t, TT_IDENTIFIER);
 
-		ret = HL_ref_obj(&P.mod->objs, *mod_pos, &o);
+		ret = HL_ref_obj(&p->mod->objs, *mod_pos, &o);
 		CHECK_RESULT(ret);
 		CHECK_CONDITION(o->type == MAT_OT_MOD);
 
@@ -396,14 +862,14 @@ static int parse_left_value(int32_t* mod_pos, int32_t* id_pos, uint32_t* index_n
 		*id_pos = idx;
 	}
 	else {
-		L_unread_token(&t);
+		L_unread_token(&p->lex, &t);
 	}
 
 	NEXT_TOKEN(t);
 
 	// index. array, dict etc...
 	while (t.tt == TT_OPEN_BRACE) {
-		ret = parse_expression();
+		ret = parse_expression(p);
 		CHECK_RESULT(ret);
 		EXPECT_NEXT_TOKEN(t, TT_CLOSE_BRACE);
 		(*index_num)++;
@@ -411,16 +877,64 @@ static int parse_left_value(int32_t* mod_pos, int32_t* id_pos, uint32_t* index_n
 	}
 
 
-	L_unread_token(&t);
+	L_unread_token(&p->lex, &t);
 
 	ret = 0;
 exit0:
 	return ret;
 }
 
-static int parse_assign(operator_e ot, uint32_t line, int32_t mod_pos, int32_t id_pos, uint32_t index_num) {
+// 没有模块限定和下标的对象使用槽位指令，值已知时直接使用常量，其它的使用通用的对象引用
+static int add_push_obj(parse_state_s* p, uint32_t line, int32_t mod_pos, int32_t id_pos, uint32_t index_num) {
+	if (mod_pos == -1 && index_num == 0) {
+		parse_known_s* k = find_known(p, id_pos);
+
+		if (k)
+			return add_const(p, line, &k->obj);
+
+		ADD_OP_LINE(line);
+
+		if (id_pos < 0) {
+			ADD_INS(IT_PUSH_LOCAL);
+			ADD_INS(-id_pos - 1);
+		}
+		else {
+			ADD_INS(IT_PUSH_GLOBAL);
+			ADD_INS(id_pos);
+			ADD_INS(0);
+		}
+
+		return 0;
+	}
+
+	ADD_OP_LINE(line);
+	ADD_INS(IT_PUSH_OBJ);
+	ADD_INS((uint32_t)mod_pos);
+	ADD_INS((uint32_t)id_pos);
+	ADD_INS(index_num);
+	return 0;
+}
+
+static int parse_assign(parse_state_s* p, operator_e ot, uint32_t line, int32_t mod_pos, int32_t id_pos, uint32_t index_num) {
 	token_s t;
 
+	if (ot == OT_ASSIGN && mod_pos == -1 && index_num == 0) {
+		ADD_OP_LINE(line);
+
+		if (id_pos < 0) {
+			ADD_INS(IT_STORE_LOCAL);
+			ADD_INS(-id_pos - 1);
+		}
+		else {
+			ADD_INS(IT_STORE_GLOBAL);
+			ADD_INS(id_pos);
+			ADD_INS(0);
+		}
+
+		EXPECT_NEXT_TOKEN(t, TT_SEMICOLON);
+		return 0;
+	}
+
 	switch (ot) {
 		case OT_ASSIGN:
 			ADD_OP_LINE(line);
@@ -483,7 +997,7 @@ static int parse_assign(operator_e ot, uint32_t line, int32_t mod_pos, int32_t i
 			break;
 
 		default:
-			E_rt_err(P.mat, P.file_name, line, "Invalid operator.");
+			E_rt_err(p->mat, p->file_name, line, "Invalid operator.");
 			return -1;
 	}
 
@@ -495,33 +1009,47 @@ static int parse_assign(operator_e ot, uint32_t line, int32_t mod_pos, int32_t i
 	return 0;
 }
 
-static int parse_left_identifier() {
+static int parse_left_identifier(parse_state_s* p) {
 	int ret;
 	token_s t;
 	int32_t mod_pos = 0;
 	int32_t id_pos = 0;
 	uint32_t index_num = 0;
 
-	ret = parse_left_value(&mod_pos, &id_pos, &index_num);
+	ret = parse_left_value(p, &mod_pos, &id_pos, &index_num);
 	CHECK_RESULT(ret);
 
 	NEXT_TOKEN(t);
 
 	if (t.tt == TT_OPERATOR) {
-		ret = parse_expression();
+		uint32_t pos = CUR_CODE_POS;
+		parse_const_s* c;
+		obj_s value;
+
+		ret = parse_expression(p);
 		CHECK_RESULT(ret);
 
-		ret = parse_assign(t.ot, t.line, mod_pos, id_pos, index_num);
+		c = get_const(p, pos);
+
+		if (c)
+			value = c->obj;
+
+		ret = parse_assign(p, t.ot, t.line, mod_pos, id_pos, index_num);
 		CHECK_RESULT(ret);
+
+		// 其它模块的对象可能就是当前模块的，带下标的赋值不改变变量本身
+		if (mod_pos != -1)
+			forget_globals(p);
+		else if (index_num == 0)
+			set_known(p, id_pos, c && t.ot == OT_ASSIGN ? &value : NULL);
 	}
 	else if (t.tt == TT_OPEN_PAREN) {
-		ADD_OP_LINE(t.line);
-		ADD_INS(IT_PUSH_OBJ);
-		ADD_INS((uint32_t)mod_pos);
-		ADD_INS((uint32_t)id_pos);
-		ADD_INS(index_num);
+		uint32_t callee_pos = CUR_CODE_POS;
 
-		ret = parse_func_call();
+		ret = add_push_obj(p, t.line, mod_pos, id_pos, index_num);
+		CHECK_RESULT(ret);
+
+		ret = parse_func_call(p, callee_pos, mod_pos == -1 && index_num == 0 ? id_pos : -1);
 		CHECK_RESULT(ret);
 
 		EXPECT_NEXT_TOKEN(t, TT_SEMICOLON);
@@ -529,7 +1057,7 @@ static int parse_left_identifier() {
 		ADD_INS(IT_POP);
 	}
 	else {
-		E_rt_err(P.mat, P.file_name, t.line, "Expect operator or \"(\".");
+		E_rt_err(p->mat, p->file_name, t.line, "Expect operator or \"(\".");
 		return -1;
 	}
 
@@ -538,13 +1066,13 @@ exit0:
 	return ret;
 }
 
-static int parse_right_value(int32_t* mod_pos, int32_t* id_pos, uint32_t* index_num) {
+static int parse_right_value(parse_state_s* p, int32_t* mod_pos, int32_t* id_pos, uint32_t* index_num) {
 	int ret;
 	token_s t;
 	EXPECT_NEXT_TOKEN(t, TT_IDENTIFIER);
 
 	*mod_pos = -1;
-	ret = parse_get_obj(t.str, id_pos);
+	ret = parse_get_obj(p, t.str, id_pos);
 	CHECK_RESULT(ret);
 
 	NEXT_TOKEN(t);
@@ -556,7 +1084,7 @@ static int parse_right_value(int32_t* mod_pos, int32_t* id_pos, uint32_t* index_
 
 		EXPECT_NEXT_TOKEN(t, TT_IDENTIFIER);
 
-		ret = HL_ref_obj(&P.mod->objs, *mod_pos, &o);
+		ret = HL_ref_obj(&p->mod->objs, *mod_pos, &o);
 		CHECK_RESULT(ret);
 		CHECK_CONDITION(o->type == MAT_OT_MOD);
 
@@ -574,14 +1102,14 @@ static int parse_right_value(int32_t* mod_pos, int32_t* id_pos, uint32_t* index_
 		*id_pos = idx;
 	}
 	else {
-		L_unread_token(&t);
+		L_unread_token(&p->lex, &t);
 	}
 
 	NEXT_TOKEN(t);
 
 	// index. array, dict etc...
 	while (t.tt == TT_OPEN_BRACE)  {
-		ret = parse_expression();
+		ret = parse_expression(p);
 		CHECK_RESULT(ret);
 		EXPECT_NEXT_TOKEN(t, TT_CLOSE_BRACE);
 		(*index_num)++;
@@ -589,42 +1117,128 @@ static int parse_right_value(int32_t* mod_pos, int32_t* id_pos, uint32_t* index_
 	}
 
 
-	L_unread_token(&t);
+	L_unread_token(&p->lex, &t);
 	ret = 0;
 exit0:
 	return ret;
 }
 
-static int parse_right_identifier() {
+static int parse_right_identifier(parse_state_s* p) {
 	int ret;
 	token_s t;
 	int32_t mod_pos = 0;
 	int32_t id_pos = 0;
 	uint32_t index_num = 0;
+	uint32_t callee_pos;
 
-	ret = parse_right_value(&mod_pos, &id_pos, &index_num);
+	ret = parse_right_value(p, &mod_pos, &id_pos, &index_num);
 	CHECK_RESULT(ret);
 
 	NEXT_TOKEN(t);
+	callee_pos = CUR_CODE_POS;
+
+	ret = add_push_obj(p, t.line, mod_pos, id_pos, index_num);
+	CHECK_RESULT(ret);
 
 	if (t.tt == TT_OPEN_PAREN) {
-		ADD_OP_LINE(t.line);
-		ADD_INS(IT_PUSH_OBJ);
-		ADD_INS((uint32_t)mod_pos);
-		ADD_INS((uint32_t)id_pos);
-		ADD_INS(index_num);
-		ret = parse_func_call();
+		ret = parse_func_call(p, callee_pos, mod_pos == -1 && index_num == 0 ? id_pos : -1);
 		CHECK_RESULT(ret);
 	}
 	else {
-		ADD_OP_LINE(t.line);
-		ADD_INS(IT_PUSH_OBJ);
-		ADD_INS((uint32_t)mod_pos);
-		ADD_INS((uint32_t)id_pos);
-		ADD_INS(index_num);
+		L_unread_token(&p->lex, &t);
+		return 0;
+	}
+
+	ret = 0;
+exit0:
+	return ret;
+}
+
+/*
+	&& 和 || 只在需要时计算右操作数，结果为决定真假的那个操作数：
+	a && b  =>  a; FALSE_JMP_KEEP end; POP; b; end:
+	a || b  =>  a; TRUE_JMP_KEEP end; POP; b; end:
+	左操作数是常量时直接确定结果，不生成跳转。
+*/
+static int add_logic(parse_state_s* p, uint32_t line, uint32_t ins, int (*parse_right)(parse_state_s* p)) {
+	int ret;
+	uint32_t jmp;
+	parse_const_s* c = p->const_size > 0 ? p->consts + p->const_size - 1 : NULL;
+
+	if (c && c->end == CUR_CODE_POS) {
+		uint32_t pos = c->pos;
+
+		// && 的左操作数为真、|| 的左操作数为假时结果就是右操作数
+		if ((c->obj.type != MAT_OT_NONE) == (ins == IT_FALSE_JMP_KEEP)) {
+			rollback_code(p, pos);
+			return parse_right(p);
+		}
+
+		// 否则结果就是左操作数，右操作数不会执行
+		pos = CUR_CODE_POS;
+		ret = parse_right(p);
+		CHECK_RESULT(ret);
+
+		rollback_code(p, pos);
+		return 0;
+	}
+
+	ADD_OP_LINE(line);
+	ADD_INS(ins);
+	jmp = CUR_CODE_POS;
+	ADD_INS(0);
+	ADD_INS(IT_POP);
+
+	ret = parse_right(p);
+	CHECK_RESULT(ret);
+
+	SET_INS(jmp, CUR_CODE_POS);
+	fold_join(p);
+
+	ret = 0;
+exit0:
+	return ret;
+}
+
+static int parse_expression(parse_state_s* p) {
+	int ret;
+	ret = parse_and_expression(p);
+	CHECK_RESULT(ret);
+
+	while (1) {
+		token_s t;
+		NEXT_TOKEN(t);
+
+		if (t.tt != TT_OPERATOR || t.ot != OT_LOGICAL_OR) {
+			L_unread_token(&p->lex, &t);
+			return 0;
+		}
+
+		ret = add_logic(p, t.line, IT_TRUE_JMP_KEEP, parse_and_expression);
+		CHECK_RESULT(ret);
+	}
+
+	ret = 0;
+exit0:
+	return ret;
+}
+
+static int parse_and_expression(parse_state_s* p) {
+	int ret;
+	ret = parse_compare_expression(p);
+	CHECK_RESULT(ret);
+
+	while (1) {
+		token_s t;
+		NEXT_TOKEN(t);
 
-		L_unread_token(&t);
-		return 0;
+		if (t.tt != TT_OPERATOR || t.ot != OT_LOGICAL_AND) {
+			L_unread_token(&p->lex, &t);
+			return 0;
+		}
+
+		ret = add_logic(p, t.line, IT_FALSE_JMP_KEEP, parse_compare_expression);
+		CHECK_RESULT(ret);
 	}
 
 	ret = 0;
@@ -632,77 +1246,63 @@ exit0:
 	return ret;
 }
 
-static int parse_expression() {
+static int parse_compare_expression(parse_state_s* p) {
 	int ret;
-	ret = parse_sub_expression();
+	ret = parse_sub_expression(p);
 	CHECK_RESULT(ret);
 
 	while (1) {
 		token_s t;
+		uint32_t ins;
 		NEXT_TOKEN(t);
 
 		if (t.tt != TT_OPERATOR ||
 		        (t.ot != OT_NOT_EQUAL &&
 		         t.ot != OT_EQUAL &&
-		         t.ot != OT_LOGICAL_AND &&
-		         t.ot != OT_LOGICAL_OR &&
 		         t.ot != OT_GREATER &&
 		         t.ot != OT_GREATER_EQUAL &&
 		         t.ot != OT_LESS &&
 		         t.ot != OT_LESS_EQUAL)) {
-			L_unread_token(&t);
+			L_unread_token(&p->lex, &t);
 			return 0;
 		}
 
-		ret = parse_sub_expression();
+		ret = parse_sub_expression(p);
 		CHECK_RESULT(ret);
 
 		switch (t.ot) {
 			case OT_EQUAL:
-				ADD_OP_LINE(t.line);
-				ADD_INS(IT_EQ);
+				ins = IT_EQ;
 				break;
 
 			case OT_NOT_EQUAL:
-				ADD_OP_LINE(t.line);
-				ADD_INS(IT_NEQ);
+				ins = IT_NEQ;
 				break;
 
 			case OT_LESS:
-				ADD_OP_LINE(t.line);
-				ADD_INS(IT_LT);
+				ins = IT_LT;
 				break;
 
 			case OT_LESS_EQUAL:
-				ADD_OP_LINE(t.line);
-				ADD_INS(IT_LE);
+				ins = IT_LE;
 				break;
 
 			case OT_GREATER:
-				ADD_OP_LINE(t.line);
-				ADD_INS(IT_GT);
+				ins = IT_GT;
 				break;
 
 			case OT_GREATER_EQUAL:
-				ADD_OP_LINE(t.line);
-				ADD_INS(IT_GE);
-				break;
-
-			case OT_LOGICAL_AND:
-				ADD_OP_LINE(t.line);
-				ADD_INS(IT_LAND);
-				break;
-
-			case OT_LOGICAL_OR:
-				ADD_OP_LINE(t.line);
-				ADD_INS(IT_LOR);
+				ins = IT_GE;
 				break;
 
 			default: {
-				E_rt_err(P.mat, P.file_name, t.line, "Unknown operator.");
+				E_rt_err(p->mat, p->file_name, t.line, "Unknown operator.");
 				return -1;
 			}
 		}
+
+		ret = add_binary(p, t.line, ins);
+		CHECK_RESULT(ret);
 	}
 
 	ret = 0;
@@ -710,39 +1310,41 @@ exit0:
 	return ret;
 }
 
-static int parse_sub_expression() {
+static int parse_sub_expression(parse_state_s* p) {
 	int ret;
-	ret = parse_term();
+	ret = parse_term(p);
 	CHECK_RESULT(ret);
 
 	while (1) {
 		token_s t;
+		uint32_t ins;
 		NEXT_TOKEN(t);
 
 		if (t.tt != TT_OPERATOR || t.ot != OT_ADD && t.ot != OT_SUB) {
-			L_unread_token(&t);
+			L_unread_token(&p->lex, &t);
 			return 0;
 		}
 
-		ret = parse_term();
+		ret = parse_term(p);
 		CHECK_RESULT(ret);
 
 		switch (t.ot) {
 			case OT_ADD:
-				ADD_OP_LINE(t.line);
-				ADD_INS(IT_ADD);
+				ins = IT_ADD;
 				break;
 
 			case OT_SUB:
-				ADD_OP_LINE(t.line);
-				ADD_INS(IT_SUB);
+				ins = IT_SUB;
 				break;
 
 			default: {
-				E_rt_err(P.mat, P.file_name, t.line, "Unknown operator.");
+				E_rt_err(p->mat, p->file_name, t.line, "Unknown operator.");
 				return -1;
 			}
 		}
+
+		ret = add_binary(p, t.line, ins);
+		CHECK_RESULT(ret);
 	}
 
 	ret = 0;
@@ -750,13 +1352,14 @@ exit0:
 	return ret;
 }
 
-static int parse_term() {
+static int parse_term(parse_state_s* p) {
 	int ret;
-	ret = parse_factor();
+	ret = parse_factor(p);
 	CHECK_RESULT(ret);
 
 	while (1) {
 		token_s t;
+		uint32_t ins;
 		NEXT_TOKEN(t);
 
 		if (t.tt != TT_OPERATOR ||
@@ -769,64 +1372,58 @@ static int parse_term() {
 		         t.ot != OT_BITWISE_XOR &&
 		         t.ot != OT_BITWISE_SHIFT_RIGHT &&
 		         t.ot != OT_BITWISE_SHIFT_LEFT)) {
-			L_unread_token(&t);
+			L_unread_token(&p->lex, &t);
 			return 0;
 		}
 
-		ret = parse_factor();
+		ret = parse_factor(p);
 		CHECK_RESULT(ret);
 
 		switch (t.ot) {
 			case OT_MUL:
-				ADD_OP_LINE(t.line);
-				ADD_INS(IT_MUL);
+				ins = IT_MUL;
 				break;
 
 			case OT_DIV:
-				ADD_OP_LINE(t.line);
-				ADD_INS(IT_DIV);
+				ins = IT_DIV;
 				break;
 
 			case OT_MOD:
-				ADD_OP_LINE(t.line);
-				ADD_INS(IT_MOD);
+				ins = IT_MOD;
 				break;
 
 			case OT_EXP:
-				ADD_OP_LINE(t.line);
-				ADD_INS(IT_EXP);
+				ins = IT_EXP;
 				break;
 
 			case OT_BITWISE_AND:
-				ADD_OP_LINE(t.line);
-				ADD_INS(IT_BAND);
+				ins = IT_BAND;
 				break;
 
 			case OT_BITWISE_OR:
-				ADD_OP_LINE(t.line);
-				ADD_INS(IT_BOR);
+				ins = IT_BOR;
 				break;
 
 			case OT_BITWISE_XOR:
-				ADD_OP_LINE(t.line);
-				ADD_INS(IT_BXOR);
+				ins = IT_BXOR;
 				break;
 
 			case OT_BITWISE_SHIFT_LEFT:
-				ADD_OP_LINE(t.line);
-				ADD_INS(IT_SHL);
+				ins = IT_SHL;
 				break;
 
 			case OT_BITWISE_SHIFT_RIGHT:
-				ADD_OP_LINE(t.line);
-				ADD_INS(IT_SHR);
+				ins = IT_SHR;
 				break;
 
 			default: {
-				E_rt_err(P.mat, P.file_name, t.line, "Uunknown operator.");
+				E_rt_err(p->mat, p->file_name, t.line, "Uunknown operator.");
 				return -1;
 			}
 		}
+
+		ret = add_binary(p, t.line, ins);
+		CHECK_RESULT(ret);
 	}
 
 	ret = 0;
@@ -834,7 +1431,7 @@ exit0:
 	return ret;
 }
 
-static int parse_make_list() {
+static int parse_make_list(parse_state_s* p) {
 	int ret;
 	token_s t;
 	uint32_t size = 0;
@@ -849,14 +1446,14 @@ static int parse_make_list() {
 			break;
 		}
 		else if (t.tt == TT_COMMA) {
-			ret = parse_expression();
+			ret = parse_expression(p);
 			CHECK_RESULT(ret);
 
 			size++;
 		}
 		else if (size == 0) {
-			L_unread_token(&t);
-			ret = parse_expression();
+			L_unread_token(&p->lex, &t);
+			ret = parse_expression(p);
 			CHECK_RESULT(ret);
 
 			size++;
@@ -871,7 +1468,7 @@ exit0:
 	return ret;
 }
 
-static int parse_make_dict() {
+static int parse_make_dict(parse_state_s* p) {
 	int ret;
 	token_s t;
 	uint32_t size = 0;
@@ -886,22 +1483,22 @@ static int parse_make_dict() {
 			break;
 		}
 		else if (t.tt == TT_COMMA) {
-			ret = parse_expression();
+			ret = parse_expression(p);
 			CHECK_RESULT(ret);
 
 			EXPECT_NEXT_TOKEN(t, TT_COLON);
 
-			ret = parse_expression();
+			ret = parse_expression(p);
 			CHECK_RESULT(ret);
 			size++;
 		}
 		else if (size == 0) {
-			L_unread_token(&t);
-			ret = parse_expression();
+			L_unread_token(&p->lex, &t);
+			ret = parse_expression(p);
 			CHECK_RESULT(ret);
 
 			EXPECT_NEXT_TOKEN(t, TT_COLON);
-			ret = parse_expression();
+			ret = parse_expression(p);
 
 			CHECK_RESULT(ret);
 			size++;
@@ -916,10 +1513,12 @@ exit0:
 	return ret;
 }
 
-static int parse_factor() {
+static int parse_factor(parse_state_s* p) {
 	int ret;
 	operator_e unary = OT_NONE;
 	token_s t;
+	obj_s obj;
+	uint32_t pos = CUR_CODE_POS;
 	NEXT_TOKEN(t);
 
 	if (t.tt == TT_OPERATOR) {
@@ -935,7 +1534,7 @@ static int parse_factor() {
 				break;
 
 			default: {
-				E_rt_err(P.mat, P.file_name, t.line, "Expect a unary operator.");
+				E_rt_err(p->mat, p->file_name, t.line, "Expect a unary operator.");
 				return -1;
 			}
 		}
@@ -943,66 +1542,65 @@ static int parse_factor() {
 
 	switch (t.tt) {
 		case TT_OPEN_BRACE: {
-			ret = parse_make_list();
+			ret = parse_make_list(p);
 			CHECK_RESULT(ret);
 			break;
 		}
 
 		case TT_OPEN_CURLY_BRACE: {
-			ret = parse_make_dict();
+			ret = parse_make_dict(p);
 			CHECK_RESULT(ret);
 			break;
 		}
 
 		case TT_REV_NONE:
-			ADD_OP_LINE(t.line);
-			ADD_INS(IT_PUSH_NONE);
+			obj.type = MAT_OT_NONE;
+			ret = add_const(p, t.line, &obj);
+			CHECK_RESULT(ret);
 			break;
 
 		case TT_CONST_INT: {
-			ADD_OP_LINE(t.line);
-			ADD_INS(IT_PUSH_INT);
-			ADD_INS((uint32_t)t.int32);
+			obj.type = MAT_OT_INT32;
+			obj.int32 = t.int32;
+			ret = add_const(p, t.line, &obj);
+			CHECK_RESULT(ret);
 			break;
 		}
 
 		case TT_CONST_REAL: {
-			ADD_OP_LINE(t.line);
-			ADD_INS(IT_PUSH_REAL);
-			ADD_INS(*(uint32_t*)&t.real);
+			obj.type = MAT_OT_REAL;
+			obj.real = t.real;
+			ret = add_const(p, t.line, &obj);
+			CHECK_RESULT(ret);
 			break;
 		}
 
 		case TT_CONST_STRING: {
-			int32_t idx;
-
 			if (unary != OT_NONE)
 				return -1;
 
-			ret = S_get_str_idx(&P.mat->strs_nogc, t.str, &idx);
+			obj.type = MAT_OT_STR;
+			obj.str = t.str;
+			ret = add_const(p, t.line, &obj);
 			CHECK_RESULT(ret);
-
-			ADD_OP_LINE(t.line);
-			ADD_INS(IT_PUSH_STRING);
-			ADD_INS(idx);
 			break;
 		}
 
 		case TT_OPEN_PAREN:
-			ret = parse_expression();
+			ret = parse_expression(p);
 			CHECK_RESULT(ret);
 
 			EXPECT_NEXT_TOKEN(t, TT_CLOSE_PAREN);
 			break;
 
 		case TT_IDENTIFIER:
-			L_unread_token(&t);
-			ret = parse_right_identifier();
+			L_unread_token(&p->lex, &t);
+			ret = parse_right_identifier(p);
 			CHECK_RESULT(ret);
 			break;
 
 		default: {
-			E_rt_err(P.mat, P.file_name, t.line, "Invalid expression.");
+			E_rt_err(p->mat, p->file_name, t.line, "Invalid expression.");
 			return -1;
 		}
 	}
@@ -1030,15 +1628,15 @@ static int parse_factor() {
 				break;
 
 			case OT_SUB:
-				ADD_OP_LINE(t.line);
-				ADD_INS(IT_MINUS);
+				ret = add_minus(p, t.line, pos);
+				CHECK_RESULT(ret);
 				break;
 
 			case OT_ADD:
 				break;
 
 			default: {
-				E_rt_err(P.mat, P.file_name, t.line, "Invalid unary operator.");
+				E_rt_err(p->mat, p->file_name, t.line, "Invalid unary operator.");
 				return -1;
 			}
 		}
@@ -1049,91 +1647,106 @@ exit0:
 	return ret;
 }
 
-static int parse_if() {
+/*
+	条件是常量的分支在编译期确定：恒为假的分支和恒为真的分支之后的分支照常解析，然后丢弃代码；
+	恒为真的分支不生成条件跳转。
+*/
+static int parse_if(parse_state_s* p) {
 	token_s t;
 	int ret;
-	int last_jmp;
 	uint32_t if_exit[MAX_IF_BLOCK_NUM];
 	int if_exit_cnt = 0;
+	int taken = 0;
 	int i;
 
-	ret = parse_expression();
-	CHECK_RESULT(ret);
+	t.tt = TT_REV_IF;
 
-	ADD_INS(IT_FALSE_JMP);
-	last_jmp = CUR_CODE_POS;
-	ADD_INS(0);
+	while (1) {
+		uint32_t arm_pos = CUR_CODE_POS;
+		parse_jmp_list_s falses;
+		int cond = 1;
 
-	ret = parse_then();
-	CHECK_RESULT(ret);
+		falses.size = 0;
 
-	TRY_NEXT_TOKEN(t);
+		if (t.tt != TT_REV_ELSE) {
+			ret = parse_expression(p);
+			CHECK_RESULT(ret);
 
-	if (t.tt == TT_REV_ELIF || t.tt == TT_REV_ELSE) {
-		ADD_OP_LINE(t.line);
-		ADD_INS(IT_JMP);
-		if_exit[if_exit_cnt++] = CUR_CODE_POS;
-		CHECK_CONDITION(if_exit_cnt < MAX_IF_BLOCK_NUM);
-		ADD_INS(0);
-	}
+			cond = pop_const_cond(p, arm_pos);
 
-	while (t.tt == TT_REV_ELIF) {
-		SET_INS(last_jmp, CUR_CODE_POS);
+			if (cond < 0) {
+				if (t.tt == TT_REV_ELIF)
+					ADD_OP_LINE(t.line);
+
+				ret = add_cond_jmp(p, arm_pos, &falses);
+				CHECK_RESULT(ret);
+			}
+		}
 
-		ret = parse_expression();
+		ret = parse_then(p);
 		CHECK_RESULT(ret);
 
-		ADD_OP_LINE(t.line);
-		ADD_INS(IT_FALSE_JMP);
-		last_jmp = CUR_CODE_POS;
-		ADD_INS(0);
+		if (t.tt == TT_REV_ELSE) {
+			if (taken) {
+				rollback_code(p, arm_pos);
+				fold_reset(p);
+			}
 
-		ret = parse_then();
-		CHECK_RESULT(ret);
+			break;
+		}
 
-		NEXT_TOKEN(t);
+		TRY_NEXT_TOKEN(t);
 
-		if (t.tt == TT_REV_ELIF || t.tt == TT_REV_ELSE) {
-			ADD_OP_LINE(t.line);
-			ADD_INS(IT_JMP);
-			if_exit[if_exit_cnt++] = CUR_CODE_POS;
-			CHECK_CONDITION(if_exit_cnt < MAX_IF_BLOCK_NUM);
-			ADD_INS(0);
+		if (taken || cond == 0) {
+			rollback_code(p, arm_pos);
+			fold_reset(p);
 		}
-	}
+		else if (cond > 0) {
+			taken = 1;
+		}
+		else {
+			if (t.tt == TT_REV_ELIF || t.tt == TT_REV_ELSE) {
+				ADD_OP_LINE(t.line);
+				ADD_INS(IT_JMP);
+				if_exit[if_exit_cnt++] = CUR_CODE_POS;
+				CHECK_CONDITION(if_exit_cnt < MAX_IF_BLOCK_NUM);
+				ADD_INS(0);
+			}
 
-	SET_INS(last_jmp, CUR_CODE_POS);
+			set_jmps(p, &falses, CUR_CODE_POS);
+			fold_reset(p);
+		}
 
-	if (t.tt == TT_REV_ELSE) {
-		ret = parse_then();
-		CHECK_RESULT(ret);
+		if (t.tt != TT_REV_ELIF && t.tt != TT_REV_ELSE) {
+			L_unread_token(&p->lex, &t);
+			break;
+		}
 	}
-	else
-		L_unread_token(&t);
 
 	for (i = 0; i < if_exit_cnt; ++i)
 		SET_INS(if_exit[i], CUR_CODE_POS);
 
+	fold_reset(p);
 	ret = 0;
 exit0:
 	return ret;
 }
 
-static int parse_then() {
+static int parse_then(parse_state_s* p) {
 	int ret;
 	token_s t;
 	NEXT_TOKEN(t);
 
 	if (t.tt == TT_OPEN_CURLY_BRACE) {
-		L_unread_token(&t);
+		L_unread_token(&p->lex, &t);
 
-		ret = parse_block(0, 0);
+		ret = parse_block(p);
 		CHECK_RESULT(ret);
 	}
 	else {
-		L_unread_token(&t);
+		L_unread_token(&p->lex, &t);
 
-		ret = parse_statement();
+		ret = parse_statement(p);
 		CHECK_RESULT(ret);
 	}
 
@@ -1142,16 +1755,16 @@ exit0:
 	return ret;
 }
 
-static int parse_block() {
+static int parse_block(parse_state_s* p) {
 	int ret;
 	token_s t;
 	EXPECT_NEXT_TOKEN(t, TT_OPEN_CURLY_BRACE);
 	NEXT_TOKEN(t);
 
 	while (t.tt != TT_CLOSE_CURLY_BRACE) {
-		L_unread_token(&t);
+		L_unread_token(&p->lex, &t);
 
-		ret = parse_statement();
+		ret = parse_statement(p);
 		CHECK_RESULT(ret);
 
 		NEXT_TOKEN(t);
@@ -1162,30 +1775,47 @@ exit0:
 	return ret;
 }
 
-static int parse_while() {
+static int parse_while(parse_state_s* p) {
 	int ret;
 	int i;
-	int enter_pos, exit_pos;
-	parse_loop_s* loop = &P.loops[P.loop_size++];
-	CHECK_CONDITION(P.loop_size < MAX_LOOP_NEST);
+	int cond;
+	int enter_pos;
+	parse_jmp_list_s exits;
+	parse_loop_s* loop = &p->loops[p->loop_size++];
+	CHECK_CONDITION(p->loop_size < MAX_LOOP_NEST);
 
 	memset(loop, 0, sizeof(parse_loop_s));
+	exits.size = 0;
 
 	enter_pos = CUR_CODE_POS;
-	ret = parse_expression();
+	fold_reset(p);
+
+	ret = parse_expression(p);
 	CHECK_RESULT(ret);
 
-	ADD_INS(IT_FALSE_JMP);
-	exit_pos = CUR_CODE_POS;
-	ADD_INS(0);
+	// 条件恒为真时不需要判断，恒为假时整个循环都不会执行
+	cond = pop_const_cond(p, enter_pos);
+
+	if (cond < 0) {
+		ret = add_cond_jmp(p, enter_pos, &exits);
+		CHECK_RESULT(ret);
+	}
 
-	ret = parse_then();
+	ret = parse_then(p);
 	CHECK_RESULT(ret);
 
-	ADD_INS(IT_JMP);
+	if (cond == 0) {
+		rollback_code(p, enter_pos);
+		fold_reset(p);
+		p->loop_size--;
+		return 0;
+	}
+
+	ADD_INS(IT_LOOP);
 	ADD_INS(enter_pos);
+	ADD_INS(0);
 
-	SET_INS(exit_pos, CUR_CODE_POS);
+	set_jmps(p, &exits, CUR_CODE_POS);
 
 	for (i = 0; i < loop->enter_size; ++i)
 		SET_INS(loop->enter[i], enter_pos);
@@ -1193,13 +1823,110 @@ static int parse_while() {
 	for (i = 0; i < loop->exit_size; ++i)
 		SET_INS(loop->exit[i], CUR_CODE_POS);
 
-	P.loop_size--;
+	p->loop_size--;
+	fold_reset(p);
+	ret = 0;
+exit0:
+	return ret;
+}
+
+/*
+	for i in a..b step s，包括上下限，步长默认为1。
+	计数、上限和步长按顺序压入运行栈，循环期间一直留在栈上：
+		a; b; s; FOR_PREP exit i
+	body:
+		...
+	continue:
+		FOR_LOOP body i
+	exit:
+		POP; POP; POP
+	FOR_LOOP 一条指令完成计数加步长、与上限比较和跳回循环体。
+*/
+static int parse_for(parse_state_s* p) {
+	int ret;
+	int i;
+	int32_t id_pos;
+	uint32_t line;
+	uint32_t prep_pos;
+	uint32_t body_pos;
+	uint32_t loop_pos;
+	obj_s one;
+	token_s t;
+	parse_loop_s* loop = &p->loops[p->loop_size++];
+	CHECK_CONDITION(p->loop_size < MAX_LOOP_NEST);
+
+	memset(loop, 0, sizeof(parse_loop_s));
+
+	EXPECT_NEXT_TOKEN(t, TT_IDENTIFIER);
+	line = t.line;
+	ret = parse_get_obj(p, t.str, &id_pos);
+	CHECK_RESULT(ret);
+
+	EXPECT_NEXT_TOKEN(t, TT_REV_IN);
+
+	ret = parse_expression(p);
+	CHECK_RESULT(ret);
+
+	EXPECT_NEXT_TOKEN(t, TT_RANGE);
+
+	ret = parse_expression(p);
+	CHECK_RESULT(ret);
+
+	NEXT_TOKEN(t);
+
+	if (t.tt == TT_REV_STEP) {
+		ret = parse_expression(p);
+		CHECK_RESULT(ret);
+	}
+	else {
+		L_unread_token(&p->lex, &t);
+
+		one.type = MAT_OT_INT32;
+		one.int32 = 1;
+		ret = add_const(p, line, &one);
+		CHECK_RESULT(ret);
+	}
+
+	ADD_OP_LINE(line);
+	prep_pos = CUR_CODE_POS;
+	ADD_INS(IT_FOR_PREP);
+	ADD_INS(0);
+	ADD_INS((uint32_t)id_pos);
+	ADD_INS(0);
+
+	body_pos = CUR_CODE_POS;
+	fold_reset(p);
+
+	ret = parse_then(p);
+	CHECK_RESULT(ret);
+
+	loop_pos = CUR_CODE_POS;
+	ADD_OP_LINE(line);
+	ADD_INS(IT_FOR_LOOP);
+	ADD_INS(body_pos);
+	ADD_INS(0);
+	ADD_INS((uint32_t)id_pos);
+	ADD_INS(0);
+
+	SET_INS(prep_pos + 1, CUR_CODE_POS);
+
+	for (i = 0; i < loop->enter_size; ++i)
+		SET_INS(loop->enter[i], loop_pos);
+
+	for (i = 0; i < loop->exit_size; ++i)
+		SET_INS(loop->exit[i], CUR_CODE_POS);
+
+	for (i = 0; i < 3; ++i)
+		ADD_INS(IT_POP);
+
+	p->loop_size--;
+	fold_reset(p);
 	ret = 0;
 exit0:
 	return ret;
 }
 
-static int parse_function() {
+static int parse_function(parse_state_s* p) {
 	int ret;
 	token_s t;
 	string_s* func_name;
@@ -1209,15 +1936,15 @@ static int parse_function() {
 	EXPECT_NEXT_TOKEN(t, TT_IDENTIFIER);
 
 	func_name = t.str;
-	idx = HL_get_obj_direct(&P.mod->objs, func_name, &obj);
+	idx = HL_get_obj_direct(&p->mod->objs, func_name, &obj);
 
 	if (idx >= 0 && obj.type != MAT_OT_DUMMY) {
-		E_rt_err(P.mat, P.file_name, t.line, "The function name \"%s\" has been used in another place.", func_name->str);
+		E_rt_err(p->mat, p->file_name, t.line, "The function name \"%s\" has been used in another place.", func_name->str);
 		return -1;
 	}
 
 	func = malloc(sizeof(func_s));
-	V_PUSH_BACK(P.mod->funcs, func, func_s*);
+	V_PUSH_BACK(p->mod->funcs, func, func_s*);
 
 	obj.type = MAT_OT_FUNC;
 	obj.func = func;
@@ -1227,27 +1954,93 @@ static int parse_function() {
 	ret = F_init(func);
 	CHECK_RESULT(ret);
 
-	idx = HL_set_obj(&P.mod->objs, func_name, &obj);
+	idx = HL_set_obj(&p->mod->objs, func_name, &obj);
 	CHECK_CONDITION(idx >= 0);
 
-	P.func = func;
+	p->func = func;
+	fold_reset(p);
+
+	ret = parse_func_param(p, func);
+	CHECK_RESULT(ret);
+
+	if (p->lazy)
+		ret = skip_func_body(p, func, t.line);
+	else
+		ret = parse_func_body(p, func, t.line, p->mat->backend);
 
-	ret = parse_func_param(func);
 	CHECK_RESULT(ret);
 
-	ret = parse_block();
+	ret = 0;
+exit0:
+	p->func = NULL;
+	fold_reset(p);
+	return ret;
+}
+
+// ret_line 为函数末尾 RET 指令的行号
+static int parse_func_body(parse_state_s* p, func_s* func, uint32_t ret_line, mat_backend_e backend) {
+	int ret;
+
+	ret = parse_block(p);
 	CHECK_RESULT(ret);
 
-	ADD_OP_LINE(t.line);
+	ADD_OP_LINE(ret_line);
 	ADD_INS(IT_RET);
 
+	if (backend == MAT_BACKEND_REGISTER) {
+		ret = RG_gen_func(p->mat, func);
+		CHECK_RESULT(ret);
+	}
+
+	ret = 0;
+exit0:
+	return ret;
+}
+
+/*
+	延迟编译：只记录函数体在源代码中的位置，跳过函数体。
+	函数体里的错误到第一次调用时才报告。
+*/
+static int skip_func_body(parse_state_s* p, func_s* func, uint32_t ret_line) {
+	int ret;
+	token_s t;
+	func_lazy_s* lazy;
+	uint32_t line;
+	uint32_t pos = L_tell(&p->lex, &line);
+
+	EXPECT_NEXT_TOKEN(t, TT_OPEN_CURLY_BRACE);
+
+	ret = L_skip_block(&p->lex);
+	CHECK_RESULT(ret);
+
+	lazy = malloc(sizeof(func_lazy_s));
+	CHECK_MALLOC(lazy);
+
+	lazy->mod = p->mod;
+	lazy->pos = pos;
+	lazy->line = line;
+	lazy->ret_line = ret_line;
+	lazy->global_num = HL_SIZE(p->mod->objs);
+	lazy->backend = p->mat->backend;
+	func->lazy = lazy;
+	p->mod->lazy_num++;
+
+	// 编译之前不占用代码空间
+	V_free(&func->code);
+	V_free(&func->op_line);
+
+	ret = V_init(&func->code, sizeof(uint32_t), 0);
+	CHECK_RESULT(ret);
+
+	ret = V_init(&func->op_line, sizeof(op_line_s), 0);
+	CHECK_RESULT(ret);
+
 	ret = 0;
 exit0:
-	P.func = NULL;
 	return ret;
 }
 
-static int parse_func_param(func_s* func) {
+static int parse_func_param(parse_state_s* p, func_s* func) {
 	token_s t;
 	int ret;
 	assert(func);
@@ -1283,7 +2076,11 @@ exit0:
 	return ret;
 }
 
-static int parse_func_call() {
+/*
+	callee_pos 为压入被调用对象的指令位置，func_pos 为不带模块限定和下标的模块对象下标，其它情况为 -1。
+	被调用的是可以内联的函数时，参数之后直接接上带检查的函数代码，见 inl.h。
+*/
+static int parse_func_call(parse_state_s* p, uint32_t callee_pos, int32_t func_pos) {
 	int ret;
 	token_s t;
 	int32_t param_num = 0;
@@ -1291,9 +2088,9 @@ static int parse_func_call() {
 	NEXT_TOKEN(t);
 
 	while (t.tt != TT_CLOSE_PAREN) {
-		L_unread_token(&t);
+		L_unread_token(&p->lex, &t);
 
-		ret = parse_expression();
+		ret = parse_expression(p);
 		CHECK_RESULT(ret);
 
 		param_num++;
@@ -1304,16 +2101,33 @@ static int parse_func_call() {
 			NEXT_TOKEN(t);
 	}
 
+	if (func_pos >= 0 && V_AT(*get_cur_code(p), callee_pos, uint32_t) == IT_PUSH_GLOBAL) {
+		ret = INL_inline_call(p->mat, p->mod, p->func, func_pos, param_num, t.line);
+		CHECK_RESULT(ret);
+
+		if (ret == 0) {
+			// 内联的代码里有跳转目标，也可能修改模块对象
+			p->last_call = (uint32_t)-1;
+			fold_join(p);
+			forget_globals(p);
+			return 0;
+		}
+	}
+
 	ADD_OP_LINE(t.line);
+	p->last_call = CUR_CODE_POS;
 	ADD_INS(IT_CALL);
 	ADD_INS(param_num);
 
+	// 被调用的函数可能修改模块对象
+	forget_globals(p);
+
 	ret = 0;
 exit0:
 	return ret;
 }
 
-static int parse_import() {
+static int parse_import(parse_state_s* p) {
 	int ret;
 	token_s t;
 	obj_s obj;
@@ -1324,15 +2138,16 @@ static int parse_import() {
 	ADD_OP_LINE(t.line);
 	ADD_INS(IT_IMPORT);
 
-	ret = S_get_str_idx(&P.mat->strs_nogc, t.str, &idx);
+	ret = S_get_str_idx(&p->mat->strs_nogc, t.str, &idx);
 	CHECK_RESULT(ret);
 
 	ADD_INS(idx);
+	forget_globals(p);
 
-	ret = VM_add_mod(P.mat, t.str, &mod, &idx);
+	ret = VM_add_mod(p->mat, t.str, &mod, &idx);
 	CHECK_RESULT(ret);
 
-	ret = BU_import(P.mat, mod);
+	ret = BU_import(p->mat, mod);
 	CHECK_RESULT(ret);
 
 	EXPECT_NEXT_TOKEN(t, TT_REV_AS);
@@ -1340,64 +2155,192 @@ static int parse_import() {
 
 	obj.type = MAT_OT_MOD;
 	obj.mod = mod;
-	idx = HL_set_obj(&P.mod->objs, t.str, &obj);
+	idx = HL_set_obj(&p->mod->objs, t.str, &obj);
+	CHECK_RESULT(ret);
+
+	ret = 0;
+exit0:
+	return ret;
+}
+
+// 解析状态每次解析各用一份，比较大，放在堆上
+static parse_state_s* new_parser() {
+	parse_state_s* p = malloc(sizeof(parse_state_s));
+	CHECK_MALLOC(p);
+	memset(p, 0, sizeof(parse_state_s));
+	p->last_call = (uint32_t)-1;
+	p->global_num = -1;
+	return p;
+}
+
+static void free_parser(parse_state_s* p) {
+	if (p) {
+		L_clear(&p->lex);
+		free(p);
+	}
+}
+
+static int read_src(mod_s* mod) {
+	int ret;
+	char path[MAX_PATH];
+	FILE* fp;
+	long size;
+
+	sprintf(path, "%s.mat", mod->name->str);
+	fp = fopen(path, "rb");
+
+	if (fp == NULL)
+		return -1;
+
+	ret = fseek(fp, 0, SEEK_END);
 	CHECK_RESULT(ret);
 
+	size = ftell(fp);
+	CHECK_CONDITION(size >= 0);
+	rewind(fp);
+
+	mod->src = malloc(size + 1);
+	CHECK_MALLOC(mod->src);
+	mod->src_size = (uint32_t)size;
+	CHECK_CONDITION(fread(mod->src, 1, size, fp) == (size_t)size);
+
 	ret = 0;
 exit0:
+	fclose(fp);
 	return ret;
 }
 
+static void free_src(mod_s* mod) {
+	free(mod->src);
+	mod->src = NULL;
+	mod->src_size = 0;
+}
+
 /* method */
 int P_parse_file(matrix_t mat, mod_s* mod) {
 	int ret = 0;
+	parse_state_s* p = NULL;
 	assert(mat);
 	assert(mod);
 
-	ret = init_parser(mat, mod);
+	if (mat->lazy && mod->src == NULL) {
+		ret = read_src(mod);
+		CHECK_RESULT(ret);
+	}
+
+	p = new_parser();
+	ret = init_parser(p, mat, mod);
 	CHECK_RESULT(ret);
 
-	ret = parse_program();
+	ret = parse_program(p);
 	CHECK_RESULT(ret);
 
 	ret = OPT_optimize(mod);
 	CHECK_RESULT(ret);
 
+	ret = LK_link_mod(mat, mod, NULL);
+	CHECK_RESULT(ret);
+
+	ret = 0;
+exit0:
+	free_parser(p);
+
+	// 没有延迟编译的函数时不再需要源代码
+	if (mod->src && mod->lazy_num == 0)
+		free_src(mod);
+
+	return ret;
+}
+
+int P_compile_func(matrix_t mat, func_s* func) {
+	int ret;
+	func_lazy_s* lazy = func->lazy;
+	mod_s* mod = lazy->mod;
+	parse_state_s* p = new_parser();
+	assert(mat);
+	assert(mod->src);
+
+	ret = init_parser(p, mat, mod);
+	CHECK_RESULT(ret);
+
+	L_seek(&p->lex, lazy->pos, lazy->line);
+	p->lazy = 0;
+	p->func = func;
+	p->global_num = (int32_t)lazy->global_num;
+
+	ret = parse_func_body(p, func, lazy->ret_line, lazy->backend);
+	CHECK_RESULT(ret);
+
+	ret = OPT_optimize_func(func);
+	CHECK_RESULT(ret);
+
+	ret = LK_link_func(mat, mod, func, NULL);
+	CHECK_RESULT(ret);
+
+	ret = DBG_add_func(mat, mod, func);
+	CHECK_RESULT(ret);
+
+	func->lazy = NULL;
+	free(lazy);
+
+	if (--mod->lazy_num == 0)
+		free_src(mod);
+
+	ret = 0;
+exit0:
+	// 编译失败时丢掉生成了一半的代码，下次调用时重新编译并报告同样的错误
+	if (func->lazy) {
+		V_SIZE(func->code) = 0;
+		V_SIZE(func->op_line) = 0;
+		V_SIZE(func->lcode) = 0;
+		V_SIZE(func->caches) = 0;
+	}
+
+	free_parser(p);
+	return ret;
+}
+
+int P_compile_mod(matrix_t mat, mod_s* mod) {
+	int ret;
+	uint32_t i;
+	assert(mat);
+	assert(mod);
+
+	for (i = 0; i < V_SIZE(mod->funcs) && mod->lazy_num > 0; ++i) {
+		func_s* func = V_AT(mod->funcs, i, func_s*);
+
+		if (func->lazy) {
+			ret = P_compile_func(mat, func);
+			CHECK_RESULT(ret);
+		}
+	}
+
 	ret = 0;
 exit0:
-	P_clear();
 	return ret;
 }
 
 int P_parse_str(matrix_t mat, mod_s* mod, const char* str, uint32_t size) {
 	int ret;
+	parse_state_s* p = new_parser();
 	assert(mat);
 	assert(mod);
 	assert(str);
 
-	ret = init_parser_str(mat, mod, str, size);
+	ret = init_parser_str(p, mat, mod, str, size);
 	CHECK_RESULT(ret);
 
-	ret = parse_program();
+	ret = parse_program(p);
 	CHECK_RESULT(ret);
 
 	ret = OPT_optimize(mod);
 	CHECK_RESULT(ret);
 
+	ret = LK_link_mod(mat, mod, NULL);
+	CHECK_RESULT(ret);
+
 	ret = 0;
 exit0:
-	P_clear();
+	free_parser(p);
 	return ret;
 }
-
-int P_clear() {
-	P.mat = NULL;
-	P.file_name = NULL;
-	P.mod = NULL;
-	P.func = NULL;
-	memset(P.loops, 0, sizeof(P.loops));
-	P.loop_size = 0;
-	L_clear();
-	return 0;
-}
-
@@ -13,7 +13,12 @@
 
 int P_parse_file(matrix_t mat, mod_s* mod);
 int P_parse_str(matrix_t mat, mod_s* mod, const char* str, uint32_t size);
-int P_clear();
+
+// 编译延迟编译的函数体，函数第一次被调用之前调用，出错时函数保持未编译
+int P_compile_func(matrix_t mat, func_s* func);
+
+// 编译模块中所有还没有编译的函数体
+int P_compile_mod(matrix_t mat, mod_s* mod);
 
 #endif
 
@@ -0,0 +1,376 @@
+﻿/*
+    Matrix Script Language
+    author: Zeb
+    e-mail: zebbey@gmail.com
+    Copyright (c) 2004 Zeb.  All rights reserved.
+*/
+
+#include "obj.h"
+#include "pc.h"
+#include "str.h"
+#include "vec.h"
+#include "err.h"
+#include "hash_list.h"
+#include "vm.h"
+#include "bc.h"
+#include "parse.h"
+#include "builtins.h"
+
+#if defined(PLATFORM_WINDOWS)
+typedef HANDLE pc_thread_t;
+typedef CRITICAL_SECTION pc_mutex_t;
+typedef CONDITION_VARIABLE pc_cond_t;
+#	define PC_LOCK(pool) EnterCriticalSection(&(pool)->lock)
+#	define PC_UNLOCK(pool) LeaveCriticalSection(&(pool)->lock)
+#	define PC_WAIT(pool) SleepConditionVariableCS(&(pool)->cond, &(pool)->lock, INFINITE)
+#	define PC_WAKE(pool) WakeAllConditionVariable(&(pool)->cond)
+#elif defined(PLATFORM_LINUX) || defined(PLATFORM_MACOS)
+#	include <pthread.h>
+typedef pthread_t pc_thread_t;
+typedef pthread_mutex_t pc_mutex_t;
+typedef pthread_cond_t pc_cond_t;
+#	define PC_LOCK(pool) pthread_mutex_lock(&(pool)->lock)
+#	define PC_UNLOCK(pool) pthread_mutex_unlock(&(pool)->lock)
+#	define PC_WAIT(pool) pthread_cond_wait(&(pool)->cond, &(pool)->lock)
+#	define PC_WAKE(pool) pthread_cond_broadcast(&(pool)->cond)
+#endif
+
+typedef enum pc_state_e {
+	PC_JOB_WAIT,
+	PC_JOB_RUN,
+	PC_JOB_DONE,
+} pc_state_e;
+
+typedef struct pc_job_s {
+	struct pc_job_s* next;
+	char* name;
+	pc_state_e state;
+	void* image; // 编译好的映像，没有编译或者编译失败时为 NULL
+	uint32_t size;
+} pc_job_s;
+
+typedef struct pc_pool_s {
+	pc_mutex_t lock;
+	pc_cond_t cond; // 有新任务、任务完成或者要退出时广播
+	pc_thread_t* threads;
+	uint32_t thread_num;
+	pc_job_s* jobs; // 按提交顺序排列，主线程通常也按这个顺序加载
+	pc_job_s* tail;
+	mat_backend_e backend;
+	int cache;
+	int quit;
+} pc_pool_s;
+
+// 调用时已经加锁
+static pc_job_s* find_job(pc_pool_s* pool, const char* name) {
+	pc_job_s* job;
+
+	for (job = pool->jobs; job; job = job->next) {
+		if (strcmp(job->name, name) == 0)
+			return job;
+	}
+
+	return NULL;
+}
+
+// 调用时已经加锁，同一个模块只有一个任务
+static pc_job_s* add_job(pc_pool_s* pool, const char* name, pc_state_e state) {
+	pc_job_s* job = find_job(pool, name);
+	size_t len;
+
+	if (job)
+		return job;
+
+	len = strlen(name);
+	job = malloc(sizeof(pc_job_s));
+
+	if (!job)
+		return NULL;
+
+	job->name = malloc(len + 1);
+
+	if (!job->name) {
+		free(job);
+		return NULL;
+	}
+
+	memcpy(job->name, name, len + 1);
+	job->next = NULL;
+	job->state = state;
+	job->image = NULL;
+	job->size = 0;
+
+	if (pool->tail)
+		pool->tail->next = job;
+	else
+		pool->jobs = job;
+
+	pool->tail = job;
+	return job;
+}
+
+// 提交 mod 导入的模块，已经加载或者正在加载的不再提交
+static int add_imports(pc_pool_s* pool, mod_s* mod) {
+	int ret = 0;
+	uint32_t i;
+
+	PC_LOCK(pool);
+
+	for (i = 0; i < HL_SIZE(mod->objs); ++i) {
+		obj_s obj;
+
+		if (HL_get_obj(&mod->objs, i, &obj) != 0 || obj.type != MAT_OT_MOD)
+			continue;
+
+		if (obj.mod == mod || obj.mod->init || V_SIZE(obj.mod->lcode) > 0)
+			continue;
+
+		if (!add_job(pool, obj.mod->name->str, PC_JOB_WAIT)) {
+			ret = -1;
+			break;
+		}
+	}
+
+	PC_WAKE(pool);
+	PC_UNLOCK(pool);
+	return ret;
+}
+
+// 在临时虚拟机里编译一个模块，只在这个线程里访问 job 的映像，完成后才标记为 PC_JOB_DONE
+static void compile(pc_pool_s* pool, pc_job_s* job) {
+	int ret;
+	matrix_t mat = NULL;
+	string_s* name;
+	mod_s* mod;
+	uint32_t idx;
+	void* image;
+	uint32_t size;
+
+	ret = MAT_init(&mat);
+	CHECK_RESULT(ret);
+
+	mat->quiet = 1;
+	mat->backend = pool->backend;
+	mat->cache = pool->cache;
+	mat->jit = 0;
+
+	ret = S_get_str(&mat->strs_nogc, job->name, &name);
+	CHECK_RESULT(ret);
+
+	ret = VM_add_mod(mat, name, &mod, &idx);
+	CHECK_RESULT(ret);
+
+	ret = BU_import(mat, mod);
+	CHECK_RESULT(ret);
+
+	// 缓存可用时由主线程读取，这里读一遍只是为了找到它导入的模块
+	ret = mat->cache ? BC_load(mat, mod) : 1;
+	CHECK_RESULT(ret);
+
+	if (ret == 1) {
+		ret = P_parse_file(mat, mod);
+		CHECK_RESULT(ret);
+
+		if (BC_save_image(mat, mod, &image, &size) == 0) {
+			if (mat->cache)
+				BC_write_image(mod, image, size);
+
+			job->image = image;
+			job->size = size;
+		}
+	}
+
+	add_imports(pool, mod);
+
+exit0:
+	if (mat)
+		MAT_free(mat);
+}
+
+static void work(pc_pool_s* pool) {
+	pc_job_s* job;
+
+	PC_LOCK(pool);
+
+	while (!pool->quit) {
+		for (job = pool->jobs; job && job->state != PC_JOB_WAIT; job = job->next);
+
+		if (!job) {
+			PC_WAIT(pool);
+			continue;
+		}
+
+		job->state = PC_JOB_RUN;
+		PC_UNLOCK(pool);
+
+		compile(pool, job);
+
+		PC_LOCK(pool);
+		job->state = PC_JOB_DONE;
+		PC_WAKE(pool);
+	}
+
+	PC_UNLOCK(pool);
+}
+
+#if defined(PLATFORM_WINDOWS)
+static DWORD WINAPI thread_main(LPVOID arg) {
+	work((pc_pool_s*)arg);
+	return 0;
+}
+#elif defined(PLATFORM_LINUX) || defined(PLATFORM_MACOS)
+static void* thread_main(void* arg) {
+	work((pc_pool_s*)arg);
+	return NULL;
+}
+#endif
+
+static int start(matrix_t mat) {
+	pc_pool_s* pool;
+	uint32_t i;
+
+	pool = malloc(sizeof(pc_pool_s));
+	CHECK_MALLOC(pool);
+	memset(pool, 0, sizeof(pc_pool_s));
+
+	pool->threads = malloc(mat->parallel * sizeof(pc_thread_t));
+
+	if (!pool->threads) {
+		free(pool);
+		return -1;
+	}
+
+	pool->backend = mat->backend;
+	pool->cache = mat->cache;
+
+#if defined(PLATFORM_WINDOWS)
+	InitializeCriticalSection(&pool->lock);
+	InitializeConditionVariable(&pool->cond);
+#elif defined(PLATFORM_LINUX) || defined(PLATFORM_MACOS)
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+#endif
+
+	// 线程启动失败时用已经启动的线程，一个都没有时主线程自己编译
+	for (i = 0; i < mat->parallel; ++i) {
+#if defined(PLATFORM_WINDOWS)
+		pool->threads[i] = CreateThread(NULL, 0, thread_main, pool, 0, NULL);
+
+		if (!pool->threads[i])
+			break;
+#elif defined(PLATFORM_LINUX) || defined(PLATFORM_MACOS)
+		if (pthread_create(&pool->threads[i], NULL, thread_main, pool) != 0)
+			break;
+#endif
+
+		pool->thread_num++;
+	}
+
+	mat->pc = pool;
+	return 0;
+}
+
+int PC_submit(matrix_t mat, mod_s* mod) {
+	int ret;
+	assert(mat);
+	assert(mod);
+
+	if (mat->parallel == 0 || mat->lazy)
+		return 0;
+
+	if (!mat->pc) {
+		ret = start(mat);
+		CHECK_RESULT(ret);
+	}
+
+	if (mat->pc->thread_num == 0)
+		return 0;
+
+	ret = add_imports(mat->pc, mod);
+	CHECK_RESULT(ret);
+
+	ret = 0;
+exit0:
+	return ret;
+}
+
+int PC_load(matrix_t mat, mod_s* mod) {
+	pc_pool_s* pool = mat->pc;
+	pc_job_s* job;
+	void* image;
+	uint32_t size;
+	assert(mat);
+	assert(mod);
+
+	if (!pool)
+		return 1;
+
+	PC_LOCK(pool);
+	job = find_job(pool, mod->name->str);
+
+	// 没有提交过或者还没有线程开始编译时，主线程自己加载，同时防止以后再提交
+	if (!job || job->state == PC_JOB_WAIT) {
+		if (job)
+			job->state = PC_JOB_DONE;
+		else
+			add_job(pool, mod->name->str, PC_JOB_DONE);
+
+		PC_UNLOCK(pool);
+		return 1;
+	}
+
+	while (job->state != PC_JOB_DONE)
+		PC_WAIT(pool);
+
+	image = job->image;
+	size = job->size;
+	job->image = NULL;
+	PC_UNLOCK(pool);
+
+	if (!image)
+		return 1;
+
+	return BC_load_image(mat, mod, image, size);
+}
+
+void PC_free(matrix_t mat) {
+	pc_pool_s* pool = mat->pc;
+	pc_job_s* job;
+	uint32_t i;
+
+	if (!pool)
+		return;
+
+	PC_LOCK(pool);
+	pool->quit = 1;
+	PC_WAKE(pool);
+	PC_UNLOCK(pool);
+
+	for (i = 0; i < pool->thread_num; ++i) {
+#if defined(PLATFORM_WINDOWS)
+		WaitForSingleObject(pool->threads[i], INFINITE);
+		CloseHandle(pool->threads[i]);
+#elif defined(PLATFORM_LINUX) || defined(PLATFORM_MACOS)
+		pthread_join(pool->threads[i], NULL);
+#endif
+	}
+
+	while (pool->jobs) {
+		job = pool->jobs;
+		pool->jobs = job->next;
+		free(job->image);
+		free(job->name);
+		free(job);
+	}
+
+#if defined(PLATFORM_WINDOWS)
+	DeleteCriticalSection(&pool->lock);
+#elif defined(PLATFORM_LINUX) || defined(PLATFORM_MACOS)
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->cond);
+#endif
+
+	free(pool->threads);
+	free(pool);
+	mat->pc = NULL;
+}
@@ -0,0 +1,35 @@
+﻿/*
+    Matrix Script Language
+    author: Zeb
+    e-mail: zebbey@gmail.com
+    Copyright (c) 2004 Zeb.  All rights reserved.
+*/
+
+#ifndef __H_PC__
+#define __H_PC__
+
+#include "matrix.h"
+#include "mod.h"
+
+/**
+    并行编译模块
+    用 MAT_set_parallel 打开后，主线程加载完一个模块，就把它导入的、还没有加载的模块交给后台线程编译。
+    后台线程为每个模块建一个临时虚拟机，在里面解析、优化，生成与 .matc 格式相同的映像，
+    然后继续提交这个模块导入的模块，这样整个导入图都在后台并行编译。
+    主线程执行到 import 时等待这个模块的任务完成，用 BC_load_image 读取映像再链接，
+    模块代码仍然在主线程按原来的顺序执行，结果与串行加载相同。
+    打开缓存时后台线程顺便写 name.matc，缓存已经可用的模块不再编译，由主线程直接读取。
+    后台编译出错时不输出错误，主线程重新解析这个模块并报告错误。
+    延迟编译函数体 (MAT_set_lazy) 打开时不做后台编译。
+*/
+
+// 把 mod 导入的、还没有加载的模块交给后台线程编译，第一次调用时启动线程
+int PC_submit(matrix_t mat, mod_s* mod);
+
+// 等待 mod 的后台编译完成并加载，加载完成返回0，没有可用的结果返回1，出错返回 -1
+int PC_load(matrix_t mat, mod_s* mod);
+
+// 停止后台线程，释放没有取走的编译结果
+void PC_free(matrix_t mat);
+
+#endif // __H_PC__
@@ -55,7 +55,7 @@ static void cache_list(pool_list_s* pl, list_s* list) {
 static list_s* alloc_list(uint32_t n, uint32_t size) {
 	int ret;
 	list_s* head = NULL;
-	uint32_t s = size;
+	uint32_t s = n;
 
 	while (s--) {
 		list_s* list = malloc(sizeof(list_s));
@@ -120,7 +120,7 @@ static void cache_dict(pool_dict_s* pd, dict_s* dict) {
 static dict_s* alloc_dict(uint32_t n, uint32_t size) {
 	int ret;
 	dict_s* head = NULL;
-	uint32_t s = size;
+	uint32_t s = n;
 
 	while (s--) {
 		dict_s* dict = malloc(sizeof(dict_s));
@@ -0,0 +1,445 @@
+﻿/*
+    Matrix Script Language
+    author: Zeb
+    e-mail: zebbey@gmail.com
+    Copyright (c) 2004 Zeb.  All rights reserved.
+*/
+
+#include "obj.h"
+#include "reg.h"
+#include "ins.h"
+#include "vec.h"
+#include "str.h"
+#include "err.h"
+#include "hash_list.h"
+#include "debug.h"
+
+#define NO_OP ((uint32_t)-1)
+
+#define EMIT(g, w) V_PUSH_BACK((g)->code, (uint32_t)(w), uint32_t)
+
+// 虚拟栈上的值，还没有真正压入运行栈
+typedef enum {
+	RV_REG, // 帧内对象，val 为函数对象的下标
+	RV_INT, // 整数常量，val 为常量值
+} reg_val_e;
+
+typedef struct {
+	reg_val_e kind;
+	int32_t val;
+} reg_val_s;
+
+typedef struct {
+	matrix_t mat;
+	func_s* func;
+	vec_s code; // uint32_t
+	reg_val_s vs[MAX_REG_TEMP_NUM];
+	uint32_t vs_size;
+	int32_t temps[MAX_REG_TEMP_NUM]; // 虚拟栈每个位置对应的临时对象下标
+	uint32_t last_op; // 结果还在虚拟栈顶的寄存器指令的位置
+} reg_gen_s;
+
+// 取得虚拟栈第 k 个位置的临时对象，第一次使用时加入函数对象表
+static int get_temp(reg_gen_s* g, uint32_t k, int32_t* idx) {
+	char name[16];
+	string_s* s;
+	obj_s obj;
+
+	if (g->temps[k] < 0) {
+		sprintf(name, "$%u", k);
+
+		if (S_get_str(&g->mat->strs_nogc, name, &s) != 0)
+			return -1;
+
+		obj.type = MAT_OT_DUMMY;
+		g->temps[k] = HL_set_obj(&g->func->objs, s, &obj);
+
+		if (g->temps[k] < 0)
+			return -1;
+	}
+
+	*idx = g->temps[k];
+	return 0;
+}
+
+// 把虚拟栈上的值按顺序压入运行栈
+static int flush(reg_gen_s* g) {
+	uint32_t i;
+
+	for (i = 0; i < g->vs_size; ++i) {
+		reg_val_s* v = g->vs + i;
+
+		if (v->kind == RV_INT) {
+			EMIT(g, IT_PUSH_INT);
+			EMIT(g, v->val);
+		}
+		else {
+			EMIT(g, IT_PUSH_LOCAL);
+			EMIT(g, v->val);
+		}
+	}
+
+	g->vs_size = 0;
+	g->last_op = NO_OP;
+	return 0;
+}
+
+// 整数常量没有寄存器，用到时先装入对应位置的临时对象
+static int materialize(reg_gen_s* g, uint32_t k) {
+	reg_val_s* v = g->vs + k;
+	int32_t idx;
+
+	if (v->kind == RV_REG)
+		return 0;
+
+	if (get_temp(g, k, &idx) != 0)
+		return -1;
+
+	EMIT(g, IT_R_LOADI);
+	EMIT(g, idx);
+	EMIT(g, v->val);
+
+	v->kind = RV_REG;
+	v->val = idx;
+	return 0;
+}
+
+// 虚拟栈顶以下是否还有值引用了局部对象 idx
+static int is_referenced(reg_gen_s* g, int32_t idx) {
+	uint32_t i;
+
+	for (i = 0; i + 1 < g->vs_size; ++i) {
+		if (g->vs[i].kind == RV_REG && g->vs[i].val == idx)
+			return 1;
+	}
+
+	return 0;
+}
+
+static int push_val(reg_gen_s* g, reg_val_e kind, int32_t val) {
+	if (g->vs_size >= MAX_REG_TEMP_NUM && flush(g) != 0)
+		return -1;
+
+	g->vs[g->vs_size].kind = kind;
+	g->vs[g->vs_size].val = val;
+	g->vs_size++;
+	g->last_op = NO_OP;
+	return 0;
+}
+
+static int gen_binary(reg_gen_s* g, uint32_t ins) {
+	uint32_t k = g->vs_size - 2;
+	int32_t dst;
+
+	if (materialize(g, k) != 0 || materialize(g, k + 1) != 0)
+		return -1;
+
+	if (get_temp(g, k, &dst) != 0)
+		return -1;
+
+	g->last_op = V_SIZE(g->code);
+	EMIT(g, ins);
+	EMIT(g, dst);
+	EMIT(g, g->vs[k].val);
+	EMIT(g, g->vs[k + 1].val);
+
+	g->vs_size--;
+	g->vs[k].kind = RV_REG;
+	g->vs[k].val = dst;
+	return 0;
+}
+
+static int gen_assign(reg_gen_s* g, int32_t idx) {
+	reg_val_s* v = g->vs + g->vs_size - 1;
+	uint32_t* last = g->last_op != NO_OP ? &V_AT(g->code, g->last_op, uint32_t) : NULL;
+
+	// 上一条指令的结果直接写到目标对象里，目标不能是第二个操作数，
+	// 第一个操作数与结果相同时和栈代码的行为一致
+	if (last && v->kind == RV_REG && (int32_t)last[1] == v->val && (int32_t)last[3] != idx)
+		last[1] = (uint32_t)idx;
+	else if (v->kind == RV_INT) {
+		EMIT(g, IT_R_LOADI);
+		EMIT(g, idx);
+		EMIT(g, v->val);
+	}
+	else if (v->val != idx) {
+		EMIT(g, IT_R_MOVE);
+		EMIT(g, idx);
+		EMIT(g, v->val);
+	}
+
+	g->vs_size--;
+	g->last_op = NO_OP;
+	return 0;
+}
+
+static int gen_assign_op(reg_gen_s* g, uint32_t ins, int32_t idx) {
+	uint32_t k = g->vs_size - 1;
+
+	if (materialize(g, k) != 0)
+		return -1;
+
+	EMIT(g, ins);
+	EMIT(g, idx);
+	EMIT(g, idx);
+	EMIT(g, g->vs[k].val);
+
+	g->vs_size--;
+	g->last_op = NO_OP;
+	return 0;
+}
+
+static int gen_jmp(reg_gen_s* g, uint32_t ins, uint32_t pos) {
+	if (materialize(g, 0) != 0)
+		return -1;
+
+	EMIT(g, ins);
+	EMIT(g, g->vs[0].val);
+	EMIT(g, pos);
+
+	g->vs_size = 0;
+	g->last_op = NO_OP;
+	return 0;
+}
+
+// 不带下标和模块限定的局部对象，返回对象下标，否则返回 -1
+static int32_t local_idx(uint32_t* ip) {
+	int32_t pos = (int32_t)ip[2];
+
+	if ((int32_t)ip[1] != -1 || pos >= 0 || ip[3] != 0)
+		return -1;
+
+	return -(pos + 1);
+}
+
+static uint32_t r_ins(uint32_t ins) {
+	switch (ins) {
+		case IT_ADD:
+		case IT_ASSIGN_ADD:
+			return IT_R_ADD;
+
+		case IT_SUB:
+		case IT_ASSIGN_SUB:
+			return IT_R_SUB;
+
+		case IT_MUL:
+		case IT_ASSIGN_MUL:
+			return IT_R_MUL;
+
+		case IT_DIV:
+		case IT_ASSIGN_DIV:
+			return IT_R_DIV;
+
+		case IT_EQ:
+			return IT_R_EQ;
+
+		case IT_NEQ:
+			return IT_R_NEQ;
+
+		case IT_LT:
+			return IT_R_LT;
+
+		case IT_LE:
+			return IT_R_LE;
+
+		case IT_GT:
+			return IT_R_GT;
+
+		case IT_GE:
+			return IT_R_GE;
+
+		case IT_FALSE_JMP:
+			return IT_R_FALSE_JMP;
+
+		case IT_TRUE_JMP:
+			return IT_R_TRUE_JMP;
+
+		default:
+			return IT_NOP;
+	}
+}
+
+// 尝试把一条指令改写到虚拟栈上，返回 1 表示已处理，0 表示需要原样输出
+static int gen_ins(reg_gen_s* g, uint32_t* ip) {
+	int32_t idx;
+	int ret = 0;
+
+	switch (*ip) {
+		case IT_PUSH_INT:
+			ret = push_val(g, RV_INT, (int32_t)ip[1]);
+			break;
+
+		case IT_PUSH_LOCAL:
+			ret = push_val(g, RV_REG, (int32_t)ip[1]);
+			break;
+
+		case IT_ADD:
+		case IT_SUB:
+		case IT_MUL:
+		case IT_DIV:
+		case IT_EQ:
+		case IT_NEQ:
+		case IT_LT:
+		case IT_LE:
+		case IT_GT:
+		case IT_GE:
+			if (g->vs_size < 2)
+				return 0;
+
+			ret = gen_binary(g, r_ins(*ip));
+			break;
+
+		case IT_STORE_LOCAL:
+			idx = (int32_t)ip[1];
+
+			if (g->vs_size == 0 || is_referenced(g, idx))
+				return 0;
+
+			ret = gen_assign(g, idx);
+			break;
+
+		case IT_ASSIGN_ADD:
+		case IT_ASSIGN_SUB:
+		case IT_ASSIGN_MUL:
+		case IT_ASSIGN_DIV:
+			idx = local_idx(ip);
+
+			if (idx < 0 || g->vs_size == 0 || is_referenced(g, idx))
+				return 0;
+
+			ret = gen_assign_op(g, r_ins(*ip), idx);
+			break;
+
+		case IT_FALSE_JMP:
+		case IT_TRUE_JMP:
+			// 栈上还有其它值时，跳转目标需要看到它们
+			if (g->vs_size != 1)
+				return 0;
+
+			ret = gen_jmp(g, r_ins(*ip), ip[1]);
+			break;
+
+		default:
+			return 0;
+	}
+
+	return ret == 0 ? 1 : -1;
+}
+
+// 把跳转地址和 op_line 从旧位置换成新位置
+static int relocate(reg_gen_s* g, uint32_t* pos_map, uint32_t old_size) {
+	int ret;
+	uint32_t* ip = &V_AT(g->code, 0, uint32_t);
+	uint32_t* ip_end = ip + V_SIZE(g->code);
+
+	while (ip < ip_end) {
+		uint32_t size = INS_size(*ip);
+		uint32_t* target = INS_jmp_target(ip);
+		CHECK_CONDITION(size > 0);
+
+		if (target) {
+			CHECK_CONDITION(*target <= old_size);
+			*target = pos_map[*target];
+		}
+
+		ip += size;
+	}
+
+	ret = DBG_relocate_op_line(&g->func->op_line, pos_map, old_size);
+	CHECK_RESULT(ret);
+
+	ret = 0;
+exit0:
+	return ret;
+}
+
+/* method */
+int RG_gen_func(matrix_t mat, func_s* func) {
+	int ret;
+	reg_gen_s g;
+	uint32_t* ip_begin;
+	uint32_t* ip;
+	uint32_t* ip_end;
+	uint32_t old_size = V_SIZE(func->code);
+	uint8_t* leaders = NULL;
+	uint32_t* pos_map = NULL;
+	uint32_t i;
+	assert(mat);
+	assert(func);
+
+	memset(&g, 0, sizeof(g));
+	g.mat = mat;
+	g.func = func;
+	g.last_op = NO_OP;
+
+	for (i = 0; i < MAX_REG_TEMP_NUM; ++i)
+		g.temps[i] = -1;
+
+	ret = V_init(&g.code, sizeof(uint32_t), old_size);
+	CHECK_RESULT(ret);
+
+	leaders = calloc(old_size + 1, sizeof(uint8_t));
+	CHECK_MALLOC(leaders);
+	pos_map = calloc(old_size + 1, sizeof(uint32_t));
+	CHECK_MALLOC(pos_map);
+
+	// 跳转目标处的虚拟栈必须为空
+	ip_begin = &V_AT(func->code, 0, uint32_t);
+	ip_end = ip_begin + old_size;
+
+	for (ip = ip_begin; ip < ip_end; ip += INS_size(*ip)) {
+		uint32_t* target = INS_jmp_target(ip);
+		CHECK_CONDITION(INS_size(*ip) > 0);
+
+		if (target) {
+			CHECK_CONDITION(*target <= old_size);
+			leaders[*target] = 1;
+		}
+	}
+
+	for (ip = ip_begin; ip < ip_end; ip += INS_size(*ip)) {
+		uint32_t pos = ip - ip_begin;
+
+		if (leaders[pos]) {
+			ret = flush(&g);
+			CHECK_RESULT(ret);
+		}
+
+		pos_map[pos] = V_SIZE(g.code);
+		ret = gen_ins(&g, ip);
+		CHECK_RESULT(ret);
+
+		if (ret == 0) {
+			ret = flush(&g);
+			CHECK_RESULT(ret);
+
+			pos_map[pos] = V_SIZE(g.code);
+
+			for (i = 0; i < INS_size(*ip); ++i) {
+				ret = V_alloc_one(&g.code);
+				CHECK_RESULT(ret);
+				V_AT(g.code, V_SIZE(g.code)++, uint32_t) = ip[i];
+			}
+		}
+	}
+
+	ret = flush(&g);
+	CHECK_RESULT(ret);
+	pos_map[old_size] = V_SIZE(g.code);
+
+	ret = relocate(&g, pos_map, old_size);
+	CHECK_RESULT(ret);
+
+	V_free(&func->code);
+	func->code = g.code;
+	g.code.p = NULL;
+
+	ret = 0;
+exit0:
+	if (g.code.p)
+		V_free(&g.code);
+
+	free(leaders);
+	free(pos_map);
+	return ret;
+}
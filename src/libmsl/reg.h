@@ -0,0 +1,27 @@
+﻿/*
+    Matrix Script Language
+    author: Zeb
+    e-mail: zebbey@gmail.com
+    Copyright (c) 2004 Zeb.  All rights reserved.
+*/
+
+#ifndef __H_REG__
+#define __H_REG__
+
+#include "matrix.h"
+#include "mod.h"
+
+/**
+    寄存器后端
+    函数解析完成后，把栈代码中只涉及局部对象和整数常量的部分改写成三地址的寄存器指令，
+    例如 x = a + b 由 PUSH_OBJ, PUSH_OBJ, ADD, ASSIGN 变成一条 R_ADD x a b。
+    寄存器就是帧内的对象槽位，表达式的中间结果放在隐藏的临时局部对象 $0, $1 ... 中。
+    改写时用一个虚拟栈记录还没有真正压栈的值，遇到不能改写的指令或者跳转目标时，
+    把虚拟栈上的值按原来的顺序压入运行栈，其余指令保持不变。
+    跳转地址和 op_line 在改写后统一修正。
+*/
+
+// 把函数代码改写为寄存器代码，需要在函数的最后一条指令生成以后调用
+int RG_gen_func(matrix_t mat, func_s* func);
+
+#endif // __H_REG__
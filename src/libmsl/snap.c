@@ -0,0 +1,1070 @@
+﻿/*
+    Matrix Script Language
+    author: Zeb
+    e-mail: zebbey@gmail.com
+    Copyright (c) 2004 Zeb.  All rights reserved.
+*/
+
+#include "obj.h"
+#include "snap.h"
+#include "ins.h"
+#include "vec.h"
+#include "str.h"
+#include "err.h"
+#include "hash.h"
+#include "hash_list.h"
+#include "func.h"
+#include "link.h"
+#include "vm.h"
+#include "list.h"
+#include "dict.h"
+#include "debug.h"
+#include "parse.h"
+
+#define SN_HEADER_SIZE 7
+
+#define PUT(w, word) V_PUSH_BACK((w)->body, (uint32_t)(word), uint32_t)
+
+// 按地址排序，查找函数、数组和字典的编号
+typedef struct {
+	const void* p;
+	uint32_t id;
+} sn_ref_s;
+
+typedef struct {
+	matrix_t mat;
+	mod_s* builtins;
+	vec_s strs; // string_s*
+	hash_s str_map; // 字符串到快照字符串表下标的映射
+	vec_s funcs; // sn_ref_s
+	vec_s lists; // sn_ref_s
+	vec_s dicts; // sn_ref_s
+	vec_s body; // uint32_t，字符串表之后的部分
+} sn_writer_s;
+
+typedef struct {
+	matrix_t mat;
+	mod_s* builtins;
+	const uint32_t* p;
+	uint32_t size;
+	uint32_t pos;
+	int bad; // 读取越界
+	uint32_t str_num;
+	string_s** strs;
+	uint32_t mod_num;
+	vec_s funcs; // func_s*
+	vec_s lists; // list_s*
+	vec_s dicts; // dict_s*
+} sn_loader_s;
+
+static int compare_ref(const void* a, const void* b) {
+	const sn_ref_s* r1 = (const sn_ref_s*)a;
+	const sn_ref_s* r2 = (const sn_ref_s*)b;
+
+	if (r1->p == r2->p)
+		return 0;
+
+	return r1->p < r2->p ? -1 : 1;
+}
+
+static int add_ref(vec_s* refs, const void* p) {
+	sn_ref_s* r;
+	V_PUSH_BACK_GET(*refs, r, sn_ref_s);
+	r->p = p;
+	r->id = V_SIZE(*refs) - 1;
+	return 0;
+}
+
+// 在排好序的 refs 中查找 p 的编号，找不到返回 -1
+static int32_t find_ref(vec_s* refs, const void* p) {
+	sn_ref_s key;
+	sn_ref_s* r;
+
+	if (V_SIZE(*refs) == 0)
+		return -1;
+
+	key.p = p;
+	r = (sn_ref_s*)bsearch(&key, refs->p, V_SIZE(*refs), sizeof(sn_ref_s), compare_ref);
+	return r ? (int32_t)r->id : -1;
+}
+
+// 读入整个文件，buf 按 uint32_t 对齐
+static int read_file(const char* path, uint8_t** buf, uint32_t* size) {
+	FILE* fp = fopen(path, "rb");
+	long n;
+
+	*buf = NULL;
+
+	if (!fp)
+		return -1;
+
+	if (fseek(fp, 0, SEEK_END) != 0 || (n = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0) {
+		fclose(fp);
+		return -1;
+	}
+
+	*buf = malloc((size_t)n + sizeof(uint32_t));
+	CHECK_MALLOC(*buf);
+
+	if (fread(*buf, 1, (size_t)n, fp) != (size_t)n) {
+		fclose(fp);
+		free(*buf);
+		*buf = NULL;
+		return -1;
+	}
+
+	fclose(fp);
+	*size = (uint32_t)n;
+	return 0;
+}
+
+// 按下标排列对象名字
+static int get_names(hash_list_s* hl, string_s** names) {
+	hash_node_s* node = HL_first(hl);
+
+	while (node) {
+		if (node->key.type != MAT_OT_STR || node->val.type != MAT_OT_INT32 || (uint32_t)node->val.int32 >= V_SIZE(hl->obj))
+			return -1;
+
+		names[node->val.int32] = node->key.str;
+		node = HL_next(hl, node);
+	}
+
+	return 0;
+}
+
+static int put_str(sn_writer_s* w, string_s* s) {
+	obj_s key, val;
+	key.type = MAT_OT_STR;
+	key.str = s;
+
+	if (H_get(&w->str_map, &key, &val) != 0) {
+		val.type = MAT_OT_INT32;
+		val.int32 = (int32_t)V_SIZE(w->strs);
+		V_PUSH_BACK(w->strs, s, string_s*);
+
+		// 加入失败时这个字符串只是会重复保存
+		H_set(&w->str_map, &key, &val);
+	}
+
+	PUT(w, val.int32);
+	return 0;
+}
+
+static int put_names(sn_writer_s* w, hash_list_s* hl) {
+	int ret;
+	string_s** names = NULL;
+	uint32_t n = V_SIZE(hl->obj);
+	uint32_t i;
+
+	PUT(w, n);
+
+	names = calloc(n + 1, sizeof(string_s*));
+	CHECK_MALLOC(names);
+
+	ret = get_names(hl, names);
+	CHECK_RESULT(ret);
+
+	for (i = 0; i < n; ++i) {
+		CHECK_CONDITION(names[i]);
+
+		ret = put_str(w, names[i]);
+		CHECK_RESULT(ret);
+	}
+
+	ret = 0;
+exit0:
+	free(names);
+	return ret;
+}
+
+// 字符串操作数从 lcode 取得，从字节码缓存加载的代码里它们不是 strs_nogc 的下标
+static int put_code(sn_writer_s* w, vec_s* code, vec_s* lcode, vec_s* op_line) {
+	uint32_t* ip_begin = &V_AT(*code, 0, uint32_t);
+	uint32_t* ip_end = ip_begin + V_SIZE(*code);
+	uint32_t* ip;
+	uint32_t i;
+
+	PUT(w, V_SIZE(*code));
+
+	for (ip = ip_begin; ip < ip_end; ip += INS_size(*ip)) {
+		uint32_t size = INS_size(*ip);
+
+		if (size == 0 || ip + size > ip_end)
+			return -1;
+
+		for (i = 0; i < size; ++i) {
+			if (i == 1 && (*ip == IT_PUSH_STRING || *ip == IT_IMPORT)) {
+				string_s* s;
+
+				if (V_SIZE(*lcode) == V_SIZE(*code))
+					s = V_AT(*lcode, ip - ip_begin + 1, lword_u).str;
+				else if (S_get_str_by_idx(&w->mat->strs_nogc, ip[1], &s) != 0)
+					return -1;
+
+				if (put_str(w, s) != 0)
+					return -1;
+			}
+			else
+				PUT(w, ip[i]);
+		}
+	}
+
+	PUT(w, V_SIZE(*op_line));
+
+	for (i = 0; i < V_SIZE(*op_line); ++i) {
+		op_line_s* opl = &V_AT(*op_line, i, op_line_s);
+		PUT(w, opl->op_pos);
+		PUT(w, opl->line);
+	}
+
+	return 0;
+}
+
+// C 函数只能是内置函数，保存它的名字
+static int put_c_func(sn_writer_s* w, matrix_api_t c_func) {
+	hash_list_s* hl = &w->builtins->objs;
+	hash_node_s* node = HL_first(hl);
+
+	while (node) {
+		obj_s obj;
+
+		if (HL_get_obj(hl, node->val.int32, &obj) == 0 && obj.type == MAT_OT_C_FUNC && obj.c_func == c_func)
+			return put_str(w, node->key.str);
+
+		node = HL_next(hl, node);
+	}
+
+	E_log("Cannot snapshot C function registered by an extension.");
+	return -1;
+}
+
+static int put_obj(sn_writer_s* w, obj_s* o) {
+	int32_t id = 0;
+	uint32_t u;
+
+	PUT(w, o->type);
+
+	switch (o->type) {
+		case MAT_OT_DUMMY:
+		case MAT_OT_NONE:
+			PUT(w, 0);
+			return 0;
+
+		case MAT_OT_INT32:
+			PUT(w, o->int32);
+			return 0;
+
+		case MAT_OT_REAL:
+			memcpy(&u, &o->real, sizeof(uint32_t));
+			PUT(w, u);
+			return 0;
+
+		case MAT_OT_STR:
+			return put_str(w, o->str);
+
+		case MAT_OT_C_FUNC:
+			return put_c_func(w, o->c_func);
+
+		case MAT_OT_FUNC:
+			id = find_ref(&w->funcs, o->func);
+			break;
+
+		case MAT_OT_LIST:
+			id = find_ref(&w->lists, o->list);
+			break;
+
+		case MAT_OT_DICT:
+			id = find_ref(&w->dicts, o->dict);
+			break;
+
+		case MAT_OT_MOD:
+			id = HL_get_obj_idx(&w->mat->mods, o->mod->name);
+			break;
+
+		default:
+			E_log("Cannot snapshot object of type \"%s\".", O_type_to_str(o->type));
+			return -1;
+	}
+
+	if (id < 0)
+		return -1;
+
+	PUT(w, id);
+	return 0;
+}
+
+static int put_mod(sn_writer_s* w, mod_s* mod) {
+	int ret;
+	uint32_t i;
+
+	if (mod->handle) {
+		E_log("Cannot snapshot dll module \"%s\".", mod->name->str);
+		return -1;
+	}
+
+	ret = put_str(w, mod->name);
+	CHECK_RESULT(ret);
+
+	PUT(w, mod->init);
+
+	ret = put_code(w, &mod->code, &mod->lcode, &mod->op_line);
+	CHECK_RESULT(ret);
+
+	PUT(w, V_SIZE(mod->funcs));
+
+	for (i = 0; i < V_SIZE(mod->funcs); ++i) {
+		func_s* func = V_AT(mod->funcs, i, func_s*);
+
+		ret = put_str(w, func->name);
+		CHECK_RESULT(ret);
+
+		PUT(w, func->param_num);
+
+		ret = put_names(w, &func->objs);
+		CHECK_RESULT(ret);
+
+		ret = put_code(w, &func->code, &func->lcode, &func->op_line);
+		CHECK_RESULT(ret);
+	}
+
+	ret = 0;
+exit0:
+	return ret;
+}
+
+static int put_mod_objs(sn_writer_s* w, mod_s* mod) {
+	int ret;
+	uint32_t i;
+
+	ret = put_names(w, &mod->objs);
+	CHECK_RESULT(ret);
+
+	for (i = 0; i < HL_SIZE(mod->objs); ++i) {
+		ret = put_obj(w, &V_AT(mod->objs.obj, i, obj_s));
+		CHECK_RESULT(ret);
+	}
+
+	ret = 0;
+exit0:
+	return ret;
+}
+
+// 函数按模块顺序编号，数组和字典按对象池里的顺序编号，写入时按同样的顺序
+static int collect_refs(sn_writer_s* w) {
+	int ret;
+	uint32_t i, j;
+	list_s* list;
+	dict_s* dict;
+
+	for (i = 0; i < HL_SIZE(w->mat->mods); ++i) {
+		mod_s* mod;
+
+		ret = VM_get_mod_by_idx(w->mat, i, &mod);
+		CHECK_RESULT(ret);
+
+		// 快照保存完整的代码，延迟编译的函数体先编译
+		ret = P_compile_mod(w->mat, mod);
+		CHECK_RESULT(ret);
+
+		for (j = 0; j < V_SIZE(mod->funcs); ++j) {
+			ret = add_ref(&w->funcs, V_AT(mod->funcs, j, func_s*));
+			CHECK_RESULT(ret);
+		}
+	}
+
+	for (list = w->mat->pool_list.used; list; list = list->next) {
+		ret = add_ref(&w->lists, list);
+		CHECK_RESULT(ret);
+	}
+
+	for (dict = w->mat->pool_dict.used; dict; dict = dict->next) {
+		ret = add_ref(&w->dicts, dict);
+		CHECK_RESULT(ret);
+	}
+
+	if (V_SIZE(w->funcs) > 0)
+		qsort(w->funcs.p, V_SIZE(w->funcs), sizeof(sn_ref_s), compare_ref);
+
+	if (V_SIZE(w->lists) > 0)
+		qsort(w->lists.p, V_SIZE(w->lists), sizeof(sn_ref_s), compare_ref);
+
+	if (V_SIZE(w->dicts) > 0)
+		qsort(w->dicts.p, V_SIZE(w->dicts), sizeof(sn_ref_s), compare_ref);
+
+	ret = 0;
+exit0:
+	return ret;
+}
+
+static int put_body(sn_writer_s* w) {
+	int ret;
+	uint32_t i;
+	mod_s* mod;
+	list_s* list;
+	dict_s* dict;
+
+	PUT(w, HL_SIZE(w->mat->mods));
+
+	for (i = 0; i < HL_SIZE(w->mat->mods); ++i) {
+		ret = VM_get_mod_by_idx(w->mat, i, &mod);
+		CHECK_RESULT(ret);
+
+		ret = put_mod(w, mod);
+		CHECK_RESULT(ret);
+	}
+
+	PUT(w, V_SIZE(w->lists));
+
+	for (list = w->mat->pool_list.used; list; list = list->next)
+		PUT(w, V_SIZE(list->v));
+
+	PUT(w, V_SIZE(w->dicts));
+
+	for (dict = w->mat->pool_dict.used; dict; dict = dict->next)
+		PUT(w, H_SIZE(dict->h));
+
+	for (i = 0; i < HL_SIZE(w->mat->mods); ++i) {
+		ret = VM_get_mod_by_idx(w->mat, i, &mod);
+		CHECK_RESULT(ret);
+
+		ret = put_mod_objs(w, mod);
+		CHECK_RESULT(ret);
+	}
+
+	for (list = w->mat->pool_list.used; list; list = list->next) {
+		for (i = 0; i < V_SIZE(list->v); ++i) {
+			ret = put_obj(w, &V_AT(list->v, i, obj_s));
+			CHECK_RESULT(ret);
+		}
+	}
+
+	for (dict = w->mat->pool_dict.used; dict; dict = dict->next) {
+		hash_node_s* node = H_first(&dict->h);
+
+		while (node) {
+			ret = put_obj(w, &node->key);
+			CHECK_RESULT(ret);
+
+			ret = put_obj(w, &node->val);
+			CHECK_RESULT(ret);
+
+			node = H_next(&dict->h, node);
+		}
+	}
+
+	ret = 0;
+exit0:
+	return ret;
+}
+
+static int write_file(sn_writer_s* w, const char* path, uint32_t* header) {
+	char tmp[MAX_PATH + 8];
+	uint32_t zero = 0;
+	uint32_t i;
+	FILE* fp;
+	int ok;
+
+	// 先写到临时文件再改名，其它进程不会读到写了一半的快照
+	sprintf(tmp, "%s.tmp", path);
+	fp = fopen(tmp, "wb");
+
+	if (!fp)
+		return -1;
+
+	ok = fwrite(header, sizeof(uint32_t), SN_HEADER_SIZE, fp) == SN_HEADER_SIZE;
+	ok = ok && fwrite(&V_SIZE(w->strs), sizeof(uint32_t), 1, fp) == 1;
+
+	for (i = 0; ok && i < V_SIZE(w->strs); ++i) {
+		string_s* s = V_AT(w->strs, i, string_s*);
+		uint32_t pad = 4 - s->size % 4;
+
+		ok = fwrite(&s->size, sizeof(uint32_t), 1, fp) == 1 &&
+		     fwrite(s->str, 1, s->size, fp) == s->size &&
+		     fwrite(&zero, 1, pad, fp) == pad;
+	}
+
+	ok = ok && fwrite(w->body.p, sizeof(uint32_t), V_SIZE(w->body), fp) == V_SIZE(w->body);
+	ok = fclose(fp) == 0 && ok;
+
+	if (ok) {
+		remove(path);
+		ok = rename(tmp, path) == 0;
+	}
+
+	if (!ok) {
+		remove(tmp);
+		return -1;
+	}
+
+	return 0;
+}
+
+static uint32_t get(sn_loader_s* l) {
+	if (l->pos >= l->size) {
+		l->bad = 1;
+		return 0;
+	}
+
+	return l->p[l->pos++];
+}
+
+static const uint32_t* get_words(sn_loader_s* l, uint32_t n) {
+	const uint32_t* p = l->p + l->pos;
+
+	if (n > l->size - l->pos) {
+		l->bad = 1;
+		return NULL;
+	}
+
+	l->pos += n;
+	return p;
+}
+
+static string_s* get_str(sn_loader_s* l) {
+	uint32_t idx = get(l);
+
+	if (l->bad || idx >= l->str_num) {
+		l->bad = 1;
+		return NULL;
+	}
+
+	return l->strs[idx];
+}
+
+// 快照里的字符串都放进 strs_nogc，它们可能是模块对象的值，不能被回收
+static int read_strs(sn_loader_s* l) {
+	uint32_t i;
+
+	l->str_num = get(l);
+
+	if (l->bad || l->str_num > l->size)
+		return 1;
+
+	l->strs = calloc(l->str_num + 1, sizeof(string_s*));
+	CHECK_MALLOC(l->strs);
+
+	for (i = 0; i < l->str_num; ++i) {
+		uint32_t size = get(l);
+		const char* s = (const char*)get_words(l, size / 4 + 1);
+
+		if (l->bad || s[size] != 0 || strlen(s) != size)
+			return 1;
+
+		if (S_create_str(&l->mat->strs_nogc, s, &l->strs[i]) != 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+// 只检查链接时要用到的字符串索引，其它操作数与保存时的虚拟机相同
+static int read_code(sn_loader_s* l, vec_s* code, vec_s* op_line) {
+	uint32_t size = get(l);
+	const uint32_t* words = get_words(l, size);
+	const uint32_t* ip;
+
+	if (l->bad)
+		return 1;
+
+	for (ip = words; ip < words + size; ip += INS_size(*ip)) {
+		if (INS_size(*ip) == 0 || ip + INS_size(*ip) > words + size)
+			return 1;
+
+		if ((*ip == IT_PUSH_STRING || *ip == IT_IMPORT) && ip[1] >= l->str_num)
+			return 1;
+	}
+
+	// 按实际大小重新分配，F_init 预留的空间对不再解析的函数没有用处
+	V_free(code);
+
+	if (V_init(code, sizeof(uint32_t), size) != 0)
+		return -1;
+
+	if (size > 0)
+		memcpy(code->p, words, size * sizeof(uint32_t));
+
+	V_SIZE(*code) = size;
+
+	size = get(l);
+	words = get_words(l, size * 2);
+
+	if (l->bad)
+		return 1;
+
+	V_free(op_line);
+
+	if (V_init(op_line, sizeof(op_line_s), size) != 0)
+		return -1;
+
+	// op_line_s 就是两个字 (op_pos, line)
+	if (size > 0)
+		memcpy(op_line->p, words, size * sizeof(op_line_s));
+
+	V_SIZE(*op_line) = size;
+	return 0;
+}
+
+static int read_func(sn_loader_s* l, mod_s* mod) {
+	int ret;
+	func_s* func = malloc(sizeof(func_s));
+	uint32_t n;
+	uint32_t i;
+	CHECK_MALLOC(func);
+
+	ret = F_init(func);
+	CHECK_RESULT(ret);
+
+	// 先放进模块的函数表，出错时随模块释放
+	V_PUSH_BACK(mod->funcs, func, func_s*);
+	V_PUSH_BACK(l->funcs, func, func_s*);
+
+	func->name = get_str(l);
+	func->param_num = get(l);
+	n = get(l);
+
+	if (l->bad || func->param_num > n || n > l->size)
+		return 1;
+
+	for (i = 0; i < n; ++i) {
+		obj_s obj;
+		string_s* name = get_str(l);
+
+		if (l->bad)
+			return 1;
+
+		obj.type = MAT_OT_DUMMY;
+
+		if (HL_set_obj(&func->objs, name, &obj) != (int32_t)i)
+			return 1;
+	}
+
+	ret = read_code(l, &func->code, &func->op_line);
+
+exit0:
+	return ret;
+}
+
+// 模块必须按原来的下标加入，__builtins__ 在初始化虚拟机时已经加入
+static int read_mod(sn_loader_s* l, uint32_t idx) {
+	int ret;
+	mod_s* mod;
+	string_s* name = get_str(l);
+	uint32_t init = get(l);
+	uint32_t mod_idx;
+	uint32_t n;
+	uint32_t i;
+
+	if (l->bad)
+		return 1;
+
+	ret = VM_add_mod(l->mat, name, &mod, &mod_idx);
+
+	if (ret < 0)
+		return -1;
+
+	if (mod_idx != idx || (ret == 1 && idx != 0))
+		return 1;
+
+	mod->init = init ? 1 : 0;
+
+	ret = read_code(l, &mod->code, &mod->op_line);
+
+	if (ret != 0)
+		return ret;
+
+	n = get(l);
+
+	if (l->bad || n > l->size)
+		return 1;
+
+	for (i = 0; i < n; ++i) {
+		ret = read_func(l, mod);
+
+		if (ret != 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int read_obj(sn_loader_s* l, obj_s* o) {
+	uint32_t type = get(l);
+	uint32_t val = get(l);
+	obj_s c_func;
+
+	if (l->bad)
+		return 1;
+
+	o->type = (mat_obj_type_e)type;
+
+	switch (type) {
+		case MAT_OT_DUMMY:
+		case MAT_OT_NONE:
+			break;
+
+		case MAT_OT_INT32:
+			o->int32 = (int32_t)val;
+			break;
+
+		case MAT_OT_REAL:
+			memcpy(&o->real, &val, sizeof(uint32_t));
+			break;
+
+		case MAT_OT_STR:
+			if (val >= l->str_num)
+				return 1;
+
+			o->str = l->strs[val];
+			break;
+
+		case MAT_OT_C_FUNC:
+			if (val >= l->str_num || HL_get_obj_direct(&l->builtins->objs, l->strs[val], &c_func) != 0 || c_func.type != MAT_OT_C_FUNC)
+				return 1;
+
+			o->c_func = c_func.c_func;
+			break;
+
+		case MAT_OT_FUNC:
+			if (val >= V_SIZE(l->funcs))
+				return 1;
+
+			o->func = V_AT(l->funcs, val, func_s*);
+			break;
+
+		case MAT_OT_LIST:
+			if (val >= V_SIZE(l->lists))
+				return 1;
+
+			o->list = V_AT(l->lists, val, list_s*);
+			break;
+
+		case MAT_OT_DICT:
+			if (val >= V_SIZE(l->dicts))
+				return 1;
+
+			o->dict = V_AT(l->dicts, val, dict_s*);
+			break;
+
+		case MAT_OT_MOD:
+			if (val >= l->mod_num || VM_get_mod_by_idx(l->mat, val, &o->mod) != 0)
+				return 1;
+
+			break;
+
+		default:
+			return 1;
+	}
+
+	return 0;
+}
+
+// 先分配所有数组和字典，对象的值才能引用它们
+static int alloc_containers(sn_loader_s* l, const uint32_t** list_sizes, const uint32_t** dict_sizes) {
+	uint32_t n;
+	uint32_t i;
+
+	n = get(l);
+	*list_sizes = get_words(l, n);
+
+	if (l->bad)
+		return 1;
+
+	for (i = 0; i < n; ++i) {
+		list_s* list;
+
+		if ((*list_sizes)[i] > l->size || LI_alloc(l->mat, (*list_sizes)[i], &list) != 0)
+			return 1;
+
+		V_PUSH_BACK(l->lists, list, list_s*);
+	}
+
+	n = get(l);
+	*dict_sizes = get_words(l, n);
+
+	if (l->bad)
+		return 1;
+
+	for (i = 0; i < n; ++i) {
+		dict_s* dict;
+
+		if ((*dict_sizes)[i] > l->size || D_alloc(l->mat, (*dict_sizes)[i], &dict) != 0)
+			return 1;
+
+		V_PUSH_BACK(l->dicts, dict, dict_s*);
+	}
+
+	return 0;
+}
+
+static int read_mod_objs(sn_loader_s* l, mod_s* mod) {
+	int ret;
+	string_s** names = NULL;
+	uint32_t n = get(l);
+	uint32_t i;
+
+	if (l->bad || n > l->size)
+		return 1;
+
+	names = calloc(n + 1, sizeof(string_s*));
+	CHECK_MALLOC(names);
+
+	for (i = 0; i < n; ++i)
+		names[i] = get_str(l);
+
+	ret = l->bad ? 1 : 0;
+
+	for (i = 0; ret == 0 && i < n; ++i) {
+		obj_s obj;
+		ret = read_obj(l, &obj);
+
+		if (ret == 0 && HL_set_obj(&mod->objs, names[i], &obj) != (int32_t)i)
+			ret = 1;
+	}
+
+	free(names);
+	return ret;
+}
+
+static int read_body(sn_loader_s* l) {
+	int ret;
+	const uint32_t* list_sizes;
+	const uint32_t* dict_sizes;
+	mod_s* mod;
+	uint32_t i, j;
+
+	ret = read_strs(l);
+
+	if (ret != 0)
+		return ret;
+
+	l->mod_num = get(l);
+
+	if (l->bad || l->mod_num == 0 || l->mod_num > l->size)
+		return 1;
+
+	for (i = 0; i < l->mod_num; ++i) {
+		ret = read_mod(l, i);
+
+		if (ret != 0)
+			return ret;
+	}
+
+	ret = alloc_containers(l, &list_sizes, &dict_sizes);
+
+	if (ret != 0)
+		return ret;
+
+	for (i = 0; i < l->mod_num; ++i) {
+		if (VM_get_mod_by_idx(l->mat, i, &mod) != 0)
+			return -1;
+
+		ret = read_mod_objs(l, mod);
+
+		if (ret != 0)
+			return ret;
+	}
+
+	for (i = 0; i < V_SIZE(l->lists); ++i) {
+		list_s* list = V_AT(l->lists, i, list_s*);
+		assert(V_CAP(list->v) >= list_sizes[i]);
+
+		for (j = 0; j < list_sizes[i]; ++j) {
+			ret = read_obj(l, &V_AT(list->v, j, obj_s));
+
+			if (ret != 0)
+				return ret;
+		}
+
+		V_SIZE(list->v) = list_sizes[i];
+	}
+
+	for (i = 0; i < V_SIZE(l->dicts); ++i) {
+		dict_s* dict = V_AT(l->dicts, i, dict_s*);
+
+		for (j = 0; j < dict_sizes[i]; ++j) {
+			obj_s key, val;
+			ret = read_obj(l, &key);
+
+			if (ret == 0)
+				ret = read_obj(l, &val);
+
+			if (ret != 0)
+				return ret;
+
+			if (H_set(&dict->h, &key, &val) != 0)
+				return 1;
+		}
+	}
+
+	if (l->pos != l->size)
+		return 1;
+
+	return 0;
+}
+
+// 模块对象都恢复以后再链接，模块限定引用的内联缓存在执行时建立
+static int link_mods(sn_loader_s* l) {
+	int ret;
+	mod_s* mod;
+	uint32_t i;
+
+	for (i = 0; i < l->mod_num; ++i) {
+		ret = VM_get_mod_by_idx(l->mat, i, &mod);
+		CHECK_RESULT(ret);
+
+		ret = LK_link_mod(l->mat, mod, l->strs);
+		CHECK_RESULT(ret);
+
+		if (V_SIZE(mod->lcode) > 0 || V_SIZE(mod->funcs) > 0) {
+			ret = DBG_add_mod(l->mat, mod);
+			CHECK_RESULT(ret);
+		}
+	}
+
+	ret = 0;
+exit0:
+	return ret;
+}
+
+/* method */
+int SN_save(matrix_t mat, const char* path) {
+	int ret;
+	sn_writer_s w;
+	uint32_t header[SN_HEADER_SIZE];
+	assert(mat);
+	assert(path);
+
+	if (mat->frame_top > 0) {
+		E_log("Cannot snapshot while a function is running.");
+		return -1;
+	}
+
+	memset(&w, 0, sizeof(w));
+	w.mat = mat;
+
+	ret = VM_get_mod_by_idx(mat, 0, &w.builtins);
+	CHECK_RESULT(ret);
+
+	ret = V_init(&w.strs, sizeof(string_s*), DEFAULT_STR_TABLE_SIZE);
+	CHECK_RESULT(ret);
+	ret = H_init(&w.str_map, DEFAULT_STR_TABLE_SIZE);
+	CHECK_RESULT(ret);
+	ret = V_init(&w.funcs, sizeof(sn_ref_s), 0);
+	CHECK_RESULT(ret);
+	ret = V_init(&w.lists, sizeof(sn_ref_s), 0);
+	CHECK_RESULT(ret);
+	ret = V_init(&w.dicts, sizeof(sn_ref_s), 0);
+	CHECK_RESULT(ret);
+	ret = V_init(&w.body, sizeof(uint32_t), DEFAULT_MOD_CODE_SIZE);
+	CHECK_RESULT(ret);
+
+	ret = collect_refs(&w);
+	CHECK_RESULT(ret);
+
+	ret = put_body(&w);
+	CHECK_RESULT(ret);
+
+	header[0] = SN_MAGIC;
+	header[1] = SN_VERSION;
+	header[2] = (uint32_t)mat->backend;
+	header[3] = (uint32_t)mat->jit;
+	header[4] = (uint32_t)mat->cache;
+	header[5] = mat->stack_limit;
+	header[6] = mat->frame_limit;
+
+	ret = write_file(&w, path, header);
+
+	if (ret != 0)
+		E_log("Write snapshot \"%s\" failed.", path);
+
+exit0:
+	if (w.strs.p)
+		V_free(&w.strs);
+
+	H_free(&w.str_map);
+
+	if (w.funcs.p)
+		V_free(&w.funcs);
+
+	if (w.lists.p)
+		V_free(&w.lists);
+
+	if (w.dicts.p)
+		V_free(&w.dicts);
+
+	if (w.body.p)
+		V_free(&w.body);
+
+	return ret;
+}
+
+int SN_load(matrix_t mat, const char* path) {
+	int ret;
+	sn_loader_s l;
+	uint8_t* buf = NULL;
+	uint32_t size = 0;
+	const uint32_t* header;
+	assert(mat);
+	assert(path);
+
+	memset(&l, 0, sizeof(l));
+	l.mat = mat;
+
+	if (read_file(path, &buf, &size) != 0) {
+		E_log("Cannot read snapshot \"%s\".", path);
+		return -1;
+	}
+
+	ret = 1;
+	header = (const uint32_t*)buf;
+
+	if (size % sizeof(uint32_t) != 0 || size < SN_HEADER_SIZE * sizeof(uint32_t))
+		goto exit0;
+
+	if (header[0] != SN_MAGIC || header[1] != SN_VERSION || header[2] > MAT_BACKEND_REGISTER || header[5] == 0 || header[6] == 0)
+		goto exit0;
+
+	mat->backend = (mat_backend_e)header[2];
+	mat->jit = header[3] ? 1 : 0;
+	mat->cache = header[4] ? 1 : 0;
+	mat->stack_limit = header[5];
+	mat->frame_limit = header[6];
+
+	l.p = header + SN_HEADER_SIZE;
+	l.size = size / sizeof(uint32_t) - SN_HEADER_SIZE;
+
+	ret = VM_get_mod_by_idx(mat, 0, &l.builtins);
+	CHECK_RESULT(ret);
+
+	ret = V_init(&l.funcs, sizeof(func_s*), 0);
+	CHECK_RESULT(ret);
+	ret = V_init(&l.lists, sizeof(list_s*), 0);
+	CHECK_RESULT(ret);
+	ret = V_init(&l.dicts, sizeof(dict_s*), 0);
+	CHECK_RESULT(ret);
+
+	ret = read_body(&l);
+
+	if (ret == 0)
+		ret = link_mods(&l);
+
+exit0:
+	if (ret == 1) {
+		E_log("Snapshot \"%s\" is invalid.", path);
+		ret = -1;
+	}
+
+	if (l.funcs.p)
+		V_free(&l.funcs);
+
+	if (l.lists.p)
+		V_free(&l.lists);
+
+	if (l.dicts.p)
+		V_free(&l.dicts);
+
+	free(l.strs);
+	free(buf);
+	return ret;
+}
@@ -0,0 +1,45 @@
+﻿/*
+    Matrix Script Language
+    author: Zeb
+    e-mail: zebbey@gmail.com
+    Copyright (c) 2004 Zeb.  All rights reserved.
+*/
+
+#ifndef __H_SNAP__
+#define __H_SNAP__
+
+#include "matrix.h"
+
+/**
+    虚拟机快照
+    把初始化完成的虚拟机（模块、函数、模块对象、数组和字典）写到一个文件里，
+    新的虚拟机从快照恢复，不再解析和执行模块的初始化代码。
+    文件由 uint32_t 字组成，按本机字节序保存：
+        头部:   SN_MAGIC, SN_VERSION, 代码生成方式, 是否 JIT, 是否使用缓存, 运行栈上限, 调用深度上限
+        字符串: 个数，每个字符串为字节数和以 0 结尾、补齐到4字节的内容
+        模块:   个数，每个模块为名字、是否初始化过、代码和 op_line，
+                函数个数，每个函数为名字、参数个数、对象个数和对象名字，然后是代码和 op_line
+        数组:   个数和每个数组的元素个数
+        字典:   个数和每个字典的元素个数
+        对象:   每个模块的对象个数和 (名字, 类型, 值)
+        然后是每个数组的元素和每个字典的 (键, 值)
+    模块和模块对象按原来的下标恢复，所以代码里的对象下标（包括模块限定引用的下标）都不需要修改，
+    只有字符串索引换成快照字符串表的下标，恢复后链接时再换成 string_s*。
+    对象的值为 (类型, 值)：函数、数组和字典是按模块顺序、对象池顺序的编号，
+    C 函数保存内置函数的名字，模块保存模块的下标。
+    动态库模块、自定义类型和 C 扩展注册的函数不能保存；运行栈不保存，快照必须在没有函数执行时建立。
+    恢复的字符串都放在不回收的字符串表里。
+*/
+
+#define SN_MAGIC 0x5354414d // "MATS"
+
+// 指令集或者文件格式改变时必须增加
+#define SN_VERSION 2
+
+// 把虚拟机的当前状态写到 path，不能保存时返回 -1
+int SN_save(matrix_t mat, const char* path);
+
+// 从 path 恢复到刚初始化的虚拟机 mat
+int SN_load(matrix_t mat, const char* path);
+
+#endif // __H_SNAP__
@@ -14,11 +14,117 @@ static void init_string(string_s* str) {
 	str->hash = 0;
 }
 
+// 与 S_hash 相同的哈希值，空字符串为0
+static uint32_t hash_n(const char* p, uint32_t size) {
+	uint32_t len = size;
+	uint32_t hash;
+
+	if (len == 0)
+		return 0;
+
+	hash = *p << 7;
+
+	while (--len > 0)
+		hash = (1000003 * hash) ^ *p++;
+
+	hash ^= size;
+
+	if (!hash)
+		hash = (uint32_t)(-1);
+
+	return hash;
+}
+
+static uint32_t str_hash(string_s* s) {
+	if (s->size == 0)
+		return 0;
+
+	if (!s->hash)
+		s->hash = hash_n(s->str, s->size);
+
+	return s->hash;
+}
+
+static void link_str(mat_str_table_s* table, uint32_t idx, uint32_t hash) {
+	uint32_t* bucket = &table->buckets[hash & (table->bucket_num - 1)];
+	V_AT(table->next, idx, uint32_t) = *bucket;
+	*bucket = idx + 1;
+}
+
+static void unlink_str(mat_str_table_s* table, uint32_t idx, uint32_t hash) {
+	uint32_t* p = &table->buckets[hash & (table->bucket_num - 1)];
+
+	while (*p) {
+		if (*p == idx + 1) {
+			*p = V_AT(table->next, idx, uint32_t);
+			return;
+		}
+
+		p = &V_AT(table->next, *p - 1, uint32_t);
+	}
+}
+
+// 重新分桶，桶的个数不少于字符串的个数
+static int build_index(mat_str_table_s* table) {
+	uint32_t n = table->bucket_num ? table->bucket_num : 64;
+	uint32_t i;
+
+	while (n < V_SIZE(table->strs))
+		n *= 2;
+
+	free(table->buckets);
+	table->buckets = calloc(n, sizeof(uint32_t));
+	CHECK_MALLOC(table->buckets);
+	table->bucket_num = n;
+
+	if (!table->next.p && V_init(&table->next, sizeof(uint32_t), n) != 0)
+		return -1;
+
+	if (V_reserve(&table->next, V_SIZE(table->strs)) != 0)
+		return -1;
+
+	V_SIZE(table->next) = V_SIZE(table->strs);
+
+	for (i = 0; i < V_SIZE(table->strs); ++i) {
+		string_s* s = V_AT(table->strs, i, string_s*);
+
+		if (s)
+			link_str(table, i, str_hash(s));
+	}
+
+	return 0;
+}
+
+/*
+	查找内容相同的字符串，返回下标，没有时返回 -1。
+	表里可能有内容相同的字符串（S_create_str 不查重），与原来的顺序查找一样返回下标最小的。
+*/
+static int32_t find_str(mat_str_table_s* table, const char* s, uint32_t size, uint32_t hash) {
+	int32_t found = -1;
+	uint32_t i;
+
+	if (!table->buckets && build_index(table) != 0)
+		return -1;
+
+	for (i = table->buckets[hash & (table->bucket_num - 1)]; i; i = V_AT(table->next, i - 1, uint32_t)) {
+		string_s* str = V_AT(table->strs, i - 1, string_s*);
+
+		if (str->size == size && memcmp(S_CSTR(str), s, size) == 0 && (found < 0 || (uint32_t)found > i - 1))
+			found = (int32_t)(i - 1);
+	}
+
+	return found;
+}
+
 /* method */
 int S_init_mat_str_table(mat_str_table_s* table) {
 	int ret;
 	assert(table);
 
+	table->buckets = NULL;
+	table->bucket_num = 0;
+	memset(&table->next, 0, sizeof(table->next));
+
 	ret = V_init(&table->strs, sizeof(string_s*), DEFAULT_STR_TABLE_SIZE);
 	CHECK_RESULT(ret);
 
@@ -39,18 +145,41 @@ int S_free_mat_str_table(mat_str_table_s* table) {
 
 	V_free(&table->strs);
 	V_free(&table->free_idx);
+
+	if (table->next.p)
+		V_free(&table->next);
+
+	free(table->buckets);
+	table->buckets = NULL;
+	table->bucket_num = 0;
 	return 0;
 }
 
+// 只有查找过的表才维护哈希索引，运行时创建的字符串（strs_gc）不需要计算哈希值
 static int add_to_table(mat_str_table_s* table, string_s* s) {
+	uint32_t idx;
+
 	if (V_SIZE(table->free_idx) > 0) {
-		uint32_t idx = V_BACK(table->free_idx, uint32_t);
+		idx = V_BACK(table->free_idx, uint32_t);
 		V_SIZE(table->free_idx)--;
 		V_AT(table->strs, idx, string_s*) = s;
-		return 0;
+	}
+	else {
+		idx = V_SIZE(table->strs);
+		V_PUSH_BACK(table->strs, s, string_s*);
+
+		if (table->buckets) {
+			V_PUSH_BACK(table->next, 0, uint32_t);
+		}
+	}
+
+	if (table->buckets) {
+		if (V_SIZE(table->strs) > table->bucket_num)
+			return build_index(table);
+
+		link_str(table, idx, str_hash(s));
 	}
 
-	V_PUSH_BACK(table->strs, s, string_s*);
 	return 0;
 }
 
@@ -105,64 +234,68 @@ int S_conc_str(mat_str_table_s* table, const char* s1, const char* s2, string_s*
 }
 
 int S_find_str(mat_str_table_s* table, const char* s, string_s** out) {
-	uint32_t i;
+	uint32_t size;
+	int32_t idx;
 	assert(table);
 	assert(out);
 
-	for (i = 0; i < V_SIZE(table->strs); ++i) {
-		string_s* str = V_AT(table->strs, i, string_s*);
+	size = (uint32_t)strlen(s);
+	idx = find_str(table, s, size, hash_n(s, size));
 
-		if (str && strcmp(S_CSTR(str), s) == 0) {
-			*out = str;
-			return 0;
-		}
-	}
+	if (idx < 0)
+		return -1;
 
-	return -1;
+	*out = V_AT(table->strs, idx, string_s*);
+	return 0;
 }
 
 int S_get_str(mat_str_table_s* table, const char* s, string_s** out) {
+	return S_get_str_n(table, s, (uint32_t)strlen(s), out);
+}
+
+int S_get_str_n(mat_str_table_s* table, const char* s, uint32_t size, string_s** out) {
+	return S_get_str_hash(table, s, size, hash_n(s, size), out);
+}
+
+int S_get_str_hash(mat_str_table_s* table, const char* s, uint32_t size, uint32_t hash, string_s** out) {
+	int32_t idx;
 	string_s* str;
 	assert(table);
 	assert(out);
+	assert(hash == hash_n(s, size));
 
-	if (S_find_str(table, s, &str) == 0) {
-		assert(str);
-		*out = str;
+	idx = find_str(table, s, size, hash);
+
+	if (idx >= 0) {
+		*out = V_AT(table->strs, idx, string_s*);
 		return 0;
 	}
 
-	return S_create_str(table, s, out);
+	str = malloc(sizeof(string_s) + size + 1);
+	CHECK_MALLOC(str);
+
+	memcpy(str->str, s, size);
+	str->str[size] = '\0';
+	str->size = size;
+	str->hash = size ? hash : 0;
+	add_to_table(table, str);
+	*out = str;
+	return 0;
 }
 
 uint32_t S_hash(string_s* s) {
-	uint32_t len, hash;
-	char* p;
-
 	assert(s);
-	p = s->str;
-	len = s->size;
 
 	if (s->hash)
 		return s->hash;
 
-	if (len == 0) {
+	if (s->size == 0) {
 		s->hash = -1;
 		return 0;
 	}
 
-	hash = *p << 7;
-
-	while (--len > 0)
-		hash = (1000003 * hash) ^ *p++;
-
-	hash ^= s->size;
-
-	if (!hash)
-		hash = (uint32_t)(-1);
-
-	s->hash = hash;
-	return hash;
+	s->hash = hash_n(s->str, s->size);
+	return s->hash;
 }
 
 int S_compare_eq(string_s* s1, string_s* s2) {
@@ -191,22 +324,19 @@ int S_get_str_by_idx(mat_str_table_s* table, uint32_t idx, string_s** out) {
 }
 
 int S_get_str_idx(mat_str_table_s* table, string_s* s, uint32_t* idx) {
-	uint32_t i;
+	int32_t i;
 
 	assert(table);
 	assert(s);
 	assert(idx);
 
-	for (i = 0; i < V_SIZE(table->strs); ++i) {
-		string_s* str = V_AT(table->strs, i, string_s*);
+	i = find_str(table, S_CSTR(s), s->size, str_hash(s));
 
-		if (S_compare_eq(str, s)) {
-			*idx = i;
-			return 0;
-		}
-	}
+	if (i < 0)
+		return -1;
 
-	return -1;
+	*idx = (uint32_t)i;
+	return 0;
 }
 
 int S_sweep(mat_str_table_s* table) {
@@ -215,10 +345,13 @@ int S_sweep(mat_str_table_s* table) {
 	for (i = 0; i < V_SIZE(table->strs); i++) {
 		string_s* s = V_AT(table->strs, i, string_s*);
 
-		if (s->str == NULL)
+		if (s == NULL)
 			continue;
 
 		if (s->gc_mark == 0) {
+			if (table->buckets)
+				unlink_str(table, i, str_hash(s));
+
 			free(s);
 			V_AT(table->strs, i, string_s*) = NULL;
 			V_PUSH_BACK(table->free_idx, i, uint32_t);
@@ -25,6 +25,12 @@ int S_find_str(mat_str_table_s* table, const char* s, string_s** out);
 // 根据给定的C风格字符串，查找内容相同的string_s对象。如果不存在，那么创建一个新的
 int S_get_str(mat_str_table_s* table, const char* s, string_s** out);
 
+// 与 S_get_str 相同，但是 s 不必以 0 结尾，只比较前 size 个字符
+int S_get_str_n(mat_str_table_s* table, const char* s, uint32_t size, string_s** out);
+
+// 与 S_get_str_n 相同，调用者已经算好了 hash，必须与 S_hash 对这个字符串的结果相同
+int S_get_str_hash(mat_str_table_s* table, const char* s, uint32_t size, uint32_t hash, string_s** out);
+
 // 获取字符串在表中的索引
 int S_get_str_idx(mat_str_table_s* table, string_s* s, uint32_t* idx);
 
@@ -15,11 +15,25 @@ int V_init(vec_s* v, uint32_t item_size, uint32_t size) {
 	return V_reserve(v, size);
 }
 
+void V_init_ref(vec_s* v, void* p, uint32_t item_size, uint32_t size) {
+	v->p = size > 0 ? p : NULL;
+	v->cap = 0;
+	v->size = size;
+	v->item_size = item_size;
+}
+
+int V_detach(vec_s* v) {
+	if (V_IS_REF(*v))
+		return V_reserve(v, v->size);
+
+	return 0;
+}
+
 void V_free(vec_s* v) {
-	if (v->p) {
+	if (v->p && v->cap > 0)
 		free(v->p);
-		v->p = NULL;
-	}
+
+	v->p = NULL;
 
 	v->cap = 0;
 	v->size = 0;
@@ -27,6 +41,19 @@ void V_free(vec_s* v) {
 }
 
 int V_reserve(vec_s* v, uint32_t n) {
+	if (V_IS_REF(*v)) {
+		void* p = v->p;
+		v->p = NULL;
+
+		if (v->size > 0) {
+			v->p = malloc(v->item_size * v->size);
+			CHECK_MALLOC(v->p);
+
+			memcpy(v->p, p, v->item_size * v->size);
+			v->cap = v->size;
+		}
+	}
+
 	if (n > v->cap) {
 		v->p = realloc(v->p, v->item_size * n);
 		CHECK_MALLOC(v->p);
@@ -39,6 +66,12 @@ int V_reserve(vec_s* v, uint32_t n) {
 }
 
 void V_clear(vec_s* v) {
+	if (V_IS_REF(*v)) {
+		v->p = NULL;
+		v->size = 0;
+		return;
+	}
+
 	memset(v->p, 0, v->item_size * v->size);
 	v->size = 0;
 }
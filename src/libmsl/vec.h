@@ -15,6 +15,16 @@ void V_free(vec_s* v);
 int V_reserve(vec_s* v, uint32_t cap);
 void V_clear(vec_s* v);
 
+/*
+	让数组直接使用外部的只读内存 p（例如映射的字节码文件），不复制也不释放。
+	这种数组的 cap 为0，第一次需要扩大空间时才复制到自己分配的内存里，
+	原地修改元素之前要先调用 V_detach。
+*/
+void V_init_ref(vec_s* v, void* p, uint32_t item_size, uint32_t size);
+int V_detach(vec_s* v);
+
+#define V_IS_REF(v) ((v).p && (v).cap == 0)
+
 // 检查数组空间是否能够容纳一个新元素，如果不够会进行分配
 int V_alloc_one(vec_s* v);
 
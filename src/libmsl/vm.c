@@ -19,40 +19,36 @@
 #include "gc.h"
 #include "builtins.h"
 #include "hash.h"
+#include "link.h"
+#include "jit.h"
+#include "bc.h"
+#include "pc.h"
 
 #define GET_REF_OBJECT(offset) \
-	mod_pos = (int32_t)(*ip++);\
-	pos = (int32_t)(*ip++);\
-	n = *ip++;\
-	if (pos >= 0) {\
-		if (mod_pos == -1) {\
-			ret = HL_ref_obj(&mod->objs, pos, &ro);\
-			CHECK_RESULT(ret);\
-		}\
-		else {\
-			ret = HL_ref_obj(&mod->objs, mod_pos, &ro);\
-			CHECK_RESULT(ret);\
+	n = ip[2].pair.lo;\
+	switch (ip[2].pair.hi) {\
+		case LK_REF_GLOBAL:\
+			ro = *ip[0].objs + ip[1].u;\
+			break;\
+		case LK_REF_LOCAL:\
+			assert(fp);\
+			ro = fp + ip[1].i;\
+			break;\
+		default:\
+			ro = *ip[0].objs + ip[1].cache->mod_pos;\
+			if (LK_CACHE_HIT(ip[1].cache, ro)) {\
+				ro = ip[1].cache->ref;\
+				break;\
+			}\
 			if (ro->type != MAT_OT_MOD) {\
 				E_rt_err(mat, mod->name->str, DBG_get_line(mat, op), "Invalid module object.");\
 				return -1;\
 			}\
-			ret = HL_ref_obj(&ro->mod->objs, pos, &ro);\
+			ret = LK_ref_mod_obj(ip[1].cache, ro->mod, &ro);\
 			CHECK_RESULT(ret);\
-		}\
-	}\
-	else {\
-		if (mod_pos != -1) {\
-			E_rt_err(mat, mod->name->str, DBG_get_line(mat, op), "The module name is used by a local object.");\
-			return -1;\
-		}\
-		assert(mat->frame_top > 0);\
-		idx = (uint32_t)(- (pos + 1));\
-		f = frame + mat->frame_top - 1;\
-		if (idx < f->func->param_num)\
-			ro = stack + f->stack_base - f->param_num + idx;\
-		else\
-			ro = stack + f->stack_base + 1 + (idx - f->param_num);\
+			break;\
 	}\
+	ip += 3;\
 	if (n > 0) {\
 		for (i = 0; i < n; ++i) {\
 			o = stack + mat->stack_top - offset - n + i;\
@@ -76,6 +72,181 @@
 #define GET_REF_OBJECT_EXPRESSION \
 	GET_REF_OBJECT(0)
 
+// 三地址寄存器指令的操作数，r 为结果，ro 和 o 为两个源操作数
+#define GET_REG_OPERANDS \
+	r = fp + ip[0].i;\
+	ro = fp + ip[1].i;\
+	o = fp + ip[2].i;\
+	ip += 3;
+
+// 调用之后运行栈和调用帧可能已经扩大，重新取得它们的地址和当前帧基址
+#define RELOAD_STACK \
+	stack = &V_AT(mat->stack, 0, obj_s);\
+	frame = &V_AT(mat->call_frames, 0, call_frame_s);\
+	fp = mat->frame_top > 0 ? stack + frame[mat->frame_top - 1].stack_base : NULL;
+
+// f 为刚弹出的调用帧，回到它保存的返回位置继续执行，ret_ip 为 NULL 时返回到 C 代码
+#define RETURN_TO_CALLER \
+	if (!f->ret_ip)\
+		return 0;\
+	fp = mat->frame_top > 0 ? stack + frame[mat->frame_top - 1].stack_base : NULL;\
+	ip_begin = f->ret_ip_begin;\
+	ip = f->ret_ip;\
+	VM_NEXT;
+
+/*
+	指令分派
+	MATRIX_THREADED_DISPATCH 为 1 时使用 computed goto，每条指令执行完后直接跳转到
+	下一条指令的处理代码，分支预测以指令为单位进行；否则使用 switch 分派。
+	链接后的指令字里直接保存处理代码的地址（或者指令编号），见 link.h。
+*/
+#if MATRIX_THREADED_DISPATCH
+#	define VM_INIT_DISPATCH_TABLE \
+	static const void* const dispatch_table[IT_MAX] = {\
+		[IT_NOP] = &&L_IT_NOP,\
+		[IT_EXIT] = &&L_IT_EXIT,\
+		[IT_IMPORT] = &&L_IT_IMPORT,\
+		[IT_IMPORT_DLL] = &&L_DEFAULT,\
+		[IT_PUSH_NONE] = &&L_IT_PUSH_NONE,\
+		[IT_PUSH_STRING] = &&L_IT_PUSH_STRING,\
+		[IT_PUSH_INT] = &&L_IT_PUSH_INT,\
+		[IT_PUSH_REAL] = &&L_IT_PUSH_REAL,\
+		[IT_POP] = &&L_IT_POP,\
+		[IT_REF_OBJ] = &&L_IT_REF_OBJ,\
+		[IT_PUSH_OBJ] = &&L_IT_PUSH_OBJ,\
+		[IT_ASSIGN] = &&L_IT_ASSIGN,\
+		[IT_ASSIGN_ADD] = &&L_IT_ASSIGN_ADD,\
+		[IT_ASSIGN_SUB] = &&L_IT_ASSIGN_SUB,\
+		[IT_ASSIGN_MUL] = &&L_IT_ASSIGN_MUL,\
+		[IT_ASSIGN_DIV] = &&L_IT_ASSIGN_DIV,\
+		[IT_ASSIGN_MOD] = &&L_IT_ASSIGN_MOD,\
+		[IT_ASSIGN_EXP] = &&L_IT_ASSIGN_EXP,\
+		[IT_ASSIGN_AND] = &&L_IT_ASSIGN_AND,\
+		[IT_ASSIGN_OR] = &&L_IT_ASSIGN_OR,\
+		[IT_ASSIGN_XOR] = &&L_IT_ASSIGN_XOR,\
+		[IT_ASSIGN_SHIFT_LEFT] = &&L_IT_ASSIGN_SHIFT_LEFT,\
+		[IT_ASSIGN_SHIFT_RIGHT] = &&L_IT_ASSIGN_SHIFT_RIGHT,\
+		[IT_FALSE_JMP] = &&L_IT_FALSE_JMP,\
+		[IT_TRUE_JMP] = &&L_IT_TRUE_JMP,\
+		[IT_JMP] = &&L_IT_JMP,\
+		[IT_LOOP] = &&L_IT_LOOP,\
+		[IT_FOR_PREP] = &&L_IT_FOR_PREP,\
+		[IT_FOR_LOOP] = &&L_IT_FOR_LOOP,\
+		[IT_MINUS] = &&L_IT_MINUS,\
+		[IT_INC] = &&L_IT_INC,\
+		[IT_DEC] = &&L_IT_DEC,\
+		[IT_LNOT] = &&L_IT_LNOT,\
+		[IT_BNOT] = &&L_IT_BNOT,\
+		[IT_ADD] = &&L_IT_ADD,\
+		[IT_SUB] = &&L_IT_SUB,\
+		[IT_MUL] = &&L_IT_MUL,\
+		[IT_DIV] = &&L_IT_DIV,\
+		[IT_MOD] = &&L_IT_MOD,\
+		[IT_EXP] = &&L_IT_EXP,\
+		[IT_BXOR] = &&L_IT_BXOR,\
+		[IT_BOR] = &&L_IT_BOR,\
+		[IT_BAND] = &&L_IT_BAND,\
+		[IT_SHL] = &&L_IT_SHL,\
+		[IT_SHR] = &&L_IT_SHR,\
+		[IT_LOR] = &&L_IT_LOR,\
+		[IT_LAND] = &&L_IT_LAND,\
+		[IT_TRUE_JMP_KEEP] = &&L_IT_TRUE_JMP_KEEP,\
+		[IT_FALSE_JMP_KEEP] = &&L_IT_FALSE_JMP_KEEP,\
+		[IT_NEQ] = &&L_IT_NEQ,\
+		[IT_EQ] = &&L_IT_EQ,\
+		[IT_GE] = &&L_IT_GE,\
+		[IT_LE] = &&L_IT_LE,\
+		[IT_GT] = &&L_IT_GT,\
+		[IT_LT] = &&L_IT_LT,\
+		[IT_CALL] = &&L_IT_CALL,\
+		[IT_TAIL_CALL] = &&L_IT_TAIL_CALL,\
+		[IT_RET] = &&L_IT_RET,\
+		[IT_RET_RESULT] = &&L_IT_RET_RESULT,\
+		[IT_INLINE_GUARD] = &&L_IT_INLINE_GUARD,\
+		[IT_MAKE_LIST] = &&L_IT_MAKE_LIST,\
+		[IT_MAKE_DICT] = &&L_IT_MAKE_DICT,\
+		[IT_R_MOVE] = &&L_IT_R_MOVE,\
+		[IT_R_LOADI] = &&L_IT_R_LOADI,\
+		[IT_R_ADD] = &&L_IT_R_ADD,\
+		[IT_R_SUB] = &&L_IT_R_SUB,\
+		[IT_R_MUL] = &&L_IT_R_MUL,\
+		[IT_R_DIV] = &&L_IT_R_DIV,\
+		[IT_R_EQ] = &&L_IT_R_EQ,\
+		[IT_R_NEQ] = &&L_IT_R_NEQ,\
+		[IT_R_LT] = &&L_IT_R_LT,\
+		[IT_R_LE] = &&L_IT_R_LE,\
+		[IT_R_GT] = &&L_IT_R_GT,\
+		[IT_R_GE] = &&L_IT_R_GE,\
+		[IT_R_FALSE_JMP] = &&L_IT_R_FALSE_JMP,\
+		[IT_R_TRUE_JMP] = &&L_IT_R_TRUE_JMP,\
+		[IT_ASSIGN_INT] = &&L_IT_ASSIGN_INT,\
+		[IT_ASSIGN_ADD_INT] = &&L_IT_ASSIGN_ADD_INT,\
+		[IT_ASSIGN_SUB_INT] = &&L_IT_ASSIGN_SUB_INT,\
+		[IT_PUSH_ADD_INT] = &&L_IT_PUSH_ADD_INT,\
+		[IT_PUSH_SUB_INT] = &&L_IT_PUSH_SUB_INT,\
+		[IT_FALSE_JMP_EQ] = &&L_IT_FALSE_JMP_EQ,\
+		[IT_FALSE_JMP_NEQ] = &&L_IT_FALSE_JMP_NEQ,\
+		[IT_FALSE_JMP_LT] = &&L_IT_FALSE_JMP_LT,\
+		[IT_FALSE_JMP_LE] = &&L_IT_FALSE_JMP_LE,\
+		[IT_FALSE_JMP_GT] = &&L_IT_FALSE_JMP_GT,\
+		[IT_FALSE_JMP_GE] = &&L_IT_FALSE_JMP_GE,\
+		[IT_ADD_II] = &&L_IT_ADD_II,\
+		[IT_SUB_II] = &&L_IT_SUB_II,\
+		[IT_MUL_II] = &&L_IT_MUL_II,\
+		[IT_EQ_II] = &&L_IT_EQ_II,\
+		[IT_NEQ_II] = &&L_IT_NEQ_II,\
+		[IT_LT_II] = &&L_IT_LT_II,\
+		[IT_LE_II] = &&L_IT_LE_II,\
+		[IT_GT_II] = &&L_IT_GT_II,\
+		[IT_GE_II] = &&L_IT_GE_II,\
+		[IT_FALSE_JMP_EQ_II] = &&L_IT_FALSE_JMP_EQ_II,\
+		[IT_FALSE_JMP_NEQ_II] = &&L_IT_FALSE_JMP_NEQ_II,\
+		[IT_FALSE_JMP_LT_II] = &&L_IT_FALSE_JMP_LT_II,\
+		[IT_FALSE_JMP_LE_II] = &&L_IT_FALSE_JMP_LE_II,\
+		[IT_FALSE_JMP_GT_II] = &&L_IT_FALSE_JMP_GT_II,\
+		[IT_FALSE_JMP_GE_II] = &&L_IT_FALSE_JMP_GE_II,\
+		[IT_PUSH_LOCAL] = &&L_IT_PUSH_LOCAL,\
+		[IT_PUSH_GLOBAL] = &&L_IT_PUSH_GLOBAL,\
+		[IT_STORE_LOCAL] = &&L_IT_STORE_LOCAL,\
+		[IT_STORE_GLOBAL] = &&L_IT_STORE_GLOBAL,\
+	}
+#	define VM_EXPORT_DISPATCH_TABLE \
+	do {\
+		if (!mod) {\
+			mat->handlers = dispatch_table;\
+			return 0;\
+		}\
+	} while (0)
+#	define VM_SWITCH(i) goto *(i)->h;
+#	define VM_CASE(i) L_##i
+#	define VM_DEFAULT L_DEFAULT
+#	define VM_NEXT \
+	do {\
+		op = ip;\
+		goto *(ip++)->h;\
+	} while (0)
+#else
+#	define VM_INIT_DISPATCH_TABLE
+#	define VM_EXPORT_DISPATCH_TABLE
+#	define VM_SWITCH(i) switch ((i)->u)
+#	define VM_CASE(i) case i
+#	define VM_DEFAULT default
+#	define VM_NEXT continue
+#endif
+
+// 改写当前指令（op）的处理代码，用于快速化
+#if MATRIX_THREADED_DISPATCH
+#	define VM_REWRITE(i) (op->h = dispatch_table[i])
+#else
+#	define VM_REWRITE(i) (op->u = (i))
+#endif
+
+#define VM_QUICKEN_II(i) \
+	do {\
+		if (r->type == MAT_OT_INT32 && o->type == MAT_OT_INT32)\
+			VM_REWRITE(i);\
+	} while (0)
+
 static load_dll(matrix_t mat, mod_s* mod, string_s* name) {
 	int ret;
 	char path[MAX_PATH];
@@ -177,6 +348,21 @@ int VM_init(matrix_t mat) {
 	CHECK_RESULT(ret);
 	V_SIZE(mat->call_frames) = DEFALT_FUNC_FRAME_SIZE;
 	mat->frame_top = 0;
+	mat->stack_limit = MAX_STACK_SIZE;
+	mat->frame_limit = MAX_FUNC_FRAME_SIZE;
+	mat->backend = MAT_BACKEND_STACK;
+	mat->jit = 1;
+	mat->cache = 1;
+	mat->lazy = 0;
+	mat->handlers = NULL;
+	mat->parallel = 0;
+	mat->pc = NULL;
+	mat->quiet = 0;
+
+#if MATRIX_JIT
+	ret = JIT_init(mat);
+	CHECK_RESULT(ret);
+#endif
 
 	ret = DBG_init(mat);
 	CHECK_RESULT(ret);
@@ -204,9 +390,13 @@ exit0:
 void VM_free(matrix_t mat) {
 	uint32_t i;
 
+	PC_free(mat);
 	POOL_dict_free(&mat->pool_dict);
 	POOL_list_free(&mat->pool_list);
 	DBG_free(mat);
+#if MATRIX_JIT
+	JIT_free(mat);
+#endif
 	V_free(&mat->call_frames);
 	V_free(&mat->stack);
 
@@ -251,13 +441,31 @@ int VM_exec_file(matrix_t mat, string_s* file_name, mod_s** out, uint32_t* mod_i
 		ret = BU_import(mat, mod);
 		CHECK_RESULT(ret);
 
-		ret = P_parse_file(mat, mod);
+		ret = PC_load(mat, mod);
+		CHECK_RESULT(ret);
+
+		if (ret == 1)
+			ret = mat->cache ? BC_load(mat, mod) : 1;
+
+		CHECK_RESULT(ret);
+
+		if (ret == 1) {
+			ret = P_parse_file(mat, mod);
+			CHECK_RESULT(ret);
+
+			// 缓存写不进去时照常执行
+			if (mat->cache)
+				BC_save(mat, mod);
+		}
+
+		// 执行模块代码之前把它导入的模块交给后台编译
+		ret = PC_submit(mat, mod);
 		CHECK_RESULT(ret);
 
 		ret = DBG_add_mod(mat, mod);
 		CHECK_RESULT(ret);
 
-		ret = VM_exec_mod(mat, mod, &mod->code);
+		ret = VM_exec_mod(mat, mod, &mod->lcode);
 		CHECK_RESULT(ret);
 	}
 	else {
@@ -282,6 +490,7 @@ int VM_exec_str(matrix_t mat, const char* str, uint32_t size, uint32_t mod_idx)
 	CHECK_RESULT(ret);
 
 	V_SIZE(mod->code) = 0;
+	V_SIZE(mod->op_line) = 0;
 
 	ret = P_parse_str(mat, mod, str, size);
 	CHECK_RESULT(ret);
@@ -289,7 +498,7 @@ int VM_exec_str(matrix_t mat, const char* str, uint32_t size, uint32_t mod_idx)
 	ret = DBG_add_mod(mat, mod);
 	CHECK_RESULT(ret);
 
-	ret = VM_exec_mod(mat, mod, &mod->code);
+	ret = VM_exec_mod(mat, mod, &mod->lcode);
 	CHECK_RESULT(ret);
 
 	ret = 0;
@@ -389,6 +598,151 @@ exit0:
 	return ret;
 }
 
+int VM_grow_stack(matrix_t mat, uint32_t n) {
+	int ret;
+	uint64_t need = (uint64_t)mat->stack_top + n;
+	uint32_t size = V_SIZE(mat->stack);
+
+	if (need <= size)
+		return 0;
+
+	if (need > mat->stack_limit)
+		return -1;
+
+	while (size < need)
+		size *= 2;
+
+	if (size > mat->stack_limit)
+		size = mat->stack_limit;
+
+	ret = V_reserve(&mat->stack, size);
+	CHECK_RESULT(ret);
+	V_SIZE(mat->stack) = size;
+
+	ret = 0;
+exit0:
+	return ret;
+}
+
+// 调用帧用完时扩大，超过 frame_limit 时返回 -1
+static int grow_frames(matrix_t mat) {
+	int ret;
+	uint32_t size = V_SIZE(mat->call_frames) * 2;
+
+	if (mat->frame_top >= mat->frame_limit)
+		return -1;
+
+	if (size > mat->frame_limit)
+		size = mat->frame_limit;
+
+	ret = V_reserve(&mat->call_frames, size);
+	CHECK_RESULT(ret);
+	V_SIZE(mat->call_frames) = size;
+
+	ret = 0;
+exit0:
+	return ret;
+}
+
+/*
+	建立函数调用帧，n 为实参个数，新的帧写到 out，返回位置为 NULL，表示返回到 C 代码，由调用者设置。
+	实参个数与形参不一致时，丢弃多余的实参或者用none补齐，
+	保证帧内对象的位置在链接时就能确定。
+	运行栈要放得下 func->frame_size 个对象，空间不够时扩大运行栈或者调用帧，
+	它们的地址可能因此改变；超过上限时报告栈溢出。op 为发起调用的指令。
+	函数体延迟编译时在这里编译，编译不改变运行栈。
+*/
+static int push_frame(matrix_t mat, mod_s* mod, lword_u* op, func_s* func, uint32_t n, call_frame_s** out) {
+	obj_s* stack;
+	obj_s* o;
+	obj_s* end;
+	call_frame_s* f;
+
+	if (func->lazy && P_compile_func(mat, func) != 0)
+		return -1;
+
+	if (mat->stack_top + func->frame_size > V_SIZE(mat->stack) || mat->frame_top >= V_SIZE(mat->call_frames)) {
+		if (VM_grow_stack(mat, func->frame_size) != 0 || (mat->frame_top >= V_SIZE(mat->call_frames) && grow_frames(mat) != 0)) {
+			E_rt_err(mat, mod->name->str, DBG_get_line(mat, op), "Stack overflow.");
+			return -1;
+		}
+	}
+
+	stack = &V_AT(mat->stack, 0, obj_s);
+
+	if (n > func->param_num)
+		mat->stack_top -= n - func->param_num;
+
+	while (n < func->param_num) {
+		stack[mat->stack_top++].type = MAT_OT_NONE;
+		n++;
+	}
+
+	f = &V_AT(mat->call_frames, mat->frame_top++, call_frame_s);
+	f->func = func;
+	f->stack_base = mat->stack_top - func->param_num;
+	f->param_num = func->param_num;
+	f->ret_ip = NULL;
+	f->ret_ip_begin = NULL;
+
+	o = stack + mat->stack_top;
+	end = o + func->local_num;
+	mat->stack_top += func->local_num;
+
+	while (o < end)
+		(o++)->type = MAT_OT_DUMMY;
+
+	*out = f;
+	return 0;
+}
+
+// 调用 C 函数或者自定义类型对象，ro 为被调用对象，n 为实参个数
+static int call_c_obj(matrix_t mat, mod_s* mod, obj_s* ro, uint32_t n, lword_u* op) {
+	obj_s* o;
+	int ret;
+	uint32_t ro_pos = mat->stack_top - 1 - n; // 调用过程中运行栈可能扩大，结果按位置写回
+
+	if (ro->type == MAT_OT_C_FUNC) {
+		matrix_api_t c_func;
+		mat->stack_base = mat->stack_top - n;
+		c_func = ro->c_func;
+		ret = c_func(mat);
+		mat->stack_base = 0;
+
+		if (ret != 0) {
+			E_rt_err(mat, mod->name->str, DBG_get_line(mat, op), "Call C function failed.");
+			return -1;
+		}
+
+		o = &V_AT(mat->stack, mat->stack_top - 1, obj_s);
+		V_AT(mat->stack, ro_pos, obj_s) = *o;
+		mat->stack_top -= (n + 1);
+		return 0;
+	}
+	else if (ro->type == MAT_OT_EXT) {
+		mat_ext_header_s* ext = ro->ext;
+
+		if (ext->call) {
+			mat->stack_base = mat->stack_top - n;
+			ret = ext->call(mat, ext);
+			mat->stack_base = 0;
+
+			if (ret != 0) {
+				E_rt_err(mat, mod->name->str, DBG_get_line(mat, op), "Call C function failed.");
+				return -1;
+			}
+
+			o = &V_AT(mat->stack, mat->stack_top - 1, obj_s);
+			V_AT(mat->stack, ro_pos, obj_s) = *o;
+			mat->stack_top -= (n + 1);
+			return 0;
+		}
+	}
+
+	E_rt_err(mat, mod->name->str, DBG_get_line(mat, op), "The object is not callable.");
+	return -1;
+}
+
 static void dump_stack(matrix_t mat) {
 	obj_s* stack = &V_AT(mat->stack, 0, obj_s);
 	uint32_t top = mat->stack_top;
@@ -409,112 +763,116 @@ static void dump_stack(matrix_t mat) {
 
 int VM_exec_mod(matrix_t mat, mod_s* mod, vec_s* code) {
 	int ret;
-	uint32_t* ip = (uint32_t*)&V_AT(*code, 0, uint32_t);
-	uint32_t* ip_begin = ip;
-	uint32_t* ip_end = ip + V_SIZE(*code);
-	uint32_t* op;
-
-	obj_s* stack = &V_AT(mat->stack, 0, obj_s);
-	obj_s* stack_end = stack + V_SIZE(mat->stack);
+	lword_u* ip;
+	lword_u* ip_begin;
+	lword_u* op;
 
-	call_frame_s* frame = &V_AT(mat->call_frames, 0, call_frame_s);
-	call_frame_s* frame_end = frame + V_SIZE(mat->call_frames);
+	obj_s* stack;
+	obj_s* fp = NULL; // 当前函数的帧基址，指向第一个参数
+	call_frame_s* frame;
 
 	obj_s* o;
 	obj_s* r;
 	obj_s* ro;
-	string_s* s;
+	obj_s imm; // 超级指令中的整数操作数
+	int64_t next; // for 循环的下一个计数
 	string_s* mod_name;
 	call_frame_s* f;
 	uint32_t idx;
 	uint32_t n, i;
-	int32_t mod_pos;
-	int32_t pos;
 	mod_s* m;
 	list_s* l;
 	dict_s* d;
 
-	uint32_t ret_addr;
-	uint32_t stack_base;
+	lword_u* ret_ip;
+	lword_u* ret_ip_begin;
 	func_s* func;
 
+	VM_INIT_DISPATCH_TABLE;
+
+	VM_EXPORT_DISPATCH_TABLE;
+
+	ip = &V_AT(*code, 0, lword_u);
+	ip_begin = ip;
+
+	// 模块代码没有调用帧，在这里保证运行栈放得下它的临时对象
+	if (VM_grow_stack(mat, V_SIZE(*code)) != 0) {
+		E_rt_err(mat, mod->name->str, 0, "Stack overflow.");
+		return -1;
+	}
+
+	stack = &V_AT(mat->stack, 0, obj_s);
+	frame = &V_AT(mat->call_frames, 0, call_frame_s);
+
+	if (mat->frame_top > 0)
+		fp = stack + frame[mat->frame_top - 1].stack_base;
+
 	for (;;) {
 		//dump_stack(mat);
 		op = ip;
 
 		//GC_run_once(mat);
 
-		switch (*ip++) {
-			case IT_NOP: {
-				continue;
+		VM_SWITCH(ip++) {
+			VM_CASE(IT_NOP): {
+				VM_NEXT;
 			}
 
-			case IT_EXIT: {
+			VM_CASE(IT_EXIT): {
 				return 0;
 			}
 
-			case IT_IMPORT: {
-				idx = *ip++;
+			VM_CASE(IT_IMPORT): {
+				mod_name = (ip++)->str;
 
-				ret = S_get_str_by_idx(&mat->strs_nogc, idx, &mod_name);
+				ret = VM_exec_file(mat, mod_name, &m, &idx);
 				CHECK_RESULT(ret);
 
-				if (*op == IT_IMPORT) {
-					ret = VM_exec_file(mat, mod_name, &m, &idx);
-					CHECK_RESULT(ret);
-				}
+				RELOAD_STACK;
 
-				continue;
+				VM_NEXT;
 			}
 
-			case IT_PUSH_NONE: {
+			VM_CASE(IT_PUSH_NONE): {
 				stack[mat->stack_top++].type = MAT_OT_NONE;
-				continue;
+				VM_NEXT;
 			}
 
-			case IT_PUSH_STRING: {
+			VM_CASE(IT_PUSH_STRING): {
 				o = stack + mat->stack_top++;
-				n = *ip++;
-				ret = S_get_str_by_idx(&mat->strs_nogc, n, &s);
-
-				if (ret != 0) {
-					E_rt_err(mat, mod->name->str, DBG_get_line(mat, op), "Get string from string table failed. Index is %d.", n);
-					return -1;
-				}
-
 				o->type = MAT_OT_STR;
-				o->str = s;
-				continue;
+				o->str = (ip++)->str;
+				VM_NEXT;
 			}
 
-			case IT_PUSH_INT: {
+			VM_CASE(IT_PUSH_INT): {
 				o = stack + mat->stack_top++;
 				o->type = MAT_OT_INT32;
-				o->int32 = *ip++;
-				continue;
+				o->int32 = (ip++)->i;
+				VM_NEXT;
 			}
 
-			case IT_PUSH_REAL: {
+			VM_CASE(IT_PUSH_REAL): {
 				o = stack + mat->stack_top++;
 				o->type = MAT_OT_REAL;
-				o->real = *(float*)ip++;
-				continue;
+				o->real = (ip++)->real;
+				VM_NEXT;
 			}
 
-			case IT_POP: {
+			VM_CASE(IT_POP): {
 				mat->stack_top--;
-				continue;
+				VM_NEXT;
 			}
 
-			case IT_ASSIGN: {
+			VM_CASE(IT_ASSIGN): {
 				GET_REF_OBJECT_ASSIGN;
 				o = stack + mat->stack_top - 1;
 				*ro = *o;
 				mat->stack_top -= (n + 1);
-				continue;
+				VM_NEXT;
 			}
 
-			case IT_ASSIGN_ADD: {
+			VM_CASE(IT_ASSIGN_ADD): {
 				GET_REF_OBJECT_ASSIGN;
 				o = stack + mat->stack_top - 1;
 				ret = O_add(mat, ro, o, ro);
@@ -526,10 +884,10 @@ int VM_exec_mod(matrix_t mat, mod_s* mod, vec_s* code) {
 				}
 
 				mat->stack_top -= (n + 1);
-				continue;
+				VM_NEXT;
 			}
 
-			case IT_ASSIGN_SUB: {
+			VM_CASE(IT_ASSIGN_SUB): {
 				GET_REF_OBJECT_ASSIGN;
 				o = stack + mat->stack_top - 1;
 				ret = O_sub(ro, o, ro);
@@ -540,10 +898,10 @@ int VM_exec_mod(matrix_t mat, mod_s* mod, vec_s* code) {
 				}
 
 				mat->stack_top -= (n + 1);
-				continue;
+				VM_NEXT;
 			}
 
-			case IT_ASSIGN_MUL: {
+			VM_CASE(IT_ASSIGN_MUL): {
 				GET_REF_OBJECT_ASSIGN;
 				o = stack + mat->stack_top - 1;
 				ret = O_mul(mat, ro, o, ro);
@@ -554,10 +912,10 @@ int VM_exec_mod(matrix_t mat, mod_s* mod, vec_s* code) {
 				}
 
 				mat->stack_top -= (n + 1);
-				continue;
+				VM_NEXT;
 			}
 
-			case IT_ASSIGN_DIV: {
+			VM_CASE(IT_ASSIGN_DIV): {
 				GET_REF_OBJECT_ASSIGN;
 				o = stack + mat->stack_top - 1;
 				ret = O_div(ro, o, ro);
@@ -568,65 +926,135 @@ int VM_exec_mod(matrix_t mat, mod_s* mod, vec_s* code) {
 				}
 
 				mat->stack_top -= (n + 1);
-				continue;
+				VM_NEXT;
 			}
 
-			case IT_ASSIGN_MOD: {
+			VM_CASE(IT_ASSIGN_MOD): {
 				assert(0);
 			}
 
-			case IT_ASSIGN_EXP: {
+			VM_CASE(IT_ASSIGN_EXP): {
 				assert(0);
 			}
 
-			case IT_ASSIGN_AND: {
+			VM_CASE(IT_ASSIGN_AND): {
 				assert(0);
 			}
 
-			case IT_ASSIGN_OR: {
+			VM_CASE(IT_ASSIGN_OR): {
 				assert(0);
 			}
 
-			case IT_ASSIGN_XOR: {
+			VM_CASE(IT_ASSIGN_XOR): {
 				assert(0);
 			}
 
-			case IT_ASSIGN_SHIFT_LEFT: {
+			VM_CASE(IT_ASSIGN_SHIFT_LEFT): {
 				assert(0);
 			}
 
-			case IT_ASSIGN_SHIFT_RIGHT: {
+			VM_CASE(IT_ASSIGN_SHIFT_RIGHT): {
 				assert(0);
 			}
 
-			case IT_FALSE_JMP: {
+			VM_CASE(IT_FALSE_JMP): {
 				o = stack + --mat->stack_top;
 
 				if (o->type == MAT_OT_NONE)
-					ip = ip_begin + *ip;
+					ip = ip->ip;
 				else
 					ip++;
 
-				continue;
+				VM_NEXT;
 			}
 
-			case IT_TRUE_JMP: {
+			VM_CASE(IT_TRUE_JMP): {
 				o = stack + --mat->stack_top;
 
 				if (o->type != MAT_OT_NONE)
-					ip = ip_begin + *ip;
+					ip = ip->ip;
 				else
 					ip++;
 
-				continue;
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_JMP): {
+				ip = ip->ip;
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_LOOP): {
+#if MATRIX_JIT
+				ret = JIT_loop(mat, mod, op, ip_begin, fp, &n);
+
+				if (ret < 0)
+					return -1;
+
+				if (ret == 0) {
+					RELOAD_STACK;
+					ip = ip_begin + n;
+					VM_NEXT;
+				}
+#endif
+				ip = ip->ip;
+				VM_NEXT;
+			}
+
+			// 栈顶的计数、上限和步长在循环结束后由 POP 弹出，循环体不会改变它们
+			VM_CASE(IT_FOR_PREP): {
+				o = stack + mat->stack_top - 3;
+
+				if (o[0].type != MAT_OT_INT32 || o[1].type != MAT_OT_INT32 || o[2].type != MAT_OT_INT32) {
+					E_rt_err(mat, mod->name->str, DBG_get_line(mat, op), "The range of for loop must be int.");
+					return -1;
+				}
+
+				if (o[2].int32 == 0) {
+					E_rt_err(mat, mod->name->str, DBG_get_line(mat, op), "The step of for loop cannot be 0.");
+					return -1;
+				}
+
+				if (o[2].int32 > 0 ? o[0].int32 > o[1].int32 : o[0].int32 < o[1].int32) {
+					ip = ip->ip;
+					VM_NEXT;
+				}
+
+				r = ip[2].objs ? *ip[2].objs + ip[1].u : fp + ip[1].i;
+				*r = o[0];
+				ip += 3;
+				VM_NEXT;
 			}
 
-			case IT_JMP: {
-				ip = ip_begin + *ip;
-				continue;
+			VM_CASE(IT_FOR_LOOP): {
+				o = stack + mat->stack_top - 3;
+				next = (int64_t)o[0].int32 + o[2].int32;
+
+				if (o[2].int32 > 0 ? next > o[1].int32 : next < o[1].int32) {
+					ip += 4;
+					VM_NEXT;
+				}
+
+				o[0].int32 = (int32_t)next;
+				r = ip[3].objs ? *ip[3].objs + ip[2].u : fp + ip[2].i;
+				*r = o[0];
+#if MATRIX_JIT
+				ret = JIT_loop(mat, mod, op, ip_begin, fp, &n);
+
+				if (ret < 0)
+					return -1;
+
+				if (ret == 0) {
+					RELOAD_STACK;
+					ip = ip_begin + n;
+					VM_NEXT;
+				}
+#endif
+				ip = ip->ip;
+				VM_NEXT;
 			}
 
-			case IT_MINUS: {
+			VM_CASE(IT_MINUS): {
 				o = stack + mat->stack_top - 1;
 
 				if (o->type == MAT_OT_INT32)
@@ -638,10 +1066,10 @@ int VM_exec_mod(matrix_t mat, mod_s* mod, vec_s* code) {
 					return -1;
 				}
 
-				continue;
+				VM_NEXT;
 			}
 
-			case IT_INC: {
+			VM_CASE(IT_INC): {
 				if (o->type == MAT_OT_INT32)
 					o->int32 = o->int32++;
 				else if (o->type == MAT_OT_REAL)
@@ -651,10 +1079,10 @@ int VM_exec_mod(matrix_t mat, mod_s* mod, vec_s* code) {
 					return -1;
 				}
 
-				continue;
+				VM_NEXT;
 			}
 
-			case IT_DEC: {
+			VM_CASE(IT_DEC): {
 				if (o->type == MAT_OT_INT32)
 					o->int32 = o->int32--;
 				else if (o->type == MAT_OT_REAL)
@@ -664,20 +1092,21 @@ int VM_exec_mod(matrix_t mat, mod_s* mod, vec_s* code) {
 					return -1;
 				}
 
-				continue;
+				VM_NEXT;
 			}
 
-			case IT_LNOT: {
+			VM_CASE(IT_LNOT): {
 				assert(0);
 			}
 
-			case IT_BNOT: {
+			VM_CASE(IT_BNOT): {
 				assert(0);
 			}
 
-			case IT_ADD: {
+			VM_CASE(IT_ADD): {
 				o = stack + --mat->stack_top;
 				r = stack + mat->stack_top - 1;
+				VM_QUICKEN_II(IT_ADD_II);
 
 				ret = O_add(mat, r, o, r);
 
@@ -686,12 +1115,13 @@ int VM_exec_mod(matrix_t mat, mod_s* mod, vec_s* code) {
 					return -1;
 				}
 
-				continue;
+				VM_NEXT;
 			}
 
-			case IT_SUB: {
+			VM_CASE(IT_SUB): {
 				o = stack + mat->stack_top - 1;
 				r = stack + mat->stack_top - 2;
+				VM_QUICKEN_II(IT_SUB_II);
 
 				ret = O_sub(r, o, r);
 
@@ -701,12 +1131,13 @@ int VM_exec_mod(matrix_t mat, mod_s* mod, vec_s* code) {
 				}
 
 				mat->stack_top--;
-				continue;
+				VM_NEXT;
 			}
 
-			case IT_MUL: {
+			VM_CASE(IT_MUL): {
 				o = stack + --mat->stack_top;
 				r = stack + mat->stack_top - 1;
+				VM_QUICKEN_II(IT_MUL_II);
 
 				ret = O_mul(mat, r, o, r);
 
@@ -715,10 +1146,10 @@ int VM_exec_mod(matrix_t mat, mod_s* mod, vec_s* code) {
 					return -1;
 				}
 
-				continue;
+				VM_NEXT;
 			}
 
-			case IT_DIV: {
+			VM_CASE(IT_DIV): {
 				o = stack + --mat->stack_top;
 				r = stack + mat->stack_top - 1;
 
@@ -729,14 +1160,14 @@ int VM_exec_mod(matrix_t mat, mod_s* mod, vec_s* code) {
 					return -1;
 				}
 
-				continue;
+				VM_NEXT;
 			}
 
-			case IT_MOD: {
+			VM_CASE(IT_MOD): {
 				assert(0);
 			}
 
-			case IT_EXP: {
+			VM_CASE(IT_EXP): {
 				o = stack + --mat->stack_top;
 				r = stack + mat->stack_top - 1;
 
@@ -747,14 +1178,14 @@ int VM_exec_mod(matrix_t mat, mod_s* mod, vec_s* code) {
 					return -1;
 				}
 
-				continue;
+				VM_NEXT;
 			}
 
-			case IT_BXOR: {
+			VM_CASE(IT_BXOR): {
 				assert(0);
 			}
 
-			case IT_BOR: {
+			VM_CASE(IT_BOR): {
 				o = stack + --mat->stack_top;
 				r = stack + mat->stack_top - 1;
 
@@ -765,10 +1196,10 @@ int VM_exec_mod(matrix_t mat, mod_s* mod, vec_s* code) {
 					return -1;
 				}
 
-				continue;
+				VM_NEXT;
 			}
 
-			case IT_BAND: {
+			VM_CASE(IT_BAND): {
 				o = stack + --mat->stack_top;
 				r = stack + mat->stack_top - 1;
 
@@ -779,10 +1210,10 @@ int VM_exec_mod(matrix_t mat, mod_s* mod, vec_s* code) {
 					return -1;
 				}
 
-				continue;
+				VM_NEXT;
 			}
 
-			case IT_SHL: {
+			VM_CASE(IT_SHL): {
 				o = stack + --mat->stack_top;
 				r = stack + mat->stack_top - 1;
 
@@ -793,10 +1224,10 @@ int VM_exec_mod(matrix_t mat, mod_s* mod, vec_s* code) {
 					return -1;
 				}
 
-				continue;
+				VM_NEXT;
 			}
 
-			case IT_SHR: {
+			VM_CASE(IT_SHR): {
 				o = stack + --mat->stack_top;
 				r = stack + mat->stack_top - 1;
 
@@ -807,10 +1238,10 @@ int VM_exec_mod(matrix_t mat, mod_s* mod, vec_s* code) {
 					return -1;
 				}
 
-				continue;
+				VM_NEXT;
 			}
 
-			case IT_LOR: {
+			VM_CASE(IT_LOR): {
 				r = stack + mat->stack_top - 2;
 				o = stack + mat->stack_top - 1;
 
@@ -820,10 +1251,10 @@ int VM_exec_mod(matrix_t mat, mod_s* mod, vec_s* code) {
 					r->type = MAT_OT_NONE;
 
 				mat->stack_top--;
-				continue;
+				VM_NEXT;
 			}
 
-			case IT_LAND: {
+			VM_CASE(IT_LAND): {
 				r = stack + mat->stack_top - 2;
 				o = stack + mat->stack_top - 1;
 
@@ -833,12 +1264,31 @@ int VM_exec_mod(matrix_t mat, mod_s* mod, vec_s* code) {
 					r->type = MAT_OT_INT32;
 
 				mat->stack_top--;
-				continue;
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_TRUE_JMP_KEEP): {
+				if (stack[mat->stack_top - 1].type != MAT_OT_NONE)
+					ip = ip->ip;
+				else
+					ip++;
+
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_FALSE_JMP_KEEP): {
+				if (stack[mat->stack_top - 1].type == MAT_OT_NONE)
+					ip = ip->ip;
+				else
+					ip++;
+
+				VM_NEXT;
 			}
 
-			case IT_NEQ: {
+			VM_CASE(IT_NEQ): {
 				r = stack + mat->stack_top - 2;
 				o = stack + mat->stack_top - 1;
+				VM_QUICKEN_II(IT_NEQ_II);
 
 				if (O_compare_eq(r, o))
 					r->type = MAT_OT_NONE;
@@ -846,12 +1296,13 @@ int VM_exec_mod(matrix_t mat, mod_s* mod, vec_s* code) {
 					r->type = MAT_OT_INT32;
 
 				mat->stack_top--;
-				continue;
+				VM_NEXT;
 			}
 
-			case IT_EQ: {
+			VM_CASE(IT_EQ): {
 				r = stack + mat->stack_top - 2;
 				o = stack + mat->stack_top - 1;
+				VM_QUICKEN_II(IT_EQ_II);
 
 				if (!O_compare_eq(r, o))
 					r->type = MAT_OT_NONE;
@@ -859,12 +1310,13 @@ int VM_exec_mod(matrix_t mat, mod_s* mod, vec_s* code) {
 					r->type = MAT_OT_INT32;
 
 				mat->stack_top--;
-				continue;
+				VM_NEXT;
 			}
 
-			case IT_GE: {
+			VM_CASE(IT_GE): {
 				r = stack + mat->stack_top - 2;
 				o = stack + mat->stack_top - 1;
+				VM_QUICKEN_II(IT_GE_II);
 
 				ret = O_compare_ge(r, o);
 
@@ -879,12 +1331,13 @@ int VM_exec_mod(matrix_t mat, mod_s* mod, vec_s* code) {
 					r->type = MAT_OT_INT32;
 
 				mat->stack_top--;
-				continue;
+				VM_NEXT;
 			}
 
-			case IT_LE: {
+			VM_CASE(IT_LE): {
 				r = stack + mat->stack_top - 2;
 				o = stack + mat->stack_top - 1;
+				VM_QUICKEN_II(IT_LE_II);
 
 				ret = O_compare_gt(r, o);
 
@@ -899,12 +1352,13 @@ int VM_exec_mod(matrix_t mat, mod_s* mod, vec_s* code) {
 					r->type = MAT_OT_INT32;
 
 				mat->stack_top--;
-				continue;
+				VM_NEXT;
 			}
 
-			case IT_GT: {
+			VM_CASE(IT_GT): {
 				r = stack + mat->stack_top - 2;
 				o = stack + mat->stack_top - 1;
+				VM_QUICKEN_II(IT_GT_II);
 
 				ret = O_compare_gt(r, o);
 
@@ -919,12 +1373,13 @@ int VM_exec_mod(matrix_t mat, mod_s* mod, vec_s* code) {
 					r->type = MAT_OT_INT32;
 
 				mat->stack_top--;
-				continue;
+				VM_NEXT;
 			}
 
-			case IT_LT: {
+			VM_CASE(IT_LT): {
 				r = stack + mat->stack_top - 2;
 				o = stack + mat->stack_top - 1;
+				VM_QUICKEN_II(IT_LT_II);
 
 				ret = O_compare_ge(r, o);
 
@@ -939,146 +1394,138 @@ int VM_exec_mod(matrix_t mat, mod_s* mod, vec_s* code) {
 					r->type = MAT_OT_INT32;
 
 				mat->stack_top--;
-				continue;
+				VM_NEXT;
 			}
 
-			case IT_CALL: {
+			VM_CASE(IT_CALL): {
 				assert(mat->stack_top > 0);
-				n = *ip;
+				n = ip->u;
 				ro = stack + mat->stack_top - 1 - n;
 
 				if (ro->type == MAT_OT_FUNC) {
-					ret_addr = ip - ip_begin + 1;
-					stack_base = mat->stack_top;
-
-					o = stack + mat->stack_top++;
-
 					func = ro->func;
-					o->type = MAT_OT_INT32;
-					o->int32 = ret_addr;
+					ret = push_frame(mat, mod, op, func, n, &f);
+					CHECK_RESULT(ret);
+					f->ret_ip = ip + 1;
+					f->ret_ip_begin = ip_begin;
 
-					f = frame + mat->frame_top++;
-					f->func = func;
-					f->stack_base = stack_base;
-					f->param_num = n;
+#if MATRIX_JIT
+					if (JIT_ready(mat, func)) {
+						ret = JIT_exec(mat, mod, func);
 
-					n = HL_SIZE(func->objs) - func->param_num;
+						if (ret != 0)
+							return -1;
 
-					while (n-- > 0) {
-						obj_s* o = stack + mat->stack_top++;
-						o->type = MAT_OT_DUMMY;
+						RELOAD_STACK;
+						ip++;
+						VM_NEXT;
 					}
+#endif
 
-					ip_begin = &V_AT(func->code, 0, uint32_t);
+					stack = &V_AT(mat->stack, 0, obj_s);
+					frame = &V_AT(mat->call_frames, 0, call_frame_s);
+					fp = stack + f->stack_base;
+					ip_begin = func->entry;
 					ip = ip_begin;
-					ip_end = ip_begin + V_SIZE(func->code);
-					continue;
+					VM_NEXT;
 				}
-				else if (ro->type == MAT_OT_C_FUNC) {
-					matrix_api_t c_func;
-					mat->stack_base = mat->stack_top - n;
-					c_func = ro->c_func;
-					ret = c_func(mat);
-					mat->stack_base = 0;
 
-					if (ret != 0) {
-						E_rt_err(mat, mod->name->str, DBG_get_line(mat, op), "Call C function failed.");
+				ret = call_c_obj(mat, mod, ro, n, op);
+
+				if (ret != 0)
+					return -1;
+
+				RELOAD_STACK;
+				ip++;
+				VM_NEXT;
+			}
+
+			/*
+				尾调用：被调用对象和实参移到当前帧的被调用对象位置，弹出当前帧后按当前帧的返回地址建立新帧，
+				深度尾递归只占用固定的运行栈和调用帧。被调用对象不是函数时按普通调用执行，由之后的 RET_RESULT 返回。
+			*/
+			VM_CASE(IT_TAIL_CALL): {
+				assert(mat->frame_top > 0);
+				n = ip->u;
+				ro = stack + mat->stack_top - 1 - n;
+
+				if (ro->type != MAT_OT_FUNC) {
+					ret = call_c_obj(mat, mod, ro, n, op);
+
+					if (ret != 0)
 						return -1;
-					}
 
-					o = stack + mat->stack_top - 1;
-					*ro = *o;
-					mat->stack_top -= (n + 1);
+					RELOAD_STACK;
 					ip++;
-					continue;
+					VM_NEXT;
 				}
-				else if (ro->type == MAT_OT_EXT) {
-					mat_ext_header_s* ext = ro->ext;
 
-					if (ext->call) {
-						mat->stack_base = mat->stack_top - n;
-						ret = ext->call(mat, ext);
-						mat->stack_base = 0;
+				func = ro->func;
+				f = frame + --mat->frame_top;
+				ret_ip = f->ret_ip;
+				ret_ip_begin = f->ret_ip_begin;
+				memmove(stack + f->stack_base - 1, ro, sizeof(obj_s) * (n + 1));
+				mat->stack_top = f->stack_base + n;
+				ret = push_frame(mat, mod, op, func, n, &f);
+				CHECK_RESULT(ret);
+				f->ret_ip = ret_ip;
+				f->ret_ip_begin = ret_ip_begin;
 
-						if (ret != 0) {
-							E_rt_err(mat, mod->name->str, DBG_get_line(mat, op), "Call C function failed.");
-							return -1;
-						}
+#if MATRIX_JIT
+				if (JIT_ready(mat, func)) {
+					ret = JIT_exec(mat, mod, func);
 
-						o = stack + mat->stack_top - 1;
-						*ro = *o;
-						mat->stack_top -= (n + 1);
-						ip++;
-						continue;
-					}
+					if (ret != 0)
+						return -1;
+
+					RELOAD_STACK;
+					f = frame + mat->frame_top;
+					RETURN_TO_CALLER;
 				}
+#endif
 
-				E_rt_err(mat, mod->name->str, DBG_get_line(mat, op), "The object is not callable.");
-				return -1;
+				stack = &V_AT(mat->stack, 0, obj_s);
+				frame = &V_AT(mat->call_frames, 0, call_frame_s);
+				fp = stack + f->stack_base;
+				ip_begin = func->entry;
+				ip = ip_begin;
+				VM_NEXT;
 			}
 
-			case IT_RET: {
+			VM_CASE(IT_RET): {
 				f = frame + --mat->frame_top;
-				o = stack + mat->stack_top - (HL_SIZE(f->func->objs) - f->func->param_num) - 1;
-				assert(o->type == MAT_OT_INT32);
-				ret_addr = o->int32;
-				n = HL_SIZE(f->func->objs) - f->func->param_num + f->param_num + 1;
-				mat->stack_top -= n;
+				mat->stack_top = f->stack_base;
 
 				o = stack + mat->stack_top - 1;
 				o->type = MAT_OT_NONE;
 
-				if (ret_addr == 0) // 表示从C代码调用过来的
-					return 0;
-				else {
-					if (mat->frame_top == 0) {
-						ip_begin = &V_AT(mod->code, 0, uint32_t);
-						ip = ip_begin + ret_addr;
-						ip_end = ip_begin + V_SIZE(mod->code);
-					}
-					else {
-						f = frame + mat->frame_top - 1;
-						ip_begin = &V_AT(f->func->code, 0, uint32_t);
-						ip = ip_begin + ret_addr;
-						ip_end = ip_begin + V_SIZE(f->func->code);
-					}
-				}
-
-				continue;
+				RETURN_TO_CALLER;
 			}
 
-			case IT_RET_RESULT: {
+			VM_CASE(IT_RET_RESULT): {
 				r = stack + mat->stack_top - 1;
 				f = frame + --mat->frame_top;
-				o = stack + mat->stack_top - (HL_SIZE(f->func->objs) - f->func->param_num) - 2;
-				assert(o->type == MAT_OT_INT32);
-				ret_addr = o->int32;
-				n = HL_SIZE(f->func->objs) - f->func->param_num + f->param_num + 2;
-				mat->stack_top -= n;
+				mat->stack_top = f->stack_base;
 
 				*(stack + mat->stack_top - 1) = *r;
 
-				if (ret_addr == 0)
-					return 0;
-				else {
-					if (mat->frame_top == 0) {
-						ip_begin = &V_AT(mod->code, 0, uint32_t);
-						ip = ip_begin + ret_addr;
-						ip_end = ip_begin + V_SIZE(mod->code);
-					}
-					else {
-						f = frame + mat->frame_top - 1;
-						ip_begin = &V_AT(f->func->code, 0, uint32_t);
-						ip = ip_begin + ret_addr;
-						ip_end = ip_begin + V_SIZE(f->func->code);
-					}
-				}
+				RETURN_TO_CALLER;
+			}
+
+			// 被调用对象仍然是内联的函数时执行后面复制的代码，否则跳到普通的 CALL
+			VM_CASE(IT_INLINE_GUARD): {
+				ro = stack + mat->stack_top - 1 - ip[2].u;
 
-				continue;
+				if (ro->type == MAT_OT_FUNC && ro->func == ip[1].func)
+					ip += 3;
+				else
+					ip = ip->ip;
+
+				VM_NEXT;
 			}
 
-			case IT_MAKE_LIST: {
-				n = *ip++;
+			VM_CASE(IT_MAKE_LIST): {
+				n = (ip++)->u;
 				ret = LI_alloc(mat, n, &l);
 				CHECK_RESULT(ret);
 				assert(V_CAP(l->v) >= n);
@@ -1093,11 +1540,11 @@ int VM_exec_mod(matrix_t mat, mod_s* mod, vec_s* code) {
 					V_SIZE(l->v) = n;
 				}
 
-				continue;
+				VM_NEXT;
 			}
 
-			case IT_MAKE_DICT: {
-				n = *ip++;
+			VM_CASE(IT_MAKE_DICT): {
+				n = (ip++)->u;
 				i = n;
 				ret = D_alloc(mat, n, &d);
 				CHECK_RESULT(ret);
@@ -1119,81 +1566,816 @@ int VM_exec_mod(matrix_t mat, mod_s* mod, vec_s* code) {
 				o = stack + mat->stack_top++;
 				o->type = MAT_OT_DICT;
 				o->dict = d;
-				continue;
+				VM_NEXT;
 			}
 
-			case IT_REF_OBJ: {
+			VM_CASE(IT_REF_OBJ): {
 				GET_REF_OBJECT_EXPRESSION;
 				o = stack + mat->stack_top;
 				o->type = MAT_OT_OBJ_REF;
 				o->obj_ref = ro;
-				continue;
+				VM_NEXT;
 			}
 
-			case IT_PUSH_OBJ: {
+			VM_CASE(IT_PUSH_OBJ): {
 				GET_REF_OBJECT_EXPRESSION;
 				mat->stack_top -= n;
 				o = stack + mat->stack_top++;
 				*o = *ro;
-				continue;
+				VM_NEXT;
 			}
 
-			default:
-				assert(0);
-				return -1;
-		}
-	}
+			VM_CASE(IT_R_MOVE): {
+				fp[ip[0].i] = fp[ip[1].i];
+				ip += 2;
+				VM_NEXT;
+			}
 
-	ret = 0;
-exit0:
-	return ret;
-}
+			VM_CASE(IT_R_LOADI): {
+				r = fp + ip[0].i;
+				r->type = MAT_OT_INT32;
+				r->int32 = ip[1].i;
+				ip += 2;
+				VM_NEXT;
+			}
 
-int VM_call(matrix_t mat, mod_s* mod, uint32_t param_num) {
-	int ret;
-	int n = param_num;
-	obj_s* ro;
-	obj_s* o;
-	obj_s* stack;
-	uint32_t stack_base;
-	func_s* func;
-	call_frame_s* f;
-	call_frame_s* frame = &V_AT(mat->call_frames, 0, call_frame_s);
+			VM_CASE(IT_R_ADD): {
+				GET_REG_OPERANDS;
+				ret = O_add(mat, ro, o, r);
 
-	assert(mat);
-	assert(mat->stack_top > 0);
+				if (ret != 0) {
+					E_rt_err(mat, mod->name->str, DBG_get_line(mat, op), "Cannot add %s and %s.", O_type_to_str(ro->type), O_type_to_str(o->type));
+					return -1;
+				}
 
-	mat->stack_top = 0;
-	mat->frame_top = 0;
+				VM_NEXT;
+			}
 
-	stack = &V_AT(mat->stack, 0, obj_s);
-	ro = stack + mat->stack_top - 1 - n;
+			VM_CASE(IT_R_SUB): {
+				GET_REG_OPERANDS;
+				ret = O_sub(ro, o, r);
 
-	if (ro->type != MAT_OT_FUNC) {
-		E_rt_err(mat, "from C code", 0, "The object is not callable.");
-		return -1;
-	}
+				if (ret != 0) {
+					E_rt_err(mat, mod->name->str, DBG_get_line(mat, op), "Cannot sub %s and %s.", O_type_to_str(ro->type), O_type_to_str(o->type));
+					return -1;
+				}
+
+				VM_NEXT;
+			}
 
-	stack_base = mat->stack_top;
-	o = stack + mat->stack_top++;
+			VM_CASE(IT_R_MUL): {
+				GET_REG_OPERANDS;
+				ret = O_mul(mat, ro, o, r);
 
-	func = ro->func;
-	o->type = MAT_OT_INT32;
-	o->int32 = 0; // 0表示是从C代码里调用过来的
+				if (ret != 0) {
+					E_rt_err(mat, mod->name->str, DBG_get_line(mat, op), "Cannot mul %s and %s.", O_type_to_str(ro->type), O_type_to_str(o->type));
+					return -1;
+				}
 
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_R_DIV): {
+				GET_REG_OPERANDS;
+				ret = O_div(ro, o, r);
+
+				if (ret != 0) {
+					E_rt_err(mat, mod->name->str, DBG_get_line(mat, op), "Cannot div %s and %s.", O_type_to_str(ro->type), O_type_to_str(o->type));
+					return -1;
+				}
+
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_R_EQ): {
+				GET_REG_OPERANDS;
+				ret = O_compare_eq(ro, o);
+				*r = *ro;
+
+				if (ret)
+					r->type = MAT_OT_INT32;
+				else
+					r->type = MAT_OT_NONE;
+
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_R_NEQ): {
+				GET_REG_OPERANDS;
+				ret = O_compare_eq(ro, o);
+				*r = *ro;
+
+				if (ret)
+					r->type = MAT_OT_NONE;
+				else
+					r->type = MAT_OT_INT32;
+
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_R_LT): {
+				GET_REG_OPERANDS;
+				ret = O_compare_ge(ro, o);
+
+				if (ret == -1) {
+					E_rt_err(mat, mod->name->str, DBG_get_line(mat, op), "Cannot compare %s and %s.", O_type_to_str(ro->type), O_type_to_str(o->type));
+					return -1;
+				}
+
+				*r = *ro;
+
+				if (ret == 0)
+					r->type = MAT_OT_INT32;
+				else
+					r->type = MAT_OT_NONE;
+
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_R_LE): {
+				GET_REG_OPERANDS;
+				ret = O_compare_gt(ro, o);
+
+				if (ret == -1) {
+					E_rt_err(mat, mod->name->str, DBG_get_line(mat, op), "Cannot compare %s and %s.", O_type_to_str(ro->type), O_type_to_str(o->type));
+					return -1;
+				}
+
+				*r = *ro;
+
+				if (ret == 0)
+					r->type = MAT_OT_INT32;
+				else
+					r->type = MAT_OT_NONE;
+
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_R_GT): {
+				GET_REG_OPERANDS;
+				ret = O_compare_gt(ro, o);
+
+				if (ret == -1) {
+					E_rt_err(mat, mod->name->str, DBG_get_line(mat, op), "Cannot compare %s and %s.", O_type_to_str(ro->type), O_type_to_str(o->type));
+					return -1;
+				}
+
+				*r = *ro;
+
+				if (ret == 1)
+					r->type = MAT_OT_INT32;
+				else
+					r->type = MAT_OT_NONE;
+
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_R_GE): {
+				GET_REG_OPERANDS;
+				ret = O_compare_ge(ro, o);
+
+				if (ret == -1) {
+					E_rt_err(mat, mod->name->str, DBG_get_line(mat, op), "Cannot compare %s and %s.", O_type_to_str(ro->type), O_type_to_str(o->type));
+					return -1;
+				}
+
+				*r = *ro;
+
+				if (ret == 1)
+					r->type = MAT_OT_INT32;
+				else
+					r->type = MAT_OT_NONE;
+
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_R_FALSE_JMP): {
+				if (fp[ip[0].i].type == MAT_OT_NONE)
+					ip = ip[1].ip;
+				else
+					ip += 2;
+
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_R_TRUE_JMP): {
+				if (fp[ip[0].i].type != MAT_OT_NONE)
+					ip = ip[1].ip;
+				else
+					ip += 2;
+
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_ASSIGN_INT): {
+				GET_REF_OBJECT_EXPRESSION;
+				ro->type = MAT_OT_INT32;
+				ro->int32 = (ip++)->i;
+				mat->stack_top -= n;
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_ASSIGN_ADD_INT): {
+				GET_REF_OBJECT_EXPRESSION;
+				imm.int32 = (ip++)->i;
+
+				if (ro->type == MAT_OT_INT32)
+					ro->int32 += imm.int32;
+				else {
+					imm.type = MAT_OT_INT32;
+					ret = O_add(mat, ro, &imm, ro);
+
+					if (ret != 0) {
+						E_rt_err(mat, mod->name->str, DBG_get_line(mat, op), "Cannot add %s and %s.", O_type_to_str(ro->type), O_type_to_str(imm.type));
+						return -1;
+					}
+				}
+
+				mat->stack_top -= n;
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_ASSIGN_SUB_INT): {
+				GET_REF_OBJECT_EXPRESSION;
+				imm.int32 = (ip++)->i;
+
+				if (ro->type == MAT_OT_INT32)
+					ro->int32 -= imm.int32;
+				else {
+					imm.type = MAT_OT_INT32;
+					ret = O_sub(ro, &imm, ro);
+
+					if (ret != 0) {
+						E_rt_err(mat, mod->name->str, DBG_get_line(mat, op), "Cannot sub %s and %s.", O_type_to_str(ro->type), O_type_to_str(imm.type));
+						return -1;
+					}
+				}
+
+				mat->stack_top -= n;
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_PUSH_ADD_INT): {
+				GET_REF_OBJECT_EXPRESSION;
+				imm.int32 = (ip++)->i;
+				mat->stack_top -= n;
+				r = stack + mat->stack_top++;
+
+				if (ro->type == MAT_OT_INT32) {
+					r->type = MAT_OT_INT32;
+					r->int32 = ro->int32 + imm.int32;
+				}
+				else {
+					imm.type = MAT_OT_INT32;
+					ret = O_add(mat, ro, &imm, r);
+
+					if (ret != 0) {
+						E_rt_err(mat, mod->name->str, DBG_get_line(mat, op), "Cannot add %s and %s.", O_type_to_str(ro->type), O_type_to_str(imm.type));
+						return -1;
+					}
+				}
+
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_PUSH_SUB_INT): {
+				GET_REF_OBJECT_EXPRESSION;
+				imm.int32 = (ip++)->i;
+				mat->stack_top -= n;
+				r = stack + mat->stack_top++;
+
+				if (ro->type == MAT_OT_INT32) {
+					r->type = MAT_OT_INT32;
+					r->int32 = ro->int32 - imm.int32;
+				}
+				else {
+					imm.type = MAT_OT_INT32;
+					ret = O_sub(ro, &imm, r);
+
+					if (ret != 0) {
+						E_rt_err(mat, mod->name->str, DBG_get_line(mat, op), "Cannot sub %s and %s.", O_type_to_str(ro->type), O_type_to_str(imm.type));
+						return -1;
+					}
+				}
+
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_FALSE_JMP_EQ): {
+				r = stack + mat->stack_top - 2;
+				o = stack + mat->stack_top - 1;
+				VM_QUICKEN_II(IT_FALSE_JMP_EQ_II);
+				ret = O_compare_eq(r, o);
+
+				mat->stack_top -= 2;
+
+				if (!ret)
+					ip = ip->ip;
+				else
+					ip++;
+
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_FALSE_JMP_NEQ): {
+				r = stack + mat->stack_top - 2;
+				o = stack + mat->stack_top - 1;
+				VM_QUICKEN_II(IT_FALSE_JMP_NEQ_II);
+				ret = O_compare_eq(r, o);
+
+				mat->stack_top -= 2;
+
+				if (ret)
+					ip = ip->ip;
+				else
+					ip++;
+
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_FALSE_JMP_LT): {
+				r = stack + mat->stack_top - 2;
+				o = stack + mat->stack_top - 1;
+				VM_QUICKEN_II(IT_FALSE_JMP_LT_II);
+				ret = O_compare_ge(r, o);
+
+				if (ret == -1) {
+					E_rt_err(mat, mod->name->str, DBG_get_line(mat, op), "Cannot compare %s and %s.", O_type_to_str(r->type), O_type_to_str(o->type));
+					return -1;
+				}
+
+				mat->stack_top -= 2;
+
+				if (ret == 1)
+					ip = ip->ip;
+				else
+					ip++;
+
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_FALSE_JMP_LE): {
+				r = stack + mat->stack_top - 2;
+				o = stack + mat->stack_top - 1;
+				VM_QUICKEN_II(IT_FALSE_JMP_LE_II);
+				ret = O_compare_gt(r, o);
+
+				if (ret == -1) {
+					E_rt_err(mat, mod->name->str, DBG_get_line(mat, op), "Cannot compare %s and %s.", O_type_to_str(r->type), O_type_to_str(o->type));
+					return -1;
+				}
+
+				mat->stack_top -= 2;
+
+				if (ret == 1)
+					ip = ip->ip;
+				else
+					ip++;
+
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_FALSE_JMP_GT): {
+				r = stack + mat->stack_top - 2;
+				o = stack + mat->stack_top - 1;
+				VM_QUICKEN_II(IT_FALSE_JMP_GT_II);
+				ret = O_compare_gt(r, o);
+
+				if (ret == -1) {
+					E_rt_err(mat, mod->name->str, DBG_get_line(mat, op), "Cannot compare %s and %s.", O_type_to_str(r->type), O_type_to_str(o->type));
+					return -1;
+				}
+
+				mat->stack_top -= 2;
+
+				if (ret == 0)
+					ip = ip->ip;
+				else
+					ip++;
+
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_FALSE_JMP_GE): {
+				r = stack + mat->stack_top - 2;
+				o = stack + mat->stack_top - 1;
+				VM_QUICKEN_II(IT_FALSE_JMP_GE_II);
+				ret = O_compare_ge(r, o);
+
+				if (ret == -1) {
+					E_rt_err(mat, mod->name->str, DBG_get_line(mat, op), "Cannot compare %s and %s.", O_type_to_str(r->type), O_type_to_str(o->type));
+					return -1;
+				}
+
+				mat->stack_top -= 2;
+
+				if (ret == 0)
+					ip = ip->ip;
+				else
+					ip++;
+
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_ADD_II): {
+				r = stack + mat->stack_top - 2;
+				o = stack + mat->stack_top - 1;
+
+				if (r->type != MAT_OT_INT32 || o->type != MAT_OT_INT32) {
+					VM_REWRITE(IT_ADD);
+					ip = op;
+					VM_NEXT;
+				}
+
+				r->int32 = r->int32 + o->int32;
+
+				mat->stack_top--;
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_SUB_II): {
+				r = stack + mat->stack_top - 2;
+				o = stack + mat->stack_top - 1;
+
+				if (r->type != MAT_OT_INT32 || o->type != MAT_OT_INT32) {
+					VM_REWRITE(IT_SUB);
+					ip = op;
+					VM_NEXT;
+				}
+
+				r->int32 = r->int32 - o->int32;
+
+				mat->stack_top--;
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_MUL_II): {
+				r = stack + mat->stack_top - 2;
+				o = stack + mat->stack_top - 1;
+
+				if (r->type != MAT_OT_INT32 || o->type != MAT_OT_INT32) {
+					VM_REWRITE(IT_MUL);
+					ip = op;
+					VM_NEXT;
+				}
+
+				r->int32 = r->int32 * o->int32;
+
+				mat->stack_top--;
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_EQ_II): {
+				r = stack + mat->stack_top - 2;
+				o = stack + mat->stack_top - 1;
+
+				if (r->type != MAT_OT_INT32 || o->type != MAT_OT_INT32) {
+					VM_REWRITE(IT_EQ);
+					ip = op;
+					VM_NEXT;
+				}
+
+				if (!(r->int32 == o->int32))
+					r->type = MAT_OT_NONE;
+
+				mat->stack_top--;
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_NEQ_II): {
+				r = stack + mat->stack_top - 2;
+				o = stack + mat->stack_top - 1;
+
+				if (r->type != MAT_OT_INT32 || o->type != MAT_OT_INT32) {
+					VM_REWRITE(IT_NEQ);
+					ip = op;
+					VM_NEXT;
+				}
+
+				if (!(r->int32 != o->int32))
+					r->type = MAT_OT_NONE;
+
+				mat->stack_top--;
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_LT_II): {
+				r = stack + mat->stack_top - 2;
+				o = stack + mat->stack_top - 1;
+
+				if (r->type != MAT_OT_INT32 || o->type != MAT_OT_INT32) {
+					VM_REWRITE(IT_LT);
+					ip = op;
+					VM_NEXT;
+				}
+
+				if (!(r->int32 < o->int32))
+					r->type = MAT_OT_NONE;
+
+				mat->stack_top--;
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_LE_II): {
+				r = stack + mat->stack_top - 2;
+				o = stack + mat->stack_top - 1;
+
+				if (r->type != MAT_OT_INT32 || o->type != MAT_OT_INT32) {
+					VM_REWRITE(IT_LE);
+					ip = op;
+					VM_NEXT;
+				}
+
+				if (!(r->int32 <= o->int32))
+					r->type = MAT_OT_NONE;
+
+				mat->stack_top--;
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_GT_II): {
+				r = stack + mat->stack_top - 2;
+				o = stack + mat->stack_top - 1;
+
+				if (r->type != MAT_OT_INT32 || o->type != MAT_OT_INT32) {
+					VM_REWRITE(IT_GT);
+					ip = op;
+					VM_NEXT;
+				}
+
+				if (!(r->int32 > o->int32))
+					r->type = MAT_OT_NONE;
+
+				mat->stack_top--;
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_GE_II): {
+				r = stack + mat->stack_top - 2;
+				o = stack + mat->stack_top - 1;
+
+				if (r->type != MAT_OT_INT32 || o->type != MAT_OT_INT32) {
+					VM_REWRITE(IT_GE);
+					ip = op;
+					VM_NEXT;
+				}
+
+				if (!(r->int32 >= o->int32))
+					r->type = MAT_OT_NONE;
+
+				mat->stack_top--;
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_FALSE_JMP_EQ_II): {
+				r = stack + mat->stack_top - 2;
+				o = stack + mat->stack_top - 1;
+
+				if (r->type != MAT_OT_INT32 || o->type != MAT_OT_INT32) {
+					VM_REWRITE(IT_FALSE_JMP_EQ);
+					ip = op;
+					VM_NEXT;
+				}
+
+				mat->stack_top -= 2;
+
+				if (r->int32 == o->int32)
+					ip++;
+				else
+					ip = ip->ip;
+
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_FALSE_JMP_NEQ_II): {
+				r = stack + mat->stack_top - 2;
+				o = stack + mat->stack_top - 1;
+
+				if (r->type != MAT_OT_INT32 || o->type != MAT_OT_INT32) {
+					VM_REWRITE(IT_FALSE_JMP_NEQ);
+					ip = op;
+					VM_NEXT;
+				}
+
+				mat->stack_top -= 2;
+
+				if (r->int32 != o->int32)
+					ip++;
+				else
+					ip = ip->ip;
+
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_FALSE_JMP_LT_II): {
+				r = stack + mat->stack_top - 2;
+				o = stack + mat->stack_top - 1;
+
+				if (r->type != MAT_OT_INT32 || o->type != MAT_OT_INT32) {
+					VM_REWRITE(IT_FALSE_JMP_LT);
+					ip = op;
+					VM_NEXT;
+				}
+
+				mat->stack_top -= 2;
+
+				if (r->int32 < o->int32)
+					ip++;
+				else
+					ip = ip->ip;
+
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_FALSE_JMP_LE_II): {
+				r = stack + mat->stack_top - 2;
+				o = stack + mat->stack_top - 1;
+
+				if (r->type != MAT_OT_INT32 || o->type != MAT_OT_INT32) {
+					VM_REWRITE(IT_FALSE_JMP_LE);
+					ip = op;
+					VM_NEXT;
+				}
+
+				mat->stack_top -= 2;
+
+				if (r->int32 <= o->int32)
+					ip++;
+				else
+					ip = ip->ip;
+
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_FALSE_JMP_GT_II): {
+				r = stack + mat->stack_top - 2;
+				o = stack + mat->stack_top - 1;
+
+				if (r->type != MAT_OT_INT32 || o->type != MAT_OT_INT32) {
+					VM_REWRITE(IT_FALSE_JMP_GT);
+					ip = op;
+					VM_NEXT;
+				}
+
+				mat->stack_top -= 2;
+
+				if (r->int32 > o->int32)
+					ip++;
+				else
+					ip = ip->ip;
+
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_FALSE_JMP_GE_II): {
+				r = stack + mat->stack_top - 2;
+				o = stack + mat->stack_top - 1;
+
+				if (r->type != MAT_OT_INT32 || o->type != MAT_OT_INT32) {
+					VM_REWRITE(IT_FALSE_JMP_GE);
+					ip = op;
+					VM_NEXT;
+				}
+
+				mat->stack_top -= 2;
+
+				if (r->int32 >= o->int32)
+					ip++;
+				else
+					ip = ip->ip;
+
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_PUSH_LOCAL): {
+				stack[mat->stack_top++] = fp[ip->i];
+				ip++;
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_PUSH_GLOBAL): {
+				stack[mat->stack_top++] = (*ip[1].objs)[ip[0].u];
+				ip += 2;
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_STORE_LOCAL): {
+				fp[ip->i] = stack[--mat->stack_top];
+				ip++;
+				VM_NEXT;
+			}
+
+			VM_CASE(IT_STORE_GLOBAL): {
+				(*ip[1].objs)[ip[0].u] = stack[--mat->stack_top];
+				ip += 2;
+				VM_NEXT;
+			}
+
+			VM_DEFAULT:
+				assert(0);
+				return -1;
+		}
+	}
+
+	ret = 0;
+exit0:
+	return ret;
+}
+
+lword_u VM_handler(matrix_t mat, uint32_t ins) {
+	lword_u w;
+	assert(ins < IT_MAX);
+	memset(&w, 0, sizeof(w));
+
+#if MATRIX_THREADED_DISPATCH
+
+	// 处理代码地址存在各自的虚拟机里，不同线程里的虚拟机不共享可写的全局状态
+	if (!mat->handlers)
+		VM_exec_mod(mat, NULL, NULL);
+
+	w.h = mat->handlers[ins];
+#else
+	w.u = ins;
+#endif
+
+	return w;
+}
+
+int VM_call_obj(matrix_t mat, mod_s* mod, uint32_t n, lword_u* op) {
+	obj_s* ro;
+	func_s* func;
+	call_frame_s* f;
+	assert(mat->stack_top > n);
+
+	ro = &V_AT(mat->stack, mat->stack_top - 1 - n, obj_s);
+
+	if (ro->type != MAT_OT_FUNC)
+		return call_c_obj(mat, mod, ro, n, op);
+
+	func = ro->func;
+
+	if (push_frame(mat, mod, op, func, n, &f) != 0)
+		return -1;
+
+#if MATRIX_JIT
+	if (JIT_ready(mat, func))
+		return JIT_exec(mat, mod, func);
+#endif
+
+	return VM_exec_mod(mat, mod, &func->lcode);
+}
+
+int VM_call(matrix_t mat, mod_s* mod, uint32_t param_num) {
+	int ret;
+	int n = param_num;
+	obj_s* ro;
+	obj_s* stack;
+	uint32_t stack_base;
+	func_s* func;
+	call_frame_s* f;
+	call_frame_s* frame = &V_AT(mat->call_frames, 0, call_frame_s);
+
+	assert(mat);
+	assert(mat->stack_top > 0);
+
+	mat->stack_top = 0;
+	mat->frame_top = 0;
+
+	stack = &V_AT(mat->stack, 0, obj_s);
+	ro = stack + mat->stack_top - 1 - n;
+
+	if (ro->type != MAT_OT_FUNC) {
+		E_rt_err(mat, "from C code", 0, "The object is not callable.");
+		return -1;
+	}
+
+	stack_base = mat->stack_top - n;
+	func = ro->func;
+
+	if (func->lazy && P_compile_func(mat, func) != 0)
+		return -1;
+
+	if (VM_grow_stack(mat, func->frame_size) != 0) {
+		E_rt_err(mat, "from C code", 0, "Stack overflow.");
+		return -1;
+	}
+
+	stack = &V_AT(mat->stack, 0, obj_s);
 	f = frame + mat->frame_top++;
 	f->func = func;
 	f->stack_base = stack_base;
 	f->param_num = n;
+	f->ret_ip = NULL; // NULL表示是从C代码里调用过来的
+	f->ret_ip_begin = NULL;
 
-	n = HL_SIZE(func->objs) - func->param_num;
+	n = func->local_num;
 
 	while (n-- > 0) {
 		obj_s* o = stack + mat->stack_top++;
 		o->type = MAT_OT_DUMMY;
 	}
 
-	ret = VM_exec_mod(mat, mod, &func->code);
+	ret = VM_exec_mod(mat, mod, &func->lcode);
 	CHECK_RESULT(ret);
 
 	ret = 0;
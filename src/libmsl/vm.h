@@ -24,5 +24,18 @@ int VM_get_mod_by_idx(matrix_t mat, uint32_t idx, mod_s** out);
 int VM_exec_mod(matrix_t mat, mod_s* mod, vec_s* code);
 int VM_call(matrix_t mat, mod_s* mod, uint32_t param_num);
 
+/*
+	保证运行栈在栈顶之上还能放下 n 个对象，不够时扩大，超过 stack_limit 时返回 -1。
+	扩大后运行栈的地址可能改变，之前取得的对象指针都要重新计算。
+*/
+int VM_grow_stack(matrix_t mat, uint32_t n);
+
+// 调用栈上的对象，栈顶是 n 个实参，实参下面是被调用对象，返回时结果留在被调用对象的位置
+// 函数返回后才会返回，op 为发起调用的指令，用于报告错误
+int VM_call_obj(matrix_t mat, mod_s* mod, uint32_t n, lword_u* op);
+
+// 返回指令对应的链接后指令字
+lword_u VM_handler(matrix_t mat, uint32_t ins);
+
 #endif
 
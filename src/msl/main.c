@@ -12,6 +12,7 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "matrix.h"
 
@@ -20,6 +21,7 @@
 #define PROMPT_UNDONE ".. "
 
 static matrix_t mat;
+static const char* snapshot_file;
 
 static void show_info() {
 	printf("MSL %s Copyright (c) 2004 Zeb.  All rights reserved.\n", MSL_VER);
@@ -70,13 +72,27 @@ static void print_usage() {
 	printf("usage: msl [options]\n");
 	printf("options:\n");
 	printf("-h, -H, --help             : show this message.\n");
+	printf("--backend <stack|register> : code generation for functions parsed after it.\n");
+	printf("--jit <on|off>             : compile hot functions to native code.\n");
+	printf("--cache <on|off>           : load and write .matc bytecode caches.\n");
+	printf("--lazy <on|off>            : compile function bodies on their first call.\n");
+	printf("--parallel <threads>       : compile imported modules on background threads.\n");
+	printf("--restore <file>           : start from a VM snapshot, put it before other options.\n");
+	printf("--snapshot <file>          : save the VM to a snapshot after --src finishes.\n");
 	printf("--src <source>             : run source file.\n");
 	printf("--disasm <source> <output> : disassemble source file.\n");
 }
 
 static int run_file(const char* file) {
 	uint32_t h_mod;
-	return MAT_exec_file(mat, file, &h_mod);
+
+	if (MAT_exec_file(mat, file, &h_mod) != 0)
+		return -1;
+
+	if (snapshot_file)
+		return MAT_snapshot(mat, snapshot_file);
+
+	return 0;
 }
 
 static FILE* fp_asm;
@@ -107,6 +123,156 @@ static int parse_option(int argc, char* argv[]) {
 			return 0;
 		}
 
+		if (strcmp(argv[i], "--backend") == 0) {
+			mat_backend_e backend;
+
+			if (i + 1 >= argc)
+				return -1;
+
+			i++;
+
+			if (strcmp(argv[i], "stack") == 0)
+				backend = MAT_BACKEND_STACK;
+			else if (strcmp(argv[i], "register") == 0)
+				backend = MAT_BACKEND_REGISTER;
+			else {
+				print_usage();
+				return -1;
+			}
+
+			MAT_set_backend(mat, backend);
+
+			if (i + 1 >= argc)
+				console_loop();
+
+			continue;
+		}
+
+		if (strcmp(argv[i], "--jit") == 0) {
+			int enable;
+
+			if (i + 1 >= argc)
+				return -1;
+
+			i++;
+
+			if (strcmp(argv[i], "on") == 0)
+				enable = 1;
+			else if (strcmp(argv[i], "off") == 0)
+				enable = 0;
+			else {
+				print_usage();
+				return -1;
+			}
+
+			MAT_set_jit(mat, enable);
+
+			if (i + 1 >= argc)
+				console_loop();
+
+			continue;
+		}
+
+		if (strcmp(argv[i], "--cache") == 0) {
+			int enable;
+
+			if (i + 1 >= argc)
+				return -1;
+
+			i++;
+
+			if (strcmp(argv[i], "on") == 0)
+				enable = 1;
+			else if (strcmp(argv[i], "off") == 0)
+				enable = 0;
+			else {
+				print_usage();
+				return -1;
+			}
+
+			MAT_set_cache(mat, enable);
+
+			if (i + 1 >= argc)
+				console_loop();
+
+			continue;
+		}
+
+		if (strcmp(argv[i], "--lazy") == 0) {
+			int enable;
+
+			if (i + 1 >= argc)
+				return -1;
+
+			i++;
+
+			if (strcmp(argv[i], "on") == 0)
+				enable = 1;
+			else if (strcmp(argv[i], "off") == 0)
+				enable = 0;
+			else {
+				print_usage();
+				return -1;
+			}
+
+			MAT_set_lazy(mat, enable);
+
+			if (i + 1 >= argc)
+				console_loop();
+
+			continue;
+		}
+
+		if (strcmp(argv[i], "--parallel") == 0) {
+			int threads;
+
+			if (i + 1 >= argc)
+				return -1;
+
+			i++;
+			threads = atoi(argv[i]);
+
+			if (threads < 0) {
+				print_usage();
+				return -1;
+			}
+
+			MAT_set_parallel(mat, (uint32_t)threads);
+
+			if (i + 1 >= argc)
+				console_loop();
+
+			continue;
+		}
+
+		if (strcmp(argv[i], "--restore") == 0) {
+			if (i + 1 >= argc)
+				return -1;
+
+			i++;
+			MAT_free(mat);
+
+			if (MAT_restore(argv[i], &mat) != 0) {
+				printf("Error: restore snapshot \"%s\" failed.\n", argv[i]);
+				MAT_init(&mat);
+				return -1;
+			}
+
+			if (i + 1 >= argc)
+				console_loop();
+
+			continue;
+		}
+
+		if (strcmp(argv[i], "--snapshot") == 0) {
+			if (i + 1 >= argc)
+				return -1;
+
+			i++;
+			snapshot_file = argv[i];
+			continue;
+		}
+
 		if (strcmp(argv[i], "--src") == 0) {
 			char* src;
 
@@ -0,0 +1,102 @@
+# 生成词法分析测试用的 lexer_data.mat 和 lexer_text.mat，各大约 4MB
+# 只定义函数，不调用，导入这个模块的时间基本上都花在词法分析和解析上
+# lexer_data.mat 是普通的代码，lexer_text.mat 以长注释、长字符串和缩进为主
+import random
+
+random.seed(2004)
+
+NAMES = ["count", "total", "index", "value", "result", "left", "right", "width", "height",
+         "offset", "item", "node", "buffer", "length", "step_size", "alpha", "beta", "gamma",
+         "x", "y", "z", "i", "j", "k", "tmp", "acc", "flag", "name", "data", "size"]
+STRINGS = ["hello", "matrix script", "key_%d", "a\\tb", "line\\n", "path\\\\to", "value = "]
+
+
+def expr(depth=0):
+    r = random.random()
+    if depth > 2 or r < 0.3:
+        return random.choice(NAMES)
+    if r < 0.45:
+        return str(random.randint(0, 100000))
+    if r < 0.5:
+        return "%d.%d" % (random.randint(0, 999), random.randint(0, 99))
+    if r < 0.55:
+        return "0x%X" % random.randint(0, 0xffffff)
+    if r < 0.6:
+        return '"%s"' % random.choice(STRINGS).replace("%d", str(random.randint(0, 99)))
+    if r < 0.7:
+        return "%s(%s, %s)" % (random.choice(NAMES), expr(depth + 1), expr(depth + 1))
+    if r < 0.75:
+        return "[%s, %s, %s]" % (expr(depth + 1), expr(depth + 1), expr(depth + 1))
+    op = random.choice(["+", "-", "*", "/", "<", ">=", "==", "!=", "&&", "||", "<<", "&"])
+    return "(%s %s %s)" % (expr(depth + 1), op, expr(depth + 1))
+
+
+def stmt(indent):
+    pad = "    " * indent
+    r = random.random()
+    if r < 0.1:
+        return pad + "// " + " ".join(random.choice(NAMES) for _ in range(8))
+    if r < 0.13:
+        return pad + "/* " + " ".join(random.choice(NAMES) for _ in range(6)) + "\n" + pad + "   " + \
+            " ".join(random.choice(NAMES) for _ in range(6)) + " */"
+    if r < 0.2 and indent < 3:
+        body = "\n".join(stmt(indent + 1) for _ in range(3))
+        return "%sif %s {\n%s\n%s}" % (pad, expr(), body, pad)
+    if r < 0.25 and indent < 3:
+        body = "\n".join(stmt(indent + 1) for _ in range(3))
+        return "%sfor %s in 0..%d {\n%s\n%s}" % (pad, random.choice(NAMES), random.randint(1, 100), body, pad)
+    op = random.choice(["=", "+=", "-=", "="])
+    return "%s%s %s %s;" % (pad, random.choice(NAMES), op, expr())
+
+
+out = []
+size = 0
+n = 0
+
+while size < 4 * 1024 * 1024:
+    lines = ["def func_%d(a, b, c) {" % n]
+    lines += [stmt(1) for _ in range(400)]
+    lines.append("    return a;")
+    lines.append("}")
+    text = "\n".join(lines) + "\n\n"
+    out.append(text)
+    size += len(text)
+    n += 1
+
+with open("lexer_data.mat", "w") as fp:
+    fp.write("".join(out))
+
+print("lexer_data.mat: %d functions, %d bytes" % (n, size))
+
+WORDS = ["matrix", "script", "language", "lexer", "scanner", "token", "string", "comment",
+         "data", "table", "value", "row", "column", "index"]
+
+
+def words(count):
+    return " ".join(random.choice(WORDS) for _ in range(count))
+
+
+out = []
+size = 0
+n = 0
+
+while size < 4 * 1024 * 1024:
+    lines = ["/*"]
+    lines += ["    " + words(14) for _ in range(20)]
+    lines.append("*/")
+    lines.append("def table_%d() {" % n)
+    lines.append("    // " + words(20))
+    lines.append("    return [")
+    lines += ['        "%s",' % words(random.randint(10, 30))[:200] for _ in range(40)]
+    lines.append('        "end"')
+    lines.append("    ];")
+    lines.append("}")
+    text = "\n".join(lines) + "\n\n"
+    out.append(text)
+    size += len(text)
+    n += 1
+
+with open("lexer_text.mat", "w") as fp:
+    fp.write("".join(out))
+
+print("lexer_text.mat: %d functions, %d bytes" % (n, size))